@@ -78,6 +78,54 @@ ArrayBhiksha::ArrayBhiksha(void *base, uint64_t max_offset, uint64_t max_next, c
     write_to_(reinterpret_cast<uint64_t*>(AlignTo8(base)) + 1 /* 8-byte header */ + 1 /* first entry is 0 */),
     original_base_(base) {}
 
+const uint8_t kEliasFanoBhikshaVersion = 0;
+
+void EliasFanoBhiksha::UpdateConfigFromBinary(const BinaryFormat &file, uint64_t offset, Config &/*config*/) {
+  uint8_t version;
+  file.ReadForConfig(&version, 1, offset);
+  if (version != kEliasFanoBhikshaVersion) UTIL_THROW(FormatLoadException, "This file has Elias-Fano pointer compression version " << (unsigned) version << " but the code expects version " << (unsigned)kEliasFanoBhikshaVersion);
+}
+
+namespace {
+
+// Bits of each value kept in the low array: floor(log2(universe / count)).
+uint8_t EliasFanoLowBits(uint64_t count, uint64_t max_next) {
+  uint8_t ret = 0;
+  for (uint64_t ratio = (max_next + 1) / count; ratio > 1; ratio >>= 1) ++ret;
+  return ret;
+}
+
+// In 64-bit words.
+uint64_t EliasFanoLowWords(uint64_t count, uint64_t max_next) {
+  // +1 so ReadInt57 stays in bounds.
+  return (count * EliasFanoLowBits(count, max_next) + 63) / 64 + 1;
+}
+
+uint64_t EliasFanoHighWords(uint64_t count, uint64_t max_next) {
+  return (count + (max_next >> EliasFanoLowBits(count, max_next)) + 1 + 63) / 64;
+}
+
+uint64_t EliasFanoSamples(uint64_t count) {
+  return (count + EliasFanoBhiksha::kSelectSample - 1) / EliasFanoBhiksha::kSelectSample;
+}
+
+} // namespace
+
+uint64_t EliasFanoBhiksha::Size(uint64_t max_offset, uint64_t max_next, const Config &/*config*/) {
+  return sizeof(uint64_t) * (1 /* header */ + EliasFanoLowWords(max_offset, max_next) + EliasFanoHighWords(max_offset, max_next) + EliasFanoSamples(max_offset)) + 7 /* 8-byte alignment */;
+}
+
+EliasFanoBhiksha::EliasFanoBhiksha(void *base, uint64_t max_offset, uint64_t max_next, const Config &/*config*/)
+  : low_(util::BitsMask::ByBits(EliasFanoLowBits(max_offset, max_next))),
+    low_begin_(reinterpret_cast<uint8_t*>(reinterpret_cast<uint64_t*>(AlignTo8(base)) + 1 /* 8-byte header */)),
+    high_begin_(reinterpret_cast<uint64_t*>(low_begin_) + EliasFanoLowWords(max_offset, max_next)),
+    samples_begin_(high_begin_ + EliasFanoHighWords(max_offset, max_next)),
+    original_base_(base) {}
+
+void EliasFanoBhiksha::FinishedLoading(const Config &/*config*/) {
+  *reinterpret_cast<uint8_t*>(original_base_) = kEliasFanoBhikshaVersion;
+}
+
 void ArrayBhiksha::FinishedLoading(const Config &config) {
   // *offset_begin_ = 0 but without a const_cast.
   *(write_to_ - (write_to_ - offset_begin_)) = 0;
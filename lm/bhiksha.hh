@@ -8,6 +8,10 @@
  *  }
  *
  *  Currently only used for next pointers.
+ *
+ *  EliasFanoBhiksha instead encodes all next pointers of an order as one
+ *  Elias-Fano sequence, using close to the information-theoretic minimum:
+ *  2 + log2(max_next / entries) bits per pointer.
  */
 
 #ifndef LM_BHIKSHA_H
@@ -115,6 +119,81 @@ class ArrayBhiksha {
     void *original_base_;
 };
 
+/* Next pointers are non-decreasing, so store them as an Elias-Fano sequence
+ * outside the entries.  Each value is split into low_bits_ low bits, packed
+ * in an array, and the remaining high bits, coded in unary as the position of
+ * the index-th one in a bit vector: value >> low_bits_ == Select(index) - index.
+ * The position of every kSelectSample-th one is stored so Select scans a
+ * bounded number of words.  Nothing is stored inline with the entries.
+ *
+ * Values must be written in index order to zeroed memory, as the trie does.
+ */
+class EliasFanoBhiksha {
+  public:
+    static const ModelType kModelTypeAdd = kEliasFanoAdd;
+
+    static const uint64_t kSelectSample = 256;
+
+    static void UpdateConfigFromBinary(const BinaryFormat &file, uint64_t offset, Config &config);
+
+    static uint64_t Size(uint64_t max_offset, uint64_t max_next, const Config &config);
+
+    static uint8_t InlineBits(uint64_t /*max_offset*/, uint64_t /*max_next*/, const Config &/*config*/) { return 0; }
+
+    EliasFanoBhiksha(void *base, uint64_t max_offset, uint64_t max_next, const Config &config);
+
+    void ReadNext(const void * /*base*/, uint64_t /*bit_offset*/, uint64_t index, uint8_t /*total_bits*/, NodeRange &out) const {
+      uint64_t position = Select(index);
+      out.begin = ((position - index) << low_.bits) | util::ReadInt57(low_begin_, index * low_.bits, low_.bits, low_.mask);
+      position = NextOne(position);
+      out.end = ((position - index - 1) << low_.bits) | util::ReadInt57(low_begin_, (index + 1) * low_.bits, low_.bits, low_.mask);
+      assert(out.end >= out.begin);
+    }
+
+    void WriteNext(void * /*base*/, uint64_t /*bit_offset*/, uint64_t index, uint64_t value) {
+      util::WriteInt57(low_begin_, index * low_.bits, low_.bits, value & low_.mask);
+      uint64_t position = (value >> low_.bits) + index;
+      high_begin_[position / 64] |= 1ULL << (position % 64);
+      if (index % kSelectSample == 0) samples_begin_[index / kSelectSample] = position;
+    }
+
+    void FinishedLoading(const Config &config);
+
+    uint8_t InlineBits() const { return 0; }
+
+  private:
+    // Position of the rank-th one (counting from 0) in the high bits.
+    uint64_t Select(uint64_t rank) const {
+      uint64_t position = samples_begin_[rank / kSelectSample];
+      uint64_t remaining = rank % kSelectSample;
+      const uint64_t *word = high_begin_ + position / 64;
+      // Drop ones before the sampled one, which counts as the 0th.
+      uint64_t bits = *word & (~0ULL << (position % 64));
+      for (unsigned int count; remaining >= (count = util::PopCount(bits)); bits = *++word) {
+        remaining -= count;
+      }
+      for (; remaining; --remaining) bits &= bits - 1;
+      return (word - high_begin_) * 64 + util::LowestBit(bits);
+    }
+
+    // Position of the first one after position.
+    uint64_t NextOne(uint64_t position) const {
+      ++position;
+      const uint64_t *word = high_begin_ + position / 64;
+      uint64_t bits = *word & (~0ULL << (position % 64));
+      while (!bits) bits = *++word;
+      return (word - high_begin_) * 64 + util::LowestBit(bits);
+    }
+
+    const util::BitsMask low_;
+
+    uint8_t *const low_begin_;
+    uint64_t *const high_begin_;
+    uint64_t *const samples_begin_;
+
+    void *original_base_;
+};
+
 } // namespace trie
 } // namespace ngram
 } // namespace lm
@@ -3,8 +3,12 @@
 #include "lm/lm_exception.hh"
 #include "util/file.hh"
 #include "util/file_piece.hh"
+#include "util/parallel_read.hh"
+#include "util/read_compressed.hh"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdio>
 #include <cstring>
 #include <limits>
 #include <string>
@@ -15,7 +19,7 @@
 namespace lm {
 namespace ngram {
 
-const char *kModelNames[6] = {"probing hash tables", "probing hash tables with rest costs", "trie", "trie with quantization", "trie with array-compressed pointers", "trie with quantization and array-compressed pointers"};
+const char *kModelNames[18] = {"probing hash tables", "probing hash tables with rest costs", "trie", "trie with quantization", "trie with array-compressed pointers", "trie with quantization and array-compressed pointers", "bucketized probing hash tables", "bucketized probing hash tables with rest costs", "fingerprint probing hash tables", "fingerprint probing hash tables with rest costs", "perfect hash tables", "perfect hash tables with rest costs", "trie with eytzinger index", "trie with eytzinger index and quantization", "trie with eytzinger index and array-compressed pointers", "trie with eytzinger index, quantization, and array-compressed pointers", "trie with elias-fano pointers", "trie with quantization and elias-fano pointers"};
 
 namespace {
 const char kMagicBeforeVersion[] = "mmap lm http://kheafield.com/code format version";
@@ -23,6 +27,8 @@ const char kMagicBytes[] = "mmap lm http://kheafield.com/code format version 5\n
 // This must be shorter than kMagicBytes and indicates an incomplete binary file (i.e. build failed).
 const char kMagicIncomplete[] = "mmap lm http://kheafield.com/code incomplete\n";
 const long int kMagicVersion = 5;
+// Same layout and version as kMagicBytes but the vocab and search are compressed.
+const char kMagicCompressed[] = "mmap lm http://kheafield.com/code compressed 5\n\0";
 
 // Old binary files built on 32-bit machines have this header.
 // TODO: eliminate with next binary release.
@@ -50,9 +56,13 @@ struct Sanity {
   WordIndex one_word_index, max_word_index, padding_to_8;
   uint64_t one_uint64;
 
-  void SetToReference() {
+  void SetToReference(bool compressed = false) {
     std::memset(this, 0, sizeof(Sanity));
-    std::memcpy(magic, kMagicBytes, sizeof(kMagicBytes));
+    if (compressed) {
+      std::memcpy(magic, kMagicCompressed, sizeof(kMagicCompressed));
+    } else {
+      std::memcpy(magic, kMagicBytes, sizeof(kMagicBytes));
+    }
     zero_f = 0.0; one_f = 1.0; minus_half_f = -0.5;
     one_word_index = 1;
     max_word_index = std::numeric_limits<WordIndex>::max();
@@ -61,10 +71,23 @@ struct Sanity {
   }
 };
 
+// Follows the header of compressed files.  Then come blocks + 1 offsets
+// delimiting the blocks, the blocks, and the vocabulary strings.
+struct CompressedIndex {
+  uint64_t raw_size, block_size, blocks;
+};
+
+// Large enough to compress well, small enough to spread over threads.
+const uint64_t kCompressBlock = 1ULL << 22;
+
+} // namespace
+
 std::size_t TotalHeaderSize(unsigned char order) {
   return ALIGN8(sizeof(Sanity) + sizeof(FixedWidthParameters) + sizeof(uint64_t) * order);
 }
 
+namespace {
+
 void WriteHeader(void *to, const Parameters &params) {
   Sanity header = Sanity();
   header.SetToReference();
@@ -95,6 +118,8 @@ bool IsBinaryFormat(int fd) {
   Sanity reference_header = Sanity();
   reference_header.SetToReference();
   if (!std::memcmp(memory.get(), &reference_header, sizeof(Sanity))) return true;
+  reference_header.SetToReference(true);
+  if (!std::memcmp(memory.get(), &reference_header, sizeof(Sanity))) return true;
   if (!std::memcmp(memory.get(), kMagicIncomplete, strlen(kMagicIncomplete))) {
     UTIL_THROW(FormatLoadException, "This binary file did not finish building");
   }
@@ -114,6 +139,13 @@ bool IsBinaryFormat(int fd) {
   return false;
 }
 
+bool IsCompressedBinary(int fd) {
+  Sanity header, compressed_header;
+  util::ErsatzPRead(fd, &header, sizeof(Sanity), 0);
+  compressed_header.SetToReference(true);
+  return !std::memcmp(&header, &compressed_header, sizeof(Sanity));
+}
+
 void ReadHeader(int fd, Parameters &out) {
   util::SeekOrThrow(fd, sizeof(Sanity));
   util::ReadOrThrow(fd, &out.fixed, sizeof(out.fixed));
@@ -136,8 +168,8 @@ void MatchCheck(ModelType model_type, unsigned int search_version, const Paramet
 const std::size_t kInvalidSize = static_cast<std::size_t>(-1);
 
 BinaryFormat::BinaryFormat(const Config &config)
-  : write_method_(config.write_method), write_mmap_(config.write_mmap), load_method_(config.load_method),
-    header_size_(kInvalidSize), vocab_size_(kInvalidSize), vocab_string_offset_(kInvalidOffset) {}
+  : write_method_(config.write_method), write_mmap_(config.write_mmap), load_method_(config.load_method), load_node_(config.load_node), load_threads_(config.load_threads),
+    header_size_(kInvalidSize), vocab_size_(kInvalidSize), vocab_string_offset_(kInvalidOffset), compressed_(false) {}
 
 void BinaryFormat::InitializeBinary(int fd, ModelType model_type, unsigned int search_version, Parameters &params) {
   file_.reset(fd);
@@ -145,11 +177,37 @@ void BinaryFormat::InitializeBinary(int fd, ModelType model_type, unsigned int s
   ReadHeader(fd, params);
   MatchCheck(model_type, search_version, params);
   header_size_ = TotalHeaderSize(params.counts.size());
+
+  compressed_ = IsCompressedBinary(fd);
+  if (!compressed_) return;
+  CompressedIndex index;
+  util::ErsatzPRead(fd, &index, sizeof(CompressedIndex), header_size_);
+  UTIL_THROW_IF(!index.block_size || index.blocks != (index.raw_size + index.block_size - 1) / index.block_size, FormatLoadException, "Compressed binary file has " << index.blocks << " blocks of " << index.block_size << " bytes for " << index.raw_size << " bytes");
+  raw_size_ = index.raw_size;
+  block_size_ = index.block_size;
+  block_offsets_.resize(util::CheckOverflow(index.blocks + 1));
+  util::ErsatzPRead(fd, &block_offsets_[0], sizeof(uint64_t) * block_offsets_.size(), header_size_ + sizeof(CompressedIndex));
+  for (std::size_t i = 1; i < block_offsets_.size(); ++i) {
+    UTIL_THROW_IF(block_offsets_[i] < block_offsets_[i - 1], FormatLoadException, "Compressed binary file has block offsets out of order.");
+  }
 }
 
 void BinaryFormat::ReadForConfig(void *to, std::size_t amount, uint64_t offset_excluding_header) const {
   assert(header_size_ != kInvalidSize);
-  util::ErsatzPRead(file_.get(), to, amount, offset_excluding_header + header_size_);
+  if (!compressed_) {
+    util::ErsatzPRead(file_.get(), to, amount, offset_excluding_header + header_size_);
+    return;
+  }
+  UTIL_THROW_IF(offset_excluding_header + amount > raw_size_, FormatLoadException, "Compressed binary file is too short to read " << amount << " bytes at " << offset_excluding_header);
+  if (!amount) return;
+  // Decompress the blocks that cover the range.
+  std::size_t first = offset_excluding_header / block_size_;
+  std::size_t last = (offset_excluding_header + amount - 1) / block_size_;
+  std::vector<uint64_t> offsets(block_offsets_.begin() + first, block_offsets_.begin() + last + 2);
+  uint64_t begin = first * block_size_;
+  std::vector<uint8_t> buffer(util::CheckOverflow(std::min(raw_size_, (last + 1) * block_size_) - begin));
+  util::ParallelDecompress(file_.get(), offsets, block_size_, &buffer[0], buffer.size());
+  std::memcpy(to, &buffer[offset_excluding_header - begin], amount);
 }
 
 void *BinaryFormat::LoadBinary(std::size_t size) {
@@ -157,9 +215,22 @@ void *BinaryFormat::LoadBinary(std::size_t size) {
   const uint64_t file_size = util::SizeFile(file_.get());
   // The header is smaller than a page, so we have to map the whole header as well.
   uint64_t total_map = static_cast<uint64_t>(header_size_) + static_cast<uint64_t>(size);
+  if (compressed_) {
+    // Decompressing makes a private copy, which is not what -l shared asks for.
+    UTIL_THROW_IF(load_method_ == util::SHARED, FormatLoadException, "This binary file was compressed with build_binary -z, so it can not be loaded from shared memory.  Run kenlm_share on a binary built without -z.");
+    UTIL_THROW_IF(raw_size_ != size, FormatLoadException, "Compressed binary file holds " << raw_size_ << " bytes but the headers say it should be " << size);
+    util::HugeMalloc(util::CheckOverflow(total_map), false, mapping_);
+    util::ErsatzPRead(file_.get(), mapping_.get(), header_size_, 0);
+    util::ParallelDecompress(file_.get(), block_offsets_, block_size_, reinterpret_cast<uint8_t*>(mapping_.get()) + header_size_, size);
+    vocab_string_offset_ = block_offsets_.back();
+    return reinterpret_cast<uint8_t*>(mapping_.get()) + header_size_;
+  }
   UTIL_THROW_IF(file_size != util::kBadSize && file_size < total_map, FormatLoadException, "Binary file has size " << file_size << " but the headers say it should be at least " << total_map);
 
-  util::MapRead(load_method_, file_.get(), 0, util::CheckOverflow(total_map), mapping_);
+  util::MapRead(load_method_, file_.get(), 0, util::CheckOverflow(total_map), mapping_, load_node_);
+  if (load_method_ == util::PREFETCH) {
+    prefetch_.reset(new util::Prefetch(mapping_.get(), mapping_.size(), load_threads_));
+  }
 
   vocab_string_offset_ = total_map;
   return reinterpret_cast<uint8_t*>(mapping_.get()) + header_size_;
@@ -279,6 +350,58 @@ void BinaryFormat::FinishFile(const Config &config, ModelType model_type, unsign
       }
       break;
   }
+  if (config.compress_level) Compress(config.compress_level);
+}
+
+void BinaryFormat::Compress(int level) {
+  const uint64_t file_size = util::SizeFile(file_.get());
+  UTIL_THROW_IF(file_size == util::kBadSize || file_size < vocab_string_offset_, util::Exception, "Binary file " << write_mmap_ << " is shorter than expected.");
+  // The finished file, whatever the write method.
+  util::scoped_memory finished;
+  util::MapRead(util::LAZY, file_.get(), 0, util::CheckOverflow(file_size), finished);
+  const uint8_t *begin = static_cast<const uint8_t*>(finished.get());
+
+  CompressedIndex index;
+  index.raw_size = vocab_string_offset_ - header_size_;
+  index.block_size = kCompressBlock;
+  index.blocks = (index.raw_size + kCompressBlock - 1) / kCompressBlock;
+  std::vector<uint64_t> offsets(1, header_size_ + sizeof(CompressedIndex) + sizeof(uint64_t) * (index.blocks + 1));
+
+  // Write beside the original and rename over it, so a live WRITE_MMAP
+  // mapping keeps the uncompressed inode.
+  std::string temporary(write_mmap_);
+  temporary += ".compressing";
+  util::scoped_fd out(util::CreateOrThrow(temporary.c_str()));
+  try {
+    std::vector<uint8_t> header(begin, begin + header_size_);
+    Sanity compressed_header;
+    compressed_header.SetToReference(true);
+    std::memcpy(&header[0], &compressed_header, sizeof(Sanity));
+    util::WriteOrThrow(out.get(), &header[0], header.size());
+
+    util::SeekOrThrow(out.get(), offsets[0]);
+    std::string block;
+    for (uint64_t i = 0; i < index.blocks; ++i) {
+      uint64_t from = header_size_ + i * kCompressBlock;
+      block.clear();
+      util::GZipBlock(begin + from, std::min<uint64_t>(kCompressBlock, vocab_string_offset_ - from), level, block);
+      util::WriteOrThrow(out.get(), block.data(), block.size());
+      offsets.push_back(offsets.back() + block.size());
+    }
+    // Vocabulary strings, if any.
+    util::WriteOrThrow(out.get(), begin + vocab_string_offset_, file_size - vocab_string_offset_);
+
+    util::SeekOrThrow(out.get(), header_size_);
+    util::WriteOrThrow(out.get(), &index, sizeof(CompressedIndex));
+    util::WriteOrThrow(out.get(), &offsets[0], sizeof(uint64_t) * offsets.size());
+    util::FSyncOrThrow(out.get());
+    UTIL_THROW_IF(std::rename(temporary.c_str(), write_mmap_), util::ErrnoException, "Failed to rename " << temporary << " to " << write_mmap_);
+  } catch (...) {
+    // Don't leave a partial file beside the model.
+    out.reset();
+    std::remove(temporary.c_str());
+    throw;
+  }
 }
 
 void BinaryFormat::MapFile(void *&vocab_base, void *&search_base) {
@@ -7,8 +7,11 @@
 
 #include "util/file_piece.hh"
 #include "util/mmap.hh"
+#include "util/prefetch.hh"
 #include "util/scoped.hh"
 
+#include <boost/scoped_ptr.hpp>
+
 #include <cstddef>
 #include <vector>
 
@@ -17,7 +20,7 @@
 namespace lm {
 namespace ngram {
 
-extern const char *kModelNames[6];
+extern const char *kModelNames[18];
 
 /*Inspect a file to determine if it is a binary lm.  If not, return false.
  * If so, return true and set recognized to the type.  This is the only API in
@@ -38,6 +41,9 @@ struct FixedWidthParameters {
 // This is a macro instead of an inline function so constants can be assigned using it.
 #define ALIGN8(a) ((std::ptrdiff_t(((a)-1)/8)+1)*8)
 
+// Size of the header, which precedes the vocabulary in binary files.
+std::size_t TotalHeaderSize(unsigned char order);
+
 // Parameters stored in the header of a binary file.
 struct Parameters {
   FixedWidthParameters fixed;
@@ -56,6 +62,20 @@ class BinaryFormat {
     // Actually load the binary file and return a pointer to the beginning of the search area.
     void *LoadBinary(std::size_t size);
 
+    // Was the binary file written with Config::compress_level?
+    bool Compressed() const { return compressed_; }
+
+    // Fraction of the loaded model in memory.  Below 1 only while load_method
+    // PREFETCH populates it in the background.
+    double LoadProgress() const {
+      return prefetch_ ? prefetch_->Progress() : 1.0;
+    }
+
+    // Block until LoadProgress() is 1.
+    void WaitLoaded() const {
+      if (prefetch_) prefetch_->Wait();
+    }
+
     uint64_t VocabStringReadingOffset() const {
       assert(vocab_string_offset_ != kInvalidOffset);
       return vocab_string_offset_;
@@ -74,10 +94,15 @@ class BinaryFormat {
   private:
     void MapFile(void *&vocab_base, void *&search_base);
 
+    // Rewrite the finished file at write_mmap_ in compressed blocks.
+    void Compress(int level);
+
     // Copied from configuration.
     const Config::WriteMethod write_method_;
     const char *write_mmap_;
     util::LoadMethod load_method_;
+    int load_node_;
+    std::size_t load_threads_;
 
     // File behind memory, if any.
     util::scoped_fd file_;
@@ -85,6 +110,9 @@ class BinaryFormat {
     // If there is a file involved, a single mapping.
     util::scoped_memory mapping_;
 
+    // Populates mapping_ for PREFETCH.  Declared after it so it stops first.
+    boost::scoped_ptr<util::Prefetch> prefetch_;
+
     // If the data is only in memory, separately allocate each because the trie
     // knows vocab's size before it knows search's size (because SRILM might
     // have pruned).
@@ -96,11 +124,21 @@ class BinaryFormat {
     // aka end of search.
     uint64_t vocab_string_offset_;
 
+    // Compressed files: uncompressed size of everything after the header
+    // (vocab, pad, search), split into blocks of block_size_ bytes that begin
+    // at these file offsets.  The last offset is the end of the last block.
+    bool compressed_;
+    uint64_t raw_size_, block_size_;
+    std::vector<uint64_t> block_offsets_;
+
     static const uint64_t kInvalidOffset = (uint64_t)-1;
 };
 
 bool IsBinaryFormat(int fd);
 
+// Whether fd, already known to be in binary format, was compressed with build_binary -z.
+bool IsCompressedBinary(int fd);
+
 } // namespace ngram
 } // namespace lm
 #endif // LM_BINARY_FORMAT_H
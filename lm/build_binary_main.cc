@@ -3,6 +3,8 @@
 #include "util/file_piece.hh"
 #include "util/usage.hh"
 
+#include <boost/thread/thread.hpp>
+
 #include <algorithm>
 #include <cstdlib>
 #include <exception>
@@ -22,22 +24,39 @@ namespace lm {
 namespace ngram {
 namespace {
 
-void Usage(const char *name, const char *default_mem) {
-  std::cerr << "Usage: " << name << " [-u log10_unknown_probability] [-s] [-i] [-w mmap|after] [-p probing_multiplier] [-T trie_temporary] [-S trie_building_mem] [-q bits] [-b bits] [-a bits] [type] input.arpa [output.mmap]\n\n"
+void Usage(const char *name, const char *default_mem, unsigned int default_threads) {
+  std::cerr << "Usage: " << name << " [-u log10_unknown_probability] [-s] [-i] [-j threads] [-w mmap|after] [-z level] [-p probing_multiplier] [-k fingerprint_bits] [-T trie_temporary] [-S trie_building_mem] [-q bits] [-b bits] [-a bits] [-e] [type] input.arpa [output.mmap]\n\n"
 "-u sets the log10 probability for <unk> if the ARPA file does not have one.\n"
 "   Default is -100.  The ARPA file will always take precedence.\n"
 "-s allows models to be built even if they do not have <s> and </s>.\n"
 "-i allows buggy models from IRSTLM by mapping positive log probability to 0.\n"
+"-j sets the number of threads that parse n-grams.  Default is " << default_threads << ".  The\n"
+"   output does not depend on this.\n"
 "-w mmap|after determines how writing is done.\n"
 "   mmap maps the binary file and writes to it.  Default for trie.\n"
 "   after allocates anonymous memory, builds, and writes.  Default for probing.\n"
+"-z level gzips the binary file at level 1-9 in independently compressed blocks.\n"
+"   Loading decompresses them in parallel into memory, so it cannot be mapped.\n"
 "-r \"order1.arpa order2 order3 order4\" adds lower-order rest costs from these\n"
 "   model files.  order1.arpa must be an ARPA file.  All others may be ARPA or\n"
 "   the same data structure as being built.  All files must have the same\n"
 "   vocabulary.  For probing, the unigrams must be in the same order.\n\n"
-"type is either probing or trie.  Default is probing.\n\n"
+"type is probing, bucket, fingerprint, perfect, trie, or eytzinger.  Default is probing.\n\n"
 "probing uses a probing hash table.  It is the fastest but uses the most memory.\n"
 "-p sets the space multiplier and must be >1.0.  The default is 1.5.\n\n"
+"bucket is a probing hash table that groups entries into cache line buckets so\n"
+"   most lookups touch one cache line.  It accepts the same options as probing\n"
+"   and tolerates a lower -p such as 1.2.\n\n"
+"fingerprint is a probing hash table that stores a fingerprint of each n-gram\n"
+"   instead of its 64-bit key.  Absent n-grams may be mistaken for present ones\n"
+"   at the rate printed while building.  An n-gram whose fingerprint matches one\n"
+"   found first in its probe sequence returns that n-gram's values; building\n"
+"   warns with the number of these.  It accepts the same options as probing.\n"
+"-k sets the fingerprint size in bits: 8, 16, 24, or 32.  The default is 16.\n\n"
+"perfect builds a minimal perfect hash per order so each lookup reads one\n"
+"   pilot and one value.  Keys are stored as -k bit fingerprints.  Building\n"
+"   temporarily uses as much memory as probing with -p to stage n-grams, on top\n"
+"   of the model, plus about 19 bytes per n-gram of the order being converted.\n\n"
 "trie is a straightforward trie with bit-level packing.  It uses the least\n"
 "memory and is still faster than SRI or IRST.  Building the trie format uses an\n"
 "on-disk sort to save memory.\n"
@@ -50,7 +69,13 @@ void Usage(const char *name, const char *default_mem) {
 "-b sets backoff quantization bits.  Requires -q and defaults to that value.\n"
 "-a compresses pointers using an array of offsets.  The parameter is the\n"
 "   maximum number of bits encoded by the array.  Memory is minimized subject\n"
-"   to the maximum, so pick 255 to minimize memory.\n\n"
+"   to the maximum, so pick 255 to minimize memory.\n"
+"-e compresses pointers as Elias-Fano sequences, using about 2 + log2(n-grams\n"
+"   of the next order / n-grams of this order) bits per pointer.  Not with -a.\n\n"
+"eytzinger is a trie with a side index holding every 8th word of each order.\n"
+"   Each sibling range's part is in Eytzinger (breadth-first) order, so\n"
+"   searches descend a tree whose next levels can be prefetched.  It accepts\n"
+"   the same options as trie and costs 4 bytes per 8 n-grams more.\n\n"
 "-h print this help message.\n\n"
 "Get a memory estimate by passing an ARPA file without an output file name.\n";
   exit(1);
@@ -103,16 +128,21 @@ int main(int argc, char *argv[]) {
   using namespace lm::ngram;
 
   const char *default_mem = util::GuessPhysicalMemory() ? "80%" : "1G";
+  // The main thread inserts in order, so more parsers than this rarely help.
+  const unsigned int default_threads = std::max(1U, std::min(4U, boost::thread::hardware_concurrency()));
 
   if (argc == 2 && !strcmp(argv[1], "--help"))
-    Usage(argv[0], default_mem);
+    Usage(argv[0], default_mem, default_threads);
 
   try {
-    bool quantize = false, set_backoff_bits = false, bhiksha = false, set_write_method = false, rest = false;
+    bool quantize = false, set_backoff_bits = false, bhiksha = false, elias_fano = false, set_write_method = false, rest = false;
     lm::ngram::Config config;
     config.building_memory = util::ParseSize(default_mem);
+    config.load_threads = default_threads;
+    util::PhaseTimer timer;
+    config.phase_timer = &timer;
     int opt;
-    while ((opt = getopt(argc, argv, "q:b:a:u:p:t:T:m:S:w:sir:h")) != -1) {
+    while ((opt = getopt(argc, argv, "q:b:a:eu:p:k:j:t:T:m:S:w:z:sir:h")) != -1) {
       switch(opt) {
         case 'q':
           config.prob_bits = ParseBitCount(optarg);
@@ -127,12 +157,22 @@ int main(int argc, char *argv[]) {
           config.pointer_bhiksha_bits = ParseBitCount(optarg);
           bhiksha = true;
           break;
+        case 'e':
+          elias_fano = true;
+          break;
         case 'u':
           config.unknown_missing_logprob = ParseFloat(optarg);
           break;
         case 'p':
           config.probing_multiplier = ParseFloat(optarg);
           break;
+        case 'k':
+          // Building rejects sizes other than 8, 16, 24, and 32.
+          config.fingerprint_bits = static_cast<uint8_t>(std::min(ParseUInt(optarg), 255UL));
+          break;
+        case 'j':
+          config.load_threads = std::max(1UL, ParseUInt(optarg));
+          break;
         case 't': // legacy
         case 'T':
           config.temporary_directory_prefix = optarg;
@@ -151,7 +191,17 @@ int main(int argc, char *argv[]) {
           } else if (!strcmp(optarg, "after")) {
             config.write_method = Config::WRITE_AFTER;
           } else {
-            Usage(argv[0], default_mem);
+            Usage(argv[0], default_mem, default_threads);
+          }
+          break;
+        case 'z':
+          {
+            unsigned long level = ParseUInt(optarg);
+            if (level < 1 || level > 9) {
+              std::cerr << "Compression level must be 1-9." << std::endl;
+              return 1;
+            }
+            config.compress_level = static_cast<int>(level);
           }
           break;
         case 's':
@@ -167,7 +217,7 @@ int main(int argc, char *argv[]) {
           break;
         case 'h': // help
         default:
-          Usage(argv[0], default_mem);
+          Usage(argv[0], default_mem, default_threads);
       }
     }
     if (!quantize && set_backoff_bits) {
@@ -190,7 +240,7 @@ int main(int argc, char *argv[]) {
       from_file = argv[optind + 1];
       config.write_mmap = argv[optind + 2];
     } else {
-      Usage(argv[0], default_mem);
+      Usage(argv[0], default_mem, default_threads);
       return 1;
     }
     if (!strcmp(model_type, "probing")) {
@@ -201,13 +251,61 @@ int main(int argc, char *argv[]) {
       } else {
         ProbingModel(from_file, config);
       }
-    } else if (!strcmp(model_type, "trie")) {
+    } else if (!strcmp(model_type, "bucket")) {
+      if (!set_write_method) config.write_method = Config::WRITE_AFTER;
+      if (quantize || set_backoff_bits) ProbingQuantizationUnsupported();
+      if (rest) {
+        RestBucketProbingModel(from_file, config);
+      } else {
+        BucketProbingModel(from_file, config);
+      }
+    } else if (!strcmp(model_type, "fingerprint")) {
+      if (!set_write_method) config.write_method = Config::WRITE_AFTER;
+      if (quantize || set_backoff_bits) ProbingQuantizationUnsupported();
+      if (rest) {
+        RestFingerprintProbingModel(from_file, config);
+      } else {
+        FingerprintProbingModel(from_file, config);
+      }
+    } else if (!strcmp(model_type, "perfect")) {
+      if (!set_write_method) config.write_method = Config::WRITE_AFTER;
+      if (quantize || set_backoff_bits) ProbingQuantizationUnsupported();
+      if (rest) {
+        RestPerfectHashModel(from_file, config);
+      } else {
+        PerfectHashModel(from_file, config);
+      }
+    } else if (!strcmp(model_type, "trie") || !strcmp(model_type, "eytzinger")) {
       if (rest) {
         std::cerr << "Rest + trie is not supported yet." << std::endl;
         return 1;
       }
       if (!set_write_method) config.write_method = Config::WRITE_MMAP;
-      if (quantize) {
+      if (elias_fano && (bhiksha || !strcmp(model_type, "eytzinger"))) {
+        std::cerr << "Elias-Fano pointers are only implemented for trie without -a." << std::endl;
+        return 1;
+      }
+      if (elias_fano) {
+        if (quantize) {
+          QuantEliasFanoTrieModel(from_file, config);
+        } else {
+          EliasFanoTrieModel(from_file, config);
+        }
+      } else if (!strcmp(model_type, "eytzinger")) {
+        if (quantize) {
+          if (bhiksha) {
+            QuantArrayEytzingerTrieModel(from_file, config);
+          } else {
+            QuantEytzingerTrieModel(from_file, config);
+          }
+        } else {
+          if (bhiksha) {
+            ArrayEytzingerTrieModel(from_file, config);
+          } else {
+            EytzingerTrieModel(from_file, config);
+          }
+        }
+      } else if (quantize) {
         if (bhiksha) {
           QuantArrayTrieModel(from_file, config);
         } else {
@@ -221,8 +319,10 @@ int main(int argc, char *argv[]) {
         }
       }
     } else {
-      Usage(argv[0], default_mem);
+      Usage(argv[0], default_mem, default_threads);
     }
+    std::cerr << "Wall time by phase with " << config.load_threads << " parsing threads:\n";
+    timer.Print(std::cerr);
   }
   catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
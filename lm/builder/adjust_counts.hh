@@ -5,6 +5,7 @@
 #include "lm/lm_exception.hh"
 #include "util/exception.hh"
 
+#include <cstddef>
 #include <vector>
 
 #include <stdint.h>
@@ -30,6 +31,17 @@ struct DiscountConfig {
   WarningAction bad_action;
 };
 
+// Statistics about the adjusted counts of one order.
+struct AdjustedStats {
+  // n_1 in equation 26 of Chen and Goodman etc
+  uint64_t n[5];
+  uint64_t count;
+  uint64_t count_pruned;
+};
+
+// Turn statistics into counts, counts_pruned, and discounts.
+void ComputeDiscounts(const std::vector<AdjustedStats> &stats, const DiscountConfig &config, std::vector<uint64_t> &counts, std::vector<uint64_t> &counts_pruned, std::vector<Discount> &discounts);
+
 /* Compute adjusted counts.
  * Input: unique suffix sorted N-grams (and just the N-grams) with raw counts.
  * Output: [1,N]-grams with adjusted counts.
@@ -42,20 +54,26 @@ class AdjustCounts {
     // counts_pruned: output
     // discounts: mostly output.  If the input already has entries, they will be kept.
     // prune_thresholds: input.  n-grams with normal (not adjusted) count below this will be pruned.
+    // stats: if not NULL, output statistics here instead of setting counts,
+    //   counts_pruned, and discounts.  Sharded estimation adds them up.
     AdjustCounts(
         const std::vector<uint64_t> &prune_thresholds,
         std::vector<uint64_t> &counts,
         std::vector<uint64_t> &counts_pruned,
         const std::vector<bool> &prune_words,
         const DiscountConfig &discount_config,
-        std::vector<Discount> &discounts)
+        std::vector<Discount> &discounts,
+        std::vector<AdjustedStats> *stats = NULL)
       : prune_thresholds_(prune_thresholds), counts_(counts), counts_pruned_(counts_pruned),
-        prune_words_(prune_words), discount_config_(discount_config), discounts_(discounts)
+        prune_words_(prune_words), discount_config_(discount_config), discounts_(discounts),
+        stats_(stats)
     {}
 
     void Run(const util::stream::ChainPositions &positions);
 
   private:
+    void Finish(const std::vector<AdjustedStats> &stats);
+
     const std::vector<uint64_t> &prune_thresholds_;
     std::vector<uint64_t> &counts_;
     std::vector<uint64_t> &counts_pruned_;
@@ -63,6 +81,8 @@ class AdjustCounts {
 
     DiscountConfig discount_config_;
     std::vector<Discount> &discounts_;
+
+    std::vector<AdjustedStats> *stats_;
 };
 
 } // namespace builder
@@ -0,0 +1,184 @@
+#include "lm/builder/checkpoint.hh"
+
+#include "lm/builder/pipeline.hh"
+#include "util/exception.hh"
+#include "util/file.hh"
+#include "util/scoped.hh"
+
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace lm { namespace builder {
+
+namespace {
+std::string ReadAll(int fd) {
+  std::string ret(util::SizeOrThrow(fd), 0);
+  if (!ret.empty()) util::ErsatzPRead(fd, &ret[0], ret.size(), 0);
+  return ret;
+}
+} // namespace
+
+Checkpoint::Checkpoint(const PipelineConfig &config, int text_file)
+  : token_count(0), type_count(0), base_(config.TempPrefix() + "checkpoint."), order_(config.order) {
+  struct stat info;
+  UTIL_THROW_IF(fstat(text_file, &info), util::ErrnoException, "Could not stat the text");
+  UTIL_THROW_IF(!S_ISREG(info.st_mode), util::Exception, "Checkpoints need the text to be a regular file, not a pipe.");
+  // Everything that changes what the first three stages write.
+  std::ostringstream print;
+  print << "kenlm checkpoint 1\n"
+    << "text " << util::NameFromFD(text_file) << ' ' << info.st_size << ' ' << info.st_mtime << '\n'
+    << "order " << config.order << '\n'
+    << "prune";
+  for (std::vector<uint64_t>::const_iterator i = config.prune_thresholds.begin(); i != config.prune_thresholds.end(); ++i) {
+    print << ' ' << *i;
+  }
+  print << "\nprune_vocab " << config.prune_vocab << ' ' << config.prune_vocab_file << '\n'
+    << std::setprecision(9)
+    << "discount " << config.discount.bad_action;
+  for (std::size_t i = 0; i < 4; ++i) {
+    print << ' ' << config.discount.fallback.amount[i];
+  }
+  for (std::vector<Discount>::const_iterator i = config.discount.overwrite.begin(); i != config.discount.overwrite.end(); ++i) {
+    for (std::size_t j = 0; j < 4; ++j) print << ' ' << i->amount[j];
+  }
+  print << "\nadd_counts " << config.add_counts;
+  if (!config.add_counts.empty()) {
+    struct stat counts_info;
+    UTIL_THROW_IF(stat(config.add_counts.c_str(), &counts_info), util::ErrnoException, "Could not stat " << config.add_counts);
+    print << ' ' << counts_info.st_size << ' ' << counts_info.st_mtime;
+  }
+  print << "\ncounts " << config.read_counts << ' ' << config.counts_vocab;
+  if (!config.counts_vocab.empty()) {
+    struct stat vocab_info;
+    UTIL_THROW_IF(stat(config.counts_vocab.c_str(), &vocab_info), util::ErrnoException, "Could not stat " << config.counts_vocab);
+    print << ' ' << vocab_info.st_size << ' ' << vocab_info.st_mtime;
+  }
+  print << "\ninterpolate_unigrams " << config.initial_probs.interpolate_unigrams << '\n'
+    << "disallowed_symbol_action " << config.disallowed_symbol_action << '\n';
+  fingerprint_ = print.str();
+}
+
+Checkpoint::Stage Checkpoint::Load() {
+  std::string manifest;
+  {
+    util::scoped_fd file(open(Name("manifest", 0).c_str(), O_RDONLY));
+    if (file.get() == -1) {
+      std::cerr << "No checkpoint to resume from " << Name("manifest", 0) << "; starting from the beginning." << std::endl;
+      return NONE;
+    }
+    manifest = ReadAll(file.get());
+  }
+  if (manifest.compare(0, fingerprint_.size(), fingerprint_)) {
+    std::cerr << "Warning: the text or settings differ from those of the checkpoint in " << Name("manifest", 0) << ".  Starting from the beginning." << std::endl;
+    return NONE;
+  }
+  std::istringstream in(manifest.substr(fingerprint_.size()));
+  std::string label;
+  unsigned int stage;
+  in >> label >> stage >> label >> token_count >> label >> type_count >> label >> std::ws;
+  std::getline(in, text_file_name);
+  UTIL_THROW_IF(!in || stage < COUNTED || stage > INITIAL, util::Exception, "Corrupt checkpoint manifest " << Name("manifest", 0));
+  if (stage >= ADJUSTED) {
+    counts.resize(order_);
+    counts_pruned.resize(order_);
+    discounts.resize(order_);
+    in >> label;
+    for (std::size_t i = 0; i < order_; ++i) in >> counts[i];
+    in >> label;
+    for (std::size_t i = 0; i < order_; ++i) in >> counts_pruned[i];
+    in >> label;
+    for (std::size_t i = 0; i < order_; ++i) {
+      for (std::size_t j = 0; j < 4; ++j) in >> discounts[i].amount[j];
+    }
+    UTIL_THROW_IF(!in, util::Exception, "Corrupt checkpoint manifest " << Name("manifest", 0));
+  }
+  util::scoped_fd words(Open("prune_words"));
+  std::string bits(ReadAll(words.get()));
+  prune_words.assign(bits.size(), false);
+  for (std::size_t i = 0; i < bits.size(); ++i) {
+    prune_words[i] = (bits[i] == '1');
+  }
+  return static_cast<Stage>(stage);
+}
+
+void Checkpoint::Finish(Stage stage) {
+  if (stage == COUNTED) {
+    std::string bits(prune_words.size(), '0');
+    for (std::size_t i = 0; i < prune_words.size(); ++i) {
+      if (prune_words[i]) bits[i] = '1';
+    }
+    util::scoped_fd words(util::CreateOrThrow(Name("prune_words", 0).c_str()));
+    util::WriteOrThrow(words.get(), bits.data(), bits.size());
+    util::FSyncOrThrow(words.get());
+  }
+  std::ostringstream out;
+  out << fingerprint_ << "stage " << stage << '\n'
+    << "tokens " << token_count << '\n'
+    << "types " << type_count << '\n'
+    << "text_file_name " << text_file_name << '\n';
+  if (stage >= ADJUSTED) {
+    out << "counts";
+    for (std::size_t i = 0; i < order_; ++i) out << ' ' << counts[i];
+    out << "\npruned";
+    for (std::size_t i = 0; i < order_; ++i) out << ' ' << counts_pruned[i];
+    out << "\ndiscounts" << std::setprecision(9);
+    for (std::size_t i = 0; i < order_; ++i) {
+      for (std::size_t j = 0; j < 4; ++j) out << ' ' << discounts[i].amount[j];
+    }
+    out << '\n';
+  }
+  const std::string manifest(out.str());
+  // Replace the manifest atomically so an interruption leaves the old one.
+  const std::string name(Name("manifest", 0)), temporary(name + ".tmp");
+  {
+    util::scoped_fd file(util::CreateOrThrow(temporary.c_str()));
+    util::WriteOrThrow(file.get(), manifest.data(), manifest.size());
+    util::FSyncOrThrow(file.get());
+  }
+  UTIL_THROW_IF(std::rename(temporary.c_str(), name.c_str()), util::ErrnoException, "Could not rename " << temporary << " to " << name);
+}
+
+void Checkpoint::Clear() {
+  const char *const single[] = {"manifest", "vocab", "prune_words"};
+  const char *const each_order[] = {"counts", "adjusted", "initial", "gamma"};
+  for (const char *const *i = single; i != single + 3; ++i) {
+    unlink(Name(*i, 0).c_str());
+  }
+  for (std::size_t order = 1; order <= order_; ++order) {
+    for (const char *const *i = each_order; i != each_order + 4; ++i) {
+      unlink(Name(*i, order).c_str());
+    }
+  }
+}
+
+void Checkpoint::Save(int fd, const char *name, std::size_t order) const {
+  util::scoped_fd to(util::CreateOrThrow(Name(name, order).c_str()));
+  util::CopyOrThrow(fd, to.get());
+  util::FSyncOrThrow(to.get());
+}
+
+int Checkpoint::Open(const char *name, std::size_t order) const {
+  return util::OpenReadOrThrow(Name(name, order).c_str());
+}
+
+void Checkpoint::Restore(int fd, const char *name, std::size_t order) const {
+  util::scoped_fd from(Open(name, order));
+  util::CopyOrThrow(from.get(), fd);
+  util::ResizeOrThrow(fd, util::SizeOrThrow(from.get()));
+}
+
+std::string Checkpoint::Name(const char *name, std::size_t order) const {
+  std::ostringstream ret;
+  ret << base_ << name;
+  if (order) ret << '.' << order;
+  return ret.str();
+}
+
+}} // namespaces
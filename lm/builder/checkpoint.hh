@@ -0,0 +1,75 @@
+#ifndef LM_BUILDER_CHECKPOINT_H
+#define LM_BUILDER_CHECKPOINT_H
+
+/* Saves what each finished stage of Pipeline hands to the next so that an
+ * interrupted estimation can resume.  Files go in the temporary prefix beside
+ * a text manifest that records the stage reached, a fingerprint of the input
+ * text and the settings that change the model, and the counts and discounts
+ * later stages need.  Counting saves the vocabulary and counts.N, adjusting
+ * saves adjusted.N in context order, and initial probabilities save initial.N
+ * in suffix order with backoffs in gamma.N.
+ */
+
+#include "lm/builder/discount.hh"
+#include "lm/word_index.hh"
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace lm { namespace builder {
+
+struct PipelineConfig;
+
+class Checkpoint {
+  public:
+    // Stages whose output is saved, in the order they finish.
+    enum Stage { NONE = 0, COUNTED = 1, ADJUSTED = 2, INITIAL = 3 };
+
+    // text_file must be a regular file.  Does not take ownership.
+    Checkpoint(const PipelineConfig &config, int text_file);
+
+    // Load the manifest and return the stage reached.  Returns NONE, with a
+    // warning if there was something to ignore, when there is no manifest or
+    // its fingerprint does not match.
+    Stage Load();
+
+    // Record that stage finished with everything it saved and the values
+    // below.  Files are synced before the manifest is replaced.
+    void Finish(Stage stage);
+
+    // Remove the manifest and every file it could refer to.
+    void Clear();
+
+    // Copy the contents of fd to the file saved as name and order.  Does not
+    // change fd's offset.
+    void Save(int fd, const char *name, std::size_t order = 0) const;
+
+    // Open a saved file for reading.
+    int Open(const char *name, std::size_t order = 0) const;
+
+    // Replace the contents of fd with a saved file.
+    void Restore(int fd, const char *name, std::size_t order = 0) const;
+
+    // Values passed between stages.  Counting sets the first four and adjusting
+    // the rest.
+    uint64_t token_count;
+    WordIndex type_count;
+    std::string text_file_name;
+    std::vector<bool> prune_words;
+
+    std::vector<uint64_t> counts, counts_pruned;
+    std::vector<Discount> discounts;
+
+  private:
+    std::string Name(const char *name, std::size_t order) const;
+
+    std::string base_;
+    std::size_t order_;
+    std::string fingerprint_;
+};
+
+}} // namespaces
+
+#endif // LM_BUILDER_CHECKPOINT_H
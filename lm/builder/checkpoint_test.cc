@@ -0,0 +1,80 @@
+#include "lm/builder/checkpoint.hh"
+
+#include "lm/builder/pipeline_test_fixture.hh"
+#include "util/file.hh"
+#include "util/scoped.hh"
+
+#define BOOST_TEST_MODULE CheckpointTest
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+namespace lm { namespace builder { namespace {
+
+PipelineConfig MakeConfig(bool checkpoint, bool resume) {
+  PipelineConfig config(builder::MakeConfig("checkpoint_test_"));
+  config.prune_thresholds[3] = 1;
+  config.checkpoint = checkpoint;
+  config.resume = resume;
+  return config;
+}
+
+class Text {
+  public:
+    explicit Text(const std::string &corpus) : file_(util::MakeTemp("checkpoint_test_text")) {
+      util::WriteOrThrow(file_.get(), corpus.data(), corpus.size());
+    }
+
+    // A fresh descriptor for the pipeline to own.
+    int Get() const {
+      util::SeekOrThrow(file_.get(), 0);
+      return util::DupOrThrow(file_.get());
+    }
+
+  private:
+    util::scoped_fd file_;
+};
+
+std::string Estimate(const PipelineConfig &config, const Text &text) {
+  return builder::Estimate(config, text.Get());
+}
+
+BOOST_AUTO_TEST_CASE(ResumeEachStage) {
+  Text text(MakeCorpus(12345, 2000));
+  std::string expected(Estimate(MakeConfig(false, false), text));
+  BOOST_REQUIRE(!expected.empty());
+  BOOST_CHECK(expected == Estimate(MakeConfig(true, false), text));
+
+  const PipelineConfig config(MakeConfig(true, true));
+  util::scoped_fd fd(text.Get());
+  Checkpoint checkpoint(config, fd.get());
+  BOOST_REQUIRE_EQUAL(Checkpoint::INITIAL, checkpoint.Load());
+  BOOST_CHECK(expected == Estimate(config, text));
+  // Pretend the run stopped earlier.  The files of later stages are ignored.
+  checkpoint.Finish(Checkpoint::ADJUSTED);
+  BOOST_CHECK(expected == Estimate(config, text));
+  checkpoint.Load();
+  checkpoint.Finish(Checkpoint::COUNTED);
+  BOOST_CHECK(expected == Estimate(config, text));
+  checkpoint.Clear();
+  BOOST_CHECK_EQUAL(Checkpoint::NONE, checkpoint.Load());
+}
+
+BOOST_AUTO_TEST_CASE(DifferentText) {
+  Text text(MakeCorpus(12345, 2000)), other(MakeCorpus(54321, 2000));
+  std::string expected(Estimate(MakeConfig(false, false), other));
+  Estimate(MakeConfig(true, false), text);
+  // The checkpoint is for a different text, so this starts over.
+  BOOST_CHECK(expected == Estimate(MakeConfig(true, true), other));
+
+  PipelineConfig config(MakeConfig(true, true));
+  util::scoped_fd fd(other.Get());
+  Checkpoint checkpoint(config, fd.get());
+  BOOST_CHECK_EQUAL(Checkpoint::INITIAL, checkpoint.Load());
+  config.prune_thresholds[3] = 0;
+  Checkpoint different(config, fd.get());
+  BOOST_CHECK_EQUAL(Checkpoint::NONE, different.Load());
+  checkpoint.Clear();
+}
+
+}}} // namespaces
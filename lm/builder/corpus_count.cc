@@ -2,6 +2,7 @@
 
 #include "lm/builder/payload.hh"
 #include "lm/common/ngram.hh"
+#include "lm/common/print.hh"
 #include "lm/lm_exception.hh"
 #include "lm/vocab.hh"
 #include "lm/word_index.hh"
@@ -9,12 +10,24 @@
 #include "util/file.hh"
 #include "util/file_piece.hh"
 #include "util/murmur_hash.hh"
+#include "util/pcqueue.hh"
 #include "util/probing_hash_table.hh"
 #include "util/scoped.hh"
 #include "util/stream/chain.hh"
 #include "util/stream/timer.hh"
 #include "util/tokenize_piece.hh"
 
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <algorithm>
+#include <cstring>
 #include <functional>
 
 #include <stdint.h>
@@ -65,17 +78,19 @@ const float kProbingMultiplier = 1.5;
 
 typedef util::ProbingHashTable<DedupeEntry, DedupeHash, DedupeEquals> Dedupe;
 
-class Writer {
+// Blocks is util::stream::Link or anything else with the same interface.  The
+// caller poisons it after the Writer is gone.
+template <class Blocks> class Writer {
   public:
-    Writer(std::size_t order, const util::stream::ChainPosition &position, void *dedupe_mem, std::size_t dedupe_mem_size)
-      : block_(position), gram_(block_->Get(), order),
+    Writer(std::size_t order, Blocks &blocks, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size, bool add_special = true)
+      : block_(blocks), gram_(block_->Get(), order),
         dedupe_invalid_(order, std::numeric_limits<WordIndex>::max()),
         dedupe_(dedupe_mem, dedupe_mem_size, &dedupe_invalid_[0], DedupeHash(order), DedupeEquals(order)),
         buffer_(new WordIndex[order - 1]),
-        block_size_(position.GetChain().BlockSize()) {
+        block_size_(block_size) {
       dedupe_.Clear();
-      assert(Dedupe::Size(position.GetChain().BlockSize() / position.GetChain().EntrySize(), kProbingMultiplier) == dedupe_mem_size);
-      if (order == 1) {
+      assert(Dedupe::Size(block_size / NGram<BuildingPayload>::TotalSize(order), kProbingMultiplier) == dedupe_mem_size);
+      if (order == 1 && add_special) {
         // Add special words.  AdjustCounts is responsible if order != 1.
         AddUnigramWord(kUNK);
         AddUnigramWord(kBOS);
@@ -84,7 +99,6 @@ class Writer {
 
     ~Writer() {
       block_->SetValidSize(reinterpret_cast<const uint8_t*>(gram_.begin()) - static_cast<const uint8_t*>(block_->Get()));
-      (++block_).Poison();
     }
 
     // Write context with a bunch of <s>
@@ -108,7 +122,25 @@ class Writer {
       }
       // Complete the write.
       gram_.Value().count = 1;
-      // Prepare the next n-gram.
+      NextGram();
+    }
+
+    // Add an n-gram that was counted elsewhere, instead of appending words.
+    void Add(const WordIndex *words, uint64_t count) {
+      std::copy(words, words + gram_.Order(), gram_.begin());
+      Dedupe::MutableIterator at;
+      if (dedupe_.FindOrInsert(DedupeEntry::Construct(gram_.begin()), at)) {
+        NGram<BuildingPayload> already(at->key, gram_.Order());
+        already.Value().count += count;
+        return;
+      }
+      gram_.Value().count = count;
+      NextGram();
+    }
+
+  private:
+    // Move past the n-gram just written and copy its context to the next one.
+    void NextGram() {
       if (reinterpret_cast<uint8_t*>(gram_.begin()) + gram_.TotalSize() != static_cast<uint8_t*>(block_->Get()) + block_size_) {
         NGram<BuildingPayload> last(gram_);
         gram_.NextInMemory();
@@ -123,7 +155,6 @@ class Writer {
       std::copy(buffer_.get(), buffer_.get() + gram_.Order() - 1, gram_.begin());
     }
 
-  private:
     void AddUnigramWord(WordIndex index) {
       *gram_.begin() = index;
       gram_.Value().count = 0;
@@ -134,7 +165,7 @@ class Writer {
       }
     }
 
-    util::stream::Link block_;
+    Blocks &block_;
 
     NGram<BuildingPayload> gram_;
 
@@ -151,20 +182,23 @@ class Writer {
 
 } // namespace
 
-float CorpusCount::DedupeMultiplier(std::size_t order) {
-  return kProbingMultiplier * static_cast<float>(sizeof(DedupeEntry)) / static_cast<float>(NGram<BuildingPayload>::TotalSize(order));
+float CorpusCount::DedupeMultiplier(std::size_t order, std::size_t threads) {
+  float dedupe = kProbingMultiplier * static_cast<float>(sizeof(DedupeEntry)) / static_cast<float>(NGram<BuildingPayload>::TotalSize(order));
+  // In parallel, each worker has a dedupe table and two blocks of its own.
+  return threads > 1 ? static_cast<float>(threads) * (dedupe + 2.0) : dedupe;
 }
 
 std::size_t CorpusCount::VocabUsage(std::size_t vocab_estimate) {
   return ngram::GrowableVocab<ngram::WriteUniqueWords>::MemUsage(vocab_estimate);
 }
 
-CorpusCount::CorpusCount(util::FilePiece &from, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol)
+CorpusCount::CorpusCount(util::FilePiece &from, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol, std::size_t threads, const std::string &seed_vocab_filename)
   : from_(from), vocab_write_(vocab_write), token_count_(token_count), type_count_(type_count),
-    prune_words_(prune_words), prune_vocab_filename_(prune_vocab_filename),
+    prune_words_(prune_words), prune_vocab_filename_(prune_vocab_filename), seed_vocab_filename_(seed_vocab_filename),
     dedupe_mem_size_(Dedupe::Size(entries_per_block, kProbingMultiplier)),
-    dedupe_mem_(util::MallocOrThrow(dedupe_mem_size_)),
-    disallowed_symbol_action_(disallowed_symbol) {
+    dedupe_mem_(util::MallocOrThrow(dedupe_mem_size_ * std::max<std::size_t>(threads, 1))),
+    disallowed_symbol_action_(disallowed_symbol),
+    threads_(threads) {
 }
 
 namespace {
@@ -180,59 +214,597 @@ namespace {
         UTIL_THROW(FormatLoadException, "Special word " << word << " is not allowed in the corpus.  I plan to support models containing <unk> in the future.  Pass --skip_symbols to convert these symbols to whitespace.");
     }
   }
+
+typedef ngram::GrowableVocab<ngram::WriteUniqueWords> Vocab;
+
+/* Parallel counting.  A reader thread copies lines into chunks.  Workers look
+ * up a chunk's words under a shared lock on the vocabulary, then take turns in
+ * input order to add the words that were missing, so ids are assigned in the
+ * same order as counting on one thread.  Each worker then dedupes n-grams into
+ * its own blocks, which the chain's thread copies into the chain one for one.
+ * Sort only combines counts across blocks, so a block must not mix workers.
+ */
+
+// Lines of input.  Each ends with a newline.
+struct CountChunk {
+  std::string text;
+  uint64_t sequence;
+};
+
+const std::size_t kChunkBytes = 1 << 18;
+
+class CountShared {
+  public:
+    CountShared(Vocab &vocab_in, WarningAction &disallowed_in, std::size_t chunks, std::size_t blocks, std::size_t threads)
+      : vocab(vocab_in), disallowed(disallowed_in),
+        free_chunks(chunks), full_chunks(chunks + threads),
+        free_blocks(blocks), full_blocks(blocks + threads),
+        turn_(0), failed_(false) {}
+
+    // Wait until the chunk with this sequence number is next to update the
+    // vocabulary.  Returns false if something failed instead.
+    bool WaitTurn(uint64_t sequence) {
+      boost::unique_lock<boost::mutex> lock(turn_mutex_);
+      while (turn_ != sequence && !failed_) turn_cond_.wait(lock);
+      return !failed_;
+    }
+
+    void EndTurn() {
+      {
+        boost::unique_lock<boost::mutex> lock(turn_mutex_);
+        ++turn_;
+      }
+      turn_cond_.notify_all();
+    }
+
+    // Record the first failure.  Remaining chunks are skipped.
+    void Fail(const std::string &message) {
+      {
+        boost::unique_lock<boost::mutex> lock(turn_mutex_);
+        if (!failed_) error_ = message;
+        failed_ = true;
+      }
+      turn_cond_.notify_all();
+    }
+
+    bool Failed() {
+      boost::unique_lock<boost::mutex> lock(turn_mutex_);
+      return failed_;
+    }
+
+    const std::string &Error() const { return error_; }
+
+    Vocab &vocab;
+    boost::shared_mutex vocab_mutex;
+    // Only used by whoever has the turn.
+    WarningAction &disallowed;
+
+    // NULL tells a worker to stop.
+    util::PCQueue<CountChunk*> free_chunks, full_chunks;
+    // An empty block means a worker is done.
+    util::PCQueue<util::stream::Block> free_blocks, full_blocks;
+
+  private:
+    boost::mutex turn_mutex_;
+    boost::condition_variable turn_cond_;
+    uint64_t turn_;
+    bool failed_;
+    std::string error_;
+};
+
+// Stands in for util::stream::Link so Writer can fill a worker's blocks.
+class WorkerBlocks {
+  public:
+    explicit WorkerBlocks(CountShared *shared) : shared_(shared) {
+      shared_->free_blocks.Consume(current_);
+    }
+
+    util::stream::Block *operator->() { return &current_; }
+
+    WorkerBlocks &operator++() {
+      shared_->full_blocks.Produce(current_);
+      shared_->free_blocks.Consume(current_);
+      return *this;
+    }
+
+    void Poison() {
+      shared_->free_blocks.Produce(current_);
+      shared_->full_blocks.Produce(util::stream::Block());
+    }
+
+  private:
+    CountShared *shared_;
+    util::stream::Block current_;
+};
+
+class ChunkReader {
+  public:
+    ChunkReader(util::FilePiece &from, CountShared &shared, std::size_t threads)
+      : from_(from), shared_(shared), threads_(threads), eof_(false) {}
+
+    void operator()() {
+      try {
+        for (uint64_t sequence = 0; !shared_.Failed(); ++sequence) {
+          CountChunk *chunk;
+          shared_.free_chunks.Consume(chunk);
+          if (!Fill(*chunk)) break;
+          chunk->sequence = sequence;
+          shared_.full_chunks.Produce(chunk);
+        }
+      } catch (const std::exception &e) {
+        shared_.Fail(e.what());
+      }
+      for (std::size_t i = 0; i < threads_; ++i) {
+        shared_.full_chunks.Produce(NULL);
+      }
+    }
+
+  private:
+    bool Fill(CountChunk &chunk) {
+      chunk.text.clear();
+      try {
+        while (!eof_ && chunk.text.size() < kChunkBytes) {
+          StringPiece line(from_.ReadLine());
+          chunk.text.append(line.data(), line.size());
+          chunk.text.push_back('\n');
+        }
+      } catch (const util::EndOfFileException &e) {
+        eof_ = true;
+      }
+      return !chunk.text.empty();
+    }
+
+    util::FilePiece &from_;
+    CountShared &shared_;
+    const std::size_t threads_;
+    bool eof_;
+};
+
+/* Looks up a chunk's words under a shared lock on the vocabulary.  Words that
+ * are missing get placeholders until the chunk's turn, when Insert adds them
+ * and Patch fills in their ids.
+ */
+class PendingWords {
+  public:
+    void Clear() {
+      at_.clear();
+      index_.clear();
+      words_.clear();
+      lookup_.clear();
+    }
+
+    // Returns true with the id in out if word is in the vocabulary.  Otherwise
+    // remembers that position needs its id.
+    bool Find(const Vocab &vocab, const StringPiece &word, std::size_t position, WordIndex &out) {
+      uint64_t hash = util::MurmurHashNative(word.data(), word.size());
+      if (vocab.Find(hash, out)) return true;
+      std::pair<boost::unordered_map<uint64_t, std::size_t>::iterator, bool> found(lookup_.insert(std::make_pair(hash, words_.size())));
+      if (found.second) words_.push_back(word);
+      at_.push_back(position);
+      index_.push_back(found.first->second);
+      return false;
+    }
+
+    // Add the missing words in the order they appeared.  Call with the turn
+    // and an exclusive lock on the vocabulary.
+    void Insert(Vocab &vocab) {
+      mapping_.resize(words_.size());
+      for (std::size_t i = 0; i < words_.size(); ++i) {
+        mapping_[i] = vocab.FindOrInsert(words_[i]);
+      }
+    }
+
+    void Patch(std::vector<WordIndex> &ids) const {
+      for (std::size_t i = 0; i < at_.size(); ++i) {
+        ids[at_[i]] = mapping_[index_[i]];
+      }
+    }
+
+  private:
+    // Positions that need ids with indices into words_.
+    std::vector<std::size_t> at_, index_;
+    std::vector<StringPiece> words_;
+    boost::unordered_map<uint64_t, std::size_t> lookup_;
+    std::vector<WordIndex> mapping_;
+};
+
+// Takes chunks until the reader is done and processes them into its own blocks.
+class ChunkWorker {
+  public:
+    ChunkWorker(CountShared &shared, std::size_t order, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size, bool add_special)
+      : shared_(shared), order_(order), tokens_(0), block_size_(block_size), dedupe_mem_(dedupe_mem), dedupe_mem_size_(dedupe_mem_size), add_special_(add_special) {
+      util::BoolCharacter::Build("\0\t\n\r ", delimiters_);
+    }
+
+    virtual ~ChunkWorker() {}
+
+    void operator()() {
+      WorkerBlocks blocks(&shared_);
+      {
+        Writer<WorkerBlocks> writer(order_, blocks, block_size_, dedupe_mem_, dedupe_mem_size_, add_special_);
+        CountChunk *chunk;
+        while (shared_.full_chunks.Consume(chunk)) {
+          try {
+            if (!shared_.Failed()) Process(*chunk, writer);
+          } catch (const std::exception &e) {
+            shared_.Fail(e.what());
+          }
+          shared_.free_chunks.Produce(chunk);
+        }
+      }
+      (++blocks).Poison();
+    }
+
+    uint64_t Tokens() const { return tokens_; }
+
+  protected:
+    virtual void Process(const CountChunk &chunk, Writer<WorkerBlocks> &writer) = 0;
+
+    // Add the words that were missing from the vocabulary in turn, then fill in
+    // their ids.  Returns false if something failed.
+    bool InsertPending(const CountChunk &chunk, std::vector<WordIndex> &words, StringPiece disallowed = StringPiece()) {
+      if (!shared_.WaitTurn(chunk.sequence)) return false;
+      try {
+        if (disallowed.data()) ComplainDisallowed(disallowed, shared_.disallowed);
+        boost::unique_lock<boost::shared_mutex> lock(shared_.vocab_mutex);
+        pending_.Insert(shared_.vocab);
+      } catch (const std::exception &e) {
+        shared_.Fail(e.what());
+      }
+      shared_.EndTurn();
+      if (shared_.Failed()) return false;
+      pending_.Patch(words);
+      return true;
+    }
+
+    CountShared &shared_;
+    const std::size_t order_;
+    bool delimiters_[256];
+    uint64_t tokens_;
+    PendingWords pending_;
+
+  private:
+    const std::size_t block_size_;
+    void *const dedupe_mem_;
+    const std::size_t dedupe_mem_size_;
+    const bool add_special_;
+};
+
+class CountWorker : public ChunkWorker {
+  public:
+    CountWorker(CountShared &shared, std::size_t order, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size, bool add_special)
+      : ChunkWorker(shared, order, block_size, dedupe_mem, dedupe_mem_size, add_special) {}
+
+  private:
+    void Process(const CountChunk &chunk, Writer<WorkerBlocks> &writer) {
+      words_.clear();
+      pending_.Clear();
+      StringPiece disallowed;
+      {
+        boost::shared_lock<boost::shared_mutex> lock(shared_.vocab_mutex);
+        const char *const end = chunk.text.data() + chunk.text.size();
+        for (const char *line = chunk.text.data(); line != end;) {
+          const char *eol = static_cast<const char*>(memchr(line, '\n', end - line));
+          for (util::TokenIter<util::BoolCharacter, true> w(StringPiece(line, eol - line), delimiters_); w; ++w) {
+            WordIndex word;
+            if (pending_.Find(shared_.vocab, *w, words_.size(), word)) {
+              if (word <= 2) {
+                if (!disallowed.data()) disallowed = *w;
+                continue;
+              }
+              words_.push_back(word);
+            } else {
+              words_.push_back(0);
+            }
+            ++tokens_;
+          }
+          words_.push_back(kEOS);
+          line = eol + 1;
+        }
+      }
+
+      if (!InsertPending(chunk, words_, disallowed)) return;
+      writer.StartSentence();
+      for (std::vector<WordIndex>::const_iterator i = words_.begin(); i != words_.end(); ++i) {
+        writer.Append(*i);
+        if (*i == kEOS) writer.StartSentence();
+      }
+    }
+
+    // Words of the chunk with each sentence ending in </s>.  Words that were
+    // not in the vocabulary are 0 until their turn.
+    std::vector<WordIndex> words_;
+};
+
+/* Counts made elsewhere are n-grams of the highest order, as lmplz would count
+ * them, one per line with the words, a tab, and the count.  Near the start of a
+ * sentence there are fewer words and the first is <s>; these are padded with
+ * <s> as lmplz pads sentences.
+ */
+const StringPiece kBOSWord("<s>");
+
+void ParseCountLine(const StringPiece &line, const bool *delimiters, std::size_t order, std::vector<StringPiece> &words, uint64_t &count) {
+  const char *tab = line.data() + line.size();
+  while (tab != line.data() && *(tab - 1) != '\t') --tab;
+  UTIL_THROW_IF(tab == line.data(), FormatLoadException, "Expected words, a tab, and a count in the line " << line);
+  const char *end = line.data() + line.size();
+  if (end != tab && *(end - 1) == '\r') --end;
+  // More digits could overflow.
+  UTIL_THROW_IF(end - tab > 19, FormatLoadException, "Count too large in the line " << line);
+  count = 0;
+  for (const char *i = tab; i != end; ++i) {
+    UTIL_THROW_IF(*i < '0' || *i > '9', FormatLoadException, "Bad count in the line " << line);
+    count = count * 10 + (*i - '0');
+  }
+  UTIL_THROW_IF(!count, FormatLoadException, "Missing or zero count in the line " << line);
+  words.clear();
+  for (util::TokenIter<util::BoolCharacter, true> w(StringPiece(line.data(), tab - 1 - line.data()), delimiters); w; ++w) {
+    words.push_back(*w);
+  }
+  UTIL_THROW_IF(words.empty() || words.size() > order || (words.size() < order && words.front() != kBOSWord), FormatLoadException,
+      "The line " << line << " has " << words.size() << " words.  Counts must be of order " << order << ", or lower at the start of a sentence where the first word is <s>.");
+  words.insert(words.begin(), order - words.size(), kBOSWord);
+}
+
+// Whether the special words are where lmplz would put them: <s> only at the
+// beginning, </s> only at the end, and never <unk>.
+bool SpecialsInPlace(const WordIndex *begin, const WordIndex *end) {
+  const WordIndex *i = begin;
+  while (i != end && *i == kBOS) ++i;
+  if (i == end) return false;
+  for (; i != end - 1; ++i) {
+    if (*i <= kEOS) return false;
+  }
+  return *i != kUNK && *i != kBOS;
+}
+
+const char kSpecialsMessage[] = " puts <s>, </s>, or <unk> where lmplz would not.  <s> may only begin an n-gram, </s> may only end one, and <unk> is not allowed.";
+
+class CountsWorker : public ChunkWorker {
+  public:
+    CountsWorker(CountShared &shared, std::size_t order, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size, bool add_special)
+      : ChunkWorker(shared, order, block_size, dedupe_mem, dedupe_mem_size, add_special) {}
+
+  private:
+    void Process(const CountChunk &chunk, Writer<WorkerBlocks> &writer) {
+      words_.clear();
+      counts_.clear();
+      lines_.clear();
+      pending_.Clear();
+      {
+        boost::shared_lock<boost::shared_mutex> lock(shared_.vocab_mutex);
+        const char *const end = chunk.text.data() + chunk.text.size();
+        for (const char *line = chunk.text.data(); line != end;) {
+          const char *eol = static_cast<const char*>(memchr(line, '\n', end - line));
+          lines_.push_back(StringPiece(line, eol - line));
+          counts_.push_back(0);
+          ParseCountLine(lines_.back(), delimiters_, order_, line_words_, counts_.back());
+          for (std::vector<StringPiece>::const_iterator w = line_words_.begin(); w != line_words_.end(); ++w) {
+            WordIndex word;
+            words_.push_back(pending_.Find(shared_.vocab, *w, words_.size(), word) ? word : 0);
+          }
+          line = eol + 1;
+        }
+      }
+
+      if (!InsertPending(chunk, words_)) return;
+      for (std::size_t i = 0; i < counts_.size(); ++i) {
+        const WordIndex *gram = &words_[i * order_];
+        UTIL_THROW_IF(!SpecialsInPlace(gram, gram + order_), FormatLoadException, "The line " << lines_[i] << kSpecialsMessage);
+        writer.Add(gram, counts_[i]);
+        if (gram[order_ - 1] != kEOS) tokens_ += counts_[i];
+      }
+    }
+
+    // order_ words for each line, 0 until their turn if they were missing.
+    std::vector<WordIndex> words_;
+    std::vector<uint64_t> counts_;
+    std::vector<StringPiece> lines_;
+    std::vector<StringPiece> line_words_;
+};
+
+// Insert the words of an earlier vocabulary file in order so they keep their ids.
+void SeedVocab(const std::string &filename, Vocab &vocab) {
+  util::scoped_fd file(util::OpenReadOrThrow(filename.c_str()));
+  VocabReconstitute words(file.get());
+  for (WordIndex i = 0; i < words.Size(); ++i) {
+    UTIL_THROW_IF(vocab.FindOrInsert(words.LookupPiece(i)) != i, util::Exception, "Word " << words.Lookup(i) << " at " << i << " in " << filename << " does not keep its id.  The vocabulary should begin with <unk>, <s>, and </s> and have no word twice.");
+  }
+}
+
+// Returns the number of tokens.  The caller poisons out.
+template <class Worker> uint64_t CountParallel(util::FilePiece &from, Vocab &vocab, util::stream::Link &out, std::size_t order, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size, std::size_t threads, WarningAction &disallowed) {
+  // Two blocks per worker so that one fills while the other is copied.
+  util::scoped_malloc block_mem(util::MallocOrThrow(block_size * 2 * threads));
+  boost::scoped_array<CountChunk> chunks(new CountChunk[2 * threads]);
+  CountShared shared(vocab, disallowed, 2 * threads, 2 * threads, threads);
+  for (std::size_t i = 0; i < 2 * threads; ++i) {
+    shared.free_chunks.Produce(&chunks[i]);
+    shared.free_blocks.Produce(util::stream::Block(static_cast<uint8_t*>(block_mem.get()) + i * block_size, block_size));
+  }
+
+  boost::ptr_vector<Worker> workers;
+  boost::thread_group worker_threads;
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers.push_back(new Worker(shared, order, block_size, static_cast<uint8_t*>(dedupe_mem) + i * dedupe_mem_size, dedupe_mem_size, i == 0));
+    worker_threads.create_thread(boost::ref(workers.back()));
+  }
+  ChunkReader reader(from, shared, threads);
+  boost::thread reader_thread(boost::ref(reader));
+
+  for (std::size_t done = 0; done < threads;) {
+    util::stream::Block from_worker;
+    shared.full_blocks.Consume(from_worker);
+    if (!from_worker) {
+      ++done;
+      continue;
+    }
+    if (from_worker.ValidSize()) {
+      memcpy(out->Get(), from_worker.Get(), from_worker.ValidSize());
+      out->SetValidSize(from_worker.ValidSize());
+      ++out;
+    }
+    from_worker.SetValidSize(block_size);
+    shared.free_blocks.Produce(from_worker);
+  }
+  out->SetValidSize(0);
+
+  reader_thread.join();
+  worker_threads.join_all();
+  UTIL_THROW_IF(shared.Failed(), util::Exception, shared.Error());
+  uint64_t tokens = 0;
+  for (std::size_t i = 0; i < threads; ++i) {
+    tokens += workers[i].Tokens();
+  }
+  return tokens;
+}
+
+// Returns the number of tokens.  The caller poisons out.
+uint64_t ReadBinaryCounts(int fd, WordIndex vocab_size, util::stream::Link &out, std::size_t order, std::size_t block_size, void *dedupe_mem, std::size_t dedupe_mem_size) {
+  const std::size_t record = NGram<BuildingPayload>::TotalSize(order);
+  const std::size_t buffer_size = std::max<std::size_t>(1, (1 << 20) / record) * record;
+  util::scoped_malloc buffer(util::MallocOrThrow(buffer_size));
+  uint8_t *const base = static_cast<uint8_t*>(buffer.get());
+  Writer<util::stream::Link> writer(order, out, block_size, dedupe_mem, dedupe_mem_size);
+  uint64_t tokens = 0, index = 0;
+  std::size_t have = 0;
+  while (std::size_t got = util::ReadOrEOF(fd, base + have, buffer_size - have)) {
+    have += got;
+    uint8_t *i = base;
+    for (; i + record <= base + have; i += record, ++index) {
+      NGram<BuildingPayload> gram(i, order);
+      for (const WordIndex *w = gram.begin(); w != gram.end(); ++w) {
+        UTIL_THROW_IF(*w >= vocab_size, FormatLoadException, "Record " << index << " of the counts has word id " << *w << " but the vocabulary has " << vocab_size << " words.");
+      }
+      UTIL_THROW_IF(!SpecialsInPlace(gram.begin(), gram.end()), FormatLoadException, "Record " << index << " of the counts" << kSpecialsMessage);
+      writer.Add(gram.begin(), gram.Value().count);
+      if (*(gram.end() - 1) != kEOS) tokens += gram.Value().count;
+    }
+    have = base + have - i;
+    memmove(base, i, have);
+  }
+  UTIL_THROW_IF(have, FormatLoadException, "The counts end with a partial record of " << have << " bytes.  Records should be " << record << " bytes for order " << order << ".");
+  return tokens;
+}
+
+// List the unigrams that are supposed to be pruned.
+void PruneWords(const std::string &filename, const Vocab &vocab, std::vector<bool> &prune_words) {
+  if (filename.empty()) return;
+  bool delimiters[256];
+  util::BoolCharacter::Build("\0\t\n\r ", delimiters);
+  try {
+    util::FilePiece prune_vocab_file(filename.c_str());
+
+    prune_words.resize(vocab.Size(), true);
+    try {
+      while (true) {
+        StringPiece word(prune_vocab_file.ReadDelimited(delimiters));
+        prune_words[vocab.Index(word)] = false;
+      }
+    } catch (const util::EndOfFileException &e) {}
+
+    // Never prune <unk>, <s>, </s>
+    prune_words[kUNK] = false;
+    prune_words[kBOS] = false;
+    prune_words[kEOS] = false;
+
+  } catch (const util::Exception &e) {
+    std::cerr << e.what() << std::endl;
+    abort();
+  }
+}
+
 } // namespace
 
 void CorpusCount::Run(const util::stream::ChainPosition &position) {
-  ngram::GrowableVocab<ngram::WriteUniqueWords> vocab(type_count_, vocab_write_);
+  Vocab vocab(type_count_, vocab_write_);
+  if (!seed_vocab_filename_.empty()) SeedVocab(seed_vocab_filename_, vocab);
   token_count_ = 0;
   type_count_ = 0;
   const WordIndex end_sentence = vocab.FindOrInsert("</s>");
-  Writer writer(NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize()), position, dedupe_mem_.get(), dedupe_mem_size_);
+  const std::size_t order = NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize());
+  const std::size_t block_size = position.GetChain().BlockSize();
+  util::stream::Link out(position);
   uint64_t count = 0;
   bool delimiters[256];
   util::BoolCharacter::Build("\0\t\n\r ", delimiters);
-  try {
-    while(true) {
-      StringPiece line(from_.ReadLine());
-      writer.StartSentence();
-      for (util::TokenIter<util::BoolCharacter, true> w(line, delimiters); w; ++w) {
-        WordIndex word = vocab.FindOrInsert(*w);
-        if (word <= 2) {
-          ComplainDisallowed(*w, disallowed_symbol_action_);
-          continue;
+  if (threads_ > 1) {
+    count = CountParallel<CountWorker>(from_, vocab, out, order, block_size, dedupe_mem_.get(), dedupe_mem_size_, threads_, disallowed_symbol_action_);
+  } else {
+    Writer<util::stream::Link> writer(order, out, block_size, dedupe_mem_.get(), dedupe_mem_size_);
+    try {
+      while(true) {
+        StringPiece line(from_.ReadLine());
+        writer.StartSentence();
+        for (util::TokenIter<util::BoolCharacter, true> w(line, delimiters); w; ++w) {
+          WordIndex word = vocab.FindOrInsert(*w);
+          if (word <= 2) {
+            ComplainDisallowed(*w, disallowed_symbol_action_);
+            continue;
+          }
+          writer.Append(word);
+          ++count;
         }
-        writer.Append(word);
-        ++count;
+        writer.Append(end_sentence);
       }
-      writer.Append(end_sentence);
-    }
-  } catch (const util::EndOfFileException &e) {}
+    } catch (const util::EndOfFileException &e) {}
+  }
   token_count_ = count;
   type_count_ = vocab.Size();
+  PruneWords(prune_vocab_filename_, vocab, prune_words_);
+  // Counts are ready once the chain sees poison.
+  (++out).Poison();
+}
 
-  // Create list of unigrams that are supposed to be pruned
-  if (!prune_vocab_filename_.empty()) {
-    try {
-      util::FilePiece prune_vocab_file(prune_vocab_filename_.c_str());
+CountsInput::CountsInput(int file, const std::string &binary_vocab_filename, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string &prune_vocab_filename, std::size_t entries_per_block, std::size_t threads, const std::string &seed_vocab_filename)
+  : file_(file), binary_vocab_filename_(binary_vocab_filename), vocab_write_(vocab_write), token_count_(token_count), type_count_(type_count),
+    prune_words_(prune_words), prune_vocab_filename_(prune_vocab_filename), seed_vocab_filename_(seed_vocab_filename),
+    dedupe_mem_size_(Dedupe::Size(entries_per_block, kProbingMultiplier)),
+    dedupe_mem_(util::MallocOrThrow(dedupe_mem_size_ * std::max<std::size_t>(threads, 1))),
+    threads_(threads) {
+  UTIL_THROW_IF(!binary_vocab_filename_.empty() && !seed_vocab_filename_.empty(), util::Exception, "Binary counts have their own vocabulary, so they can not extend another one.");
+}
 
-      prune_words_.resize(vocab.Size(), true);
-      try {
-        while (true) {
-          StringPiece word(prune_vocab_file.ReadDelimited(delimiters));
-          prune_words_[vocab.Index(word)] = false;
+void CountsInput::Run(const util::stream::ChainPosition &position) {
+  Vocab vocab(type_count_, vocab_write_);
+  if (!seed_vocab_filename_.empty()) SeedVocab(seed_vocab_filename_, vocab);
+  const std::size_t order = NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize());
+  const std::size_t block_size = position.GetChain().BlockSize();
+  util::stream::Link out(position);
+  uint64_t count = 0;
+  if (!binary_vocab_filename_.empty()) {
+    SeedVocab(binary_vocab_filename_, vocab);
+    count = ReadBinaryCounts(file_.get(), vocab.Size(), out, order, block_size, dedupe_mem_.get(), dedupe_mem_size_);
+  } else if (threads_ > 1) {
+    util::FilePiece from(file_.release(), NULL, &std::cerr);
+    // Special words are allowed, so this is never used.
+    WarningAction disallowed = THROW_UP;
+    count = CountParallel<CountsWorker>(from, vocab, out, order, block_size, dedupe_mem_.get(), dedupe_mem_size_, threads_, disallowed);
+  } else {
+    util::FilePiece from(file_.release(), NULL, &std::cerr);
+    Writer<util::stream::Link> writer(order, out, block_size, dedupe_mem_.get(), dedupe_mem_size_);
+    bool delimiters[256];
+    util::BoolCharacter::Build("\0\t\n\r ", delimiters);
+    std::vector<StringPiece> words;
+    std::vector<WordIndex> ids(order);
+    uint64_t number;
+    try {
+      while (true) {
+        StringPiece line(from.ReadLine());
+        ParseCountLine(line, delimiters, order, words, number);
+        for (std::size_t i = 0; i < order; ++i) {
+          ids[i] = vocab.FindOrInsert(words[i]);
         }
-      } catch (const util::EndOfFileException &e) {}
-
-      // Never prune <unk>, <s>, </s>
-      prune_words_[kUNK] = false;
-      prune_words_[kBOS] = false;
-      prune_words_[kEOS] = false;
-
-    } catch (const util::Exception &e) {
-      std::cerr << e.what() << std::endl;
-      abort();
-    }
+        UTIL_THROW_IF(!SpecialsInPlace(&*ids.begin(), &*ids.begin() + order), FormatLoadException, "The line " << line << kSpecialsMessage);
+        writer.Add(&*ids.begin(), number);
+        if (ids.back() != kEOS) count += number;
+      }
+    } catch (const util::EndOfFileException &e) {}
   }
+  token_count_ = count;
+  type_count_ = vocab.Size();
+  PruneWords(prune_vocab_filename_, vocab, prune_words_);
+  (++out).Poison();
 }
 
 } // namespace builder
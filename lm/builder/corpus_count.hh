@@ -3,6 +3,7 @@
 
 #include "lm/lm_exception.hh"
 #include "lm/word_index.hh"
+#include "util/file.hh"
 #include "util/scoped.hh"
 
 #include <cstddef>
@@ -22,15 +23,20 @@ namespace builder {
 
 class CorpusCount {
   public:
-    // Memory usage will be DedupeMultipler(order) * block_size + total_chain_size + unknown vocab_hash_size
-    static float DedupeMultiplier(std::size_t order);
+    // Memory usage will be DedupeMultipler(order, threads) * block_size + total_chain_size + unknown vocab_hash_size
+    static float DedupeMultiplier(std::size_t order, std::size_t threads = 1);
 
     // How much memory vocabulary will use based on estimated size of the vocab.
     static std::size_t VocabUsage(std::size_t vocab_estimate);
 
     // token_count: out.
     // type_count aka vocabulary size.  Initialize to an estimate.  It is set to the exact value.
-    CorpusCount(util::FilePiece &from, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol);
+    // threads: tokenize and dedupe on this many threads.  Vocabulary ids and
+    // the sorted counts are the same as with one thread.
+    // seed_vocab_filename: if not empty, words from an earlier vocab_write,
+    // which keep their ids so the counts can be combined with earlier counts.
+    // type_count includes them but token_count is only for from.
+    CorpusCount(util::FilePiece &from, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string& prune_vocab_filename, std::size_t entries_per_block, WarningAction disallowed_symbol, std::size_t threads = 1, const std::string &seed_vocab_filename = std::string());
 
     void Run(const util::stream::ChainPosition &position);
 
@@ -40,12 +46,51 @@ class CorpusCount {
     uint64_t &token_count_;
     WordIndex &type_count_;
     std::vector<bool>& prune_words_;
-    const std::string& prune_vocab_filename_;
+    const std::string prune_vocab_filename_;
+    const std::string seed_vocab_filename_;
 
     std::size_t dedupe_mem_size_;
     util::scoped_malloc dedupe_mem_;
 
     WarningAction disallowed_symbol_action_;
+
+    std::size_t threads_;
+};
+
+/* Reads n-grams of the highest order that were counted elsewhere instead of
+ * counting text, with the same output and memory usage as CorpusCount.  The
+ * n-grams are those lmplz would count: sentences begin with <s> and end with
+ * </s>, and n-grams at the start of a sentence may be shorter, beginning with
+ * <s>, in which case they are padded with <s>.  <unk> is not allowed.  The
+ * same n-gram may appear more than once; its counts are summed.
+ */
+class CountsInput {
+  public:
+    // file: counts, which this takes ownership of.  If binary_vocab_filename
+    // is empty, these are text, one n-gram per line with its words, a tab, and
+    // the count.  Text is parsed on threads as CorpusCount does.  Otherwise
+    // they are binary records of order word ids and a 64-bit count, as
+    // dump_counts reads, with the vocabulary in binary_vocab_filename.
+    // Other arguments are as for CorpusCount.  A seed vocabulary only works
+    // with text.
+    CountsInput(int file, const std::string &binary_vocab_filename, int vocab_write, uint64_t &token_count, WordIndex &type_count, std::vector<bool> &prune_words, const std::string &prune_vocab_filename, std::size_t entries_per_block, std::size_t threads = 1, const std::string &seed_vocab_filename = std::string());
+
+    void Run(const util::stream::ChainPosition &position);
+
+  private:
+    util::scoped_fd file_;
+    const std::string binary_vocab_filename_;
+    int vocab_write_;
+    uint64_t &token_count_;
+    WordIndex &type_count_;
+    std::vector<bool> &prune_words_;
+    const std::string prune_vocab_filename_;
+    const std::string seed_vocab_filename_;
+
+    std::size_t dedupe_mem_size_;
+    util::scoped_malloc dedupe_mem_;
+
+    std::size_t threads_;
 };
 
 } // namespace builder
@@ -13,6 +13,11 @@
 #define BOOST_TEST_MODULE CorpusCountTest
 #include <boost/test/unit_test.hpp>
 
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
 namespace lm { namespace builder { namespace {
 
 #define Check(str, cnt) { \
@@ -76,4 +81,70 @@ BOOST_AUTO_TEST_CASE(Short) {
   BOOST_CHECK_EQUAL(sizeof(v) / sizeof(const char*), type_count);
 }
 
+typedef std::map<std::vector<WordIndex>, uint64_t> Counts;
+
+// Each block should be deduped, but blocks overlap, so add up counts like the sort does.
+void CountThreaded(const std::string &input, std::size_t threads, Counts &counts, std::string &vocab_words, uint64_t &token_count, WordIndex &type_count) {
+  util::scoped_fd input_file(util::MakeTemp("corpus_count_test_temp"));
+  util::WriteOrThrow(input_file.get(), input.data(), input.size());
+  util::SeekOrThrow(input_file.get(), 0);
+  util::FilePiece input_piece(input_file.release(), "temp file");
+
+  util::stream::ChainConfig config;
+  config.entry_size = NGram<BuildingPayload>::TotalSize(3);
+  config.total_memory = config.entry_size * 1000;
+  config.block_count = 2;
+
+  util::scoped_fd vocab(util::MakeTemp("corpus_count_test_vocab"));
+  util::stream::Chain chain(config);
+  type_count = 10;
+  std::vector<bool> prune_words;
+  CorpusCount counter(input_piece, vocab.get(), token_count, type_count, prune_words, "", chain.BlockSize() / chain.EntrySize(), SILENT, threads);
+  chain >> boost::ref(counter);
+  util::stream::ChainPosition position(chain.Add());
+  chain >> util::stream::kRecycle;
+  for (util::stream::Link link(position); link; ++link) {
+    // The sort does not combine within a single block.
+    Counts block;
+    for (NGram<BuildingPayload> gram(link->Get(), 3); gram.Base() != link->ValidEnd(); gram.NextInMemory()) {
+      BOOST_REQUIRE(block.insert(std::make_pair(std::vector<WordIndex>(gram.begin(), gram.end()), gram.Value().count)).second);
+      counts[std::vector<WordIndex>(gram.begin(), gram.end())] += gram.Value().count;
+    }
+  }
+  // The vocabulary is flushed when CorpusCount's thread finishes, after poison.
+  chain.Wait();
+
+  vocab_words.resize(util::SizeOrThrow(vocab.get()));
+  util::SeekOrThrow(vocab.get(), 0);
+  util::ReadOrThrow(vocab.get(), &vocab_words[0], vocab_words.size());
+}
+
+BOOST_AUTO_TEST_CASE(ThreadsMatch) {
+  // Several chunks of text, with <s> appearing to be skipped.
+  std::ostringstream input;
+  uint32_t state = 1;
+  for (unsigned int line = 0; line < 40000; ++line) {
+    state = state * 1103515245 + 12345;
+    for (unsigned int i = (state >> 16) % 15; i; --i) {
+      state = state * 1103515245 + 12345;
+      unsigned int value = (state >> 16) % 3000;
+      input << 'w' << (value * value / 3000) << ' ';
+    }
+    if (line % 1000 == 7) input << "<s>";
+    input << '\n';
+  }
+
+  Counts single, threaded;
+  std::string single_vocab, threaded_vocab;
+  uint64_t single_tokens, threaded_tokens;
+  WordIndex single_types, threaded_types;
+  CountThreaded(input.str(), 1, single, single_vocab, single_tokens, single_types);
+  CountThreaded(input.str(), 3, threaded, threaded_vocab, threaded_tokens, threaded_types);
+  BOOST_CHECK_EQUAL(single_tokens, threaded_tokens);
+  BOOST_CHECK_EQUAL(single_types, threaded_types);
+  BOOST_CHECK(single_vocab == threaded_vocab);
+  BOOST_CHECK_EQUAL(single.size(), threaded.size());
+  BOOST_CHECK(single == threaded);
+}
+
 }}} // namespaces
@@ -4,6 +4,7 @@
 #include "lm/lm_exception.hh"
 #include "util/file.hh"
 #include "util/file_piece.hh"
+#include "util/read_compressed.hh"
 #include "util/usage.hh"
 
 #include <iostream>
@@ -64,6 +65,15 @@ lm::builder::Discount ParseDiscountFallback(const std::vector<std::string> &para
   return ret;
 }
 
+lm::ngram::ModelType ParseBinaryType(const std::string &name) {
+  if (name == "probing") return lm::ngram::PROBING;
+  if (name == "trie") return lm::ngram::TRIE;
+  if (name == "quant_trie") return lm::ngram::QUANT_TRIE;
+  if (name == "array_trie") return lm::ngram::ARRAY_TRIE;
+  if (name == "quant_array_trie") return lm::ngram::QUANT_ARRAY_TRIE;
+  UTIL_THROW(util::Exception, "Unknown binary type " << name << ".  Use probing, trie, quant_trie, array_trie, or quant_array_trie.");
+}
+
 } // namespace
 
 int main(int argc, char *argv[]) {
@@ -72,7 +82,7 @@ int main(int argc, char *argv[]) {
     po::options_description options("Language model building options");
     lm::builder::PipelineConfig pipeline;
 
-    std::string text, intermediate, arpa;
+    std::string text, intermediate, arpa, binary, binary_type;
     std::vector<std::string> pruning;
     std::vector<std::string> discount_fallback;
     std::vector<std::string> discount_fallback_default;
@@ -94,14 +104,27 @@ int main(int argc, char *argv[]) {
       ("memory,S", lm:: SizeOption(pipeline.sort.total_memory, util::GuessPhysicalMemory() ? "80%" : "1G"), "Sorting memory")
       ("minimum_block", lm::SizeOption(pipeline.minimum_block, "8K"), "Minimum block size to allow")
       ("sort_block", lm::SizeOption(pipeline.sort.buffer_size, "64M"), "Size of IO operations for sort (determines arity)")
+      ("sort_threads", po::value<std::size_t>(&pipeline.sort.threads)->default_value(1), "Threads for each sort to sort blocks and merge with")
+      ("compress_spills", po::bool_switch(&pipeline.sort.compress), "Compress sorted runs in temporary files.  Uses less disk and I/O for more CPU.  Merges of compressed runs use one thread.  Requires zlib.")
+      ("lazy_without_merge", po::bool_switch(&pipeline.lazy_without_merge), "Before adjusting counts, give the last merge of the counts enough memory to skip a merge pass, if it fits.  This can leave smaller blocks for the chains that follow.")
       ("block_count", po::value<std::size_t>(&pipeline.block_count)->default_value(2), "Block count (per order)")
+      ("count_threads", po::value<std::size_t>(&pipeline.count_threads)->default_value(1), "Threads for tokenizing and counting n-grams in step 1.  Each needs its own deduplication table and two blocks of memory.")
       ("vocab_estimate", po::value<lm::WordIndex>(&pipeline.vocab_estimate)->default_value(1000000), "Assume this vocabulary size for purposes of calculating memory in step 1 (corpus count) and pre-sizing the hash table")
       ("vocab_pad", po::value<uint64_t>(&pipeline.vocab_size_for_unk)->default_value(0), "If the vocabulary is smaller than this value, pad with <unk> to reach this size. Requires --interpolate_unigrams")
       ("verbose_header", po::bool_switch(&verbose_header), "Add a verbose header to the ARPA file that includes information such as token count, smoothing type, etc.")
       ("text", po::value<std::string>(&text), "Read text from a file instead of stdin")
       ("arpa", po::value<std::string>(&arpa), "Write ARPA to a file instead of stdout")
       ("intermediate", po::value<std::string>(&intermediate), "Write ngrams to intermediate files.  Turns off ARPA output (which can be reactivated by --arpa file).  Forces --renumber on.")
+      ("binary", po::value<std::string>(&binary), "Write a binary model for the query tools to a file directly.  Turns off ARPA output (which can be reactivated by --arpa file).")
+      ("binary_type", po::value<std::string>(&binary_type)->default_value("probing"), "Data structure for --binary: probing, trie, quant_trie, array_trie, or quant_array_trie.  Quantization uses 8 bits.")
       ("renumber", po::bool_switch(&pipeline.renumber_vocabulary), "Rrenumber the vocabulary identifiers so that they are monotone with the hash of each string.  This is consistent with the ordering used by the trie data structure.")
+      ("shards", po::value<unsigned int>(&pipeline.shards)->default_value(1), "Estimate in this many worker processes, partitioning n-grams by the hash of a word.  Each gets an equal share of the memory and they exchange files in the temporary directory.  Not compatible with --renumber or --intermediate.")
+      ("checkpoint", po::bool_switch(&pipeline.checkpoint), "Save the output of each finished stage in the temporary directory so --resume can pick up after an interruption.  The files stay there until a later run with --checkpoint starts over.  The text must be a file given with --text.  Not compatible with --shards, --renumber, or --intermediate.")
+      ("resume", po::bool_switch(&pipeline.resume), "Skip the stages finished by an earlier run with --checkpoint on the same text and settings.  Implies --checkpoint.")
+      ("save_counts", po::value<std::string>(&pipeline.save_counts), "Save the raw counts of the highest order to this file and the vocabulary to the file with .vocab appended, as dump_counts reads them, so a later build can add to them with --add_counts.  Not compatible with --shards.")
+      ("add_counts", po::value<std::string>(&pipeline.add_counts), "Add counts saved with --save_counts by an earlier build of the same order.  Only the new text is counted.  Not compatible with --shards.")
+      ("counts", po::bool_switch(&pipeline.read_counts), "The input, from --text or stdin, is n-grams of the highest order counted elsewhere instead of text, skipping the tokenization pass.  Each line has the words, a tab, and the count.  N-grams at the start of a sentence may be shorter and begin with <s>, which is added until they have the full order.  Repeated n-grams are summed.  <unk> is not allowed.")
+      ("counts_vocab", po::value<std::string>(&pipeline.counts_vocab), "The counts are binary records, as --save_counts writes and dump_counts reads, with this vocabulary.  Implies --counts.  Not compatible with --add_counts.")
       ("collapse_values", po::bool_switch(&pipeline.output_q), "Collapse probability and backoff into a single value, q that yields the same sentence-level probabilities.  See http://kheafield.com/professional/edinburgh/rest_paper.pdf for more details, including a proof.")
       ("prune", po::value<std::vector<std::string> >(&pruning)->multitoken(), "Prune n-grams with count less than or equal to the given threshold.  Specify one value for each order i.e. 0 0 1 to prune singleton trigrams and above.  The sequence of values must be non-decreasing and the last value applies to any remaining orders. Default is to not prune, which is equivalent to --prune 0.")
       ("limit_vocab_file", po::value<std::string>(&pipeline.prune_vocab_file)->default_value(""), "Read allowed vocabulary separated by whitespace. N-grams that contain vocabulary items not in this list will be pruned. Can be combined with --prune arg")
@@ -148,6 +171,11 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    if (pipeline.sort.compress && !util::GZipAvailable()) {
+      std::cerr << "--compress_spills requires zlib, which was not compiled in" << std::endl;
+      return 1;
+    }
+
     if (pipeline.vocab_size_for_unk && !pipeline.initial_probs.interpolate_unigrams) {
       std::cerr << "--vocab_pad requires --interpolate_unigrams be on" << std::endl;
       return 1;
@@ -180,6 +208,9 @@ int main(int argc, char *argv[]) {
 
     util::NormalizeTempPrefix(pipeline.sort.temp_prefix);
 
+    if (pipeline.resume) pipeline.checkpoint = true;
+    if (!pipeline.counts_vocab.empty()) pipeline.read_counts = true;
+
     lm::builder::InitialProbabilitiesConfig &initial = pipeline.initial_probs;
     // TODO: evaluate options for these.
     initial.adder_in.total_memory = 32768;
@@ -202,10 +233,19 @@ int main(int argc, char *argv[]) {
       if (writing_intermediate) {
         pipeline.renumber_vocabulary = true;
       }
+      bool writing_binary = vm.count("binary");
       lm::builder::Output output(writing_intermediate ? intermediate : pipeline.sort.temp_prefix, writing_intermediate, pipeline.output_q);
-      if (!writing_intermediate || vm.count("arpa")) {
+      if ((!writing_intermediate && !writing_binary) || vm.count("arpa")) {
         output.Add(new lm::builder::PrintHook(out.release(), verbose_header));
       }
+      if (writing_binary) {
+        lm::ngram::ModelType model_type = ParseBinaryType(binary_type);
+        lm::ngram::Config config;
+        config.temporary_directory_prefix = pipeline.sort.temp_prefix;
+        // Same as build_binary.
+        config.write_method = (model_type == lm::ngram::PROBING) ? lm::ngram::Config::WRITE_AFTER : lm::ngram::Config::WRITE_MMAP;
+        output.Add(new lm::builder::BinaryHook(binary, model_type, config));
+      }
       lm::builder::Pipeline(pipeline, in.release(), output);
     } catch (const util::MallocException &e) {
       std::cerr << e.what() << std::endl;
@@ -1,10 +1,17 @@
 #include "lm/builder/output.hh"
 
 #include "lm/common/model_buffer.hh"
+#include "lm/common/ngram.hh"
 #include "lm/common/print.hh"
+#include "lm/model.hh"
+#include "lm/ngram_source.hh"
 #include "util/fake_ofstream.hh"
 #include "util/stream/multi_stream.hh"
+#include "util/stream/stream.hh"
 
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
 #include <iostream>
 
 namespace lm { namespace builder {
@@ -25,7 +32,7 @@ void Output::SinkProbs(util::stream::Chains &chains) {
   chains >> util::stream::kRecycle;
   chains.Wait(false);
   if (Have(PROB_SEQUENTIAL_HOOK)) {
-    std::cerr << "=== 5/5 Writing ARPA model ===" << std::endl;
+    std::cerr << "=== 5/5 Writing model ===" << std::endl;
     buffer_.Source(chains);
     Apply(PROB_SEQUENTIAL_HOOK, chains);
     chains >> util::stream::kRecycle;
@@ -49,4 +56,112 @@ void PrintHook::Sink(const HeaderInfo &info, int vocab_file, util::stream::Chain
   chains >> PrintARPA(vocab_file, file_.get(), info.counts_pruned);
 }
 
+namespace {
+
+// Presents the sequential chains to the model builder as they would be read
+// from ARPA.  Unigrams are in vocabulary id order.
+class ChainSource : public NGramSource {
+  public:
+    ChainSource(int vocab_file, const std::vector<uint64_t> &counts, const util::stream::ChainPositions &positions)
+      : vocab_(vocab_file), counts_(counts), positions_(positions), order_(0), read_(0) {}
+
+    void ReadCounts(std::vector<uint64_t> &counts) {
+      counts = counts_;
+    }
+
+    void BeginOrder(unsigned int n) {
+      FinishOrder();
+      order_ = n;
+      stream_.reset(new util::stream::Stream(positions_[n - 1]));
+    }
+
+    void Read(WordIndex *ids, float &prob, float &backoff) {
+      UTIL_THROW_IF(!*stream_, util::Exception, "Ran out of " << order_ << "-grams after " << read_ << " n-grams.");
+      if (order_ == positions_.size()) {
+        NGram<Prob> gram(stream_->Get(), order_);
+        std::copy(gram.begin(), gram.end(), ids);
+        prob = gram.Value().prob;
+      } else {
+        NGram<ProbBackoff> gram(stream_->Get(), order_);
+        std::copy(gram.begin(), gram.end(), ids);
+        prob = gram.Value().prob;
+        backoff = gram.Value().backoff;
+      }
+      ++*stream_;
+      ++read_;
+    }
+
+    void ReadEnd() {
+      FinishOrder();
+      UTIL_THROW_IF(order_ != positions_.size(), util::Exception, "Stopped at order " << order_ << " of " << positions_.size());
+    }
+
+    StringPiece Word(WordIndex id) const {
+      UTIL_THROW_IF(id >= vocab_.Size(), util::Exception, "Word id " << id << " is not in the vocabulary of size " << vocab_.Size());
+      return vocab_.LookupPiece(id);
+    }
+
+    uint64_t Offset() const { return read_; }
+
+  private:
+    void FinishOrder() {
+      UTIL_THROW_IF(stream_.get() && *stream_, util::Exception, "More " << order_ << "-grams than the " << counts_[order_ - 1] << " counted.");
+    }
+
+    VocabReconstitute vocab_;
+    const std::vector<uint64_t> &counts_;
+    const util::stream::ChainPositions &positions_;
+
+    boost::scoped_ptr<util::stream::Stream> stream_;
+    unsigned int order_;
+    uint64_t read_;
+};
+
+class WriteBinary {
+  public:
+    WriteBinary(int vocab_file, const std::vector<uint64_t> &counts, ngram::ModelType model_type, const ngram::Config &config)
+      : vocab_file_(vocab_file), counts_(counts), model_type_(model_type), config_(config) {}
+
+    void Run(const util::stream::ChainPositions &positions) {
+      ChainSource source(vocab_file_, counts_, positions);
+      switch (model_type_) {
+        case ngram::PROBING:
+          ngram::ProbingModel(source, config_);
+          break;
+        case ngram::TRIE:
+          ngram::TrieModel(source, config_);
+          break;
+        case ngram::QUANT_TRIE:
+          ngram::QuantTrieModel(source, config_);
+          break;
+        case ngram::ARRAY_TRIE:
+          ngram::ArrayTrieModel(source, config_);
+          break;
+        case ngram::QUANT_ARRAY_TRIE:
+          ngram::QuantArrayTrieModel(source, config_);
+          break;
+        default:
+          UTIL_THROW(util::Exception, "Cannot build model type " << model_type_ << " from lmplz.");
+      }
+    }
+
+  private:
+    int vocab_file_;
+    std::vector<uint64_t> counts_;
+    ngram::ModelType model_type_;
+    ngram::Config config_;
+};
+
+} // namespace
+
+BinaryHook::BinaryHook(const std::string &file, ngram::ModelType model_type, const ngram::Config &config)
+  : OutputHook(PROB_SEQUENTIAL_HOOK), file_(file), model_type_(model_type), config_(config) {
+  UTIL_THROW_IF(model_type_ != ngram::PROBING && model_type_ != ngram::TRIE && model_type_ != ngram::QUANT_TRIE && model_type_ != ngram::ARRAY_TRIE && model_type_ != ngram::QUANT_ARRAY_TRIE, util::Exception, "Cannot build model type " << model_type_ << " from lmplz.");
+  config_.write_mmap = file_.c_str();
+}
+
+void BinaryHook::Sink(const HeaderInfo &info, int vocab_file, util::stream::Chains &chains) {
+  chains >> WriteBinary(vocab_file, info.counts_pruned, model_type_, config_);
+}
+
 }} // namespaces
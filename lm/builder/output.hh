@@ -3,11 +3,15 @@
 
 #include "lm/builder/header_info.hh"
 #include "lm/common/model_buffer.hh"
+#include "lm/config.hh"
+#include "lm/model_type.hh"
 #include "util/file.hh"
 
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/utility.hpp>
 
+#include <string>
+
 namespace util { namespace stream { class Chains; class ChainPositions; } }
 
 /* Outputs from lmplz: ARPA, sharded files, etc */
@@ -80,6 +84,21 @@ class PrintHook : public OutputHook {
     bool verbose_header_;
 };
 
+// Builds a binary model straight from the estimated n-grams, skipping ARPA.
+class BinaryHook : public OutputHook {
+  public:
+    // Writes to file, overriding config.write_mmap.  model_type is one of
+    // PROBING, TRIE, QUANT_TRIE, ARRAY_TRIE, or QUANT_ARRAY_TRIE.
+    BinaryHook(const std::string &file, ngram::ModelType model_type, const ngram::Config &config);
+
+    void Sink(const HeaderInfo &info, int vocab_file, util::stream::Chains &chains);
+
+  private:
+    std::string file_;
+    ngram::ModelType model_type_;
+    ngram::Config config_;
+};
+
 }} // namespaces
 
 #endif // LM_BUILDER_OUTPUT_H
@@ -0,0 +1,84 @@
+#include "lm/builder/output.hh"
+
+#include "lm/binary_format.hh"
+#include "lm/builder/pipeline_test_fixture.hh"
+#include "lm/model.hh"
+#include "util/file.hh"
+#include "util/scoped.hh"
+
+#define BOOST_TEST_MODULE OutputTest
+#include <boost/test/unit_test.hpp>
+
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+namespace lm { namespace builder { namespace {
+
+const char kArpa[] = "output_test_arpa";
+const char kBinary[] = "output_test_binary";
+
+// Run lmplz once with both ARPA and --binary output, as lmplz_main does.
+void EstimateBoth(const std::string &corpus, ngram::ModelType model_type) {
+  PipelineConfig config(MakeConfig("output_test_"));
+  util::scoped_fd text(util::MakeTemp(config.TempPrefix() + "text"));
+  util::WriteOrThrow(text.get(), corpus.data(), corpus.size());
+  util::SeekOrThrow(text.get(), 0);
+
+  Output output(config.TempPrefix(), false, false);
+  output.Add(new PrintHook(util::CreateOrThrow(kArpa), false));
+  ngram::Config binary_config;
+  binary_config.temporary_directory_prefix = config.TempPrefix();
+  binary_config.write_method = (model_type == ngram::PROBING) ? ngram::Config::WRITE_AFTER : ngram::Config::WRITE_MMAP;
+  output.Add(new BinaryHook(kBinary, model_type, binary_config));
+  Pipeline(config, text.release(), output);
+}
+
+// Score every word of the corpus and the end of each sentence in both models.
+template <class Model> void CheckSameScores(const std::string &corpus, const Model &from_arpa, const Model &from_binary) {
+  BOOST_REQUIRE_EQUAL(from_arpa.GetVocabulary().Bound(), from_binary.GetVocabulary().Bound());
+  // Unseen words too.
+  std::istringstream lines(corpus + "unseen w0 also_unseen\n");
+  for (std::string line; std::getline(lines, line);) {
+    ngram::State arpa_state(from_arpa.BeginSentenceState()), binary_state(from_binary.BeginSentenceState()), out_state;
+    std::istringstream words(line);
+    std::string word;
+    bool end = false;
+    while (!end) {
+      end = !(words >> word);
+      if (end) word = "</s>";
+      FullScoreReturn arpa_ret(from_arpa.FullScore(arpa_state, from_arpa.GetVocabulary().Index(word), out_state));
+      arpa_state = out_state;
+      FullScoreReturn binary_ret(from_binary.FullScore(binary_state, from_binary.GetVocabulary().Index(word), out_state));
+      binary_state = out_state;
+      BOOST_REQUIRE_EQUAL(arpa_ret.prob, binary_ret.prob);
+      BOOST_REQUIRE_EQUAL(arpa_ret.ngram_length, binary_ret.ngram_length);
+      BOOST_REQUIRE_EQUAL(arpa_state.Length(), binary_state.Length());
+    }
+  }
+}
+
+template <class Model> void CheckBinary(ngram::ModelType model_type) {
+  const std::string corpus(MakeCorpus(12345, 2000));
+  EstimateBoth(corpus, model_type);
+  ngram::ModelType recognized;
+  BOOST_REQUIRE(ngram::RecognizeBinary(kBinary, recognized));
+  BOOST_CHECK_EQUAL(model_type, recognized);
+  {
+    Model from_arpa(kArpa), from_binary(kBinary);
+    CheckSameScores(corpus, from_arpa, from_binary);
+  }
+  unlink(kArpa);
+  unlink(kBinary);
+}
+
+BOOST_AUTO_TEST_CASE(BinaryProbing) {
+  CheckBinary<ngram::ProbingModel>(ngram::PROBING);
+}
+
+BOOST_AUTO_TEST_CASE(BinaryTrie) {
+  CheckBinary<ngram::TrieModel>(ngram::TRIE);
+}
+
+}}} // namespaces
@@ -1,12 +1,14 @@
 #include "lm/builder/pipeline.hh"
 
 #include "lm/builder/adjust_counts.hh"
+#include "lm/builder/checkpoint.hh"
 #include "lm/builder/combine_counts.hh"
 #include "lm/builder/corpus_count.hh"
 #include "lm/builder/hash_gamma.hh"
 #include "lm/builder/initial_probabilities.hh"
 #include "lm/builder/interpolate.hh"
 #include "lm/builder/output.hh"
+#include "lm/builder/shard.hh"
 #include "lm/common/compare.hh"
 #include "lm/common/renumber.hh"
 
@@ -15,19 +17,53 @@
 
 #include "util/exception.hh"
 #include "util/file.hh"
+#include "util/fixed_array.hh"
 #include "util/stream/io.hh"
+#include "util/stream/stream.hh"
+#include "util/usage.hh"
 
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
 namespace lm { namespace builder {
 
 using util::stream::Sorts;
 
 namespace {
 
+// Whether name is the file open as fd.
+bool SameFile(int fd, const std::string &name) {
+  struct stat open_info, named_info;
+  if (fstat(fd, &open_info) || stat(name.c_str(), &named_info)) return false;
+  return open_info.st_dev == named_info.st_dev && open_info.st_ino == named_info.st_ino;
+}
+
+// Tokens in the n-grams of the highest order, which end at each token or </s>.
+class CountTokens {
+  public:
+    explicit CountTokens(uint64_t &tokens) : tokens_(tokens) {}
+
+    void Run(const util::stream::ChainPosition &position) {
+      const std::size_t order = NGram<BuildingPayload>::OrderFromSize(position.GetChain().EntrySize());
+      uint64_t tokens = 0;
+      for (util::stream::Stream stream(position); stream; ++stream) {
+        NGram<BuildingPayload> gram(stream.Get(), order);
+        if (*(gram.end() - 1) != kEOS) tokens += gram.Value().count;
+      }
+      tokens_ = tokens;
+    }
+
+  private:
+    uint64_t &tokens_;
+};
+
 void PrintStatistics(const std::vector<uint64_t> &counts, const std::vector<uint64_t> &counts_pruned, const std::vector<Discount> &discounts) {
   std::cerr << "Statistics:\n";
   for (size_t i = 0; i < counts.size(); ++i) {
@@ -41,15 +77,138 @@ void PrintStatistics(const std::vector<uint64_t> &counts, const std::vector<uint
   }
 }
 
+/* Accounts for the memory each stage hands out under -S and decides how it is
+ * spent on merging.  Merges run before chains are allocated, so they get all
+ * of -S; what's left to decide is the size of merge reads, where smaller reads
+ * mean higher arity, and lazy memory, which can save a pass over the data
+ * when it holds every remaining stripe.  Report shows the most memory handed
+ * out at once, which is not measured usage, merge passes, and time by stage.
+ */
+class MemoryGovernor {
+  public:
+    MemoryGovernor(std::size_t total, bool lazy_without_merge) : total_(total), lazy_without_merge_(lazy_without_merge), ended_(0) {}
+
+    // Merges may read as little as an eighth of the sort block to save a pass.
+    static std::size_t MinMergeBuffer(const PipelineConfig &config) {
+      return std::max(config.minimum_block, config.sort.buffer_size / 8);
+    }
+
+    void BeginStage(const std::string &name) {
+      EndStage();
+      Stage stage;
+      stage.name = name;
+      stage.chains = stage.lazy = stage.other = stage.peak = 0;
+      stage.passes = 0;
+      stage.seconds = util::WallTime();
+      stages_.push_back(stage);
+    }
+
+    // Accounting outside a stage, as in shard processes, is ignored.
+
+    // Memory held by the stage's chains, replacing earlier chains.
+    void Chains(std::size_t bytes) {
+      if (stages_.empty()) return;
+      stages_.back().chains = bytes;
+      Update();
+    }
+    // Memory held by lazy merges feeding the chains.
+    void Lazy(std::size_t bytes) {
+      if (stages_.empty()) return;
+      stages_.back().lazy = bytes;
+      Update();
+    }
+    // Anything else: vocabulary, second readers.
+    void Other(std::size_t bytes) {
+      if (stages_.empty()) return;
+      stages_.back().other = bytes;
+      Update();
+    }
+
+    // Everything was released.
+    void Free() {
+      if (stages_.empty()) return;
+      stages_.back().chains = stages_.back().lazy = stages_.back().other = 0;
+    }
+
+    void Passes(unsigned int passes) {
+      if (!stages_.empty()) stages_.back().passes += passes;
+    }
+
+    // Lazy memory for sort with at most available to spare.  This is the
+    // trade off Sort suggests unless asked to give it enough to skip merging.
+    template <class Sort> std::size_t LazyFor(const Sort &sort, std::size_t available) const {
+      if (lazy_without_merge_) {
+        const std::size_t without = sort.LazyWithoutMerge();
+        if (without <= available) return without;
+      }
+      return std::min(available, sort.DefaultLazy());
+    }
+
+    void Report(std::ostream &out) {
+      EndStage();
+      out << "Memory and time by stage:\n";
+      for (std::vector<Stage>::const_iterator i = stages_.begin(); i != stages_.end(); ++i) {
+        out << i->name << ": ";
+        if (i->peak) out << "allocated at most " << i->peak << " of " << total_ << " bytes, ";
+        out << i->passes << " merge passes, " << i->seconds << " s\n";
+      }
+      out << std::flush;
+    }
+
+  private:
+    struct Stage {
+      std::string name;
+      std::size_t chains, lazy, other, peak;
+      unsigned int passes;
+      // Start time until the stage ends.
+      double seconds;
+    };
+
+    void Update() {
+      Stage &stage = stages_.back();
+      stage.peak = std::max(stage.peak, stage.chains + stage.lazy + stage.other);
+    }
+
+    void EndStage() {
+      if (stages_.empty() || ended_ == stages_.size()) return;
+      stages_.back().seconds = util::WallTime() - stages_.back().seconds;
+      ended_ = stages_.size();
+    }
+
+    const std::size_t total_;
+    const bool lazy_without_merge_;
+    std::vector<Stage> stages_;
+    std::size_t ended_;
+};
+
 class Master {
   public:
     explicit Master(PipelineConfig &config, unsigned output_steps)
-      : config_(config), chains_(config.order), unigrams_(util::MakeTemp(config_.TempPrefix())), steps_(output_steps + 4) {
+      : config_(config), chains_(config.order), unigrams_(util::MakeTemp(config_.TempPrefix())), steps_(output_steps + 4), governor_(config.TotalMemory(), config.lazy_without_merge) {
       config_.minimum_block = std::max(NGram<BuildingPayload>::TotalSize(config_.order), config_.minimum_block);
+      config_.sort.min_merge_buffer = MemoryGovernor::MinMergeBuffer(config_);
     }
 
     const PipelineConfig &Config() const { return config_; }
 
+    MemoryGovernor &Governor() { return governor_; }
+
+    // Print the stage banner and start accounting for it.
+    void BeginStage(unsigned int number, const char *name) {
+      std::cerr << "=== " << number << '/' << steps_ << ' ' << name << " ===" << std::endl;
+      std::ostringstream label;
+      label << number << '/' << steps_ << ' ' << name;
+      governor_.BeginStage(label.str());
+    }
+
+    // Merge, counting passes for the report.
+    template <class Sort> std::size_t Merge(Sort &sort, std::size_t lazy_memory) {
+      const unsigned int before = sort.MergePasses();
+      const std::size_t ret = sort.Merge(lazy_memory);
+      governor_.Passes(sort.MergePasses() - before);
+      return ret;
+    }
+
     util::stream::Chains &MutableChains() { return chains_; }
 
     template <class T> Master &operator>>(const T &worker) {
@@ -66,21 +225,40 @@ class Master {
       // Prevent overflow in subtracting.
       const std::size_t total = std::max<std::size_t>(config_.TotalMemory(), min_chains + subtract_for_numbering + config_.minimum_block);
       // Do merge sort with calculated laziness.
-      const std::size_t merge_using = ngrams.Merge(std::min(total - min_chains - subtract_for_numbering, ngrams.DefaultLazy()));
+      const std::size_t merge_using = Merge(ngrams, governor_.LazyFor(ngrams, total - min_chains - subtract_for_numbering));
+      governor_.Lazy(merge_using);
+      governor_.Other(subtract_for_numbering);
 
       std::vector<uint64_t> count_bounds(1, types);
       CreateChains(total - merge_using - subtract_for_numbering, count_bounds);
       ngrams.Output(chains_.back(), merge_using);
     }
 
-    // For initial probabilities, but this is generic.
-    void SortAndReadTwice(const std::vector<uint64_t> &counts, Sorts<ContextOrder> &sorts, util::stream::Chains &second, util::stream::ChainConfig second_config) {
-      bool unigrams_are_sorted = !config_.renumber_vocabulary;
-      // Do merge first before allocating chain memory.
-      for (std::size_t i = 0; i < config_.order - unigrams_are_sorted; ++i) {
-        sorts[i].Merge(0);
+    // Same, but the n-grams are in files, each completely merged, so the
+    // chains get all the memory.  Counts of the same n-gram in different
+    // files are summed.  Takes ownership.
+    void InitForAdjust(const std::vector<int> &counts_files, WordIndex types) {
+      std::vector<uint64_t> count_bounds(1, types);
+      CreateChains(config_.TotalMemory(), count_bounds);
+      chains_.back() >> MergeSuffixFiles(counts_files, true);
+    }
+
+    // Merge each sort all the way and take its file.  The caller owns them.
+    template <class Compare> void StealCompleted(Sorts<Compare> &sorts, std::vector<int> &files) {
+      files.clear();
+      for (std::size_t i = 0; i < sorts.size(); ++i) {
+        Merge(sorts[i], 0);
+        files.push_back(sorts[i].StealCompleted());
       }
+    }
+
+    // For initial probabilities, but this is generic.  files are sorted in
+    // context order, starting with unigrams if they were sorted.  Takes
+    // ownership.
+    void ReadTwice(const std::vector<uint64_t> &counts, const std::vector<int> &files, util::stream::Chains &second, util::stream::ChainConfig second_config) {
+      bool unigrams_are_sorted = !config_.renumber_vocabulary;
       // There's no lazy merge, so just divide memory amongst the chains.
+      governor_.Other(second_config.total_memory * config_.order);
       CreateChains(config_.TotalMemory(), counts);
       chains_.back().ActivateProgress();
       if (unigrams_are_sorted) {
@@ -90,7 +268,7 @@ class Master {
         second.back() >> unigrams_.Source();
       }
       for (std::size_t i = unigrams_are_sorted; i < config_.order; ++i) {
-        util::scoped_fd fd(sorts[i - unigrams_are_sorted].StealCompleted());
+        util::scoped_fd fd(files[i - unigrams_are_sorted]);
         chains_[i].SetProgressTarget(util::SizeOrThrow(fd.get()));
         chains_[i] >> util::stream::PRead(util::DupOrThrow(fd.get()), true);
         second_config.entry_size = NGram<BuildingPayload>::TotalSize(i + 1);
@@ -110,11 +288,16 @@ class Master {
       std::vector<std::size_t> laziness;
       // Prioritize longer n-grams.
       for (util::stream::Sort<SuffixOrder> *i = sorts.end() - 1; i >= sorts.begin(); --i) {
-        laziness.push_back(i->Merge(for_merge));
+        laziness.push_back(Merge(*i, for_merge));
         assert(for_merge >= laziness.back());
         for_merge -= laziness.back();
       }
       std::reverse(laziness.begin(), laziness.end());
+      std::size_t lazy_total = 0;
+      for (std::vector<std::size_t>::const_iterator i = laziness.begin(); i != laziness.end(); ++i) {
+        lazy_total += *i;
+      }
+      governor_.Lazy(lazy_total);
 
       CreateChains(for_merge + min_chains, counts);
       chains_.back().ActivateProgress();
@@ -124,6 +307,17 @@ class Master {
       }
     }
 
+    // Like MaximumLazyInput, but files are completed sorts above unigrams.
+    // Takes ownership.
+    void ReadInput(const std::vector<uint64_t> &counts, const std::vector<int> &files) {
+      CreateChains(config_.TotalMemory(), counts);
+      chains_.back().ActivateProgress();
+      chains_[0] >> unigrams_.Source();
+      for (std::size_t i = 1; i < config_.order; ++i) {
+        chains_[i] >> util::stream::PRead(files[i - 1], true);
+      }
+    }
+
     template <class Compare> void SetupSorts(Sorts<Compare> &sorts, bool exclude_unigrams) {
       sorts.Init(config_.order - exclude_unigrams);
       // Unigrams don't get sorted because their order is always the same.
@@ -132,11 +326,14 @@ class Master {
         sorts.push_back(chains_[i], config_.sort, Compare(i + 1));
       }
       chains_.Wait(true);
+      governor_.Free();
     }
 
     unsigned int Steps() const { return steps_; }
 
-  private:
+    // Unigrams, which skip sorting, as the last stage left them.
+    util::stream::FileBuffer &Unigrams() { return unigrams_; }
+
     // Create chains, allocating memory to them.  Totally heuristic.  Count
     // bounds are upper bounds on the counts or not present.
     void CreateChains(std::size_t remaining_mem, const std::vector<uint64_t> &count_bounds) {
@@ -190,16 +387,20 @@ class Master {
       }
       chains_.clear();
       std::cerr << "Chain sizes:";
+      std::size_t chain_memory = 0;
       for (std::size_t i = 0; i < config_.order; ++i) {
         // Always have enough for at least one record.
         // This was crashing if e.g. there was no 5-gram.
         assignments[i] = std::max(assignments[i], block_count[i] * NGram<BuildingPayload>::TotalSize(i + 1));
         std::cerr << ' ' << (i+1) << ":" << assignments[i];
         chains_.push_back(util::stream::ChainConfig(NGram<BuildingPayload>::TotalSize(i + 1), block_count[i], assignments[i]));
+        chain_memory += assignments[i];
       }
       std::cerr << std::endl;
+      governor_.Chains(chain_memory);
     }
 
+  private:
     PipelineConfig &config_;
 
     util::stream::Chains chains_;
@@ -207,11 +408,22 @@ class Master {
     util::stream::FileBuffer unigrams_;
 
     const unsigned int steps_;
+
+    MemoryGovernor governor_;
 };
 
+// Run counter, which is CorpusCount or CountsInput, on chain and sort the
+// n-grams it writes.
+template <class Counter> util::stream::Sort<SuffixOrder, CombineCounts> *SortCounted(util::stream::Chain &chain, Counter &counter, const PipelineConfig &config) {
+  chain >> boost::ref(counter);
+  util::scoped_ptr<util::stream::Sort<SuffixOrder, CombineCounts> > sorter(new util::stream::Sort<SuffixOrder, CombineCounts>(chain, config.sort, SuffixOrder(config.order), CombineCounts()));
+  chain.Wait(true);
+  return sorter.release();
+}
+
 util::stream::Sort<SuffixOrder, CombineCounts> *CountText(int text_file /* input */, int vocab_file /* output */, Master &master, uint64_t &token_count, WordIndex &type_count, std::string &text_file_name, std::vector<bool> &prune_words) {
   const PipelineConfig &config = master.Config();
-  std::cerr << "=== 1/" << master.Steps() << " Counting and sorting n-grams ===" << std::endl;
+  master.BeginStage(1, "Counting and sorting n-grams");
 
   const std::size_t vocab_usage = CorpusCount::VocabUsage(config.vocab_estimate);
   UTIL_THROW_IF(config.TotalMemory() < vocab_usage, util::Exception, "Vocab hash size estimate " << vocab_usage << " exceeds total memory " << config.TotalMemory());
@@ -219,54 +431,52 @@ util::stream::Sort<SuffixOrder, CombineCounts> *CountText(int text_file /* input
     // This much memory to work with after vocab hash table.
     static_cast<float>(config.TotalMemory() - vocab_usage) /
     // Solve for block size including the dedupe multiplier for one block.
-    (static_cast<float>(config.block_count) + CorpusCount::DedupeMultiplier(config.order)) *
+    (static_cast<float>(config.block_count) + CorpusCount::DedupeMultiplier(config.order, config.count_threads)) *
     // Chain likes memory expressed in terms of total memory.
     static_cast<float>(config.block_count);
   util::stream::Chain chain(util::stream::ChainConfig(NGram<BuildingPayload>::TotalSize(config.order), config.block_count, memory_for_chain));
+  master.Governor().Chains(memory_for_chain);
+  master.Governor().Other(vocab_usage + static_cast<std::size_t>(static_cast<float>(chain.BlockSize()) * CorpusCount::DedupeMultiplier(config.order, config.count_threads)));
 
   type_count = config.vocab_estimate;
-  util::FilePiece text(text_file, NULL, &std::cerr);
-  text_file_name = text.FileName();
-  CorpusCount counter(text, vocab_file, token_count, type_count, prune_words, config.prune_vocab_file, chain.BlockSize() / chain.EntrySize(), config.disallowed_symbol_action);
-  chain >> boost::ref(counter);
-
-  util::scoped_ptr<util::stream::Sort<SuffixOrder, CombineCounts> > sorter(new util::stream::Sort<SuffixOrder, CombineCounts>(chain, config.sort, SuffixOrder(config.order), CombineCounts()));
-  chain.Wait(true);
-  return sorter.release();
+  const std::string seed_vocab(config.add_counts.empty() ? std::string() : config.add_counts + ".vocab");
+  util::stream::Sort<SuffixOrder, CombineCounts> *sorter;
+  if (config.read_counts) {
+    text_file_name = util::NameFromFD(text_file);
+    CountsInput counter(text_file, config.counts_vocab, vocab_file, token_count, type_count, prune_words, config.prune_vocab_file, chain.BlockSize() / chain.EntrySize(), config.count_threads, seed_vocab);
+    sorter = SortCounted(chain, counter, config);
+  } else {
+    util::FilePiece text(text_file, NULL, &std::cerr);
+    text_file_name = text.FileName();
+    CorpusCount counter(text, vocab_file, token_count, type_count, prune_words, config.prune_vocab_file, chain.BlockSize() / chain.EntrySize(), config.disallowed_symbol_action, config.count_threads, seed_vocab);
+    sorter = SortCounted(chain, counter, config);
+  }
+  master.Governor().Free();
+  return sorter;
 }
 
-void InitialProbabilities(const std::vector<uint64_t> &counts, const std::vector<uint64_t> &counts_pruned, const std::vector<Discount> &discounts, Master &master, Sorts<SuffixOrder> &primary, util::FixedArray<util::stream::FileBuffer> &gammas, const std::vector<uint64_t> &prune_thresholds, bool prune_vocab, const SpecialVocab &specials) {
+// context: files sorted in context order, as from Master::StealCompleted.  Takes ownership.
+// gammas: a file for each order above unigrams, to receive backoffs.
+void InitialProbabilities(const std::vector<uint64_t> &counts_pruned, const std::vector<Discount> &discounts, Master &master, const std::vector<int> &context, Sorts<SuffixOrder> &primary, util::FixedArray<util::stream::FileBuffer> &gammas, const std::vector<uint64_t> &prune_thresholds, bool prune_vocab, const SpecialVocab &specials) {
   const PipelineConfig &config = master.Config();
   util::stream::Chains second(config.order);
-
-  {
-    Sorts<ContextOrder> sorts;
-    master.SetupSorts(sorts, !config.renumber_vocabulary);
-    PrintStatistics(counts, counts_pruned, discounts);
-    lm::ngram::ShowSizes(counts_pruned);
-    std::cerr << "=== 3/" << master.Steps() << " Calculating and sorting initial probabilities ===" << std::endl;
-    master.SortAndReadTwice(counts_pruned, sorts, second, config.initial_probs.adder_in);
-  }
+  master.ReadTwice(counts_pruned, context, second, config.initial_probs.adder_in);
 
   util::stream::Chains gamma_chains(config.order);
   InitialProbabilities(config.initial_probs, discounts, master.MutableChains(), second, gamma_chains, prune_thresholds, prune_vocab, specials);
   // Don't care about gamma for 0.
   gamma_chains[0] >> util::stream::kRecycle;
-  gammas.Init(config.order - 1);
   for (std::size_t i = 1; i < config.order; ++i) {
-    gammas.push_back(util::MakeTemp(config.TempPrefix()));
     gamma_chains[i] >> gammas[i - 1].Sink();
   }
   // Has to be done here due to gamma_chains scope.
   master.SetupSorts(primary, true);
 }
 
-void InterpolateProbabilities(const std::vector<uint64_t> &counts, Master &master, Sorts<SuffixOrder> &primary, util::FixedArray<util::stream::FileBuffer> &gammas, Output &output, const SpecialVocab &specials) {
-  std::cerr << "=== 4/" << master.Steps() << " Calculating and writing order-interpolated probabilities ===" << std::endl;
+// Attach Interpolate to the master's chains, reading backoffs from gammas
+// through gamma_chains, which must outlive the master's chains.
+void AttachInterpolate(const std::vector<uint64_t> &counts, Master &master, util::FixedArray<util::stream::FileBuffer> &gammas, util::stream::Chains &gamma_chains, const SpecialVocab &specials) {
   const PipelineConfig &config = master.Config();
-  master.MaximumLazyInput(counts, primary);
-
-  util::stream::Chains gamma_chains(config.order - 1);
   for (std::size_t i = 0; i < config.order - 1; ++i) {
     util::stream::ChainConfig read_backoffs(config.read_backoffs);
 
@@ -280,6 +490,12 @@ void InterpolateProbabilities(const std::vector<uint64_t> &counts, Master &maste
   }
   master >> Interpolate(std::max(master.Config().vocab_size_for_unk, counts[0] - 1 /* <s> is not included */), util::stream::ChainPositions(gamma_chains), config.prune_thresholds, config.prune_vocab, config.output_q, specials);
   gamma_chains >> util::stream::kRecycle;
+}
+
+// The master's chains must already read n-grams in suffix order.
+void InterpolateProbabilities(const std::vector<uint64_t> &counts, Master &master, util::FixedArray<util::stream::FileBuffer> &gammas, Output &output, const SpecialVocab &specials) {
+  util::stream::Chains gamma_chains(master.Config().order - 1);
+  AttachInterpolate(counts, master, gammas, gamma_chains, specials);
   output.SinkProbs(master.MutableChains());
 }
 
@@ -326,6 +542,257 @@ class VocabNumbering {
     SpecialVocab specials_;
 };
 
+/* Sharded estimation.  After counting, n-grams are partitioned by the hash of
+ * a word so that each shard has everything it needs for a step: the last word
+ * for adjusted counts and interpolation and the last word of the context for
+ * initial probabilities.  Each step runs all shards as separate processes
+ * that exchange files named by ShardFiles.  Only the adjusted count
+ * statistics and the unigrams, which every shard needs for the unigram
+ * probabilities, go through this process.
+ */
+
+// Stage A: adjust counts, then send unigrams to 'u' and higher orders to 'b'
+// partitioned by the last word of the context.  Statistics go to 's'.
+class ShardAdjust {
+  public:
+    ShardAdjust(const PipelineConfig &config, const ShardFiles &files, WordIndex types, const std::vector<bool> &prune_words)
+      : config_(config), files_(files), types_(types), prune_words_(prune_words) {}
+
+    void operator()(unsigned int shard) const {
+      PipelineConfig config(config_);
+      const unsigned int shards = files_.Shards();
+      util::FixedArray<util::scoped_fd> out(1 + (config.order - 1) * shards);
+      Master master(config, 0);
+      std::vector<uint64_t> count_bounds(1, types_);
+      master.CreateChains(config.TotalMemory(), count_bounds);
+      util::stream::Chains &chains = master.MutableChains();
+      chains.back() >> util::stream::PRead(files_.Take('a', 0, shard, config.order), true);
+
+      std::vector<uint64_t> counts, counts_pruned;
+      std::vector<Discount> discounts;
+      std::vector<AdjustedStats> stats;
+      master >> AdjustCounts(config.prune_thresholds, counts, counts_pruned, prune_words_, config.discount, discounts, &stats);
+
+      // AdjustCounts puts <unk> and <s> in every shard's unigrams.  Keep this
+      // shard's own.
+      std::vector<int> unigrams(shards, -1);
+      out.push_back(files_.Create('u', shard, 0, 1));
+      unigrams[shard] = out.back().get();
+      chains[0] >> PartitionByWord(unigrams, 0) >> util::stream::kRecycle;
+      for (std::size_t i = 1; i < config.order; ++i) {
+        std::vector<int> to;
+        for (unsigned int t = 0; t < shards; ++t) {
+          out.push_back(files_.Create('b', shard, t, i + 1));
+          to.push_back(out.back().get());
+        }
+        chains[i] >> PartitionByWord(to, i - 1) >> util::stream::kRecycle;
+      }
+      chains.Wait(true);
+
+      const WordIndex injected[] = {kUNK, kBOS};
+      for (const WordIndex *i = injected; i != injected + 2; ++i) {
+        if (ShardOf(*i, shards) == shard) continue;
+        --stats[0].count;
+        --stats[0].count_pruned;
+        --stats[0].n[0];
+      }
+      util::scoped_fd stats_file(files_.Create('s', shard, 0, 0));
+      util::WriteOrThrow(stats_file.get(), &stats[0], sizeof(AdjustedStats) * stats.size());
+    }
+
+  private:
+    const PipelineConfig &config_;
+    const ShardFiles &files_;
+    WordIndex types_;
+    const std::vector<bool> &prune_words_;
+};
+
+// Stage B: initial probabilities with every unigram, writing backoffs to 'g'.
+// Then send n-grams to 'c' partitioned by their last word.
+class ShardInitial {
+  public:
+    ShardInitial(const PipelineConfig &config, const ShardFiles &files, int unigrams, const std::vector<uint64_t> &counts_pruned, const std::vector<Discount> &discounts, const SpecialVocab &specials)
+      : config_(config), files_(files), unigrams_(unigrams), counts_pruned_(counts_pruned), discounts_(discounts), specials_(specials) {}
+
+    void operator()(unsigned int shard) const {
+      PipelineConfig config(config_);
+      const unsigned int shards = files_.Shards();
+      util::FixedArray<util::scoped_fd> out(1 + (config.order - 1) * shards);
+      Master master(config, 0);
+      master.CreateChains(config.TotalMemory(), counts_pruned_);
+      util::stream::Chains &chains = master.MutableChains();
+      chains[0] >> util::stream::PRead(unigrams_);
+      std::vector<int> in;
+      for (std::size_t i = 1; i < config.order; ++i) {
+        files_.TakeAll('b', shard, i + 1, in);
+        chains[i] >> ReadFiles(in);
+      }
+
+      util::FixedArray<util::stream::FileBuffer> gammas(config.order - 1);
+      for (std::size_t i = 1; i < config.order; ++i) {
+        gammas.push_back(files_.Create('g', shard, shard, i + 1));
+      }
+      Sorts<SuffixOrder> primary;
+      {
+        Sorts<ContextOrder> sorts;
+        master.SetupSorts(sorts, true);
+        std::vector<int> context;
+        master.StealCompleted(sorts, context);
+        InitialProbabilities(counts_pruned_, discounts_, master, context, primary, gammas, config.prune_thresholds, config.prune_vocab, specials_);
+      }
+      master.MaximumLazyInput(counts_pruned_, primary);
+
+      // Unigrams were all here; keep this shard's own.
+      std::vector<int> unigrams(shards, -1);
+      out.push_back(files_.Create('c', shard, shard, 1));
+      unigrams[shard] = out.back().get();
+      chains[0] >> PartitionByWord(unigrams, 0) >> util::stream::kRecycle;
+      for (std::size_t i = 1; i < config.order; ++i) {
+        std::vector<int> to;
+        for (unsigned int t = 0; t < shards; ++t) {
+          out.push_back(files_.Create('c', shard, t, i + 1));
+          to.push_back(out.back().get());
+        }
+        chains[i] >> PartitionByWord(to, i) >> util::stream::kRecycle;
+      }
+      chains.Wait(true);
+    }
+
+  private:
+    const PipelineConfig &config_;
+    const ShardFiles &files_;
+    int unigrams_;
+    const std::vector<uint64_t> &counts_pruned_;
+    const std::vector<Discount> &discounts_;
+    SpecialVocab specials_;
+};
+
+// Stage C: interpolate orders, writing each to 'f' in suffix order.
+class ShardInterpolate {
+  public:
+    ShardInterpolate(const PipelineConfig &config, const ShardFiles &files, const std::vector<uint64_t> &counts_pruned, const SpecialVocab &specials)
+      : config_(config), files_(files), counts_pruned_(counts_pruned), specials_(specials) {}
+
+    void operator()(unsigned int shard) const {
+      PipelineConfig config(config_);
+      util::FixedArray<util::scoped_fd> out(config.order);
+      Master master(config, 0);
+      master.CreateChains(config.TotalMemory(), counts_pruned_);
+      util::stream::Chains &chains = master.MutableChains();
+      chains[0] >> util::stream::PRead(files_.Take('c', shard, shard, 1), true);
+      std::vector<int> in;
+      for (std::size_t i = 1; i < config.order; ++i) {
+        files_.TakeAll('c', shard, i + 1, in);
+        chains[i] >> MergeSuffixFiles(in);
+      }
+
+      util::FixedArray<util::stream::FileBuffer> gammas(config.order - 1);
+      for (std::size_t i = 1; i < config.order; ++i) {
+        gammas.push_back(files_.Take('g', shard, shard, i + 1));
+      }
+      util::stream::Chains gamma_chains(config.order - 1);
+      AttachInterpolate(counts_pruned_, master, gammas, gamma_chains, specials_);
+      for (std::size_t i = 0; i < config.order; ++i) {
+        out.push_back(files_.Create('f', shard, 0, i + 1));
+        chains[i] >> util::stream::WriteAndRecycle(out.back().get());
+      }
+      chains.Wait(true);
+    }
+
+  private:
+    const PipelineConfig &config_;
+    const ShardFiles &files_;
+    const std::vector<uint64_t> &counts_pruned_;
+    SpecialVocab specials_;
+};
+
+void ShardedPipeline(Master &master, int text_file, Output &output) {
+  const PipelineConfig &config = master.Config();
+  PipelineConfig shard_config(config);
+  shard_config.sort.total_memory = config.TotalMemory() / config.shards;
+  if (shard_config.sort.buffer_size * 4 > shard_config.TotalMemory()) {
+    shard_config.sort.buffer_size = shard_config.TotalMemory() / 4;
+    std::cerr << "Warning: changing sort block size to " << shard_config.sort.buffer_size << " bytes for each of " << config.shards << " shards." << std::endl;
+  }
+  UTIL_THROW_IF(shard_config.sort.buffer_size < config.minimum_block, util::Exception, "Sort block size " << shard_config.sort.buffer_size << " for each shard is below the minimum block size " << config.minimum_block << ".");
+  const SpecialVocab specials(kBOS, kEOS);
+  ShardFiles files(config.TempPrefix(), config.shards);
+
+  uint64_t token_count;
+  WordIndex type_count;
+  std::string text_file_name;
+  std::vector<bool> prune_words;
+  {
+    util::scoped_ptr<util::stream::Sort<SuffixOrder, CombineCounts> > sorted_counts(
+        CountText(text_file, output.VocabFile(), master, token_count, type_count, text_file_name, prune_words));
+    std::cerr << "Unigram tokens " << token_count << " types " << type_count << std::endl;
+    util::FixedArray<util::scoped_fd> out(config.shards);
+    std::vector<int> to;
+    for (unsigned int t = 0; t < config.shards; ++t) {
+      out.push_back(files.Create('a', 0, t, config.order));
+      to.push_back(out.back().get());
+    }
+    const std::size_t merge_using = master.Merge(*sorted_counts, master.Governor().LazyFor(*sorted_counts, config.TotalMemory() / 2));
+    master.Governor().Lazy(merge_using);
+    master.Governor().Chains(config.TotalMemory() - merge_using);
+    util::stream::Chain chain(util::stream::ChainConfig(NGram<BuildingPayload>::TotalSize(config.order), config.block_count, config.TotalMemory() - merge_using));
+    sorted_counts->Output(chain, merge_using);
+    chain >> PartitionByWord(to, config.order - 1) >> util::stream::kRecycle;
+    chain.Wait(true);
+  }
+
+  // Shards are separate processes, each with TotalMemory() / shards, so the
+  // report only has their time.
+  master.BeginStage(2, "Calculating and sorting adjusted counts");
+  RunShards(config.shards, ShardAdjust(shard_config, files, type_count, prune_words));
+
+  std::vector<AdjustedStats> stats(config.order);
+  for (unsigned int shard = 0; shard < config.shards; ++shard) {
+    std::vector<AdjustedStats> part(config.order);
+    util::scoped_fd stats_file(files.Take('s', shard, 0, 0));
+    util::ReadOrThrow(stats_file.get(), &part[0], sizeof(AdjustedStats) * part.size());
+    for (std::size_t i = 0; i < config.order; ++i) {
+      for (std::size_t j = 0; j < 5; ++j) stats[i].n[j] += part[i].n[j];
+      stats[i].count += part[i].count;
+      stats[i].count_pruned += part[i].count_pruned;
+    }
+  }
+  std::vector<uint64_t> counts;
+  std::vector<uint64_t> counts_pruned;
+  std::vector<Discount> discounts;
+  ComputeDiscounts(stats, config.discount, counts, counts_pruned, discounts);
+  PrintStatistics(counts, counts_pruned, discounts);
+  lm::ngram::ShowSizes(counts_pruned);
+
+  master.BeginStage(3, "Calculating and sorting initial probabilities");
+  // Every shard needs all the unigrams to normalize them.
+  util::scoped_fd unigrams(util::MakeTemp(config.TempPrefix()));
+  {
+    const std::size_t unigram_size = NGram<BuildingPayload>::TotalSize(1);
+    util::stream::Chain chain(util::stream::ChainConfig(unigram_size, config.block_count,
+        std::max<uint64_t>(config.minimum_block * config.block_count, std::min<uint64_t>(config.TotalMemory(), counts[0] * unigram_size))));
+    std::vector<int> in;
+    files.TakeAll('u', 0, 1, in);
+    chain >> MergeSuffixFiles(in) >> util::stream::WriteAndRecycle(unigrams.get());
+    chain.Wait(true);
+  }
+  RunShards(config.shards, ShardInitial(shard_config, files, unigrams.get(), counts_pruned, discounts, specials));
+  unigrams.reset();
+
+  master.BeginStage(4, "Calculating and writing order-interpolated probabilities");
+  RunShards(config.shards, ShardInterpolate(shard_config, files, counts_pruned, specials));
+
+  master.CreateChains(config.TotalMemory(), counts_pruned);
+  std::vector<int> in;
+  for (std::size_t i = 0; i < config.order; ++i) {
+    files.TakeAll('f', 0, i + 1, in);
+    master.MutableChains()[i] >> MergeSuffixFiles(in);
+  }
+  output.SetHeader(HeaderInfo(text_file_name, token_count, counts_pruned));
+  output.SinkProbs(master.MutableChains());
+  master.Governor().Report(std::cerr);
+}
+
 } // namespace
 
 void Pipeline(PipelineConfig &config, int text_file, Output &output) {
@@ -341,41 +808,183 @@ void Pipeline(PipelineConfig &config, int text_file, Output &output) {
   UTIL_THROW_IF(config.sort.buffer_size < config.minimum_block, util::Exception, "Sort block size " << config.sort.buffer_size << " is below the minimum block size " << config.minimum_block << ".");
   UTIL_THROW_IF(config.TotalMemory() < config.minimum_block * config.order * config.block_count, util::Exception,
       "Not enough memory to fit " << (config.order * config.block_count) << " blocks with minimum size " << config.minimum_block << ".  Increase memory to " << (config.minimum_block * config.order * config.block_count) << " bytes or decrease the minimum block size.");
+  UTIL_THROW_IF(!config.shards, util::Exception, "Need at least one shard.");
+  if (config.shards > 1) {
+    UTIL_THROW_IF(config.order < 2, util::Exception, "Sharding needs order at least 2.");
+    UTIL_THROW_IF(config.renumber_vocabulary, util::Exception, "Renumbering the vocabulary is not supported with shards.");
+    UTIL_THROW_IF(config.TotalMemory() / config.shards < config.minimum_block * config.order * config.block_count, util::Exception,
+        "Not enough memory for each of " << config.shards << " shards to fit " << (config.order * config.block_count) << " blocks with minimum size " << config.minimum_block << ".  Increase memory to " << (config.minimum_block * config.order * config.block_count * config.shards) << " bytes or use fewer shards.");
+  }
+  UTIL_THROW_IF(config.resume && !config.checkpoint, util::Exception, "Resuming needs checkpoints.");
+  UTIL_THROW_IF(config.shards > 1 && !(config.add_counts.empty() && config.save_counts.empty()), util::Exception, "Adding or saving counts is not supported with shards.");
+  UTIL_THROW_IF(!config.counts_vocab.empty() && !config.read_counts, util::Exception, "A vocabulary for binary counts needs counts as input.");
+  UTIL_THROW_IF(!config.counts_vocab.empty() && !config.add_counts.empty(), util::Exception, "Binary counts can not be combined with added counts because each has its own vocabulary.");
+  if (config.checkpoint) {
+    UTIL_THROW_IF(config.shards > 1, util::Exception, "Checkpoints are not supported with shards.");
+    UTIL_THROW_IF(config.renumber_vocabulary, util::Exception, "Checkpoints are not supported when renumbering the vocabulary.");
+  }
 
   Master master(config, output.Steps());
   // master's destructor will wait for chains.  But they might be deadlocked if
   // this thread dies because e.g. it ran out of memory.
   try {
+    if (config.shards > 1) {
+      ShardedPipeline(master, text_file, output);
+      return;
+    }
     VocabNumbering numbering(output.VocabFile(), config.TempPrefix(), config.renumber_vocabulary);
+    util::scoped_fd text(text_file);
+    util::scoped_fd earlier_counts, save_counts;
+    if (!config.add_counts.empty()) {
+      earlier_counts.reset(util::OpenReadOrThrow(config.add_counts.c_str()));
+    }
+    if (!config.save_counts.empty()) {
+      UTIL_THROW_IF(earlier_counts.get() != -1 && SameFile(earlier_counts.get(), config.save_counts), util::Exception, "Saving counts to " << config.save_counts << " would overwrite the counts being added.");
+      save_counts.reset(util::CreateOrThrow(config.save_counts.c_str()));
+    }
+    util::scoped_ptr<Checkpoint> checkpoint;
+    Checkpoint::Stage resume = Checkpoint::NONE;
+    if (config.checkpoint) {
+      checkpoint.reset(new Checkpoint(config, text.get()));
+      if (config.resume) resume = checkpoint->Load();
+      if (resume > Checkpoint::COUNTED && save_counts.get() != -1) {
+        std::cerr << "Resuming after stage 1 to save counts." << std::endl;
+        resume = Checkpoint::COUNTED;
+      }
+      if (resume == Checkpoint::NONE) checkpoint->Clear();
+    }
+
     uint64_t token_count;
     WordIndex type_count;
     std::string text_file_name;
     std::vector<bool> prune_words;
-    util::scoped_ptr<util::stream::Sort<SuffixOrder, CombineCounts> > sorted_counts(
-        CountText(text_file, numbering.WriteOnTheFly(), master, token_count, type_count, text_file_name, prune_words));
+    util::scoped_ptr<util::stream::Sort<SuffixOrder, CombineCounts> > sorted_counts;
+    if (resume >= Checkpoint::COUNTED) {
+      token_count = checkpoint->token_count;
+      type_count = checkpoint->type_count;
+      text_file_name = checkpoint->text_file_name;
+      prune_words.swap(checkpoint->prune_words);
+      checkpoint->Restore(numbering.WriteOnTheFly(), "vocab");
+      std::cerr << "Resuming after stage " << resume << '/' << master.Steps() << " from the checkpoint." << std::endl;
+    } else {
+      sorted_counts.reset(CountText(text.release(), numbering.WriteOnTheFly(), master, token_count, type_count, text_file_name, prune_words));
+      if (checkpoint.get()) {
+        master.Merge(*sorted_counts, 0);
+        util::scoped_fd merged(sorted_counts->StealCompleted());
+        sorted_counts.reset();
+        checkpoint->Save(merged.get(), "counts", config.order);
+        checkpoint->Save(numbering.WriteOnTheFly(), "vocab");
+        checkpoint->token_count = token_count;
+        checkpoint->type_count = type_count;
+        checkpoint->text_file_name = text_file_name;
+        checkpoint->prune_words = prune_words;
+        checkpoint->Finish(Checkpoint::COUNTED);
+      }
+    }
     std::cerr << "Unigram tokens " << token_count << " types " << type_count << std::endl;
+    if (save_counts.get() != -1) {
+      util::scoped_fd vocab(util::CreateOrThrow((config.save_counts + ".vocab").c_str()));
+      util::CopyOrThrow(numbering.WriteOnTheFly(), vocab.get());
+    }
 
     // Create vocab mapping, which uses temporary memory, while nothing else is happening.
     std::size_t subtract_for_numbering = numbering.ComputeMapping(type_count);
 
-    std::cerr << "=== 2/" << master.Steps() << " Calculating and sorting adjusted counts ===" << std::endl;
-    master.InitForAdjust(*sorted_counts, type_count, subtract_for_numbering);
-    sorted_counts.reset();
-
     std::vector<uint64_t> counts;
     std::vector<uint64_t> counts_pruned;
     std::vector<Discount> discounts;
-    master >> AdjustCounts(config.prune_thresholds, counts, counts_pruned, prune_words, config.discount, discounts);
-    numbering.ApplyRenumber(master.MutableChains());
+    Sorts<ContextOrder> sorts;
+    if (resume < Checkpoint::ADJUSTED) {
+      master.BeginStage(2, "Calculating and sorting adjusted counts");
+      std::vector<int> counts_files;
+      if (checkpoint.get()) {
+        counts_files.push_back(checkpoint->Open("counts", config.order));
+      } else if (earlier_counts.get() != -1) {
+        master.Merge(*sorted_counts, 0);
+        counts_files.push_back(sorted_counts->StealCompleted());
+        sorted_counts.reset();
+      }
+      if (earlier_counts.get() != -1) counts_files.push_back(earlier_counts.release());
+      if (counts_files.empty()) {
+        master.InitForAdjust(*sorted_counts, type_count, subtract_for_numbering);
+        sorted_counts.reset();
+      } else {
+        master.InitForAdjust(counts_files, type_count);
+      }
+      // Earlier counts have tokens too.
+      if (!config.add_counts.empty()) master.MutableChains().back() >> CountTokens(token_count);
+      if (save_counts.get() != -1) master.MutableChains().back() >> util::stream::Write(save_counts.get());
+      master >> AdjustCounts(config.prune_thresholds, counts, counts_pruned, prune_words, config.discount, discounts);
+      numbering.ApplyRenumber(master.MutableChains());
+      master.SetupSorts(sorts, !config.renumber_vocabulary);
+      if (!config.add_counts.empty()) std::cerr << "Unigram tokens with the added counts " << token_count << std::endl;
+    } else {
+      counts = checkpoint->counts;
+      counts_pruned = checkpoint->counts_pruned;
+      discounts = checkpoint->discounts;
+    }
 
     {
-      util::FixedArray<util::stream::FileBuffer> gammas;
+      util::FixedArray<util::stream::FileBuffer> gammas(config.order - 1);
+      for (std::size_t i = 1; i < config.order; ++i) {
+        gammas.push_back(resume >= Checkpoint::INITIAL ? checkpoint->Open("gamma", i + 1) : util::MakeTemp(config.TempPrefix()));
+      }
+      // With a checkpoint, the n-grams in suffix order are merged into files.
       Sorts<SuffixOrder> primary;
-      InitialProbabilities(counts, counts_pruned, discounts, master, primary, gammas, config.prune_thresholds, config.prune_vocab, numbering.Specials());
+      std::vector<int> suffix;
+      if (resume < Checkpoint::INITIAL) {
+        PrintStatistics(counts, counts_pruned, discounts);
+        lm::ngram::ShowSizes(counts_pruned);
+        master.BeginStage(3, "Calculating and sorting initial probabilities");
+        std::vector<int> context;
+        if (resume < Checkpoint::ADJUSTED) {
+          master.StealCompleted(sorts, context);
+          if (checkpoint.get()) {
+            checkpoint->Save(master.Unigrams().File(), "adjusted", 1);
+            for (std::size_t i = 0; i < context.size(); ++i) {
+              checkpoint->Save(context[i], "adjusted", i + 2);
+            }
+            checkpoint->token_count = token_count;
+            checkpoint->counts = counts;
+            checkpoint->counts_pruned = counts_pruned;
+            checkpoint->discounts = discounts;
+            checkpoint->Finish(Checkpoint::ADJUSTED);
+          }
+        } else {
+          checkpoint->Restore(master.Unigrams().File(), "adjusted", 1);
+          for (std::size_t i = 2; i <= config.order; ++i) {
+            context.push_back(checkpoint->Open("adjusted", i));
+          }
+        }
+        InitialProbabilities(counts_pruned, discounts, master, context, primary, gammas, config.prune_thresholds, config.prune_vocab, numbering.Specials());
+        if (checkpoint.get()) {
+          master.StealCompleted(primary, suffix);
+          checkpoint->Save(master.Unigrams().File(), "initial", 1);
+          for (std::size_t i = 0; i < suffix.size(); ++i) {
+            checkpoint->Save(suffix[i], "initial", i + 2);
+            checkpoint->Save(gammas[i].File(), "gamma", i + 2);
+          }
+          checkpoint->Finish(Checkpoint::INITIAL);
+        }
+      } else {
+        PrintStatistics(counts, counts_pruned, discounts);
+        lm::ngram::ShowSizes(counts_pruned);
+        checkpoint->Restore(master.Unigrams().File(), "initial", 1);
+        for (std::size_t i = 2; i <= config.order; ++i) {
+          suffix.push_back(checkpoint->Open("initial", i));
+        }
+      }
       output.SetHeader(HeaderInfo(text_file_name, token_count, counts_pruned));
+      master.BeginStage(4, "Calculating and writing order-interpolated probabilities");
+      if (checkpoint.get()) {
+        master.ReadInput(counts_pruned, suffix);
+      } else {
+        master.MaximumLazyInput(counts_pruned, primary);
+      }
       // Also does output.
-      InterpolateProbabilities(counts_pruned, master, primary, gammas, output, numbering.Specials());
+      InterpolateProbabilities(counts_pruned, master, gammas, output, numbering.Specials());
     }
+    master.Governor().Report(std::cerr);
   } catch (const util::Exception &e) {
     std::cerr << e.what() << std::endl;
     abort();
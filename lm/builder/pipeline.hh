@@ -22,6 +22,9 @@ struct PipelineConfig {
   InitialProbabilitiesConfig initial_probs;
   util::stream::ChainConfig read_backoffs;
 
+  // Threads for tokenizing and deduplicating in CorpusCount.
+  std::size_t count_threads;
+
   // Estimated vocabulary size.  Used for sizing CorpusCount memory and
   // initial probing hash table sizing, also in CorpusCount.
   lm::WordIndex vocab_estimate;
@@ -65,6 +68,45 @@ struct PipelineConfig {
    */
   WarningAction disallowed_symbol_action;
 
+  /* Estimate in this many shards, each a separate process with an equal
+   * share of the memory.  n-grams are partitioned by the hash of a word after
+   * counting and exchanged through files in the temporary directory.  1 runs
+   * everything in this process.  Renumbering is not supported with shards.
+   */
+  unsigned int shards;
+
+  /* Save the output of each finished stage under the temporary prefix, with a
+   * manifest, so an interrupted run can resume.  With resume, skip the stages
+   * a checkpoint from the same text and settings already finished.  Not
+   * supported with shards or renumbering.
+   */
+  bool checkpoint;
+  bool resume;
+
+  /* Save the raw counts of the highest order, in suffix order, to save_counts
+   * and the vocabulary to save_counts + ".vocab", which is what dump_counts
+   * reads.  A later build can add them with add_counts so that only new text
+   * is counted; its vocabulary extends the earlier one.  Empty strings
+   * disable.  Not supported with shards.
+   */
+  std::string add_counts;
+  std::string save_counts;
+
+  /* The input is n-grams of the highest order counted elsewhere instead of
+   * text; see CountsInput.  They are text with a tab before each count unless
+   * counts_vocab names the vocabulary of binary counts as dump_counts reads.
+   * Binary counts can not be combined with add_counts.
+   */
+  bool read_counts;
+  std::string counts_vocab;
+
+  /* Before step 2, give the lazy merge of the counts all the memory it needs
+   * to read every remaining stripe at once, if that fits, instead of the
+   * usual Sort::DefaultLazy share.  This saves a merge pass but can leave
+   * less memory for the chains of step 2.
+   */
+  bool lazy_without_merge;
+
   const std::string &TempPrefix() const { return sort.temp_prefix; }
   std::size_t TotalMemory() const { return sort.total_memory; }
 };
@@ -0,0 +1,137 @@
+#include "lm/builder/pipeline.hh"
+
+#include "lm/builder/pipeline_test_fixture.hh"
+#include "util/file.hh"
+#include "util/scoped.hh"
+
+#define BOOST_TEST_MODULE PipelineTest
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace lm { namespace builder { namespace {
+
+// Text counts of the n-grams lmplz would count, with counts above one split
+// across two lines.
+std::string CountCorpus(const std::string &corpus, std::size_t order) {
+  std::map<std::string, uint64_t> counts;
+  std::istringstream in(corpus);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::vector<std::string> words(1, "<s>");
+    std::istringstream tokens(line);
+    for (std::string word; tokens >> word;) words.push_back(word);
+    words.push_back("</s>");
+    for (std::size_t end = 2; end <= words.size(); ++end) {
+      std::string gram;
+      for (std::size_t i = (end > order ? end - order : 0); i < end; ++i) {
+        if (!gram.empty()) gram += ' ';
+        gram += words[i];
+      }
+      ++counts[gram];
+    }
+  }
+  std::ostringstream out;
+  for (std::map<std::string, uint64_t>::const_iterator i = counts.begin(); i != counts.end(); ++i) {
+    if (i->second > 1) out << i->first << "\t1\n";
+    out << i->first << '\t' << (i->second > 1 ? i->second - 1 : 1) << '\n';
+  }
+  return out.str();
+}
+
+// Vocabulary ids, and so the order of n-grams in ARPA, follow the input.
+std::string SortLines(const std::string &text) {
+  std::vector<std::string> lines;
+  std::istringstream in(text);
+  for (std::string line; std::getline(in, line);) lines.push_back(line);
+  std::sort(lines.begin(), lines.end());
+  std::string ret;
+  for (std::vector<std::string>::const_iterator i = lines.begin(); i != lines.end(); ++i) {
+    ret += *i;
+    ret += '\n';
+  }
+  return ret;
+}
+
+PipelineConfig MakeConfig() {
+  return builder::MakeConfig("pipeline_test_");
+}
+
+// The token count from an ARPA with the verbose header.
+uint64_t HeaderTokens(const std::string &arpa) {
+  const std::string label("# Token count: ");
+  std::string::size_type start = arpa.find(label);
+  BOOST_REQUIRE(start != std::string::npos);
+  std::istringstream in(arpa.substr(start + label.size()));
+  uint64_t ret;
+  BOOST_REQUIRE(in >> ret);
+  return ret;
+}
+
+// Words in the corpus, not counting <s> or </s>, as lmplz counts tokens.
+uint64_t CorpusTokens(const std::string &corpus) {
+  std::istringstream in(corpus);
+  uint64_t ret = 0;
+  for (std::string word; in >> word;) ++ret;
+  return ret;
+}
+
+BOOST_AUTO_TEST_CASE(AddCountsSameAsConcatenated) {
+  const std::string earlier(MakeCorpus(12345, 3000)), later(MakeCorpus(54321, 500));
+  std::string expected(Estimate(MakeConfig(), earlier + later));
+  BOOST_REQUIRE(!expected.empty());
+
+  PipelineConfig config(MakeConfig());
+  config.save_counts = "pipeline_test_counts";
+  Estimate(config, earlier);
+  config.add_counts = config.save_counts;
+  config.save_counts = "pipeline_test_counts2";
+  BOOST_CHECK(expected == Estimate(config, later));
+
+  // The counts saved while adding cover both texts.
+  config.add_counts = config.save_counts;
+  config.save_counts.clear();
+  BOOST_CHECK(Estimate(MakeConfig(), earlier + later + later) == Estimate(config, later));
+
+  // The header counts the tokens of the added counts too.
+  BOOST_CHECK_EQUAL(CorpusTokens(earlier + later + later), HeaderTokens(Estimate(MakeConfig(), earlier + later + later, true)));
+  BOOST_CHECK_EQUAL(CorpusTokens(earlier + later + later), HeaderTokens(Estimate(config, later, true)));
+
+  unlink("pipeline_test_counts");
+  unlink("pipeline_test_counts.vocab");
+  unlink("pipeline_test_counts2");
+  unlink("pipeline_test_counts2.vocab");
+}
+
+BOOST_AUTO_TEST_CASE(CountsSameAsText) {
+  const std::string corpus(MakeCorpus(12345, 3000));
+  PipelineConfig config(MakeConfig());
+  config.save_counts = "pipeline_test_counts";
+  std::string expected(Estimate(config, corpus));
+  BOOST_REQUIRE(!expected.empty());
+  config.save_counts.clear();
+
+  config.read_counts = true;
+  const std::string counts(CountCorpus(corpus, config.order));
+  const std::string from_counts(Estimate(config, counts));
+  BOOST_CHECK(SortLines(expected) == SortLines(from_counts));
+  config.count_threads = 3;
+  BOOST_CHECK(from_counts == Estimate(config, counts));
+
+  util::scoped_fd saved(util::OpenReadOrThrow("pipeline_test_counts"));
+  std::string binary(util::SizeOrThrow(saved.get()), 0);
+  util::ReadOrThrow(saved.get(), &binary[0], binary.size());
+  config.counts_vocab = "pipeline_test_counts.vocab";
+  BOOST_CHECK(expected == Estimate(config, binary));
+
+  unlink("pipeline_test_counts");
+  unlink("pipeline_test_counts.vocab");
+}
+
+}}} // namespaces
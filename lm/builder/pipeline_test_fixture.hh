@@ -0,0 +1,95 @@
+#ifndef LM_BUILDER_PIPELINE_TEST_FIXTURE_H
+#define LM_BUILDER_PIPELINE_TEST_FIXTURE_H
+
+/* Small corpora, configuration, and estimation shared by the tests that run
+ * the whole lmplz pipeline.
+ */
+
+#include "lm/builder/output.hh"
+#include "lm/builder/pipeline.hh"
+#include "util/file.hh"
+#include "util/scoped.hh"
+
+#include <sstream>
+#include <string>
+
+namespace lm { namespace builder {
+
+// Deterministic text with a skewed vocabulary so every order has n-grams of
+// various counts.
+inline std::string MakeCorpus(uint32_t state, unsigned int lines) {
+  std::ostringstream text;
+  for (unsigned int line = 0; line < lines; ++line) {
+    state = state * 1103515245 + 12345;
+    unsigned int length = 1 + (state >> 16) % 12;
+    for (unsigned int i = 0; i < length; ++i) {
+      state = state * 1103515245 + 12345;
+      unsigned int value = (state >> 16) % 1000;
+      // Roughly Zipfian: small ids are much more common.
+      text << 'w' << (value * value / 2000) << ' ';
+    }
+    text << '\n';
+  }
+  return text.str();
+}
+
+// Unpruned, unsharded estimation in one process with temporary files under
+// temp_prefix and fallback discounts, since the corpora are small.
+inline PipelineConfig MakeConfig(const std::string &temp_prefix, std::size_t order = 4) {
+  PipelineConfig config;
+  config.order = order;
+  config.sort.temp_prefix = temp_prefix;
+  config.sort.buffer_size = 1 << 20;
+  config.sort.total_memory = 64 << 20;
+  config.initial_probs.adder_in.total_memory = 32768;
+  config.initial_probs.adder_in.block_count = 2;
+  config.initial_probs.adder_out = config.initial_probs.adder_in;
+  config.initial_probs.interpolate_unigrams = true;
+  config.read_backoffs = config.initial_probs.adder_out;
+  config.count_threads = 1;
+  config.vocab_estimate = 1000;
+  config.minimum_block = 8192;
+  config.block_count = 2;
+  config.prune_thresholds.resize(order, 0);
+  config.prune_vocab = false;
+  config.renumber_vocabulary = false;
+  config.discount.fallback.amount[0] = 0.0;
+  config.discount.fallback.amount[1] = 0.5;
+  config.discount.fallback.amount[2] = 1.0;
+  config.discount.fallback.amount[3] = 1.5;
+  config.discount.bad_action = SILENT;
+  config.output_q = false;
+  config.vocab_size_for_unk = 0;
+  config.disallowed_symbol_action = THROW_UP;
+  config.shards = 1;
+  config.checkpoint = false;
+  config.resume = false;
+  config.read_counts = false;
+  config.lazy_without_merge = false;
+  return config;
+}
+
+// Run the pipeline on text, which it takes ownership of, and return the ARPA.
+inline std::string Estimate(PipelineConfig config, int text, bool verbose_header = false) {
+  util::scoped_fd arpa(util::MakeTemp(config.TempPrefix() + "arpa"));
+  {
+    Output output(config.TempPrefix(), false, false);
+    output.Add(new PrintHook(util::DupOrThrow(arpa.get()), verbose_header));
+    Pipeline(config, text, output);
+  }
+  std::string ret(util::SizeOrThrow(arpa.get()), 0);
+  util::SeekOrThrow(arpa.get(), 0);
+  util::ReadOrThrow(arpa.get(), &ret[0], ret.size());
+  return ret;
+}
+
+inline std::string Estimate(const PipelineConfig &config, const std::string &corpus, bool verbose_header = false) {
+  util::scoped_fd text(util::MakeTemp(config.TempPrefix() + "text"));
+  util::WriteOrThrow(text.get(), corpus.data(), corpus.size());
+  util::SeekOrThrow(text.get(), 0);
+  return Estimate(config, text.release(), verbose_header);
+}
+
+}} // namespaces
+
+#endif // LM_BUILDER_PIPELINE_TEST_FIXTURE_H
@@ -0,0 +1,190 @@
+#include "lm/builder/shard.hh"
+
+#include "lm/builder/combine_counts.hh"
+#include "lm/builder/payload.hh"
+#include "lm/common/compare.hh"
+#include "lm/common/ngram.hh"
+#include "util/fake_ofstream.hh"
+#include "util/file.hh"
+#include "util/fixed_array.hh"
+#include "util/scoped.hh"
+#include "util/stream/chain.hh"
+#include "util/stream/io.hh"
+#include "util/stream/stream.hh"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <sys/wait.h>
+
+namespace lm { namespace builder {
+
+ShardFiles::ShardFiles(const std::string &temp_prefix, unsigned int shards) : shards_(shards) {
+  std::ostringstream base;
+  base << temp_prefix << "shard" << getpid() << '.';
+  base_ = base.str();
+}
+
+std::string ShardFiles::Name(char stage, unsigned int from, unsigned int to, unsigned int order) const {
+  std::ostringstream name;
+  name << base_ << stage << '.' << from << '.' << to << '.' << order;
+  return name.str();
+}
+
+int ShardFiles::Create(char stage, unsigned int from, unsigned int to, unsigned int order) const {
+  return util::CreateOrThrow(Name(stage, from, to, order).c_str());
+}
+
+int ShardFiles::Take(char stage, unsigned int from, unsigned int to, unsigned int order) const {
+  std::string name(Name(stage, from, to, order));
+  int fd = util::OpenReadOrThrow(name.c_str());
+  UTIL_THROW_IF(unlink(name.c_str()), util::ErrnoException, "Could not remove " << name);
+  return fd;
+}
+
+void ShardFiles::TakeAll(char stage, unsigned int to, unsigned int order, std::vector<int> &out) const {
+  out.clear();
+  for (unsigned int from = 0; from < shards_; ++from) {
+    out.push_back(Take(stage, from, to, order));
+  }
+}
+
+namespace {
+const std::size_t kShardBuffer = 1 << 18;
+} // namespace
+
+void PartitionByWord::Run(const util::stream::ChainPosition &position) {
+  const std::size_t entry_size = position.GetChain().EntrySize();
+  const unsigned int shards = files_.size();
+  util::FixedArray<util::FakeOFStream> out(shards);
+  for (unsigned int i = 0; i < shards; ++i) {
+    out.push_back(files_[i], files_[i] == -1 ? 0 : kShardBuffer);
+  }
+  for (util::stream::Link link(position); link; ++link) {
+    const uint8_t *const end = static_cast<const uint8_t*>(link->ValidEnd());
+    for (const uint8_t *i = static_cast<const uint8_t*>(link->Get()); i != end; i += entry_size) {
+      unsigned int shard = ShardOf(reinterpret_cast<const WordIndex*>(i)[key_], shards);
+      if (files_[shard] != -1) out[shard].write(i, entry_size);
+    }
+  }
+}
+
+void ReadFiles::Run(const util::stream::ChainPosition &position) {
+  const std::size_t block_size = position.GetChain().BlockSize();
+  const std::size_t entry_size = position.GetChain().EntrySize();
+  std::vector<int>::const_iterator file = files_.begin();
+  for (util::stream::Link link(position); link; ++link) {
+    uint8_t *base = static_cast<uint8_t*>(link->Get());
+    std::size_t filled = 0;
+    while (filled < block_size && file != files_.end()) {
+      std::size_t got = util::ReadOrEOF(*file, base + filled, block_size - filled);
+      if (filled + got < block_size) {
+        util::scoped_fd finished(*file);
+        ++file;
+      }
+      filled += got;
+    }
+    UTIL_THROW_IF(filled % entry_size, util::stream::ReadSizeException, "Shard files ended with " << filled << " bytes, not a multiple of " << entry_size << ".");
+    if (!filled) {
+      link.Poison();
+      return;
+    }
+    link->SetValidSize(filled);
+  }
+}
+
+namespace {
+
+// Buffered reading of fixed-size entries from a file it owns.
+class EntryReader {
+  public:
+    EntryReader(int fd, std::size_t entry_size)
+      : file_(fd), entry_size_(entry_size),
+        buffer_size_(std::max(entry_size, kShardBuffer - kShardBuffer % entry_size)),
+        buffer_(util::MallocOrThrow(buffer_size_)) {
+      Fill();
+    }
+
+    const uint8_t *Get() const { return current_; }
+
+    operator bool() const { return current_ != end_; }
+
+    EntryReader &operator++() {
+      current_ += entry_size_;
+      if (current_ == end_) Fill();
+      return *this;
+    }
+
+  private:
+    void Fill() {
+      current_ = static_cast<uint8_t*>(buffer_.get());
+      std::size_t got = util::ReadOrEOF(file_.get(), current_, buffer_size_);
+      UTIL_THROW_IF(got % entry_size_, util::stream::ReadSizeException, "Shard file ended with " << got << " bytes, not a multiple of " << entry_size_ << ".");
+      end_ = current_ + got;
+    }
+
+    util::scoped_fd file_;
+    const std::size_t entry_size_, buffer_size_;
+    util::scoped_malloc buffer_;
+    uint8_t *current_, *end_;
+};
+
+} // namespace
+
+void MergeSuffixFiles::Run(const util::stream::ChainPosition &position) {
+  const std::size_t entry_size = position.GetChain().EntrySize();
+  const SuffixOrder compare(NGram<BuildingPayload>::OrderFromSize(entry_size));
+  const CombineCounts combine;
+  util::FixedArray<EntryReader> readers(files_.size());
+  for (std::vector<int>::const_iterator i = files_.begin(); i != files_.end(); ++i) {
+    readers.push_back(*i, entry_size);
+  }
+  util::stream::Stream out(position);
+  while (true) {
+    // There are only a few shards, so linear search.
+    EntryReader *least = NULL;
+    for (EntryReader *i = readers.begin(); i != readers.end(); ++i) {
+      if (*i && (!least || compare(i->Get(), least->Get()))) least = i;
+    }
+    if (!least) break;
+    memcpy(out.Get(), least->Get(), entry_size);
+    ++*least;
+    if (combine_counts_) {
+      for (EntryReader *i = readers.begin(); i != readers.end(); ++i) {
+        if (*i && combine(out.Get(), i->Get(), compare)) ++*i;
+      }
+    }
+    ++out;
+  }
+  out.Poison();
+}
+
+bool WaitShards(const std::vector<pid_t> &children) {
+  bool success = true;
+  for (std::vector<pid_t>::const_iterator i = children.begin(); i != children.end(); ++i) {
+    int status;
+    pid_t ret;
+    while (-1 == (ret = waitpid(*i, &status, 0)) && errno == EINTR) {}
+    if (ret == -1) {
+      std::cerr << "waitpid failed for shard process " << *i << ": " << strerror(errno) << std::endl;
+      success = false;
+    } else if (WIFSIGNALED(status)) {
+      std::cerr << "Shard process " << *i << " died from signal " << WTERMSIG(status) << std::endl;
+      success = false;
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+      std::cerr << "Shard process " << *i << " failed" << std::endl;
+      success = false;
+    }
+  }
+  return success;
+}
+
+void ExitShard(unsigned int shard, bool success) {
+  if (!success) std::cerr << "Shard " << shard << " failed." << std::endl;
+  std::cerr.flush();
+  // Skip destructors and atexit handlers, which belong to the parent.
+  _exit(success ? 0 : 1);
+}
+
+}} // namespaces
@@ -0,0 +1,128 @@
+#ifndef LM_BUILDER_SHARD_H
+#define LM_BUILDER_SHARD_H
+
+/* Pieces for estimating a model in shards that run as separate processes and
+ * exchange n-grams through files.  See ShardedPipeline in pipeline.cc for how
+ * they fit together.
+ */
+
+#include "lm/word_index.hh"
+#include "util/exception.hh"
+#include "util/murmur_hash.hh"
+
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace util { namespace stream { class ChainPosition; } }
+
+namespace lm { namespace builder {
+
+inline unsigned int ShardOf(WordIndex word, unsigned int shards) {
+  return static_cast<unsigned int>(util::MurmurHashNative(&word, sizeof(WordIndex)) % shards);
+}
+
+// Names the files that shards exchange.  Each stage (a letter) writes files
+// from one shard to another for each order.
+class ShardFiles {
+  public:
+    // Files go in temp_prefix with a name unique to this process.
+    ShardFiles(const std::string &temp_prefix, unsigned int shards);
+
+    unsigned int Shards() const { return shards_; }
+
+    std::string Name(char stage, unsigned int from, unsigned int to, unsigned int order) const;
+
+    int Create(char stage, unsigned int from, unsigned int to, unsigned int order) const;
+
+    // Open for reading and remove the name.  Each file is read once.
+    int Take(char stage, unsigned int from, unsigned int to, unsigned int order) const;
+
+    // Take the files from every shard to this one.
+    void TakeAll(char stage, unsigned int to, unsigned int order, std::vector<int> &out) const;
+
+  private:
+    std::string base_;
+    unsigned int shards_;
+};
+
+// Send each n-gram to the file of the shard that owns the word at position
+// key.  Files of -1 drop their n-grams.  Does not take ownership.
+class PartitionByWord {
+  public:
+    PartitionByWord(const std::vector<int> &files, std::size_t key) : files_(files), key_(key) {}
+
+    void Run(const util::stream::ChainPosition &position);
+
+  private:
+    std::vector<int> files_;
+    std::size_t key_;
+};
+
+// Read files one after another.  Takes ownership.
+class ReadFiles {
+  public:
+    explicit ReadFiles(const std::vector<int> &files) : files_(files) {}
+
+    void Run(const util::stream::ChainPosition &position);
+
+  private:
+    std::vector<int> files_;
+};
+
+// Merge files that are each in suffix order with no n-gram twice.  No n-gram
+// may appear in more than one file unless combine_counts, in which case their
+// counts are summed.  Takes ownership.
+class MergeSuffixFiles {
+  public:
+    explicit MergeSuffixFiles(const std::vector<int> &files, bool combine_counts = false)
+      : files_(files), combine_counts_(combine_counts) {}
+
+    void Run(const util::stream::ChainPosition &position);
+
+  private:
+    std::vector<int> files_;
+    bool combine_counts_;
+};
+
+// Wait for all the children, reporting any that failed.  Returns true if all succeeded.
+bool WaitShards(const std::vector<pid_t> &children);
+
+// Exit from a shard's process without running the parent's destructors.
+void ExitShard(unsigned int shard, bool success);
+
+/* Run work(shard) for each shard in its own process and wait for all of them.
+ * Throws if any fails.  Call with no other threads running, since only the
+ * calling thread survives fork.
+ */
+template <class Work> void RunShards(unsigned int shards, const Work &work) {
+  std::vector<pid_t> children;
+  for (unsigned int shard = 0; shard < shards; ++shard) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      try {
+        work(shard);
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        ExitShard(shard, false);
+      }
+      ExitShard(shard, true);
+    }
+    if (pid == -1) {
+      int error = errno;
+      WaitShards(children);
+      errno = error;
+      UTIL_THROW(util::ErrnoException, "fork failed for shard " << shard);
+    }
+    children.push_back(pid);
+  }
+  UTIL_THROW_IF(!WaitShards(children), util::Exception, "Shard processes failed.");
+}
+
+}} // namespaces
+
+#endif // LM_BUILDER_SHARD_H
@@ -0,0 +1,37 @@
+#include "lm/builder/pipeline.hh"
+
+#include "lm/builder/pipeline_test_fixture.hh"
+
+#define BOOST_TEST_MODULE ShardTest
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+namespace lm { namespace builder { namespace {
+
+PipelineConfig MakeConfig(std::size_t order, unsigned int shards) {
+  PipelineConfig config(builder::MakeConfig("shard_test_", order));
+  config.shards = shards;
+  return config;
+}
+
+BOOST_AUTO_TEST_CASE(SameAsUnsharded) {
+  std::string corpus(MakeCorpus(12345, 3000));
+  std::string expected(Estimate(MakeConfig(3, 1), corpus));
+  BOOST_REQUIRE(!expected.empty());
+  BOOST_CHECK(expected == Estimate(MakeConfig(3, 3), corpus));
+}
+
+BOOST_AUTO_TEST_CASE(PrunedSameAsUnsharded) {
+  std::string corpus(MakeCorpus(12345, 3000));
+  PipelineConfig unsharded(MakeConfig(4, 1));
+  unsharded.prune_thresholds[2] = 1;
+  unsharded.prune_thresholds[3] = 1;
+  PipelineConfig sharded(unsharded);
+  sharded.shards = 2;
+  std::string expected(Estimate(unsharded, corpus));
+  BOOST_REQUIRE(!expected.empty());
+  BOOST_CHECK(expected == Estimate(sharded, corpus));
+}
+
+}}} // namespaces
@@ -0,0 +1,125 @@
+#ifndef LM_CACHED_MODEL_H
+#define LM_CACHED_MODEL_H
+
+#include "lm/return.hh"
+#include "lm/state.hh"
+#include "lm/word_index.hh"
+
+#include <boost/scoped_array.hpp>
+
+#include <cstddef>
+
+#include <stdint.h>
+
+namespace lm {
+namespace ngram {
+
+/* Remembers recent FullScore results in front of a model.  Decoders query the
+ * same (state, word) pairs over and over as hypotheses that share a context
+ * try the same target words, so these hit a small table instead of walking
+ * the model's lookups again.
+ *
+ * The table is set associative with kWays entries per set, indexed by
+ * hash_value of the state seeded with the word.  Each set evicts its least
+ * recently used entry.  A hit compares the full state and word, so results
+ * are always those of the model.  States should come from the same model,
+ * because backoffs in the state are assumed to follow from its words.
+ *
+ * This is not thread safe.  Make one per thread around a shared model; the
+ * model itself is only read.
+ */
+template <class ModelT> class CachedModel {
+  public:
+    typedef ModelT Model;
+    typedef typename Model::State State;
+    typedef typename Model::Vocabulary Vocabulary;
+
+    static const std::size_t kWays = 4;
+
+    // entries is rounded up to a power of two of at least kWays.
+    explicit CachedModel(const Model &model, std::size_t entries = 1 << 14)
+      : model_(model), clock_(0), hits_(0), misses_(0) {
+      std::size_t sets = 1;
+      while (sets * kWays < entries) sets <<= 1;
+      set_mask_ = sets - 1;
+      table_.reset(new Entry[sets * kWays]);
+      Clear();
+    }
+
+    FullScoreReturn FullScore(const State &in_state, const WordIndex new_word, State &out_state) const {
+      const uint64_t hash = hash_value(in_state, new_word);
+      Entry *set = &table_[(hash & set_mask_) * kWays];
+      Entry *victim = set;
+      for (Entry *i = set; i != set + kWays; ++i) {
+        if (i->hash == hash && i->used && i->word == new_word && i->in == in_state) {
+          ++hits_;
+          i->used = ++clock_;
+          out_state = i->out;
+          return i->ret;
+        }
+        if (i->used < victim->used) victim = i;
+      }
+      ++misses_;
+      FullScoreReturn ret(model_.FullScore(in_state, new_word, out_state));
+      victim->hash = hash;
+      victim->used = ++clock_;
+      victim->word = new_word;
+      victim->in = in_state;
+      victim->out = out_state;
+      victim->ret = ret;
+      return ret;
+    }
+
+    float Score(const State &in_state, const WordIndex new_word, State &out_state) const {
+      return FullScore(in_state, new_word, out_state).prob;
+    }
+
+    const State &BeginSentenceState() const { return model_.BeginSentenceState(); }
+    const State &NullContextState() const { return model_.NullContextState(); }
+    const Vocabulary &GetVocabulary() const { return model_.GetVocabulary(); }
+    unsigned char Order() const { return model_.Order(); }
+
+    const Model &Underlying() const { return model_; }
+
+    // Forget cached scores but not the counts.
+    void Clear() {
+      for (Entry *i = table_.get(); i != table_.get() + (set_mask_ + 1) * kWays; ++i) {
+        i->used = 0;
+      }
+      clock_ = 0;
+    }
+
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+
+    double HitRate() const {
+      return (hits_ + misses_) ? static_cast<double>(hits_) / static_cast<double>(hits_ + misses_) : 0.0;
+    }
+
+    void ResetCounts() { hits_ = misses_ = 0; }
+
+  private:
+    struct Entry {
+      uint64_t hash;
+      // Time of last use or 0 if empty.
+      uint64_t used;
+      WordIndex word;
+      State in, out;
+      FullScoreReturn ret;
+    };
+
+    const Model &model_;
+
+    boost::scoped_array<Entry> table_;
+    std::size_t set_mask_;
+
+    mutable uint64_t clock_;
+    mutable uint64_t hits_, misses_;
+};
+
+template <class ModelT> const std::size_t CachedModel<ModelT>::kWays;
+
+} // namespace ngram
+} // namespace lm
+
+#endif // LM_CACHED_MODEL_H
@@ -0,0 +1,135 @@
+#include "lm/cached_model.hh"
+#include "lm/model.hh"
+
+#define BOOST_TEST_MODULE CachedModelTest
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+namespace lm {
+namespace ngram {
+namespace {
+
+const char *FileLocation() {
+  if (boost::unit_test::framework::master_test_suite().argc < 2) {
+    return "test.arpa";
+  }
+  return boost::unit_test::framework::master_test_suite().argv[1];
+}
+
+template <class M> void CheckSame(const M &model, const CachedModel<M> &cached, const State &in, WordIndex word) {
+  State model_out, cached_out;
+  FullScoreReturn model_ret(model.FullScore(in, word, model_out));
+  FullScoreReturn cached_ret(cached.FullScore(in, word, cached_out));
+  BOOST_CHECK_EQUAL(model_ret.prob, cached_ret.prob);
+  BOOST_CHECK_EQUAL(model_ret.ngram_length, cached_ret.ngram_length);
+  BOOST_CHECK_EQUAL(model_ret.independent_left, cached_ret.independent_left);
+  if (!model_ret.independent_left) BOOST_CHECK_EQUAL(model_ret.extend_left, cached_ret.extend_left);
+  BOOST_CHECK_EQUAL(model_ret.rest, cached_ret.rest);
+  BOOST_REQUIRE(model_out == cached_out);
+  for (unsigned char i = 0; i < model_out.length; ++i) {
+    BOOST_CHECK_EQUAL(model_out.backoff[i], cached_out.backoff[i]);
+  }
+}
+
+// Every word after every context along a sentence, for two passes.
+template <class M> void Exhaustive(std::size_t entries) {
+  Config config;
+  config.messages = NULL;
+  M model(FileLocation(), config);
+  CachedModel<M> cached(model, entries);
+  const char *const kSentence[] = {"looking", "on", "a", "little", "more", "loin", "</s>"};
+  std::vector<State> contexts(1, model.BeginSentenceState());
+  for (std::size_t i = 0; i < sizeof(kSentence) / sizeof(const char*); ++i) {
+    State out;
+    model.FullScore(contexts.back(), model.GetVocabulary().Index(kSentence[i]), out);
+    contexts.push_back(out);
+  }
+  contexts.push_back(model.NullContextState());
+  WordIndex bound = model.GetVocabulary().Bound();
+  for (unsigned int pass = 0; pass < 2; ++pass) {
+    for (std::vector<State>::const_iterator c = contexts.begin(); c != contexts.end(); ++c) {
+      for (WordIndex word = 0; word < bound; ++word) {
+        CheckSame(model, cached, *c, word);
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(2 * contexts.size() * bound, cached.Hits() + cached.Misses());
+  if (entries >= contexts.size() * bound) {
+    // Everything fits, though sets may still conflict.  Distinct contexts could collide, so be loose.
+    BOOST_CHECK(cached.Hits() >= contexts.size() * bound / 2);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ProbingSame) {
+  Exhaustive<ProbingModel>(1 << 12);
+}
+BOOST_AUTO_TEST_CASE(ProbingTiny) {
+  Exhaustive<ProbingModel>(CachedModel<ProbingModel>::kWays);
+}
+BOOST_AUTO_TEST_CASE(TrieSame) {
+  Exhaustive<TrieModel>(1 << 12);
+}
+BOOST_AUTO_TEST_CASE(QuantTrieSame) {
+  Exhaustive<QuantTrieModel>(64);
+}
+
+// A hit returns the extend_left that ExtendLeft needs.
+BOOST_AUTO_TEST_CASE(HitExtendLeft) {
+  Config config;
+  config.messages = NULL;
+  ProbingModel model(FileLocation(), config);
+  CachedModel<ProbingModel> cached(model, 1 << 12);
+  const WordIndex little = model.GetVocabulary().Index("little");
+  State out;
+  // "a little" is in the model, so the unigram "little" can extend left.
+  FullScoreReturn expect(model.FullScore(model.NullContextState(), little, out));
+  BOOST_REQUIRE(!expect.independent_left);
+  cached.FullScore(model.NullContextState(), little, out);
+  BOOST_CHECK_EQUAL(0U, cached.Hits());
+  FullScoreReturn hit(cached.FullScore(model.NullContextState(), little, out));
+  BOOST_REQUIRE_EQUAL(1U, cached.Hits());
+  BOOST_CHECK(!hit.independent_left);
+  BOOST_CHECK_EQUAL(expect.extend_left, hit.extend_left);
+
+  const WordIndex a = model.GetVocabulary().Index("a");
+  float backoff_in = 0.0, backoff_out[KENLM_MAX_ORDER - 1];
+  unsigned char next_use;
+  FullScoreReturn extended(model.ExtendLeft(&a, &a + 1, &backoff_in, hit.extend_left, 1, backoff_out, next_use));
+  BOOST_CHECK_EQUAL(2, extended.ngram_length);
+}
+
+// With a single set, the least recently used entry goes first.
+BOOST_AUTO_TEST_CASE(LeastRecentlyUsed) {
+  Config config;
+  config.messages = NULL;
+  ProbingModel model(FileLocation(), config);
+  const std::size_t kWays = CachedModel<ProbingModel>::kWays;
+  CachedModel<ProbingModel> cached(model, kWays);
+  const State &begin = model.BeginSentenceState();
+  State out;
+  for (WordIndex w = 1; w <= kWays; ++w) {
+    cached.FullScore(begin, w, out);
+  }
+  BOOST_CHECK_EQUAL(0U, cached.Hits());
+  BOOST_CHECK_EQUAL(kWays, cached.Misses());
+  // Touch 1 so 2 is the oldest.
+  cached.FullScore(begin, 1, out);
+  BOOST_CHECK_EQUAL(1U, cached.Hits());
+  cached.FullScore(begin, kWays + 1, out);
+  cached.ResetCounts();
+  cached.FullScore(begin, 1, out);
+  BOOST_CHECK_EQUAL(1U, cached.Hits());
+  cached.FullScore(begin, 2, out);
+  BOOST_CHECK_EQUAL(1U, cached.Misses());
+
+  cached.Clear();
+  cached.ResetCounts();
+  cached.FullScore(begin, 1, out);
+  BOOST_CHECK_EQUAL(0U, cached.Hits());
+  BOOST_CHECK_EQUAL(0.0, cached.HitRate());
+}
+
+} // namespace
+} // namespace ngram
+} // namespace lm
@@ -2,9 +2,11 @@
 #define LM_COMMON_COMPARE_H
 
 #include "lm/word_index.hh"
+#include "util/stream/radix_sort.hh"
 
 #include <functional>
 #include <string>
+#include <vector>
 
 namespace lm {
 
@@ -81,6 +83,12 @@ class SuffixOrder : public Comparator<SuffixOrder> {
       return lhs[0] < rhs[0];
     }
 
+    /** Word positions from most to least significant, for radix sort. */
+    void Significance(std::vector<std::size_t> &words) const {
+      words.clear();
+      for (std::size_t i = order_; i != 0; --i) words.push_back(i - 1);
+    }
+
     static const unsigned kMatchOffset = 1;
 };
 
@@ -125,6 +133,13 @@ class ContextOrder : public Comparator<ContextOrder> {
       }
       return lhs[order_ - 1] < rhs[order_ - 1];
     }
+
+    /** Word positions from most to least significant, for radix sort. */
+    void Significance(std::vector<std::size_t> &words) const {
+      words.clear();
+      for (std::size_t i = order_ - 1; i != 0; --i) words.push_back(i - 1);
+      words.push_back(order_ - 1);
+    }
 };
 
 /**
@@ -166,9 +181,37 @@ class PrefixOrder : public Comparator<PrefixOrder> {
       return false;
     }
 
+    /** Word positions from most to least significant, for radix sort. */
+    void Significance(std::vector<std::size_t> &words) const {
+      words.clear();
+      for (std::size_t i = 0; i < order_; ++i) words.push_back(i);
+    }
+
     static const unsigned kMatchOffset = 0;
 };
 
 } // namespace lm
 
+namespace util { namespace stream {
+// Let BlockSorter radix sort n-grams.
+template <> struct WordOrder<lm::SuffixOrder> {
+  static bool Get(const lm::SuffixOrder &compare, std::vector<std::size_t> &words) {
+    compare.Significance(words);
+    return sizeof(lm::WordIndex) == sizeof(uint32_t);
+  }
+};
+template <> struct WordOrder<lm::ContextOrder> {
+  static bool Get(const lm::ContextOrder &compare, std::vector<std::size_t> &words) {
+    compare.Significance(words);
+    return sizeof(lm::WordIndex) == sizeof(uint32_t);
+  }
+};
+template <> struct WordOrder<lm::PrefixOrder> {
+  static bool Get(const lm::PrefixOrder &compare, std::vector<std::size_t> &words) {
+    compare.Significance(words);
+    return sizeof(lm::WordIndex) == sizeof(uint32_t);
+  }
+};
+}} // namespaces
+
 #endif // LM_COMMON_COMPARE_H
@@ -0,0 +1,76 @@
+#include "lm/common/compare.hh"
+#include "util/scoped.hh"
+#include "util/sized_iterator.hh"
+#include "util/stream/radix_sort.hh"
+#include "util/usage.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+
+namespace lm {
+namespace {
+
+// Records shaped like lmplz's: order words then an 8-byte payload.
+void Fill(uint8_t *begin, std::size_t entries, std::size_t order, std::size_t entry_size) {
+  uint64_t state = 1;
+  for (uint8_t *i = begin; i != begin + entries * entry_size; i += entry_size) {
+    WordIndex *words = reinterpret_cast<WordIndex*>(i);
+    for (std::size_t w = 0; w < order; ++w) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      // Roughly Zipfian over a million words.
+      uint64_t value = (state >> 33) % 1000;
+      words[w] = static_cast<WordIndex>(value * value);
+    }
+    memcpy(i + order * sizeof(WordIndex), &state, sizeof(uint64_t));
+  }
+}
+
+template <class Compare> void Run(const char *name, std::size_t entries, std::size_t order, std::size_t threads) {
+  const std::size_t entry_size = order * sizeof(WordIndex) + sizeof(uint64_t);
+  util::scoped_malloc compared(util::MallocOrThrow(entries * entry_size)), radixed(util::MallocOrThrow(entries * entry_size));
+  uint8_t *compared_begin = static_cast<uint8_t*>(compared.get()), *radixed_begin = static_cast<uint8_t*>(radixed.get());
+  Fill(compared_begin, entries, order, entry_size);
+  memcpy(radixed_begin, compared_begin, entries * entry_size);
+  Compare compare(order);
+
+  double start = util::CPUTime();
+  std::sort(util::SizedIt(compared_begin, entry_size), util::SizedIt(compared_begin + entries * entry_size, entry_size), util::SizedCompare<Compare>(compare));
+  double sort_time = util::CPUTime() - start;
+
+  std::vector<std::size_t> words;
+  util::stream::WordOrder<Compare>::Get(compare, words);
+  double wall = util::WallTime();
+  start = util::CPUTime();
+  util::stream::RadixSort(radixed_begin, radixed_begin + entries * entry_size, entry_size, words, compare, threads);
+  double radix_time = util::CPUTime() - start;
+  wall = util::WallTime() - wall;
+
+  for (std::size_t i = 0; i < entries * entry_size; i += entry_size) {
+    if (memcmp(compared_begin + i, radixed_begin + i, order * sizeof(WordIndex))) {
+      std::cerr << name << ": radix sort disagrees with std::sort at entry " << (i / entry_size) << std::endl;
+      std::abort();
+    }
+  }
+  std::cout << name << ' ' << entries << " entries of order " << order << ": std::sort " << sort_time << "s CPU, radix sort " << radix_time << "s CPU " << wall << "s wall on " << threads << " threads." << std::endl;
+}
+
+} // namespace
+} // namespace lm
+
+int main(int argc, char *argv[]) {
+  if (argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " [entries] [order] [threads]" << std::endl;
+    return 1;
+  }
+  std::size_t entries = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+  std::size_t order = argc > 2 ? strtoull(argv[2], NULL, 10) : 5;
+  std::size_t threads = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+  lm::Run<lm::SuffixOrder>("SuffixOrder", entries, order, threads);
+  lm::Run<lm::ContextOrder>("ContextOrder", entries, order, threads);
+  lm::Run<lm::PrefixOrder>("PrefixOrder", entries, order, threads);
+}
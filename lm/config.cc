@@ -14,17 +14,22 @@ Config::Config() :
   positive_log_probability(THROW_UP),
   unknown_missing_logprob(-100.0),
   probing_multiplier(1.5),
+  fingerprint_bits(16),
   building_memory(1073741824ULL), // 1 GB
   temporary_directory_prefix(""),
+  load_threads(1),
+  phase_timer(NULL),
   arpa_complain(ALL),
   write_mmap(NULL),
   write_method(WRITE_AFTER),
   include_vocab(true),
+  compress_level(0),
   rest_function(REST_MAX),
   prob_bits(8),
   backoff_bits(8),
   pointer_bhiksha_bits(22),
-  load_method(util::POPULATE_OR_READ) {}
+  load_method(util::POPULATE_OR_READ),
+  load_node(-1) {}
 
 } // namespace ngram
 } // namespace lm
@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 
+namespace util { class PhaseTimer; }
+
 /* Configuration for ngram model.  Separate header to reduce pollution. */
 
 namespace lm {
@@ -60,6 +62,11 @@ struct Config {
   // TrieModel which has lower memory consumption.
   float probing_multiplier;
 
+  // Bits of each n-gram's hash stored by the fingerprint probing model in
+  // place of the 64-bit key: 8, 16, 24, or 32.  Fewer bits save memory but
+  // absent n-grams are more likely to match a stored one.
+  uint8_t fingerprint_bits;
+
   // Amount of memory to use for building.  The actual memory usage will be
   // higher since this just sets sort buffer size.  Only applies to trie
   // models.
@@ -71,6 +78,17 @@ struct Config {
   // defaults to input file name.
   std::string temporary_directory_prefix;
 
+  // Threads that parse n-grams of order 2 and above.  Lines are still read
+  // and n-grams inserted in file order by the calling thread, so the model
+  // does not depend on this.  1 parses on the calling thread.  Binary files
+  // loaded with util::PREFETCH use this many background threads.
+  unsigned int load_threads;
+
+  // If not NULL, loading from ARPA finishes a phase here after the unigrams,
+  // each order, and each later step of building.  Config does not take
+  // ownership.
+  util::PhaseTimer *phase_timer;
+
   // Level of complaining to do when loading from ARPA instead of binary format.
   enum ARPALoadComplain {ALL, EXPENSIVE, NONE};
   ARPALoadComplain arpa_complain;
@@ -88,6 +106,12 @@ struct Config {
   // Include the vocab in the binary file?  Only effective if write_mmap != NULL.
   bool include_vocab;
 
+  // If 1-9, gzip the binary file at this level in independently compressed
+  // blocks to save disk and network.  Loading decompresses the blocks in
+  // parallel into memory with the same layout, regardless of load_method.
+  // 0 (default) writes an uncompressed file that can be mapped.
+  int compress_level;
+
 
   // Left rest options.  Only used when the model includes rest costs.
   enum RestFunction {
@@ -114,6 +138,10 @@ struct Config {
   // See util/mmap.hh for details of MapMethod.
   util::LoadMethod load_method;
 
+  // NUMA node for load_method NODE_READ or -1 for the node of the loading
+  // thread.  Replicate a model by loading it once per node.
+  int load_node;
+
 
   // Set defaults.
   Config();
@@ -31,6 +31,42 @@ int main(int argc, char *argv[]) {
     case lm::ngram::REST_PROBING:
       Query<lm::ngram::RestProbingModel>(name);
       break;
+    case lm::ngram::BUCKET_PROBING:
+      Query<lm::ngram::BucketProbingModel>(name);
+      break;
+    case lm::ngram::REST_BUCKET_PROBING:
+      Query<lm::ngram::RestBucketProbingModel>(name);
+      break;
+    case lm::ngram::FINGERPRINT_PROBING:
+      Query<lm::ngram::FingerprintProbingModel>(name);
+      break;
+    case lm::ngram::REST_FINGERPRINT_PROBING:
+      Query<lm::ngram::RestFingerprintProbingModel>(name);
+      break;
+    case lm::ngram::PERFECT_HASH:
+      Query<lm::ngram::PerfectHashModel>(name);
+      break;
+    case lm::ngram::REST_PERFECT_HASH:
+      Query<lm::ngram::RestPerfectHashModel>(name);
+      break;
+    case lm::ngram::EYTZINGER_TRIE:
+      Query<lm::ngram::EytzingerTrieModel>(name);
+      break;
+    case lm::ngram::QUANT_EYTZINGER_TRIE:
+      Query<lm::ngram::QuantEytzingerTrieModel>(name);
+      break;
+    case lm::ngram::ARRAY_EYTZINGER_TRIE:
+      Query<lm::ngram::ArrayEytzingerTrieModel>(name);
+      break;
+    case lm::ngram::QUANT_ARRAY_EYTZINGER_TRIE:
+      Query<lm::ngram::QuantArrayEytzingerTrieModel>(name);
+      break;
+    case lm::ngram::ELIAS_FANO_TRIE:
+      Query<lm::ngram::EliasFanoTrieModel>(name);
+      break;
+    case lm::ngram::QUANT_ELIAS_FANO_TRIE:
+      Query<lm::ngram::QuantEliasFanoTrieModel>(name);
+      break;
     default:
       std::cerr << "Model type not supported yet." << std::endl;
   }
@@ -1,13 +1,26 @@
+#include "lm/cached_model.hh"
 #include "lm/model.hh"
 #include "util/fake_ofstream.hh"
 #include "util/file.hh"
 #include "util/file_piece.hh"
+#include "util/mmap.hh"
 #include "util/usage.hh"
 
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace {
 
+struct GreaterScore {
+  bool operator()(const std::pair<float, lm::ngram::State> &first, const std::pair<float, lm::ngram::State> &second) const {
+    return first.first > second.first;
+  }
+};
+
 template <class Model, class Width> void ConvertToBytes(const Model &model, int fd_in) {
   util::FilePiece in(fd_in);
   util::FakeOFStream out(1);
@@ -62,53 +75,247 @@ template <class Model, class Width> void QueryFromBytes(const Model &model, int
   std::cout << "CPU_excluding_load: " << (util::CPUTime() - loaded) << " CPU_per_query: " << ((util::CPUTime() - loaded) / static_cast<double>(completed)) << std::endl;
 }
 
-template <class Model, class Width> void DispatchFunction(const Model &model, bool query) {
-  if (query) {
+/* Split the text into kLanes contiguous streams and score them in lockstep,
+ * as a decoder would with many hypotheses.  Each step either calls FullScore
+ * once per lane or FullScoreBatch once for all lanes.
+ */
+template <class Model, class Width> float ScoreLanes(const Model &model, const std::vector<Width> &text, bool batch) {
+  const std::size_t kLanes = 64;
+  const Width kEOS = model.GetVocabulary().EndSentence();
+  const lm::ngram::State &begin_state = model.BeginSentenceState();
+  std::size_t lane_size = (text.size() + kLanes - 1) / kLanes;
+  std::vector<lm::ngram::State> in(kLanes, begin_state), out(kLanes);
+  std::vector<lm::FullScoreReturn> ret(kLanes);
+  std::vector<lm::WordIndex> words(kLanes);
+  float sum = 0.0;
+  for (std::size_t offset = 0; offset < lane_size; ++offset) {
+    std::size_t lanes = 0;
+    for (; lanes < kLanes && lanes * lane_size + offset < text.size(); ++lanes) {
+      words[lanes] = text[lanes * lane_size + offset];
+    }
+    if (batch) {
+      model.FullScoreBatch(&in[0], &words[0], &out[0], &ret[0], lanes);
+    } else {
+      for (std::size_t l = 0; l < lanes; ++l) {
+        ret[l] = model.FullScore(in[l], words[l], out[l]);
+      }
+    }
+    for (std::size_t l = 0; l < lanes; ++l) {
+      sum += ret[l].prob;
+      in[l] = (words[l] == kEOS) ? begin_state : out[l];
+    }
+  }
+  return sum;
+}
+
+template <class Model, class Width> void CompareBatch(const Model &model, int fd_in) {
+  std::vector<Width> text;
+  Width buf[4096];
+  while (std::size_t got = util::ReadOrEOF(fd_in, buf, sizeof(buf))) {
+    UTIL_THROW_IF2(got % sizeof(Width), "File size not a multiple of vocab id size " << sizeof(Width));
+    text.insert(text.end(), buf, buf + got / sizeof(Width));
+  }
+
+  double start = util::CPUTime();
+  float scalar_sum = ScoreLanes<Model, Width>(model, text, false);
+  double scalar = util::CPUTime() - start;
+
+  start = util::CPUTime();
+  float batch_sum = ScoreLanes<Model, Width>(model, text, true);
+  double batch = util::CPUTime() - start;
+
+  std::cerr << "Probability sums are " << scalar_sum << " scalar and " << batch_sum << " batch" << std::endl;
+  std::cout << "CPU_scalar: " << scalar << " CPU_per_query: " << (scalar / static_cast<double>(text.size())) << '\n'
+    << "CPU_batch: " << batch << " CPU_per_query: " << (batch / static_cast<double>(text.size())) << std::endl;
+}
+
+/* Replays the queries of a beam search decoder over each sentence.  Every
+ * hypothesis in the beam tries the next few words of the sentence, as a
+ * decoder would try several translation options, and the best distinct states
+ * survive.  Hypotheses that share a context repeat the same queries, which is
+ * what CachedModel is for.  Returns the sum of the best score of each sentence.
+ */
+template <class Model, class Width> float ReplayTrace(const Model &model, const std::vector<Width> &text) {
+  const std::size_t kBeam = 16, kOptions = 4;
+  const Width kEOS = model.GetVocabulary().EndSentence();
+  typedef std::pair<float, lm::ngram::State> Hypothesis;
+  std::vector<Hypothesis> beam, next;
+  float sum = 0.0;
+  for (typename std::vector<Width>::const_iterator sentence = text.begin(); sentence != text.end();) {
+    typename std::vector<Width>::const_iterator end = std::find(sentence, text.end(), kEOS);
+    if (end != text.end()) ++end;
+    beam.assign(1, Hypothesis(0.0, model.BeginSentenceState()));
+    for (typename std::vector<Width>::const_iterator word = sentence; word != end; ++word) {
+      next.clear();
+      for (typename std::vector<Hypothesis>::const_iterator hyp = beam.begin(); hyp != beam.end(); ++hyp) {
+        for (typename std::vector<Width>::const_iterator option = word; option != end && option != word + kOptions; ++option) {
+          next.push_back(Hypothesis(hyp->first, lm::ngram::State()));
+          next.back().first += model.FullScore(hyp->second, *option, next.back().second).prob;
+        }
+      }
+      // Best first, then recombine hypotheses with the same state.
+      std::sort(next.begin(), next.end(), GreaterScore());
+      beam.clear();
+      for (typename std::vector<Hypothesis>::const_iterator hyp = next.begin(); hyp != next.end() && beam.size() < kBeam; ++hyp) {
+        bool seen = false;
+        for (typename std::vector<Hypothesis>::const_iterator b = beam.begin(); b != beam.end() && !seen; ++b) {
+          seen = (b->second == hyp->second);
+        }
+        if (!seen) beam.push_back(*hyp);
+      }
+    }
+    sum += beam.front().first;
+    sentence = end;
+  }
+  return sum;
+}
+
+template <class Model, class Width> void CompareCache(const Model &model, int fd_in) {
+  std::vector<Width> text;
+  Width buf[4096];
+  while (std::size_t got = util::ReadOrEOF(fd_in, buf, sizeof(buf))) {
+    UTIL_THROW_IF2(got % sizeof(Width), "File size not a multiple of vocab id size " << sizeof(Width));
+    text.insert(text.end(), buf, buf + got / sizeof(Width));
+  }
+
+  double start = util::CPUTime();
+  float uncached_sum = ReplayTrace<Model, Width>(model, text);
+  double uncached = util::CPUTime() - start;
+
+  lm::ngram::CachedModel<Model> cached_model(model);
+  start = util::CPUTime();
+  float cached_sum = ReplayTrace<lm::ngram::CachedModel<Model>, Width>(cached_model, text);
+  double cached = util::CPUTime() - start;
+
+  uint64_t queries = cached_model.Hits() + cached_model.Misses();
+  std::cerr << "Best score sums are " << uncached_sum << " uncached and " << cached_sum << " cached" << std::endl;
+  std::cout << "Queries: " << queries << " Hits: " << cached_model.Hits() << " Hit_rate: " << cached_model.HitRate() << '\n'
+    << "CPU_uncached: " << uncached << " CPU_per_query: " << (uncached / static_cast<double>(queries)) << '\n'
+    << "CPU_cached: " << cached << " CPU_per_query: " << (cached / static_cast<double>(queries)) << std::endl;
+}
+
+// Models being compared score the same ids, read from stdin once.
+struct Comparison {
+  Comparison() : width(0) {}
+  std::string text;
+  std::size_t width;
+  double queries_per_second;
+};
+
+// Best of several passes over text, as CPU time is noisy.
+template <class Model, class Width> double QueriesPerSecond(const Model &model, Comparison &compare) {
+  UTIL_THROW_IF2(compare.width && compare.width != sizeof(Width), "Compared models must share a vocabulary");
+  compare.width = sizeof(Width);
+  UTIL_THROW_IF2(compare.text.size() % sizeof(Width), "File size not a multiple of vocab id size " << sizeof(Width));
+  std::vector<Width> text(compare.text.size() / sizeof(Width));
+  if (text.empty()) return 0.0;
+  memcpy(&text[0], compare.text.data(), compare.text.size());
+  const Width kEOS = model.GetVocabulary().EndSentence();
+  const lm::ngram::State *const begin_state = &model.BeginSentenceState();
+  lm::ngram::State state[2];
+  double best = 0.0;
+  for (unsigned int pass = 0; pass < 3; ++pass) {
+    const lm::ngram::State *in = begin_state;
+    float sum = 0.0;
+    double start = util::CPUTime();
+    for (std::size_t i = 0; i < text.size(); ++i) {
+      lm::ngram::State &out = state[i & 1];
+      sum += model.FullScore(*in, text[i], out).prob;
+      in = (text[i] == kEOS) ? begin_state : &out;
+    }
+    double elapsed = util::CPUTime() - start;
+    if (!pass) std::cerr << "Probability sum is " << sum << std::endl;
+    if (elapsed > 0.0) best = std::max(best, static_cast<double>(text.size()) / elapsed);
+  }
+  return best;
+}
+
+template <class Model, class Width> void DispatchFunction(const Model &model, const char *mode, Comparison *compare) {
+  if (!strcmp(mode, "query")) {
     QueryFromBytes<Model, Width>(model, 0);
+  } else if (!strcmp(mode, "batch")) {
+    CompareBatch<Model, Width>(model, 0);
+  } else if (!strcmp(mode, "cache")) {
+    CompareCache<Model, Width>(model, 0);
+  } else if (!strcmp(mode, "compare")) {
+    compare->queries_per_second = QueriesPerSecond<Model, Width>(model, *compare);
   } else {
     ConvertToBytes<Model, Width>(model, 0);
   }
 }
 
-template <class Model> void DispatchWidth(const char *file, bool query) {
-  lm::ngram::Config config;
-  config.load_method = util::READ;
-  std::cerr << "Using load_method = READ." << std::endl;
+template <class Model> void DispatchWidth(const char *file, const char *mode, const lm::ngram::Config &config, Comparison *compare) {
   Model model(file, config);
   lm::WordIndex bound = model.GetVocabulary().Bound();
   if (bound <= 256) {
-    DispatchFunction<Model, uint8_t>(model, query);
+    DispatchFunction<Model, uint8_t>(model, mode, compare);
   } else if (bound <= 65536) {
-    DispatchFunction<Model, uint16_t>(model, query);
+    DispatchFunction<Model, uint16_t>(model, mode, compare);
   } else if (bound <= (1ULL << 32)) {
-    DispatchFunction<Model, uint32_t>(model, query);
+    DispatchFunction<Model, uint32_t>(model, mode, compare);
   } else {
-    DispatchFunction<Model, uint64_t>(model, query);
+    DispatchFunction<Model, uint64_t>(model, mode, compare);
   }
 }
 
-void Dispatch(const char *file, bool query) {
+void Dispatch(const char *file, const char *mode, const lm::ngram::Config &config, Comparison *compare = NULL) {
   using namespace lm::ngram;
   lm::ngram::ModelType model_type;
   if (lm::ngram::RecognizeBinary(file, model_type)) {
     switch(model_type) {
       case PROBING:
-        DispatchWidth<lm::ngram::ProbingModel>(file, query);
+        DispatchWidth<lm::ngram::ProbingModel>(file, mode, config, compare);
         break;
       case REST_PROBING:
-        DispatchWidth<lm::ngram::RestProbingModel>(file, query);
+        DispatchWidth<lm::ngram::RestProbingModel>(file, mode, config, compare);
         break;
       case TRIE:
-        DispatchWidth<lm::ngram::TrieModel>(file, query);
+        DispatchWidth<lm::ngram::TrieModel>(file, mode, config, compare);
         break;
       case QUANT_TRIE:
-        DispatchWidth<lm::ngram::QuantTrieModel>(file, query);
+        DispatchWidth<lm::ngram::QuantTrieModel>(file, mode, config, compare);
         break;
       case ARRAY_TRIE:
-        DispatchWidth<lm::ngram::ArrayTrieModel>(file, query);
+        DispatchWidth<lm::ngram::ArrayTrieModel>(file, mode, config, compare);
         break;
       case QUANT_ARRAY_TRIE:
-        DispatchWidth<lm::ngram::QuantArrayTrieModel>(file, query);
+        DispatchWidth<lm::ngram::QuantArrayTrieModel>(file, mode, config, compare);
+        break;
+      case BUCKET_PROBING:
+        DispatchWidth<lm::ngram::BucketProbingModel>(file, mode, config, compare);
+        break;
+      case REST_BUCKET_PROBING:
+        DispatchWidth<lm::ngram::RestBucketProbingModel>(file, mode, config, compare);
+        break;
+      case FINGERPRINT_PROBING:
+        DispatchWidth<lm::ngram::FingerprintProbingModel>(file, mode, config, compare);
+        break;
+      case REST_FINGERPRINT_PROBING:
+        DispatchWidth<lm::ngram::RestFingerprintProbingModel>(file, mode, config, compare);
+        break;
+      case PERFECT_HASH:
+        DispatchWidth<lm::ngram::PerfectHashModel>(file, mode, config, compare);
+        break;
+      case REST_PERFECT_HASH:
+        DispatchWidth<lm::ngram::RestPerfectHashModel>(file, mode, config, compare);
+        break;
+      case EYTZINGER_TRIE:
+        DispatchWidth<lm::ngram::EytzingerTrieModel>(file, mode, config, compare);
+        break;
+      case QUANT_EYTZINGER_TRIE:
+        DispatchWidth<lm::ngram::QuantEytzingerTrieModel>(file, mode, config, compare);
+        break;
+      case ARRAY_EYTZINGER_TRIE:
+        DispatchWidth<lm::ngram::ArrayEytzingerTrieModel>(file, mode, config, compare);
+        break;
+      case QUANT_ARRAY_EYTZINGER_TRIE:
+        DispatchWidth<lm::ngram::QuantArrayEytzingerTrieModel>(file, mode, config, compare);
+        break;
+      case ELIAS_FANO_TRIE:
+        DispatchWidth<lm::ngram::EliasFanoTrieModel>(file, mode, config, compare);
+        break;
+      case QUANT_ELIAS_FANO_TRIE:
+        DispatchWidth<lm::ngram::QuantEliasFanoTrieModel>(file, mode, config, compare);
         break;
       default:
         UTIL_THROW(util::Exception, "Unrecognized kenlm model type " << model_type);
@@ -118,10 +325,44 @@ void Dispatch(const char *file, bool query) {
   }
 }
 
+void Compare(const char *model, const char *baseline, const lm::ngram::Config &config) {
+  Comparison compare;
+  char buf[4096];
+  while (std::size_t got = util::ReadOrEOF(0, buf, sizeof(buf))) {
+    compare.text.append(buf, got);
+  }
+  Dispatch(model, "compare", config, &compare);
+  double model_qps = compare.queries_per_second;
+  Dispatch(baseline, "compare", config, &compare);
+  double baseline_qps = compare.queries_per_second;
+  std::cout << "Queries_per_second: " << model_qps << " " << model << '\n'
+    << "Queries_per_second: " << baseline_qps << " " << baseline << '\n'
+    << "Ratio: " << (model_qps / baseline_qps) << std::endl;
+}
+
 } // namespace
 
 int main(int argc, char *argv[]) {
-  if (argc != 3 || (strcmp(argv[1], "vocab") && strcmp(argv[1], "query"))) {
+  lm::ngram::Config config;
+  config.load_method = util::READ;
+  const char *load = "read";
+  if (argc >= 3 && !strcmp(argv[1], "-l")) {
+    load = argv[2];
+    if (!util::ParseLoadMethod(load, config.load_method, config.load_node)) {
+      std::cerr << "Unknown load method " << load << std::endl;
+      return 1;
+    }
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+  std::cerr << "Using load method " << load << "." << std::endl;
+  if (argc == 4 && !strcmp(argv[1], "compare")) {
+    Compare(argv[2], argv[3], config);
+    util::PrintUsage(std::cerr);
+    return 0;
+  }
+  if (argc != 3 || (strcmp(argv[1], "vocab") && strcmp(argv[1], "query") && strcmp(argv[1], "batch") && strcmp(argv[1], "cache"))) {
     std::cerr
       << "Benchmark program for KenLM.  Intended usage:\n"
       << "#Convert text to vocabulary ids offline.  These ids are tied to a model.\n"
@@ -129,10 +370,21 @@ int main(int argc, char *argv[]) {
       << "#Ensure files are in RAM.\n"
       << "cat $text.vocab $model >/dev/null\n"
       << "#Timed query against the model, including loading.\n"
-      << "time " << argv[0] << " query $model <$text.vocab\n";
+      << "time " << argv[0] << " query $model <$text.vocab\n"
+      << "#Compare FullScore with FullScoreBatch on interleaved sentences.\n"
+      << argv[0] << " batch $model <$text.vocab\n"
+      << "#Replay beam search queries with and without CachedModel.\n"
+      << argv[0] << " cache $model <$text.vocab\n"
+      << "#Queries per second of two models with the same vocabulary, such as trie\n"
+      << "#and eytzinger built from one ARPA file.\n"
+      << argv[0] << " compare $model $baseline <$text.vocab\n"
+      << "#Any of these can start with -l to choose how to load models, as in query:\n"
+      << "#lazy, populate, read (the default), parallel, huge, interleave, node[:N],\n"
+      << "#shared, or prefetch.\n"
+      << argv[0] << " -l interleave query $model <$text.vocab\n";
     return 1;
   }
-  Dispatch(argv[2], !strcmp(argv[1], "query"));
+  Dispatch(argv[2], argv[1], config);
   util::PrintUsage(std::cerr);
   return 0;
 }
@@ -0,0 +1,79 @@
+#include "lm/binary_format.hh"
+#include "util/exception.hh"
+#include "util/file.hh"
+#include "util/mmap.hh"
+#include "util/usage.hh"
+
+#include <iostream>
+
+#include <signal.h>
+#include <unistd.h>
+
+/* Copies a binary model into shared memory once, so that any number of
+ * decoder processes on the host can load it with -l shared (or
+ * util::SHARED) and use the same pages without copying or page faults from
+ * disk.  The shared copy lasts until this is interrupted or terminated.
+ */
+
+namespace {
+
+void Usage(const char *name) {
+  std::cerr <<
+    "Usage: " << name << " binary_model shared_path\n"
+    "Copies a binary model to shared_path, which should be on tmpfs such as\n"
+    "/dev/shm/model or on hugetlbfs for huge pages.  Load it from any process\n"
+    "with query -l shared shared_path or config.load_method = util::SHARED.\n"
+    "The copy is removed when this is interrupted or terminated.  Binaries\n"
+    "compressed with build_binary -z can not be shared.\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    Usage(argv[0]);
+    return 1;
+  }
+  const char *model = argv[1], *path = argv[2];
+  try {
+    lm::ngram::ModelType model_type;
+    UTIL_THROW_IF(!lm::ngram::RecognizeBinary(model, model_type), util::Exception, model << " is not a binary model.  Run build_binary first.");
+
+    // Blocked before anything else so that only sigwait sees them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    UTIL_THROW_IF(sigprocmask(SIG_BLOCK, &signals, NULL), util::ErrnoException, "sigprocmask failed");
+
+    double start = util::WallTime();
+    {
+      util::scoped_fd in(util::OpenReadOrThrow(model));
+      // Loading would decompress into private memory, so sharing it saves nothing.
+      UTIL_THROW_IF(lm::ngram::IsCompressedBinary(in.get()), util::Exception, model << " was compressed with build_binary -z, which can not be shared.  Share a binary built without -z.");
+      uint64_t size = util::SizeFile(in.get());
+      UTIL_THROW_IF(size == util::kBadSize, util::Exception, "Cannot tell the size of " << model);
+      util::scoped_fd out;
+      util::scoped_memory memory;
+      util::CreateShared(path, util::CheckOverflow(size), out, memory);
+      try {
+        util::ReadOrThrow(in.get(), memory.get(), size);
+        util::PublishShared(path);
+      } catch (...) {
+        util::AbandonShared(path);
+        throw;
+      }
+    }
+    std::cerr << "Shared " << model << " at " << path << " in " << (util::WallTime() - start) << " seconds.  Load it with -l shared " << path << " and interrupt this to remove it." << std::endl;
+
+    int got;
+    UTIL_THROW_IF(sigwait(&signals, &got), util::Exception, "sigwait failed");
+    UTIL_THROW_IF(unlink(path), util::ErrnoException, "while removing " << path);
+    std::cerr << "Removed " << path << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
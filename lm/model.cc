@@ -2,11 +2,13 @@
 
 #include "lm/blank.hh"
 #include "lm/lm_exception.hh"
+#include "lm/ngram_source.hh"
 #include "lm/search_hashed.hh"
 #include "lm/search_trie.hh"
 #include "lm/read_arpa.hh"
 #include "util/have.hh"
 #include "util/murmur_hash.hh"
+#include "util/usage.hh"
 
 #include <algorithm>
 #include <functional>
@@ -40,7 +42,9 @@ void ComplainAboutARPA(const Config &config, ModelType model_type) {
   if (config.arpa_complain == Config::ALL) {
     *config.messages << "Loading the LM will be faster if you build a binary file." << std::endl;
   } else if (config.arpa_complain == Config::EXPENSIVE &&
-             (model_type == TRIE || model_type == QUANT_TRIE || model_type == ARRAY_TRIE || model_type == QUANT_ARRAY_TRIE)) {
+             (model_type == TRIE || model_type == QUANT_TRIE || model_type == ARRAY_TRIE || model_type == QUANT_ARRAY_TRIE ||
+              model_type == EYTZINGER_TRIE || model_type == QUANT_EYTZINGER_TRIE || model_type == ARRAY_EYTZINGER_TRIE || model_type == QUANT_ARRAY_EYTZINGER_TRIE ||
+              model_type == ELIAS_FANO_TRIE || model_type == QUANT_ELIAS_FANO_TRIE)) {
     *config.messages << "Building " << kModelNames[model_type] << " from ARPA is expensive.  Save time by building a binary format." << std::endl;
   }
 }
@@ -75,7 +79,20 @@ template <class Search, class VocabularyT> GenericModel<Search, VocabularyT>::Ge
     ComplainAboutARPA(init_config, kModelType);
     InitializeFromARPA(fd.release(), file, init_config);
   }
+  InitializeStates();
+}
+
+template <class Search, class VocabularyT> GenericModel<Search, VocabularyT>::GenericModel(NGramSource &source, const Config &config) : backing_(config) {
+  try {
+    InitializeFrom(source, "", config);
+  } catch (util::Exception &e) {
+    e << " N-gram: " << source.Offset();
+    throw;
+  }
+  InitializeStates();
+}
 
+template <class Search, class VocabularyT> void GenericModel<Search, VocabularyT>::InitializeStates() {
   // g++ prints warnings unless these are fully initialized.
   State begin_sentence = State();
   begin_sentence.length = 1;
@@ -93,44 +110,60 @@ template <class Search, class VocabularyT> void GenericModel<Search, VocabularyT
   // Backing file is the ARPA.
   util::FilePiece f(fd, file, config.ProgressMessages());
   try {
-    std::vector<uint64_t> counts;
-    // File counts do not include pruned trigrams that extend to quadgrams etc.   These will be fixed by search_.
-    ReadARPACounts(f, counts);
-    CheckCounts(counts);
-    if (counts.size() < 2) UTIL_THROW(FormatLoadException, "This ngram implementation assumes at least a bigram model.");
-    if (config.probing_multiplier <= 1.0) UTIL_THROW(ConfigException, "probing multiplier must be > 1.0");
-
-    std::size_t vocab_size = util::CheckOverflow(VocabularyT::Size(counts[0], config));
-    // Setup the binary file for writing the vocab lookup table.  The search_ is responsible for growing the binary file to its needs.
-    vocab_.SetupMemory(backing_.SetupJustVocab(vocab_size, counts.size()), vocab_size, counts[0], config);
-
-    if (config.write_mmap && config.include_vocab) {
-      WriteWordsWrapper wrap(config.enumerate_vocab);
-      vocab_.ConfigureEnumerate(&wrap, counts[0]);
-      search_.InitializeFromARPA(file, f, counts, config, vocab_, backing_);
-      void *vocab_rebase, *search_rebase;
-      backing_.WriteVocabWords(wrap.Buffer(), vocab_rebase, search_rebase);
-      // Due to writing at the end of file, mmap may have relocated data.  So remap.
-      vocab_.Relocate(vocab_rebase);
-      search_.SetupMemory(reinterpret_cast<uint8_t*>(search_rebase), counts, config);
-    } else {
-      vocab_.ConfigureEnumerate(config.enumerate_vocab, counts[0]);
-      search_.InitializeFromARPA(file, f, counts, config, vocab_, backing_);
-    }
-
-    if (!vocab_.SawUnk()) {
-      assert(config.unknown_missing != THROW_UP);
-      // Default probabilities for unknown.
-      search_.UnknownUnigram().backoff = 0.0;
-      search_.UnknownUnigram().prob = config.unknown_missing_logprob;
-    }
-    backing_.FinishFile(config, kModelType, kVersion, counts);
+    InitializeFrom(f, file, config);
   } catch (util::Exception &e) {
     e << " Byte: " << f.Offset();
     throw;
   }
 }
 
+template <class Search, class VocabularyT> template <class File> void GenericModel<Search, VocabularyT>::InitializeFrom(File &f, const char *file, const Config &config) {
+  std::vector<uint64_t> counts;
+  // File counts do not include pruned trigrams that extend to quadgrams etc.   These will be fixed by search_.
+  ReadARPACounts(f, counts);
+  CheckCounts(counts);
+  if (counts.size() < 2) UTIL_THROW(FormatLoadException, "This ngram implementation assumes at least a bigram model.");
+  if (config.probing_multiplier <= 1.0) UTIL_THROW(ConfigException, "probing multiplier must be > 1.0");
+
+  std::size_t vocab_size = util::CheckOverflow(VocabularyT::Size(counts[0], config));
+  // Setup the binary file for writing the vocab lookup table.  The search_ is responsible for growing the binary file to its needs.
+  vocab_.SetupMemory(backing_.SetupJustVocab(vocab_size, counts.size()), vocab_size, counts[0], config);
+
+  if (config.write_mmap && config.include_vocab) {
+    WriteWordsWrapper wrap(config.enumerate_vocab);
+    vocab_.ConfigureEnumerate(&wrap, counts[0]);
+    search_.InitializeFromARPA(file, f, counts, config, vocab_, backing_);
+    void *vocab_rebase, *search_rebase;
+    backing_.WriteVocabWords(wrap.Buffer(), vocab_rebase, search_rebase);
+    // Due to writing at the end of file, mmap may have relocated data.  So remap.
+    vocab_.Relocate(vocab_rebase);
+    search_.SetupMemory(reinterpret_cast<uint8_t*>(search_rebase), counts, config);
+  } else {
+    vocab_.ConfigureEnumerate(config.enumerate_vocab, counts[0]);
+    search_.InitializeFromARPA(file, f, counts, config, vocab_, backing_);
+  }
+
+  if (!vocab_.SawUnk()) {
+    assert(config.unknown_missing != THROW_UP);
+    // Default probabilities for unknown.
+    search_.UnknownUnigram().backoff = 0.0;
+    search_.UnknownUnigram().prob = config.unknown_missing_logprob;
+  }
+  backing_.FinishFile(config, kModelType, kVersion, counts);
+  if (config.phase_timer) config.phase_timer->Finish("finish file");
+}
+
+namespace {
+// Do a paraonoid copy of history, assuming new_word has already been copied
+// (hence the -1).  out_state.length could be zero so I avoided using
+// std::copy.
+void CopyRemainingHistory(const WordIndex *from, State &out_state) {
+  WordIndex *out = out_state.words + 1;
+  const WordIndex *in_end = from + static_cast<ptrdiff_t>(out_state.length) - 1;
+  for (const WordIndex *in = from; in < in_end; ++in, ++out) *out = *in;
+}
+} // namespace
+
 template <class Search, class VocabularyT> FullScoreReturn GenericModel<Search, VocabularyT>::FullScore(const State &in_state, const WordIndex new_word, State &out_state) const {
   FullScoreReturn ret = ScoreExceptBackoff(in_state.words, in_state.words + in_state.length, new_word, out_state);
   for (const float *i = in_state.backoff + ret.ngram_length - 1; i < in_state.backoff + in_state.length; ++i) {
@@ -139,6 +172,92 @@ template <class Search, class VocabularyT> FullScoreReturn GenericModel<Search,
   return ret;
 }
 
+template <class Search, class VocabularyT> const std::size_t GenericModel<Search, VocabularyT>::kBatchWidth;
+
+template <class Search, class VocabularyT> void GenericModel<Search, VocabularyT>::FullScoreBatch(const State *in, const WordIndex *words, State *out, FullScoreReturn *ret, std::size_t n) const {
+  for (std::size_t i = 0; i < n; i += kBatchWidth) {
+    ScoreBatchGroup(in + i, words + i, out + i, ret + i, std::min(kBatchWidth, n - i));
+  }
+}
+
+/* Same logic as ScoreExceptBackoff and ResumeScore, but run in lockstep over
+ * the group one order at a time.  Each order makes two passes: the first
+ * issues prefetches for every query still active and the second does the
+ * lookups, by which time the lines are hopefully on their way.
+ */
+template <class Search, class VocabularyT> void GenericModel<Search, VocabularyT>::ScoreBatchGroup(const State *in, const WordIndex *words, State *out, FullScoreReturn *ret, std::size_t n) const {
+  typename Search::Node node[kBatchWidth];
+  bool active[kBatchWidth];
+  for (std::size_t i = 0; i < n; ++i) {
+    assert(words[i] < vocab_.Bound());
+    search_.PrefetchUnigram(words[i]);
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    ret[i].ngram_length = 1;
+    typename Search::UnigramPointer uni(search_.LookupUnigram(words[i], node[i], ret[i].independent_left, ret[i].extend_left));
+    out[i].backoff[0] = uni.Backoff();
+    ret[i].prob = uni.Prob();
+    ret[i].rest = uni.Rest();
+    out[i].length = HasExtension(out[i].backoff[0]) ? 1 : 0;
+    out[i].words[0] = words[i];
+    active[i] = in[i].length && !ret[i].independent_left;
+  }
+
+  unsigned char order_minus_2 = 0;
+  for (; order_minus_2 < P::Order() - 2; ++order_minus_2) {
+    bool any = false;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!active[i]) continue;
+      if (order_minus_2 >= in[i].length) {
+        active[i] = false;
+        continue;
+      }
+      search_.PrefetchMiddle(order_minus_2, in[i].words[order_minus_2], node[i]);
+      any = true;
+    }
+    if (!any) break;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!active[i]) continue;
+      typename Search::MiddlePointer pointer(search_.LookupMiddle(order_minus_2, in[i].words[order_minus_2], node[i], ret[i].independent_left, ret[i].extend_left));
+      if (!pointer.Found()) {
+        active[i] = false;
+        continue;
+      }
+      float *backoff_out = out[i].backoff + order_minus_2 + 1;
+      *backoff_out = pointer.Backoff();
+      ret[i].prob = pointer.Prob();
+      ret[i].rest = pointer.Rest();
+      ret[i].ngram_length = order_minus_2 + 2;
+      if (HasExtension(*backoff_out)) out[i].length = ret[i].ngram_length;
+      if (ret[i].independent_left) active[i] = false;
+    }
+  }
+
+  if (order_minus_2 == P::Order() - 2) {
+    for (std::size_t i = 0; i < n; ++i) {
+      if (active[i] && order_minus_2 < in[i].length)
+        search_.PrefetchLongest(in[i].words[order_minus_2], node[i]);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!active[i] || order_minus_2 >= in[i].length) continue;
+      ret[i].independent_left = true;
+      typename Search::LongestPointer longest(search_.LookupLongest(in[i].words[order_minus_2], node[i]));
+      if (longest.Found()) {
+        ret[i].prob = longest.Prob();
+        ret[i].rest = ret[i].prob;
+        ret[i].ngram_length = P::Order();
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < n; ++i) {
+    if (in[i].length) CopyRemainingHistory(in[i].words, out[i]);
+    for (const float *b = in[i].backoff + ret[i].ngram_length - 1; b < in[i].backoff + in[i].length; ++b) {
+      ret[i].prob += *b;
+    }
+  }
+}
+
 template <class Search, class VocabularyT> FullScoreReturn GenericModel<Search, VocabularyT>::FullScoreForgotState(const WordIndex *context_rbegin, const WordIndex *context_rend, const WordIndex new_word, State &out_state) const {
   context_rend = std::min(context_rend, context_rbegin + P::Order() - 1);
   FullScoreReturn ret = ScoreExceptBackoff(context_rbegin, context_rend, new_word, out_state);
@@ -226,17 +345,6 @@ template <class Search, class VocabularyT> FullScoreReturn GenericModel<Search,
   return ret;
 }
 
-namespace {
-// Do a paraonoid copy of history, assuming new_word has already been copied
-// (hence the -1).  out_state.length could be zero so I avoided using
-// std::copy.
-void CopyRemainingHistory(const WordIndex *from, State &out_state) {
-  WordIndex *out = out_state.words + 1;
-  const WordIndex *in_end = from + static_cast<ptrdiff_t>(out_state.length) - 1;
-  for (const WordIndex *in = from; in < in_end; ++in, ++out) *out = *in;
-}
-} // namespace
-
 /* Ugly optimized function.  Produce a score excluding backoff.
  * The search goes in increasing order of ngram length.
  * Context goes backward, so context_begin is the word immediately preceeding
@@ -318,10 +426,22 @@ template <class Search, class VocabularyT> float GenericModel<Search, Vocabulary
 
 template class GenericModel<HashedSearch<BackoffValue>, ProbingVocabulary>;
 template class GenericModel<HashedSearch<RestValue>, ProbingVocabulary>;
+template class GenericModel<HashedSearch<BackoffValue, BucketProbing>, ProbingVocabulary>;
+template class GenericModel<HashedSearch<RestValue, BucketProbing>, ProbingVocabulary>;
+template class GenericModel<HashedSearch<BackoffValue, FingerprintProbing>, ProbingVocabulary>;
+template class GenericModel<HashedSearch<RestValue, FingerprintProbing>, ProbingVocabulary>;
+template class GenericModel<HashedSearch<BackoffValue, PerfectHash>, ProbingVocabulary>;
+template class GenericModel<HashedSearch<RestValue, PerfectHash>, ProbingVocabulary>;
 template class GenericModel<trie::TrieSearch<DontQuantize, trie::DontBhiksha>, SortedVocabulary>;
 template class GenericModel<trie::TrieSearch<DontQuantize, trie::ArrayBhiksha>, SortedVocabulary>;
 template class GenericModel<trie::TrieSearch<SeparatelyQuantize, trie::DontBhiksha>, SortedVocabulary>;
 template class GenericModel<trie::TrieSearch<SeparatelyQuantize, trie::ArrayBhiksha>, SortedVocabulary>;
+template class GenericModel<trie::TrieSearch<DontQuantize, trie::EliasFanoBhiksha>, SortedVocabulary>;
+template class GenericModel<trie::TrieSearch<SeparatelyQuantize, trie::EliasFanoBhiksha>, SortedVocabulary>;
+template class GenericModel<trie::TrieSearch<DontQuantize, trie::DontBhiksha, trie::EytzingerSiblings>, SortedVocabulary>;
+template class GenericModel<trie::TrieSearch<DontQuantize, trie::ArrayBhiksha, trie::EytzingerSiblings>, SortedVocabulary>;
+template class GenericModel<trie::TrieSearch<SeparatelyQuantize, trie::DontBhiksha, trie::EytzingerSiblings>, SortedVocabulary>;
+template class GenericModel<trie::TrieSearch<SeparatelyQuantize, trie::ArrayBhiksha, trie::EytzingerSiblings>, SortedVocabulary>;
 
 } // namespace detail
 
@@ -340,6 +460,30 @@ base::Model *LoadVirtual(const char *file_name, const Config &config, ModelType
       return new ArrayTrieModel(file_name, config);
     case QUANT_ARRAY_TRIE:
       return new QuantArrayTrieModel(file_name, config);
+    case BUCKET_PROBING:
+      return new BucketProbingModel(file_name, config);
+    case REST_BUCKET_PROBING:
+      return new RestBucketProbingModel(file_name, config);
+    case FINGERPRINT_PROBING:
+      return new FingerprintProbingModel(file_name, config);
+    case REST_FINGERPRINT_PROBING:
+      return new RestFingerprintProbingModel(file_name, config);
+    case PERFECT_HASH:
+      return new PerfectHashModel(file_name, config);
+    case REST_PERFECT_HASH:
+      return new RestPerfectHashModel(file_name, config);
+    case EYTZINGER_TRIE:
+      return new EytzingerTrieModel(file_name, config);
+    case QUANT_EYTZINGER_TRIE:
+      return new QuantEytzingerTrieModel(file_name, config);
+    case ARRAY_EYTZINGER_TRIE:
+      return new ArrayEytzingerTrieModel(file_name, config);
+    case QUANT_ARRAY_EYTZINGER_TRIE:
+      return new QuantArrayEytzingerTrieModel(file_name, config);
+    case ELIAS_FANO_TRIE:
+      return new EliasFanoTrieModel(file_name, config);
+    case QUANT_ELIAS_FANO_TRIE:
+      return new QuantEliasFanoTrieModel(file_name, config);
     default:
       UTIL_THROW(FormatLoadException, "Confused by model type " << model_type);
   }
@@ -22,6 +22,7 @@
 namespace util { class FilePiece; }
 
 namespace lm {
+class NGramSource;
 namespace ngram {
 namespace detail {
 
@@ -50,12 +51,27 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
      */
     explicit GenericModel(const char *file, const Config &config = Config());
 
+    /* Build the model from n-grams that are not ARPA text, such as those
+     * lmplz estimated (see lm/ngram_source.hh).  Set config.write_mmap to
+     * save a binary file as when loading ARPA.  The trie puts temporary files
+     * at config.temporary_directory_prefix or else next to write_mmap.
+     */
+    GenericModel(NGramSource &source, const Config &config);
+
     /* Score p(new_word | in_state) and incorporate new_word into out_state.
      * Note that in_state and out_state must be different references:
      * &in_state != &out_state.
      */
     FullScoreReturn FullScore(const State &in_state, const WordIndex new_word, State &out_state) const;
 
+    /* Score many independent queries at once.  This is equivalent to
+     *   for (i = 0; i < n; ++i) ret[i] = FullScore(in[i], words[i], out[i]);
+     * but lookups are interleaved across the batch and each order is
+     * prefetched before it is probed, so memory latency overlaps.  The out
+     * array must not overlap the in array.
+     */
+    void FullScoreBatch(const State *in, const WordIndex *words, State *out, FullScoreReturn *ret, std::size_t n) const;
+
     /* Slower call without in_state.  Try to remember state, but sometimes it
      * would cost too much memory or your decoder isn't setup properly.
      * To use this function, make an array of WordIndex containing the context
@@ -93,6 +109,15 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
         // Amount of additional content that should be considered by the next call.
         unsigned char &next_use) const;
 
+    /* With load_method util::PREFETCH, the model is usable as soon as the
+     * constructor returns while background threads page it in.  This is the
+     * fraction in memory so far, which is 1 for other load methods.
+     */
+    double LoadProgress() const { return backing_.LoadProgress(); }
+
+    // Block until the model is fully in memory.
+    void WaitLoaded() const { backing_.WaitLoaded(); }
+
     /* Return probabilities minus rest costs for an array of pointers.  The
      * first length should be the length of the n-gram to which pointers_begin
      * points.
@@ -103,6 +128,12 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
     }
 
   private:
+    // Number of queries in flight at once in FullScoreBatch.
+    static const std::size_t kBatchWidth = 8;
+
+    // FullScoreBatch on at most kBatchWidth queries.
+    void ScoreBatchGroup(const State *in, const WordIndex *words, State *out, FullScoreReturn *ret, std::size_t n) const;
+
     FullScoreReturn ScoreExceptBackoff(const WordIndex *const context_rbegin, const WordIndex *const context_rend, const WordIndex new_word, State &out_state) const;
 
     // Score bigrams and above.  Do not include backoff.
@@ -113,6 +144,12 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
 
     void InitializeFromARPA(int fd, const char *file, const Config &config);
 
+    // Build from util::FilePiece (ARPA) or NGramSource.
+    template <class File> void InitializeFrom(File &f, const char *file, const Config &config);
+
+    // Set the begin sentence and null context states after loading.
+    void InitializeStates();
+
     float InternalUnRest(const uint64_t *pointers_begin, const uint64_t *pointers_end, unsigned char first_length) const;
 
     BinaryFormat backing_;
@@ -131,14 +168,27 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
 class name : public from {\
   public:\
     name(const char *file, const Config &config = Config()) : from(file, config) {}\
+    name(NGramSource &source, const Config &config = Config()) : from(source, config) {}\
 };
 
 LM_NAME_MODEL(ProbingModel, detail::GenericModel<detail::HashedSearch<BackoffValue> LM_COMMA() ProbingVocabulary>);
 LM_NAME_MODEL(RestProbingModel, detail::GenericModel<detail::HashedSearch<RestValue> LM_COMMA() ProbingVocabulary>);
+LM_NAME_MODEL(BucketProbingModel, detail::GenericModel<detail::HashedSearch<BackoffValue LM_COMMA() detail::BucketProbing> LM_COMMA() ProbingVocabulary>);
+LM_NAME_MODEL(RestBucketProbingModel, detail::GenericModel<detail::HashedSearch<RestValue LM_COMMA() detail::BucketProbing> LM_COMMA() ProbingVocabulary>);
+LM_NAME_MODEL(FingerprintProbingModel, detail::GenericModel<detail::HashedSearch<BackoffValue LM_COMMA() detail::FingerprintProbing> LM_COMMA() ProbingVocabulary>);
+LM_NAME_MODEL(RestFingerprintProbingModel, detail::GenericModel<detail::HashedSearch<RestValue LM_COMMA() detail::FingerprintProbing> LM_COMMA() ProbingVocabulary>);
+LM_NAME_MODEL(PerfectHashModel, detail::GenericModel<detail::HashedSearch<BackoffValue LM_COMMA() detail::PerfectHash> LM_COMMA() ProbingVocabulary>);
+LM_NAME_MODEL(RestPerfectHashModel, detail::GenericModel<detail::HashedSearch<RestValue LM_COMMA() detail::PerfectHash> LM_COMMA() ProbingVocabulary>);
 LM_NAME_MODEL(TrieModel, detail::GenericModel<trie::TrieSearch<DontQuantize LM_COMMA() trie::DontBhiksha> LM_COMMA() SortedVocabulary>);
 LM_NAME_MODEL(ArrayTrieModel, detail::GenericModel<trie::TrieSearch<DontQuantize LM_COMMA() trie::ArrayBhiksha> LM_COMMA() SortedVocabulary>);
 LM_NAME_MODEL(QuantTrieModel, detail::GenericModel<trie::TrieSearch<SeparatelyQuantize LM_COMMA() trie::DontBhiksha> LM_COMMA() SortedVocabulary>);
 LM_NAME_MODEL(QuantArrayTrieModel, detail::GenericModel<trie::TrieSearch<SeparatelyQuantize LM_COMMA() trie::ArrayBhiksha> LM_COMMA() SortedVocabulary>);
+LM_NAME_MODEL(EytzingerTrieModel, detail::GenericModel<trie::TrieSearch<DontQuantize LM_COMMA() trie::DontBhiksha LM_COMMA() trie::EytzingerSiblings> LM_COMMA() SortedVocabulary>);
+LM_NAME_MODEL(ArrayEytzingerTrieModel, detail::GenericModel<trie::TrieSearch<DontQuantize LM_COMMA() trie::ArrayBhiksha LM_COMMA() trie::EytzingerSiblings> LM_COMMA() SortedVocabulary>);
+LM_NAME_MODEL(QuantEytzingerTrieModel, detail::GenericModel<trie::TrieSearch<SeparatelyQuantize LM_COMMA() trie::DontBhiksha LM_COMMA() trie::EytzingerSiblings> LM_COMMA() SortedVocabulary>);
+LM_NAME_MODEL(EliasFanoTrieModel, detail::GenericModel<trie::TrieSearch<DontQuantize LM_COMMA() trie::EliasFanoBhiksha> LM_COMMA() SortedVocabulary>);
+LM_NAME_MODEL(QuantEliasFanoTrieModel, detail::GenericModel<trie::TrieSearch<SeparatelyQuantize LM_COMMA() trie::EliasFanoBhiksha> LM_COMMA() SortedVocabulary>);
+LM_NAME_MODEL(QuantArrayEytzingerTrieModel, detail::GenericModel<trie::TrieSearch<SeparatelyQuantize LM_COMMA() trie::ArrayBhiksha LM_COMMA() trie::EytzingerSiblings> LM_COMMA() SortedVocabulary>);
 
 // Default implementation.  No real reason for it to be the default.
 typedef ::lm::ngram::ProbingVocabulary Vocabulary;
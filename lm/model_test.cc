@@ -1,7 +1,18 @@
 #include "lm/model.hh"
+#include "lm/ngram_source.hh"
+#include "lm/read_arpa.hh"
+#include "util/file.hh"
+#include "util/file_piece.hh"
+#include "util/scoped.hh"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
 
 #define BOOST_TEST_MODULE ModelTest
 #include <boost/test/unit_test.hpp>
@@ -286,6 +297,41 @@ template <class M> void NoUnkCheck(const M &model) {
   SLOPPY_CHECK_CLOSE(-100.0, ret.prob, 0.001);
 }
 
+// FullScoreBatch should agree with FullScore for every state and word.
+template <class M> void Batch(const M &model) {
+  const char *words[] = {"looking", "on", "a", "little", "the", "biarritz", "not_found", "more", ".", "</s>", "loin", "also", "would", "consider"};
+  const std::size_t kWords = sizeof(words) / sizeof(const char*);
+  std::vector<State> states;
+  states.push_back(model.BeginSentenceState());
+  states.push_back(model.NullContextState());
+  for (std::size_t i = 0; i < kWords; ++i) {
+    State out;
+    model.FullScore(states.back(), model.GetVocabulary().Index(words[i]), out);
+    states.push_back(out);
+  }
+  std::vector<State> in;
+  std::vector<WordIndex> query;
+  for (std::size_t s = 0; s < states.size(); ++s) {
+    for (std::size_t i = 0; i < kWords; ++i) {
+      in.push_back(states[s]);
+      query.push_back(model.GetVocabulary().Index(words[i]));
+    }
+  }
+  std::vector<State> out(in.size());
+  std::vector<FullScoreReturn> ret(in.size());
+  model.FullScoreBatch(&in[0], &query[0], &out[0], &ret[0], in.size());
+  for (std::size_t i = 0; i < in.size(); ++i) {
+    State expect_state;
+    FullScoreReturn expect = model.FullScore(in[i], query[i], expect_state);
+    BOOST_CHECK_EQUAL(expect_state, out[i]);
+    BOOST_CHECK_EQUAL(expect.prob, ret[i].prob);
+    BOOST_CHECK_EQUAL(expect.rest, ret[i].rest);
+    BOOST_CHECK_EQUAL(static_cast<unsigned int>(expect.ngram_length), static_cast<unsigned int>(ret[i].ngram_length));
+    BOOST_CHECK_EQUAL(expect.independent_left, ret[i].independent_left);
+    if (!expect.independent_left) BOOST_CHECK_EQUAL(expect.extend_left, ret[i].extend_left);
+  }
+}
+
 template <class M> void Everything(const M &m) {
   Starters(m);
   Continuation(m);
@@ -294,6 +340,7 @@ template <class M> void Everything(const M &m) {
   MinimalState(m);
   ExtendLeftTest(m);
   Stateless(m);
+  Batch(m);
 }
 
 class ExpectEnumerateVocab : public EnumerateVocab {
@@ -321,8 +368,9 @@ class ExpectEnumerateVocab : public EnumerateVocab {
     std::vector<std::string> seen;
 };
 
-template <class ModelT> void LoadingTest() {
+template <class ModelT> void LoadingTest(unsigned int load_threads = 1) {
   Config config;
+  config.load_threads = load_threads;
   config.arpa_complain = Config::NONE;
   config.messages = NULL;
   config.probing_multiplier = 2.0;
@@ -347,9 +395,24 @@ template <class ModelT> void LoadingTest() {
 BOOST_AUTO_TEST_CASE(probing) {
   LoadingTest<Model>();
 }
+BOOST_AUTO_TEST_CASE(probing_threads) {
+  LoadingTest<Model>(3);
+}
+BOOST_AUTO_TEST_CASE(bucket_probing) {
+  LoadingTest<BucketProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(fingerprint_probing) {
+  LoadingTest<FingerprintProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(perfect_hash) {
+  LoadingTest<PerfectHashModel>();
+}
 BOOST_AUTO_TEST_CASE(trie) {
   LoadingTest<TrieModel>();
 }
+BOOST_AUTO_TEST_CASE(trie_threads) {
+  LoadingTest<TrieModel>(3);
+}
 BOOST_AUTO_TEST_CASE(quant_trie) {
   LoadingTest<QuantTrieModel>();
 }
@@ -359,6 +422,18 @@ BOOST_AUTO_TEST_CASE(bhiksha_trie) {
 BOOST_AUTO_TEST_CASE(quant_bhiksha_trie) {
   LoadingTest<QuantArrayTrieModel>();
 }
+BOOST_AUTO_TEST_CASE(elias_fano_trie) {
+  LoadingTest<EliasFanoTrieModel>();
+}
+BOOST_AUTO_TEST_CASE(quant_elias_fano_trie) {
+  LoadingTest<QuantEliasFanoTrieModel>();
+}
+BOOST_AUTO_TEST_CASE(eytzinger_trie) {
+  LoadingTest<EytzingerTrieModel>();
+}
+BOOST_AUTO_TEST_CASE(quant_bhiksha_eytzinger_trie) {
+  LoadingTest<QuantArrayEytzingerTrieModel>();
+}
 
 template <class ModelT> void BinaryTest(Config::WriteMethod write_method) {
   Config config;
@@ -386,6 +461,18 @@ template <class ModelT> void BinaryTest(Config::WriteMethod write_method) {
     enumerate.Check(binary.GetVocabulary());
     Everything(binary);
   }
+  {
+    Config prefetch(config);
+    prefetch.load_method = util::PREFETCH;
+    prefetch.load_threads = 2;
+    enumerate.Clear();
+    ModelT binary("test.binary", prefetch);
+    // Usable before it is all in memory.
+    enumerate.Check(binary.GetVocabulary());
+    Everything(binary);
+    binary.WaitLoaded();
+    BOOST_CHECK_EQUAL(1.0, binary.LoadProgress());
+  }
   unlink("test.binary");
 
   // Now test without <unk>.
@@ -418,6 +505,71 @@ BOOST_AUTO_TEST_CASE(write_and_read_probing) {
 BOOST_AUTO_TEST_CASE(write_and_read_rest_probing) {
   BinaryTest<RestProbingModel>();
 }
+BOOST_AUTO_TEST_CASE(write_and_read_bucket_probing) {
+  BinaryTest<BucketProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_rest_bucket_probing) {
+  BinaryTest<RestBucketProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_fingerprint_probing) {
+  BinaryTest<FingerprintProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_rest_fingerprint_probing) {
+  BinaryTest<RestFingerprintProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_perfect_hash) {
+  BinaryTest<PerfectHashModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_rest_perfect_hash) {
+  BinaryTest<RestPerfectHashModel>();
+}
+// Shared copies on hugetlbfs end with zeros up to a whole page.
+template <class ModelT> void ZeroPaddedTest() {
+  Config config;
+  config.write_mmap = "test_padded.binary";
+  config.messages = NULL;
+  {
+    ModelT model(TestLocation(), config);
+  }
+  {
+    util::scoped_fd file(open("test_padded.binary", O_WRONLY | O_APPEND));
+    BOOST_REQUIRE(file.get() != -1);
+    std::string padding(4096, 0);
+    util::WriteOrThrow(file.get(), padding.data(), padding.size());
+  }
+  config.write_mmap = NULL;
+  ExpectEnumerateVocab enumerate;
+  config.enumerate_vocab = &enumerate;
+  {
+    ModelT binary("test_padded.binary", config);
+    enumerate.Check(binary.GetVocabulary());
+    Everything(binary);
+  }
+  unlink("test_padded.binary");
+}
+BOOST_AUTO_TEST_CASE(zero_padded_probing) {
+  ZeroPaddedTest<ProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(zero_padded_trie) {
+  ZeroPaddedTest<TrieModel>();
+}
+// The fingerprint size comes from the binary file, not the loading config.
+BOOST_AUTO_TEST_CASE(fingerprint_bits_from_binary) {
+  Config config;
+  config.write_mmap = "test_fingerprint.binary";
+  config.messages = NULL;
+  config.fingerprint_bits = 32;
+  {
+    FingerprintProbingModel model(TestLocation(), config);
+  }
+  config.write_mmap = NULL;
+  config.fingerprint_bits = 8;
+  {
+    FingerprintProbingModel binary("test_fingerprint.binary", config);
+    Everything(binary);
+  }
+  unlink("test_fingerprint.binary");
+}
 BOOST_AUTO_TEST_CASE(write_and_read_trie) {
   BinaryTest<TrieModel>();
 }
@@ -430,6 +582,174 @@ BOOST_AUTO_TEST_CASE(write_and_read_array_trie) {
 BOOST_AUTO_TEST_CASE(write_and_read_quant_array_trie) {
   BinaryTest<QuantArrayTrieModel>();
 }
+BOOST_AUTO_TEST_CASE(write_and_read_elias_fano_trie) {
+  BinaryTest<EliasFanoTrieModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_quant_elias_fano_trie) {
+  BinaryTest<QuantEliasFanoTrieModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_eytzinger_trie) {
+  BinaryTest<EytzingerTrieModel>();
+}
+BOOST_AUTO_TEST_CASE(write_and_read_quant_array_eytzinger_trie) {
+  BinaryTest<QuantArrayEytzingerTrieModel>();
+}
+
+#ifdef HAVE_ZLIB
+// Compressed files decompress into the same model.
+template <class ModelT> void CompressedTest(Config::WriteMethod write_method) {
+  Config config;
+  config.write_mmap = "test_compressed.binary";
+  config.messages = NULL;
+  config.write_method = write_method;
+  config.compress_level = 6;
+  {
+    ModelT copy_model(TestLocation(), config);
+    Everything(copy_model);
+  }
+  config.write_mmap = NULL;
+  ModelType type;
+  BOOST_REQUIRE(RecognizeBinary("test_compressed.binary", type));
+  BOOST_CHECK_EQUAL(ModelT::kModelType, type);
+  ExpectEnumerateVocab enumerate;
+  config.enumerate_vocab = &enumerate;
+  {
+    ModelT binary("test_compressed.binary", config);
+    enumerate.Check(binary.GetVocabulary());
+    Everything(binary);
+  }
+  // Decompressing would make a private copy, so shared loading refuses.
+  config.enumerate_vocab = NULL;
+  config.load_method = util::SHARED;
+  BOOST_CHECK_THROW(ModelT("test_compressed.binary", config), FormatLoadException);
+  unlink("test_compressed.binary");
+}
+
+template <class ModelT> void CompressedTest() {
+  CompressedTest<ModelT>(Config::WRITE_MMAP);
+  CompressedTest<ModelT>(Config::WRITE_AFTER);
+}
+
+BOOST_AUTO_TEST_CASE(compressed_probing) {
+  CompressedTest<ProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(compressed_trie) {
+  CompressedTest<TrieModel>();
+}
+// Reads quantization and pointer parameters before loading.
+BOOST_AUTO_TEST_CASE(compressed_quant_array_trie) {
+  CompressedTest<QuantArrayTrieModel>();
+}
+#endif // HAVE_ZLIB
+
+// Replays an ARPA file as an NGramSource, numbering words in unigram order.
+// Higher orders come backwards to show that order within an order is free.
+class ArpaSource : public NGramSource {
+  public:
+    explicit ArpaSource(const char *file) : order_(0), next_(0), offset_(0) {
+      util::FilePiece f(file);
+      ReadARPACounts(f, counts_);
+      grams_.resize(counts_.size());
+      std::map<std::string, WordIndex> ids;
+      for (unsigned int n = 1; n <= counts_.size(); ++n) {
+        ReadNGramHeader(f, n);
+        for (uint64_t i = 0; i < counts_[n - 1]; ++i) {
+          Entry entry;
+          entry.prob = f.ReadFloat();
+          for (unsigned int w = 0; w < n; ++w) {
+            std::string word(f.ReadDelimited(kARPASpaces).as_string());
+            if (n == 1) {
+              ids[word] = words_.size();
+              words_.push_back(word);
+            }
+            BOOST_REQUIRE(ids.count(word));
+            entry.ids.push_back(ids[word]);
+          }
+          if (n == counts_.size()) {
+            Prob weights;
+            ReadBackoff(f, weights);
+            entry.backoff = 0.0;
+          } else {
+            ProbBackoff weights;
+            ReadBackoff(f, weights);
+            entry.backoff = weights.backoff;
+          }
+          grams_[n - 1].push_back(entry);
+        }
+        if (n > 1) std::reverse(grams_[n - 1].begin(), grams_[n - 1].end());
+      }
+      lm::ReadEnd(f);
+    }
+
+    void ReadCounts(std::vector<uint64_t> &counts) { counts = counts_; }
+
+    void BeginOrder(unsigned int n) {
+      BOOST_REQUIRE_EQUAL(order_ + 1, n);
+      order_ = n;
+      next_ = 0;
+    }
+
+    void Read(WordIndex *ids, float &prob, float &backoff) {
+      BOOST_REQUIRE(next_ < grams_[order_ - 1].size());
+      const Entry &entry = grams_[order_ - 1][next_++];
+      std::copy(entry.ids.begin(), entry.ids.end(), ids);
+      prob = entry.prob;
+      if (order_ != counts_.size()) backoff = entry.backoff;
+      ++offset_;
+    }
+
+    void ReadEnd() {
+      BOOST_CHECK_EQUAL(counts_.size(), order_);
+      BOOST_CHECK_EQUAL(grams_.back().size(), next_);
+    }
+
+    StringPiece Word(WordIndex id) const { return words_[id]; }
+
+    uint64_t Offset() const { return offset_; }
+
+  private:
+    struct Entry {
+      std::vector<WordIndex> ids;
+      float prob, backoff;
+    };
+
+    std::vector<uint64_t> counts_;
+    std::vector<std::string> words_;
+    std::vector<std::vector<Entry> > grams_;
+
+    unsigned int order_;
+    std::size_t next_;
+    uint64_t offset_;
+};
+
+// Building from already parsed n-grams matches building from ARPA.
+template <class ModelT> void SourceTest() {
+  Config config;
+  config.messages = NULL;
+  config.write_mmap = "test_source.binary";
+  {
+    ArpaSource source(TestLocation());
+    ModelT m(source, config);
+    BOOST_CHECK_EQUAL((WordIndex)37, m.GetVocabulary().Bound());
+    Everything(m);
+  }
+  config.write_mmap = NULL;
+  {
+    ModelT binary("test_source.binary", config);
+    Everything(binary);
+  }
+  unlink("test_source.binary");
+}
+
+BOOST_AUTO_TEST_CASE(source_probing) {
+  SourceTest<ProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(source_trie) {
+  SourceTest<TrieModel>();
+}
+BOOST_AUTO_TEST_CASE(source_quant_array_trie) {
+  SourceTest<QuantArrayTrieModel>();
+}
 
 BOOST_AUTO_TEST_CASE(rest_max) {
   Config config;
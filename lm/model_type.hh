@@ -6,7 +6,7 @@ namespace ngram {
 
 /* Not the best numbering system, but it grew this way for historical reasons
  * and I want to preserve existing binary files. */
-typedef enum {PROBING=0, REST_PROBING=1, TRIE=2, QUANT_TRIE=3, ARRAY_TRIE=4, QUANT_ARRAY_TRIE=5} ModelType;
+typedef enum {PROBING=0, REST_PROBING=1, TRIE=2, QUANT_TRIE=3, ARRAY_TRIE=4, QUANT_ARRAY_TRIE=5, BUCKET_PROBING=6, REST_BUCKET_PROBING=7, FINGERPRINT_PROBING=8, REST_FINGERPRINT_PROBING=9, PERFECT_HASH=10, REST_PERFECT_HASH=11, EYTZINGER_TRIE=12, QUANT_EYTZINGER_TRIE=13, ARRAY_EYTZINGER_TRIE=14, QUANT_ARRAY_EYTZINGER_TRIE=15, ELIAS_FANO_TRIE=16, QUANT_ELIAS_FANO_TRIE=17} ModelType;
 
 // Historical names.
 const ModelType HASH_PROBING = PROBING;
@@ -17,6 +17,11 @@ const ModelType QUANT_ARRAY_TRIE_SORTED = QUANT_ARRAY_TRIE;
 
 const static ModelType kQuantAdd = static_cast<ModelType>(QUANT_TRIE - TRIE);
 const static ModelType kArrayAdd = static_cast<ModelType>(ARRAY_TRIE - TRIE);
+const static ModelType kBucketAdd = static_cast<ModelType>(BUCKET_PROBING - PROBING);
+const static ModelType kFingerprintAdd = static_cast<ModelType>(FINGERPRINT_PROBING - PROBING);
+const static ModelType kPerfectHashAdd = static_cast<ModelType>(PERFECT_HASH - PROBING);
+const static ModelType kEytzingerAdd = static_cast<ModelType>(EYTZINGER_TRIE - TRIE);
+const static ModelType kEliasFanoAdd = static_cast<ModelType>(ELIAS_FANO_TRIE - TRIE);
 
 } // namespace ngram
 } // namespace lm
@@ -5,10 +5,16 @@
 #include "lm/model.hh"
 #include "util/fake_ofstream.hh"
 #include "util/file_piece.hh"
+#include "util/pcqueue.hh"
+#include "util/read_compressed.hh"
+#include "util/thread_pool.hh"
 #include "util/usage.hh"
 
+#include <boost/scoped_array.hpp>
+
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include <cmath>
 
 namespace lm {
@@ -49,6 +55,36 @@ class QueryPrinter {
     bool flush_;
 };
 
+// Corpus statistics.  Add in input order so that threaded queries match exactly.
+class QueryTotals {
+  public:
+    QueryTotals() : total_(0.0), total_oov_only_(0.0), oov_(0), tokens_(0) {}
+
+    void Word(bool oov, float prob) {
+      if (oov) total_oov_only_ += prob;
+      ++tokens_;
+    }
+
+    void Line(uint64_t oov, float total) {
+      total_ += total;
+      oov_ += oov;
+    }
+
+    template <class Printer> void Summary(Printer &printer) const {
+      printer.Summary(
+          pow(10.0, -(total_ / static_cast<double>(tokens_))), // PPL including OOVs
+          pow(10.0, -((total_ - total_oov_only_) / static_cast<double>(tokens_ - oov_))), // PPL excluding OOVs
+          oov_,
+          tokens_);
+    }
+
+  private:
+    double total_;
+    double total_oov_only_;
+    uint64_t oov_;
+    uint64_t tokens_;
+};
+
 template <class Model, class Printer> void Query(const Model &model, bool sentence_context, Printer &printer) {
   typename Model::State state, out;
   lm::FullScoreReturn ret;
@@ -56,10 +92,7 @@ template <class Model, class Printer> void Query(const Model &model, bool senten
 
   util::FilePiece in(0);
 
-  double corpus_total = 0.0;
-  double corpus_total_oov_only = 0.0;
-  uint64_t corpus_oov = 0;
-  uint64_t corpus_tokens = 0;
+  QueryTotals totals;
 
   while (true) {
     state = sentence_context ? model.BeginSentenceState() : model.NullContextState();
@@ -71,11 +104,10 @@ template <class Model, class Printer> void Query(const Model &model, bool senten
       ret = model.FullScore(state, vocab, out);
       if (vocab == model.GetVocabulary().NotFound()) {
         ++oov;
-        corpus_total_oov_only += ret.prob;
       }
       total += ret.prob;
       printer.Word(word, vocab, ret);
-      ++corpus_tokens;
+      totals.Word(vocab == model.GetVocabulary().NotFound(), ret.prob);
       state = out;
     }
     // If people don't have a newline after their last query, this won't add a </s>.
@@ -86,23 +118,182 @@ template <class Model, class Printer> void Query(const Model &model, bool senten
     if (sentence_context) {
       ret = model.FullScore(state, model.GetVocabulary().EndSentence(), out);
       total += ret.prob;
-      ++corpus_tokens;
       printer.Word("</s>", model.GetVocabulary().EndSentence(), ret);
+      totals.Word(false, ret.prob);
     }
     printer.Line(oov, total);
-    corpus_total += total;
-    corpus_oov += oov;
+    totals.Line(oov, total);
   }
-  printer.Summary(
-      pow(10.0, -(corpus_total / static_cast<double>(corpus_tokens))), // PPL including OOVs
-      pow(10.0, -((corpus_total - corpus_total_oov_only) / static_cast<double>(corpus_tokens - corpus_oov))), // PPL excluding OOVs
-      corpus_oov,
-      corpus_tokens);
+  totals.Summary(printer);
 }
 
-template <class Model> void Query(const char *file, const Config &config, bool sentence_context, QueryPrinter &printer) {
+namespace detail {
+
+struct ScoredWord {
+  StringPiece surface;
+  WordIndex vocab;
+  FullScoreReturn ret;
+};
+
+struct ScoredLine {
+  // Index in QueryBatch::words after the last word of the line.
+  std::size_t words_end;
+  uint64_t oov;
+  float total;
+};
+
+struct QueryBatch {
+  QueryBatch() : done(0) {}
+
+  // Whole lines, except that the input may end without a newline.
+  std::string text;
+
+  // Filled by the worker.  Words after the last line belong to the unterminated end of the input.
+  std::vector<ScoredWord> words;
+  std::vector<ScoredLine> lines;
+
+  util::Semaphore done;
+};
+
+// Scores batches with the same tokenization and sentence handling as the single-threaded Query.
+template <class Model> class QueryWorker {
+  public:
+    typedef QueryBatch *Request;
+
+    QueryWorker(const Model &model, bool sentence_context) : model_(model), sentence_context_(sentence_context) {}
+
+    void operator()(Request batch) {
+      batch->words.clear();
+      batch->lines.clear();
+      typename Model::State state, out;
+      ScoredWord scored;
+      const char *i = batch->text.data(), *const end = i + batch->text.size();
+      while (i != end) {
+        state = sentence_context_ ? model_.BeginSentenceState() : model_.NullContextState();
+        ScoredLine line;
+        line.oov = 0;
+        line.total = 0.0;
+        while (true) {
+          for (; i != end && *i != '\n' && util::kSpaces[static_cast<unsigned char>(*i)]; ++i) {}
+          if (i == end || *i == '\n') break;
+          const char *word = i;
+          for (; i != end && !util::kSpaces[static_cast<unsigned char>(*i)]; ++i) {}
+          scored.surface = StringPiece(word, i - word);
+          scored.vocab = model_.GetVocabulary().Index(scored.surface);
+          scored.ret = model_.FullScore(state, scored.vocab, out);
+          if (scored.vocab == model_.GetVocabulary().NotFound()) ++line.oov;
+          line.total += scored.ret.prob;
+          batch->words.push_back(scored);
+          state = out;
+        }
+        // No </s> or line total without a newline, as in Query.
+        if (i == end) break;
+        ++i;
+        if (sentence_context_) {
+          scored.surface = StringPiece("</s>", 4);
+          scored.vocab = model_.GetVocabulary().EndSentence();
+          scored.ret = model_.FullScore(state, scored.vocab, out);
+          line.total += scored.ret.prob;
+          batch->words.push_back(scored);
+        }
+        line.words_end = batch->words.size();
+        batch->lines.push_back(line);
+      }
+      batch->done.post();
+    }
+
+  private:
+    const Model &model_;
+    const bool sentence_context_;
+};
+
+// Reads input in blocks that end at a newline, or at the end of the input.
+class QueryInput {
+  public:
+    // Takes ownership of fd.
+    explicit QueryInput(int fd) : in_(fd), eof_(false) {}
+
+    // Returns false if there is nothing left.
+    bool Fill(std::string &text) {
+      text.swap(carry_);
+      carry_.clear();
+      while (!eof_) {
+        std::size_t old = text.size();
+        text.resize(old + kBlock);
+        std::size_t got = in_.ReadOrEOF(&text[old], kBlock);
+        text.resize(old + got);
+        if (!got) {
+          eof_ = true;
+          break;
+        }
+        std::size_t last = text.rfind('\n');
+        if (last != std::string::npos) {
+          carry_.assign(text, last + 1, std::string::npos);
+          text.resize(last + 1);
+          break;
+        }
+      }
+      return !text.empty();
+    }
+
+  private:
+    static const std::size_t kBlock = 1048576;
+
+    util::ReadCompressed in_;
+    // Start of a line that did not fit in the last block.
+    std::string carry_;
+    bool eof_;
+};
+
+} // namespace detail
+
+/* Like Query but reads large blocks of lines and scores them on threads
+ * workers.  Output and corpus statistics are produced in input order by the
+ * calling thread, so they match Query exactly.
+ */
+template <class Model, class Printer> void ThreadedQuery(const Model &model, bool sentence_context, Printer &printer, std::size_t threads) {
+  // Enough in flight that workers rarely wait for the printing thread.
+  const std::size_t batch_count = 2 * threads + 1;
+  boost::scoped_array<detail::QueryBatch> batches(new detail::QueryBatch[batch_count]);
+  detail::QueryInput in(0);
+  util::ThreadPool<detail::QueryWorker<Model> > pool(batch_count, threads, detail::QueryWorker<Model>(model, sentence_context), NULL);
+  std::size_t filled = 0;
+  for (; filled < batch_count && in.Fill(batches[filled].text); ++filled) {
+    pool.Produce(&batches[filled]);
+  }
+
+  QueryTotals totals;
+  const WordIndex not_found = model.GetVocabulary().NotFound();
+  for (std::size_t consumed = 0; consumed < filled; ++consumed) {
+    detail::QueryBatch &batch = batches[consumed % batch_count];
+    util::WaitSemaphore(batch.done);
+    std::vector<detail::ScoredWord>::const_iterator word = batch.words.begin();
+    for (std::vector<detail::ScoredLine>::const_iterator line = batch.lines.begin(); ; ++line) {
+      std::vector<detail::ScoredWord>::const_iterator words_end = (line == batch.lines.end()) ? batch.words.end() : batch.words.begin() + line->words_end;
+      for (; word != words_end; ++word) {
+        printer.Word(word->surface, word->vocab, word->ret);
+        totals.Word(word->vocab == not_found, word->ret.prob);
+      }
+      if (line == batch.lines.end()) break;
+      printer.Line(line->oov, line->total);
+      totals.Line(line->oov, line->total);
+    }
+    // Batches are refilled in the order they finish printing so they stay in input order.
+    if (in.Fill(batch.text)) {
+      pool.Produce(&batch);
+      ++filled;
+    }
+  }
+  totals.Summary(printer);
+}
+
+template <class Model> void Query(const char *file, const Config &config, bool sentence_context, QueryPrinter &printer, std::size_t threads = 1) {
   Model model(file, config);
-  Query<Model, QueryPrinter>(model, sentence_context, printer);
+  if (threads > 1) {
+    ThreadedQuery<Model, QueryPrinter>(model, sentence_context, printer, threads);
+  } else {
+    Query<Model, QueryPrinter>(model, sentence_context, printer);
+  }
 }
 
 } // namespace ngram
@@ -0,0 +1,137 @@
+#ifndef LM_NGRAM_SOURCE_H
+#define LM_NGRAM_SOURCE_H
+
+/* Build a model from n-grams that are already parsed, such as lmplz output,
+ * instead of ARPA text.  The model builders are templated on their input and
+ * these overloads stand in for the ARPA readers in read_arpa.hh and
+ * parallel_read_arpa.hh when the input is an NGramSource.
+ */
+
+#include "lm/blank.hh"
+#include "lm/lm_exception.hh"
+#include "lm/parallel_read_arpa.hh"
+#include "lm/read_arpa.hh"
+#include "lm/weights.hh"
+#include "lm/word_index.hh"
+#include "util/string_piece.hh"
+
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+namespace lm {
+
+/* Sections come in ARPA order: counts, unigrams, then each higher order.
+ * N-grams within an order may come in any order.  Word ids are the source's
+ * own; unigrams are read in id order starting from 0.
+ */
+class NGramSource {
+  public:
+    virtual ~NGramSource();
+
+    // Number of n-grams of each order, unigrams first.
+    virtual void ReadCounts(std::vector<uint64_t> &counts) = 0;
+
+    // Called before the n-grams of order n = 1, 2, ...
+    virtual void BeginOrder(unsigned int n) = 0;
+
+    // Next n-gram of the current order, first word first.  backoff is not
+    // set for the highest order.
+    virtual void Read(WordIndex *ids, float &prob, float &backoff) = 0;
+
+    // Called after the last order.
+    virtual void ReadEnd() = 0;
+
+    // String for a source word id.  Valid until the next call.
+    virtual StringPiece Word(WordIndex id) const = 0;
+
+    // N-grams read so far, for error messages.
+    virtual uint64_t Offset() const = 0;
+
+    // Model id of each source id, filled in by Read1Grams.
+    std::vector<WordIndex> &ModelIds() { return model_ids_; }
+
+  private:
+    std::vector<WordIndex> model_ids_;
+};
+
+inline void ReadARPACounts(NGramSource &in, std::vector<uint64_t> &number) {
+  in.ReadCounts(number);
+}
+
+inline void ReadNGramHeader(NGramSource &in, unsigned int length) {
+  in.BeginOrder(length);
+}
+
+inline void ReadEnd(NGramSource &in) {
+  in.ReadEnd();
+}
+
+namespace detail {
+
+inline void SourceProb(float &prob, PositiveProbWarn &warn) {
+  if (prob > 0.0) {
+    warn.Warn(prob);
+    prob = 0.0;
+  }
+}
+
+// Zero backoff is stored as negative zero until an extension shows up, as
+// ReadBackoff does for ARPA.
+inline void SourceBackoff(Prob &/*weights*/, float /*backoff*/) {}
+template <class Weights> void SourceBackoff(Weights &weights, float backoff) {
+  weights.backoff = (backoff == ngram::kExtensionBackoff) ? ngram::kNoExtensionBackoff : backoff;
+}
+
+} // namespace detail
+
+template <class Voc, class Weights> void Read1Grams(NGramSource &f, std::size_t count, Voc &vocab, Weights *unigrams, PositiveProbWarn &warn) {
+  ReadNGramHeader(f, 1);
+  for (std::size_t i = 0; i < count; ++i) {
+    WordIndex id;
+    float prob, backoff;
+    f.Read(&id, prob, backoff);
+    UTIL_THROW_IF(id != i, FormatLoadException, "Unigram " << i << " has id " << id);
+    detail::SourceProb(prob, warn);
+    Weights &w = unigrams[vocab.Insert(f.Word(id))];
+    w.prob = prob;
+    detail::SourceBackoff(w, backoff);
+  }
+  vocab.FinishedLoading(unigrams);
+  // Vocabularies such as SortedVocabulary renumber words in FinishedLoading.
+  std::vector<WordIndex> &ids = f.ModelIds();
+  ids.resize(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    ids[i] = vocab.Index(f.Word(i));
+  }
+}
+
+// Same interface as reading ARPA: model ids in reverse order.
+template <class Voc, class Weights> class NGramReader<Voc, Weights, NGramSource> {
+  public:
+    NGramReader(NGramSource &f, unsigned char n, uint64_t /*count*/, const Voc &/*vocab*/, PositiveProbWarn &warn, std::size_t /*threads*/)
+      : f_(f), n_(n), warn_(warn), ids_(n) {}
+
+    void Read(WordIndex *reversed_ids, Weights &weights) {
+      float backoff;
+      f_.Read(&ids_[0], weights.prob, backoff);
+      detail::SourceProb(weights.prob, warn_);
+      const std::vector<WordIndex> &model_ids = f_.ModelIds();
+      for (unsigned char i = 0; i < n_; ++i) {
+        UTIL_THROW_IF(ids_[i] >= model_ids.size(), FormatLoadException, "Word id " << ids_[i] << " in a " << static_cast<unsigned int>(n_) << "-gram is not a unigram");
+        reversed_ids[n_ - 1 - i] = model_ids[ids_[i]];
+      }
+      detail::SourceBackoff(weights, backoff);
+    }
+
+  private:
+    NGramSource &f_;
+    const unsigned char n_;
+    PositiveProbWarn &warn_;
+    std::vector<WordIndex> ids_;
+};
+
+} // namespace lm
+
+#endif // LM_NGRAM_SOURCE_H
@@ -0,0 +1,189 @@
+#ifndef LM_PARALLEL_READ_ARPA_H
+#define LM_PARALLEL_READ_ARPA_H
+
+#include "lm/lm_exception.hh"
+#include "lm/read_arpa.hh"
+#include "lm/word_index.hh"
+#include "util/file_piece.hh"
+#include "util/pcqueue.hh"
+#include "util/thread_pool.hh"
+
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace lm {
+namespace detail {
+
+// Lines of one section copied out of the ARPA file for a worker to parse.
+template <class Weights> struct NGramChunk {
+  NGramChunk() : lines(0), done(0) {}
+
+  std::string text;
+  // Of the first line in the ARPA file, for error messages.
+  uint64_t offset;
+  std::size_t lines;
+
+  // Filled by the worker: order vocab ids per line in reverse order.
+  std::vector<WordIndex> ids;
+  std::vector<Weights> weights;
+  // First positive log probability, which was mapped to 0, or 0.0 if none.
+  float positive;
+  // Message of the exception thrown while parsing, if any.
+  std::string error;
+
+  util::Semaphore done;
+};
+
+// Keeps the first positive log probability for the reading thread to act on.
+class DeferPositiveProb {
+  public:
+    explicit DeferPositiveProb(float &first) : first_(first) {}
+
+    void Warn(float prob) {
+      if (first_ == 0.0) first_ = prob;
+    }
+
+  private:
+    float &first_;
+};
+
+template <class Voc, class Weights> class NGramChunkParser {
+  public:
+    typedef NGramChunk<Weights> *Request;
+
+    NGramChunkParser(const Voc &vocab, unsigned char n) : vocab_(&vocab), n_(n) {}
+
+    void operator()(Request chunk) {
+      chunk->ids.resize(chunk->lines * n_);
+      chunk->weights.resize(chunk->lines);
+      chunk->positive = 0.0;
+      chunk->error.clear();
+      try {
+        std::istringstream stream(chunk->text);
+        util::FilePiece f(stream, NULL, chunk->text.size() + 1);
+        DeferPositiveProb warn(chunk->positive);
+        for (std::size_t i = 0; i < chunk->lines; ++i) {
+          std::reverse_iterator<WordIndex*> out(&chunk->ids[0] + (i + 1) * n_);
+          ReadNGram(f, n_, *vocab_, out, chunk->weights[i], warn);
+        }
+      } catch (const std::exception &e) {
+        chunk->error = e.what();
+      }
+      chunk->done.post();
+    }
+
+  private:
+    const Voc *vocab_;
+    unsigned char n_;
+};
+
+} // namespace detail
+
+/* Reads count n-grams of order n in file order, like calling ReadNGram count
+ * times with reversed vocab ids.  With more than one thread, the calling
+ * thread copies lines out of the file in chunks and workers parse them, so
+ * parsing overlaps with whatever the caller does with earlier n-grams.  The
+ * section header must already have been read.  File is util::FilePiece; the
+ * specialization for NGramSource is in ngram_source.hh.
+ */
+template <class Voc, class Weights, class File = util::FilePiece> class NGramReader {
+  public:
+    NGramReader(util::FilePiece &f, unsigned char n, uint64_t count, const Voc &vocab, PositiveProbWarn &warn, std::size_t threads)
+      : f_(f), n_(n), vocab_(vocab), warn_(warn), unread_(count) {
+      if (threads <= 1) return;
+      chunk_count_ = 2 * threads + 1;
+      chunks_.reset(new Chunk[chunk_count_]);
+      pool_.reset(new Pool(chunk_count_, threads, Parser(vocab, n), NULL));
+      for (std::size_t i = 0; i < chunk_count_ && Fill(chunks_[i]); ++i) {
+        pool_->Produce(&chunks_[i]);
+      }
+      consume_ = 0;
+      line_ = 0;
+    }
+
+    // Writes the vocab ids of the n-gram in reverse order.
+    void Read(WordIndex *reversed_ids, Weights &weights) {
+      if (!pool_) {
+        ReadNGram(f_, n_, vocab_, std::reverse_iterator<WordIndex*>(reversed_ids + n_), weights, warn_);
+        return;
+      }
+      Chunk &chunk = chunks_[consume_ % chunk_count_];
+      if (line_ == 0) Wait(chunk);
+      const WordIndex *ids = &chunk.ids[line_ * n_];
+      std::copy(ids, ids + n_, reversed_ids);
+      weights = chunk.weights[line_];
+      if (++line_ == chunk.lines) {
+        line_ = 0;
+        ++consume_;
+        // Chunks are refilled in the order they are consumed so the ring stays in file order.
+        if (Fill(chunk)) pool_->Produce(&chunk);
+      }
+    }
+
+  private:
+    typedef detail::NGramChunk<Weights> Chunk;
+    typedef detail::NGramChunkParser<Voc, Weights> Parser;
+    typedef util::ThreadPool<Parser> Pool;
+
+    // Lines per chunk.  Large enough that queueing is cheap relative to parsing.
+    static const std::size_t kChunkLines = 16384;
+
+    // Copy the next lines into chunk.  Returns false if there are none.
+    bool Fill(Chunk &chunk) {
+      chunk.text.clear();
+      chunk.lines = 0;
+      chunk.offset = f_.Offset();
+      for (; unread_ && chunk.lines < kChunkLines; --unread_) {
+        StringPiece line;
+        // ReadNGram skips blank lines so count only the others.
+        do {
+          line = f_.ReadLine('\n', false);
+        } while (Blank(line));
+        chunk.text.append(line.data(), line.size());
+        chunk.text.push_back('\n');
+        ++chunk.lines;
+      }
+      return chunk.lines != 0;
+    }
+
+    static bool Blank(const StringPiece &line) {
+      for (const char *i = line.data(); i != line.data() + line.size(); ++i) {
+        if (!kARPASpaces[static_cast<unsigned char>(*i)]) return false;
+      }
+      return true;
+    }
+
+    void Wait(Chunk &chunk) {
+      util::WaitSemaphore(chunk.done);
+      UTIL_THROW_IF(!chunk.error.empty(), FormatLoadException, chunk.error << " counting from the chunk of " << static_cast<unsigned int>(n_) << "-grams that starts at byte " << chunk.offset);
+      if (chunk.positive != 0.0) warn_.Warn(chunk.positive);
+    }
+
+    util::FilePiece &f_;
+    const unsigned char n_;
+    const Voc &vocab_;
+    PositiveProbWarn &warn_;
+
+    uint64_t unread_;
+
+    // Declared before pool_ so that workers are done before these go away.
+    boost::scoped_array<Chunk> chunks_;
+    std::size_t chunk_count_;
+    // Chunks consumed so far and the next line in the current one.
+    std::size_t consume_, line_;
+
+    boost::scoped_ptr<Pool> pool_;
+};
+
+template <class Voc, class Weights, class File> const std::size_t NGramReader<Voc, Weights, File>::kChunkLines;
+
+} // namespace lm
+
+#endif // LM_PARALLEL_READ_ARPA_H
@@ -1,20 +1,32 @@
 #include "lm/ngram_query.hh"
 #include "util/getopt.hh"
+#include "util/mmap.hh"
 
 #ifdef WITH_NPLM
 #include "lm/wrappers/nplm.hh"
 #endif
 
+#include <algorithm>
+
 #include <stdlib.h>
 
 void Usage(const char *name) {
   std::cerr <<
     "KenLM was compiled with maximum order " << KENLM_MAX_ORDER << ".\n"
-    "Usage: " << name << " [-b] [-n] [-w] [-s] lm_file\n"
+    "Usage: " << name << " [-b] [-n] [-w] [-s] [-j threads] lm_file\n"
     "-b: Do not buffer output.\n"
     "-n: Do not wrap the input in <s> and </s>.\n"
     "-v summary|sentence|word: Level of verbosity\n"
-    "-l lazy|populate|read|parallel: Load lazily, with populate, or malloc+read\n"
+    "-j threads: Score blocks of lines on this many threads.  Output is in the\n"
+    "            same order and has the same statistics as with one thread.\n"
+    "            nplm models ignore this.\n"
+    "-l lazy|populate|read|parallel|huge|interleave|node[:N]|shared|prefetch:\n"
+    "   Load lazily, with populate, or malloc+read.  huge reads into explicit\n"
+    "   huge pages, which must be reserved in /proc/sys/vm/nr_hugepages.\n"
+    "   interleave spreads pages across NUMA nodes and node binds them to node N\n"
+    "   or the loading node.  shared attaches to a copy that kenlm_share put in\n"
+    "   shared memory.  prefetch starts querying at once while a background\n"
+    "   thread pages the model in.\n"
     "The default loading method is populate on Linux and read on others.\n";
   exit(1);
 }
@@ -27,9 +39,10 @@ int main(int argc, char *argv[]) {
   bool sentence_context = true;
   unsigned int verbosity = 2;
   bool flush = false;
+  std::size_t threads = 1;
 
   int opt;
-  while ((opt = getopt(argc, argv, "bnv:l:")) != -1) {
+  while ((opt = getopt(argc, argv, "bnv:l:j:")) != -1) {
     switch (opt) {
       case 'b':
         flush = true;
@@ -49,18 +62,13 @@ int main(int argc, char *argv[]) {
         }
         break;
       case 'l':
-        if (!strcmp(optarg, "lazy")) {
-          config.load_method = util::LAZY;
-        } else if (!strcmp(optarg, "populate")) {
-          config.load_method = util::POPULATE_OR_READ;
-        } else if (!strcmp(optarg, "read")) {
-          config.load_method = util::READ;
-        } else if (!strcmp(optarg, "parallel")) {
-          config.load_method = util::PARALLEL_READ;
-        } else {
+        if (!util::ParseLoadMethod(optarg, config.load_method, config.load_node)) {
           Usage(argv[0]);
         }
         break;
+      case 'j':
+        threads = std::max(1L, atol(optarg));
+        break;
       case 'h':
       default:
         Usage(argv[0]);
@@ -76,22 +84,58 @@ int main(int argc, char *argv[]) {
     if (RecognizeBinary(file, model_type)) {
       switch(model_type) {
         case PROBING:
-          Query<lm::ngram::ProbingModel>(file, config, sentence_context, printer);
+          Query<lm::ngram::ProbingModel>(file, config, sentence_context, printer, threads);
           break;
         case REST_PROBING:
-          Query<lm::ngram::RestProbingModel>(file, config, sentence_context, printer);
+          Query<lm::ngram::RestProbingModel>(file, config, sentence_context, printer, threads);
           break;
         case TRIE:
-          Query<TrieModel>(file, config, sentence_context, printer);
+          Query<TrieModel>(file, config, sentence_context, printer, threads);
           break;
         case QUANT_TRIE:
-          Query<QuantTrieModel>(file, config, sentence_context, printer);
+          Query<QuantTrieModel>(file, config, sentence_context, printer, threads);
           break;
         case ARRAY_TRIE:
-          Query<ArrayTrieModel>(file, config, sentence_context, printer);
+          Query<ArrayTrieModel>(file, config, sentence_context, printer, threads);
           break;
         case QUANT_ARRAY_TRIE:
-          Query<QuantArrayTrieModel>(file, config, sentence_context, printer);
+          Query<QuantArrayTrieModel>(file, config, sentence_context, printer, threads);
+          break;
+        case BUCKET_PROBING:
+          Query<BucketProbingModel>(file, config, sentence_context, printer, threads);
+          break;
+        case REST_BUCKET_PROBING:
+          Query<RestBucketProbingModel>(file, config, sentence_context, printer, threads);
+          break;
+        case FINGERPRINT_PROBING:
+          Query<FingerprintProbingModel>(file, config, sentence_context, printer, threads);
+          break;
+        case REST_FINGERPRINT_PROBING:
+          Query<RestFingerprintProbingModel>(file, config, sentence_context, printer, threads);
+          break;
+        case PERFECT_HASH:
+          Query<PerfectHashModel>(file, config, sentence_context, printer, threads);
+          break;
+        case REST_PERFECT_HASH:
+          Query<RestPerfectHashModel>(file, config, sentence_context, printer, threads);
+          break;
+        case EYTZINGER_TRIE:
+          Query<EytzingerTrieModel>(file, config, sentence_context, printer, threads);
+          break;
+        case QUANT_EYTZINGER_TRIE:
+          Query<QuantEytzingerTrieModel>(file, config, sentence_context, printer, threads);
+          break;
+        case ARRAY_EYTZINGER_TRIE:
+          Query<ArrayEytzingerTrieModel>(file, config, sentence_context, printer, threads);
+          break;
+        case QUANT_ARRAY_EYTZINGER_TRIE:
+          Query<QuantArrayEytzingerTrieModel>(file, config, sentence_context, printer, threads);
+          break;
+        case ELIAS_FANO_TRIE:
+          Query<EliasFanoTrieModel>(file, config, sentence_context, printer, threads);
+          break;
+        case QUANT_ELIAS_FANO_TRIE:
+          Query<QuantEliasFanoTrieModel>(file, config, sentence_context, printer, threads);
           break;
         default:
           std::cerr << "Unrecognized kenlm model type " << model_type << std::endl;
@@ -99,12 +143,13 @@ int main(int argc, char *argv[]) {
       }
 #ifdef WITH_NPLM
     } else if (lm::np::Model::Recognize(file)) {
+      if (threads > 1) std::cerr << "Warning: -j is not supported for nplm models, so queries run on one thread." << std::endl;
       lm::np::Model model(file);
       Query<lm::np::Model, lm::ngram::QueryPrinter>(model, sentence_context, printer);
       Query<lm::np::Model, lm::ngram::QueryPrinter>(model, sentence_context, printer);
 #endif
     } else {
-      Query<ProbingModel>(file, config, sentence_context, printer);
+      Query<ProbingModel>(file, config, sentence_context, printer, threads);
     }
     util::PrintUsage(std::cerr);
   } catch (const std::exception &e) {
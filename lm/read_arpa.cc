@@ -2,6 +2,7 @@
 
 #include "lm/blank.hh"
 #include "util/file.hh"
+#include "util/usage.hh"
 
 #include <cmath>
 #include <cstdlib>
@@ -85,6 +86,13 @@ void ReadNGramHeader(util::FilePiece &in, unsigned int length) {
   if (line != expected.str()) UTIL_THROW(FormatLoadException, "Was expecting n-gram header " << expected.str() << " but got " << line << " instead");
 }
 
+void FinishOrderPhase(util::PhaseTimer *timer, unsigned int n) {
+  if (!timer) return;
+  std::stringstream name;
+  name << n << "-grams";
+  timer->Finish(name.str());
+}
+
 void ReadBackoff(util::FilePiece &in, Prob &/*weights*/) {
   switch (in.get()) {
     case '\t':
@@ -10,6 +10,8 @@
 #include <iosfwd>
 #include <vector>
 
+namespace util { class PhaseTimer; }
+
 namespace lm {
 
 void ReadARPACounts(util::FilePiece &in, std::vector<uint64_t> &number);
@@ -26,6 +28,9 @@ inline void ReadBackoff(util::FilePiece &in, RestWeights &weights) {
 
 void ReadEnd(util::FilePiece &in);
 
+// Finish the phase of timer for n-grams of order n.  No-op if timer is NULL.
+void FinishOrderPhase(util::PhaseTimer *timer, unsigned int n);
+
 extern const bool kARPASpaces[256];
 
 // Positive log probability warning.
@@ -67,8 +72,8 @@ template <class Voc, class Weights> void Read1Grams(util::FilePiece &f, std::siz
   vocab.FinishedLoading(unigrams);
 }
 
-// Read ngram, write vocab ids to indices_out.
-template <class Voc, class Weights, class Iterator> void ReadNGram(util::FilePiece &f, const unsigned char n, const Voc &vocab, Iterator indices_out, Weights &weights, PositiveProbWarn &warn) {
+// Read ngram, write vocab ids to indices_out.  Warn is usually PositiveProbWarn.
+template <class Voc, class Weights, class Iterator, class Warn> void ReadNGram(util::FilePiece &f, const unsigned char n, const Voc &vocab, Iterator indices_out, Weights &weights, Warn &warn) {
   try {
     weights.prob = f.ReadFloat();
     if (weights.prob > 0.0) {
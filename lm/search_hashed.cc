@@ -4,12 +4,16 @@
 #include "lm/blank.hh"
 #include "lm/lm_exception.hh"
 #include "lm/model.hh"
+#include "lm/ngram_source.hh"
+#include "lm/parallel_read_arpa.hh"
 #include "lm/read_arpa.hh"
 #include "lm/value.hh"
 #include "lm/vocab.hh"
 
 #include "util/bit_packing.hh"
 #include "util/file_piece.hh"
+#include "util/mmap.hh"
+#include "util/usage.hh"
 
 #include <string>
 
@@ -55,12 +59,12 @@ template <class Weights> class ActivateUnigram {
 };
 
 // Find the lower order entry, inserting blanks along the way as necessary.
-template <class Value> void FindLower(
+template <class Value, class Middle> void FindLower(
     const std::vector<uint64_t> &keys,
     typename Value::Weights &unigram,
-    std::vector<util::ProbingHashTable<typename Value::ProbingEntry, util::IdentityHash> > &middle,
+    std::vector<Middle> &middle,
     std::vector<typename Value::Weights *> &between) {
-  typename util::ProbingHashTable<typename Value::ProbingEntry, util::IdentityHash>::MutableIterator iter;
+  typename Middle::MutableIterator iter;
   typename Value::ProbingEntry entry;
   // Backoff will always be 0.0.  We'll get the probability and rest in another pass.
   entry.value.backoff = kNoExtensionBackoff;
@@ -78,20 +82,19 @@ template <class Value> void FindLower(
 }
 
 // Between usually has  single entry, the value to adjust.  But sometimes SRI stupidly pruned entries so it has unitialized blank values to be set here.
-template <class Added, class Build> void AdjustLower(
+template <class Added, class Build, class Middle> void AdjustLower(
     const Added &added,
     const Build &build,
     std::vector<typename Build::Value::Weights *> &between,
     const unsigned int n,
     const std::vector<WordIndex> &vocab_ids,
     typename Build::Value::Weights *unigrams,
-    std::vector<util::ProbingHashTable<typename Build::Value::ProbingEntry, util::IdentityHash> > &middle) {
+    std::vector<Middle> &middle) {
   typedef typename Build::Value Value;
   if (between.size() == 1) {
     build.MarkExtends(*between.front(), added);
     return;
   }
-  typedef util::ProbingHashTable<typename Value::ProbingEntry, util::IdentityHash> Middle;
   float prob = -fabs(between.back()->prob);
   // Order of the n-gram on which probabilities are based.
   unsigned char basis = n - between.size();
@@ -136,11 +139,11 @@ template <class Added, class Build> void AdjustLower(
 }
 
 // Continue marking lower entries even they know that they extend left.  This is used for upper/lower bounds.
-template <class Build> void MarkLower(
+template <class Build, class Middle> void MarkLower(
     const std::vector<uint64_t> &keys,
     const Build &build,
     typename Build::Value::Weights &unigram,
-    std::vector<util::ProbingHashTable<typename Build::Value::ProbingEntry, util::IdentityHash> > &middle,
+    std::vector<Middle> &middle,
     int start_order,
     const typename Build::Value::Weights &longer) {
   if (start_order == 0) return;
@@ -156,20 +159,22 @@ template <class Build> void MarkLower(
   }
 }
 
-template <class Build, class Activate, class Store> void ReadNGrams(
-    util::FilePiece &f,
+template <class Build, class Activate, class Store, class Middle, class File> void ReadNGrams(
+    File &f,
     const unsigned int n,
     const size_t count,
     const ProbingVocabulary &vocab,
     const Build &build,
     typename Build::Value::Weights *unigrams,
-    std::vector<util::ProbingHashTable<typename Build::Value::ProbingEntry, util::IdentityHash> > &middle,
+    std::vector<Middle> &middle,
     Activate activate,
     Store &store,
-    PositiveProbWarn &warn) {
+    PositiveProbWarn &warn,
+    std::size_t threads) {
   typedef typename Build::Value Value;
   assert(n >= 2);
   ReadNGramHeader(f, n);
+  NGramReader<ProbingVocabulary, typename Store::Entry::Value, File> reader(f, n, count, vocab, warn, threads);
 
   // Both vocab_ids and keys are non-empty because n >= 2.
   // vocab ids of words in reverse order.
@@ -178,7 +183,7 @@ template <class Build, class Activate, class Store> void ReadNGrams(
   typename Store::Entry entry;
   std::vector<typename Value::Weights *> between;
   for (size_t i = 0; i < count; ++i) {
-    ReadNGram(f, n, vocab, vocab_ids.rbegin(), entry.value, warn);
+    reader.Read(&vocab_ids[0], entry.value);
     build.SetRest(&*vocab_ids.begin(), n, entry.value);
 
     keys[0] = detail::CombineWordHash(static_cast<uint64_t>(vocab_ids.front()), vocab_ids[1]);
@@ -200,21 +205,152 @@ template <class Build, class Activate, class Store> void ReadNGrams(
   store.FinishedInserting();
 }
 
+// Passed to Layout::Populate to read n-grams of order 2 and above into the tables it chooses.
+template <class Build, class File> class ReadTables {
+  public:
+    typedef typename Build::Value::Weights Weights;
+
+    ReadTables(File &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build, Weights *unigrams)
+      : f_(f), counts_(counts), config_(config), vocab_(vocab), warn_(warn), build_(build), unigrams_(unigrams) {}
+
+    template <class Middle, class Longest> void operator()(std::vector<Middle> &middle, Longest &longest) {
+      try {
+        if (counts_.size() > 2) {
+          ReadNGrams<Build, ActivateUnigram<Weights>, Middle>(
+              f_, 2, counts_[1], vocab_, build_, unigrams_, middle, ActivateUnigram<Weights>(unigrams_), middle[0], warn_, config_.load_threads);
+          FinishOrderPhase(config_.phase_timer, 2);
+        }
+        for (unsigned int n = 3; n < counts_.size(); ++n) {
+          ReadNGrams<Build, ActivateLowerMiddle<Middle>, Middle>(
+              f_, n, counts_[n-1], vocab_, build_, unigrams_, middle, ActivateLowerMiddle<Middle>(middle[n-3]), middle[n-2], warn_, config_.load_threads);
+          FinishOrderPhase(config_.phase_timer, n);
+        }
+        if (counts_.size() > 2) {
+          ReadNGrams<Build, ActivateLowerMiddle<Middle>, Longest>(
+              f_, counts_.size(), counts_[counts_.size() - 1], vocab_, build_, unigrams_, middle, ActivateLowerMiddle<Middle>(middle.back()), longest, warn_, config_.load_threads);
+        } else {
+          ReadNGrams<Build, ActivateUnigram<Weights>, Longest>(
+              f_, counts_.size(), counts_[counts_.size() - 1], vocab_, build_, unigrams_, middle, ActivateUnigram<Weights>(unigrams_), longest, warn_, config_.load_threads);
+        }
+        FinishOrderPhase(config_.phase_timer, counts_.size());
+      } catch (util::ProbingSizeException &e) {
+        UTIL_THROW(util::ProbingSizeException, "Avoid pruning n-grams like \"bar baz quux\" when \"foo bar baz quux\" is still in the model.  KenLM will work when this pruning happens, but the probing model assumes these events are rare enough that using blank space in the probing hash table will cover all of them.  Increase probing_multiplier (-p to build_binary) to add more blank spaces.\n");
+      }
+    }
+
+  private:
+    File &f_;
+    const std::vector<uint64_t> &counts_;
+    const Config &config_;
+    const ProbingVocabulary &vocab_;
+    PositiveProbWarn &warn_;
+    const Build &build_;
+    Weights *unigrams_;
+};
+
 } // namespace
 namespace detail {
 
-template <class Value> uint8_t *HashedSearch<Value>::SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts, const Config &config) {
+namespace {
+const unsigned char kFingerprintVersion = 0;
+} // namespace
+
+void FingerprintProbing::UpdateConfigFromBinary(const BinaryFormat &file, uint64_t offset, Config &config) {
+  unsigned char buffer[2];
+  file.ReadForConfig(buffer, 2, offset);
+  UTIL_THROW_IF(buffer[0] != kFingerprintVersion, FormatLoadException, "This file has fingerprint version " << (unsigned)buffer[0] << " but the code expects version " << (unsigned)kFingerprintVersion);
+  config.fingerprint_bits = buffer[1];
+}
+
+void FingerprintProbing::WriteHeader(void *to, const Config &config) {
+  util::FingerprintProbingHashTable<ProbEntry>::CheckBits(config.fingerprint_bits);
+  unsigned char *out = static_cast<unsigned char*>(to);
+  out[0] = kFingerprintVersion;
+  out[1] = config.fingerprint_bits;
+}
+
+void FingerprintProbing::Report(const std::vector<uint64_t> &counts, const Config &config) {
+  if (!config.messages) return;
+  *config.messages << "Expected false positive rate per lookup with " << static_cast<unsigned int>(config.fingerprint_bits) << "-bit fingerprints:";
+  for (std::size_t n = 1; n < counts.size(); ++n) {
+    *config.messages << ' ' << (n + 1) << "-gram " << util::FingerprintProbingHashTable<ProbEntry>::FalsePositiveRate(counts[n], config.probing_multiplier, config.fingerprint_bits);
+  }
+  *config.messages << std::endl;
+}
+
+template <class Middle, class Longest, class Reader> void FingerprintProbing::Populate(std::vector<Middle> &middle, Longest &longest, const std::vector<uint64_t> &, const Config &config, Reader &reader) {
+  reader(middle, longest);
+  if (!config.messages) return;
+  std::size_t total = longest.Collisions();
+  for (typename std::vector<Middle>::const_iterator i = middle.begin(); i != middle.end(); ++i) {
+    total += i->Collisions();
+  }
+  if (!total) return;
+  *config.messages << "Warning: " << total << " n-grams share a fingerprint with an n-gram that is found first when looking them up, so queries of them return the other's probability and backoff.  Use more bits to avoid this.  By order:";
+  for (std::size_t n = 0; n < middle.size(); ++n) {
+    *config.messages << ' ' << (n + 2) << "-gram " << middle[n].Collisions();
+  }
+  *config.messages << ' ' << (middle.size() + 2) << "-gram " << longest.Collisions() << std::endl;
+}
+
+void PerfectHash::Report(const std::vector<uint64_t> &, const Config &config) {
+  if (!config.messages) return;
+  *config.messages << "Expected false positive rate per lookup with " << static_cast<unsigned int>(config.fingerprint_bits) << "-bit fingerprints: " << util::PerfectHashTable<ProbEntry>::FalsePositiveRate(config.fingerprint_bits) << std::endl;
+}
+
+template <class Middle, class Longest, class Reader> void PerfectHash::Populate(std::vector<Middle> &middle, Longest &longest, const std::vector<uint64_t> &counts, const Config &config, Reader &reader) {
+  typedef util::ProbingHashTable<typename Middle::Entry, util::IdentityHash> StageMiddle;
+  typedef util::ProbingHashTable<typename Longest::Entry, util::IdentityHash> StageLongest;
+  std::vector<uint64_t> sizes;
+  uint64_t total = 0;
+  for (std::size_t n = 1; n < counts.size() - 1; ++n) {
+    sizes.push_back(StageMiddle::Size(counts[n], config.probing_multiplier));
+    total += sizes.back();
+  }
+  sizes.push_back(StageLongest::Size(counts.back(), config.probing_multiplier));
+  total += sizes.back();
+
+  util::scoped_memory memory;
+  util::HugeMalloc(total, true, memory);
+  uint8_t *start = static_cast<uint8_t*>(memory.get());
+  std::vector<StageMiddle> stage_middle;
+  for (std::size_t i = 0; i < middle.size(); ++i) {
+    stage_middle.push_back(StageMiddle(start, sizes[i]));
+    start += sizes[i];
+  }
+  StageLongest stage_longest(start, sizes.back());
+
+  reader(stage_middle, stage_longest);
+
+  start = static_cast<uint8_t*>(memory.get());
+  for (std::size_t i = 0; i < middle.size(); ++i) {
+    const typename Middle::Entry *begin = reinterpret_cast<const typename Middle::Entry*>(start);
+    middle[i].Build(begin, begin + sizes[i] / sizeof(typename Middle::Entry), 0);
+    start += sizes[i];
+  }
+  const typename Longest::Entry *begin = reinterpret_cast<const typename Longest::Entry*>(start);
+  longest.Build(begin, begin + sizes.back() / sizeof(typename Longest::Entry), 0);
+}
+
+template <class Value, class Layout> uint64_t HashedSearch<Value, Layout>::Padding(const std::vector<uint64_t> &counts, const Config &config) {
+  if (Layout::kAlign == 1) return 0;
+  uint64_t offset = TotalHeaderSize(counts.size()) + ProbingVocabulary::Size(counts[0], config) + Layout::kHeaderSize + Unigram::Size(counts[0]);
+  return (Layout::kAlign - offset % Layout::kAlign) % Layout::kAlign;
+}
+
+template <class Value, class Layout> uint8_t *HashedSearch<Value, Layout>::SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts, const Config &config) {
+  start += Layout::kHeaderSize;
   unigram_ = Unigram(start, counts[0]);
-  start += Unigram::Size(counts[0]);
+  start += Unigram::Size(counts[0]) + Padding(counts, config);
   std::size_t allocated;
   middle_.clear();
   for (unsigned int n = 2; n < counts.size(); ++n) {
-    allocated = Middle::Size(counts[n - 1], config.probing_multiplier);
-    middle_.push_back(Middle(start, allocated));
+    allocated = Layout::template Size<Middle>(counts[n - 1], config);
+    middle_.push_back(Layout::template Make<Middle>(start, allocated, counts[n - 1], config));
     start += allocated;
   }
-  allocated = Longest::Size(counts.back(), config.probing_multiplier);
-  longest_ = Longest(start, allocated);
+  allocated = Layout::template Size<Longest>(counts.back(), config);
+  longest_ = Layout::template Make<Longest>(start, allocated, counts.back(), config);
   start += allocated;
   return start;
 }
@@ -229,69 +365,66 @@ template <class Value> uint8_t *HashedSearch<Value>::SetupMemory(uint8_t *start,
   longest_.Relocate(start);
 }*/
 
-template <class Value> void HashedSearch<Value>::InitializeFromARPA(const char * /*file*/, util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing) {
+template <class Value, class Layout> void HashedSearch<Value, Layout>::InitializeFromARPA(const char * /*file*/, util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing) {
+  InitializeFrom(f, counts, config, vocab, backing);
+}
+
+template <class Value, class Layout> void HashedSearch<Value, Layout>::InitializeFromARPA(const char * /*file*/, NGramSource &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing) {
+  InitializeFrom(f, counts, config, vocab, backing);
+}
+
+template <class Value, class Layout> template <class File> void HashedSearch<Value, Layout>::InitializeFrom(File &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing) {
   void *vocab_rebase;
   void *search_base = backing.GrowForSearch(Size(counts, config), vocab.UnkCountChangePadding(), vocab_rebase);
   vocab.Relocate(vocab_rebase);
+  Layout::WriteHeader(search_base, config);
+  Layout::Report(counts, config);
   SetupMemory(reinterpret_cast<uint8_t*>(search_base), counts, config);
 
   PositiveProbWarn warn(config.positive_log_probability);
   Read1Grams(f, counts[0], vocab, unigram_.Raw(), warn);
   CheckSpecials(config, vocab);
-  DispatchBuild(f, counts, config, vocab, warn);
+  FinishOrderPhase(config.phase_timer, 1);
+  BuildCallback<File> callback(*this, f, counts, config, vocab, warn);
+  Value::template Callback<ProbingModel>(config, counts.size(), vocab, callback);
 }
 
-template <> void HashedSearch<BackoffValue>::DispatchBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn) {
-  NoRestBuild build;
-  ApplyBuild(f, counts, vocab, warn, build);
-}
+template <class Value, class Layout> template <class File> class HashedSearch<Value, Layout>::BuildCallback {
+  public:
+    BuildCallback(HashedSearch<Value, Layout> &search, File &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn)
+      : search_(search), f_(f), counts_(counts), config_(config), vocab_(vocab), warn_(warn) {}
 
-template <> void HashedSearch<RestValue>::DispatchBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn) {
-  switch (config.rest_function) {
-    case Config::REST_MAX:
-      {
-        MaxRestBuild build;
-        ApplyBuild(f, counts, vocab, warn, build);
-      }
-      break;
-    case Config::REST_LOWER:
-      {
-        LowerRestBuild<ProbingModel> build(config, counts.size(), vocab);
-        ApplyBuild(f, counts, vocab, warn, build);
-      }
-      break;
-  }
-}
+    template <class Build> void operator()(const Build &build) {
+      search_.ApplyBuild(f_, counts_, config_, vocab_, warn_, build);
+    }
 
-template <class Value> template <class Build> void HashedSearch<Value>::ApplyBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build) {
+  private:
+    HashedSearch<Value, Layout> &search_;
+    File &f_;
+    const std::vector<uint64_t> &counts_;
+    const Config &config_;
+    const ProbingVocabulary &vocab_;
+    PositiveProbWarn &warn_;
+};
+
+template <class Value, class Layout> template <class Build, class File> void HashedSearch<Value, Layout>::ApplyBuild(File &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build) {
   for (WordIndex i = 0; i < counts[0]; ++i) {
     build.SetRest(&i, (unsigned int)1, unigram_.Raw()[i]);
   }
-
-  try {
-    if (counts.size() > 2) {
-      ReadNGrams<Build, ActivateUnigram<typename Value::Weights>, Middle>(
-          f, 2, counts[1], vocab, build, unigram_.Raw(), middle_, ActivateUnigram<typename Value::Weights>(unigram_.Raw()), middle_[0], warn);
-    }
-    for (unsigned int n = 3; n < counts.size(); ++n) {
-      ReadNGrams<Build, ActivateLowerMiddle<Middle>, Middle>(
-          f, n, counts[n-1], vocab, build, unigram_.Raw(), middle_, ActivateLowerMiddle<Middle>(middle_[n-3]), middle_[n-2], warn);
-    }
-    if (counts.size() > 2) {
-      ReadNGrams<Build, ActivateLowerMiddle<Middle>, Longest>(
-          f, counts.size(), counts[counts.size() - 1], vocab, build, unigram_.Raw(), middle_, ActivateLowerMiddle<Middle>(middle_.back()), longest_, warn);
-    } else {
-      ReadNGrams<Build, ActivateUnigram<typename Value::Weights>, Longest>(
-          f, counts.size(), counts[counts.size() - 1], vocab, build, unigram_.Raw(), middle_, ActivateUnigram<typename Value::Weights>(unigram_.Raw()), longest_, warn);
-    }
-  } catch (util::ProbingSizeException &e) {
-    UTIL_THROW(util::ProbingSizeException, "Avoid pruning n-grams like \"bar baz quux\" when \"foo bar baz quux\" is still in the model.  KenLM will work when this pruning happens, but the probing model assumes these events are rare enough that using blank space in the probing hash table will cover all of them.  Increase probing_multiplier (-p to build_binary) to add more blank spaces.\n");
-  }
+  ReadTables<Build, File> reader(f, counts, config, vocab, warn, build, unigram_.Raw());
+  Layout::Populate(middle_, longest_, counts, config, reader);
   ReadEnd(f);
+  if (config.phase_timer) config.phase_timer->Finish("finish tables");
 }
 
-template class HashedSearch<BackoffValue>;
-template class HashedSearch<RestValue>;
+template class HashedSearch<BackoffValue, LinearProbing>;
+template class HashedSearch<RestValue, LinearProbing>;
+template class HashedSearch<BackoffValue, BucketProbing>;
+template class HashedSearch<RestValue, BucketProbing>;
+template class HashedSearch<BackoffValue, FingerprintProbing>;
+template class HashedSearch<RestValue, FingerprintProbing>;
+template class HashedSearch<BackoffValue, PerfectHash>;
+template class HashedSearch<RestValue, PerfectHash>;
 
 } // namespace detail
 } // namespace ngram
@@ -8,6 +8,9 @@
 #include "lm/weights.hh"
 
 #include "util/bit_packing.hh"
+#include "util/bucketized_probing_hash_table.hh"
+#include "util/fingerprint_probing_hash_table.hh"
+#include "util/perfect_hash_table.hh"
 #include "util/probing_hash_table.hh"
 
 #include <algorithm>
@@ -17,6 +20,7 @@
 namespace util { class FilePiece; }
 
 namespace lm {
+class NGramSource;
 namespace ngram {
 class BinaryFormat;
 class ProbingVocabulary;
@@ -59,7 +63,109 @@ class LongestPointer {
     const float *to_;
 };
 
-template <class Value> class HashedSearch {
+/* Hash table layouts for HashedSearch.  Each maps an entry type to a table
+ * and has its own model type and binary format version.
+ */
+// One entry per slot with linear probing.
+struct LinearProbing {
+  static const ModelType kModelTypeAdd = static_cast<ModelType>(0);
+  static const unsigned int kVersion = 0;
+  // Alignment of the tables' offset in the binary file.
+  static const std::size_t kAlign = 1;
+  // Bytes reserved at the beginning of the search for layout parameters.
+  static const std::size_t kHeaderSize = 0;
+
+  template <class Entry> struct Table {
+    typedef util::ProbingHashTable<Entry, util::IdentityHash> T;
+  };
+
+  template <class TableT> static uint64_t Size(uint64_t entries, const Config &config) {
+    return TableT::Size(entries, config.probing_multiplier);
+  }
+
+  template <class TableT> static TableT Make(void *start, std::size_t allocated, uint64_t /*entries*/, const Config &) {
+    return TableT(start, allocated);
+  }
+
+  static void UpdateConfigFromBinary(const BinaryFormat &, uint64_t, Config &) {}
+  static void WriteHeader(void *, const Config &) {}
+  static void Report(const std::vector<uint64_t> &, const Config &) {}
+
+  /* Fill the tables from the ARPA file by calling reader(middle, longest),
+   * which inserts into whatever tables it is passed.
+   */
+  template <class Middle, class Longest, class Reader> static void Populate(std::vector<Middle> &middle, Longest &longest, const std::vector<uint64_t> & /*counts*/, const Config & /*config*/, Reader &reader) {
+    reader(middle, longest);
+  }
+};
+
+// Cache line sized buckets with keys at the front of each bucket.
+struct BucketProbing : public LinearProbing {
+  static const ModelType kModelTypeAdd = kBucketAdd;
+  static const std::size_t kAlign = 64;
+
+  template <class Entry> struct Table {
+    typedef util::BucketizedProbingHashTable<Entry, util::IdentityHash> T;
+  };
+};
+
+// Store config.fingerprint_bits of each key's hash instead of the full key.
+struct FingerprintProbing : public LinearProbing {
+  static const ModelType kModelTypeAdd = kFingerprintAdd;
+  static const unsigned int kVersion = 0;
+  static const std::size_t kAlign = 1;
+  // Holds the number of fingerprint bits.
+  static const std::size_t kHeaderSize = 8;
+
+  template <class Entry> struct Table {
+    typedef util::FingerprintProbingHashTable<Entry, util::IdentityHash> T;
+  };
+
+  template <class TableT> static uint64_t Size(uint64_t entries, const Config &config) {
+    return TableT::Size(entries, config.probing_multiplier, config.fingerprint_bits);
+  }
+
+  template <class TableT> static TableT Make(void *start, std::size_t allocated, uint64_t /*entries*/, const Config &config) {
+    return TableT(start, allocated, config.fingerprint_bits);
+  }
+
+  static void UpdateConfigFromBinary(const BinaryFormat &file, uint64_t offset, Config &config);
+  static void WriteHeader(void *to, const Config &config);
+  // Print the expected false positive rate of each order to config.messages.
+  static void Report(const std::vector<uint64_t> &counts, const Config &config);
+
+  // Fill the tables, then print how many n-grams of each order collided.
+  template <class Middle, class Longest, class Reader> static void Populate(std::vector<Middle> &middle, Longest &longest, const std::vector<uint64_t> &counts, const Config &config, Reader &reader);
+};
+
+/* Minimal perfect hash per order with dense values and fingerprints of
+ * config.fingerprint_bits.  These tables cannot be inserted into, so entries
+ * are staged in probing hash tables while reading the ARPA file.  Peak build
+ * memory is the model, the staging tables, and what PerfectHashTable::Build
+ * uses for the largest order.
+ */
+struct PerfectHash : public FingerprintProbing {
+  static const ModelType kModelTypeAdd = kPerfectHashAdd;
+  static const std::size_t kAlign = 8;
+
+  template <class Entry> struct Table {
+    typedef util::PerfectHashTable<Entry> T;
+  };
+
+  template <class TableT> static uint64_t Size(uint64_t entries, const Config &config) {
+    return TableT::Size(entries, config.fingerprint_bits);
+  }
+
+  template <class TableT> static TableT Make(void *start, std::size_t /*allocated*/, uint64_t entries, const Config &config) {
+    return TableT(start, entries, config.fingerprint_bits);
+  }
+
+  static void Report(const std::vector<uint64_t> &counts, const Config &config);
+
+  template <class Middle, class Longest, class Reader> static void Populate(std::vector<Middle> &middle, Longest &longest, const std::vector<uint64_t> &counts, const Config &config, Reader &reader);
+};
+
+template <class Value, class Layout = LinearProbing> class HashedSearch {
   public:
     typedef uint64_t Node;
 
@@ -67,24 +173,33 @@ template <class Value> class HashedSearch {
     typedef typename Value::ProbingProxy MiddlePointer;
     typedef ::lm::ngram::detail::LongestPointer LongestPointer;
 
-    static const ModelType kModelType = Value::kProbingModelType;
+    static const ModelType kModelType = static_cast<ModelType>(Value::kProbingModelType + Layout::kModelTypeAdd);
     static const bool kDifferentRest = Value::kDifferentRest;
-    static const unsigned int kVersion = 0;
+    static const unsigned int kVersion = Layout::kVersion;
 
     // TODO: move probing_multiplier here with next binary file format update.
-    static void UpdateConfigFromBinary(const BinaryFormat &, const std::vector<uint64_t> &, uint64_t, Config &) {}
+    static void UpdateConfigFromBinary(const BinaryFormat &file, const std::vector<uint64_t> &, uint64_t offset, Config &config) {
+      Layout::UpdateConfigFromBinary(file, offset, config);
+    }
 
     static uint64_t Size(const std::vector<uint64_t> &counts, const Config &config) {
-      uint64_t ret = Unigram::Size(counts[0]);
+      uint64_t ret = Layout::kHeaderSize + Unigram::Size(counts[0]) + Padding(counts, config);
       for (unsigned char n = 1; n < counts.size() - 1; ++n) {
-        ret += Middle::Size(counts[n], config.probing_multiplier);
+        ret += Layout::template Size<Middle>(counts[n], config);
       }
-      return ret + Longest::Size(counts.back(), config.probing_multiplier);
+      return ret + Layout::template Size<Longest>(counts.back(), config);
     }
 
+    /* Padding between unigrams and the hash tables so that the tables start
+     * at a file offset aligned to Layout::kAlign.  Mapped files are page
+     * aligned so the tables are aligned in memory too.
+     */
+    static uint64_t Padding(const std::vector<uint64_t> &counts, const Config &config);
+
     uint8_t *SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts, const Config &config);
 
     void InitializeFromARPA(const char *file, util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing);
+    void InitializeFromARPA(const char *file, NGramSource &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing);
 
     unsigned char Order() const {
       return middle_.size() + 2;
@@ -125,6 +240,20 @@ template <class Value> class HashedSearch {
       return LongestPointer(found->value.prob);
     }
 
+    // Prefetching for GenericModel::FullScoreBatch.  Each call should be
+    // followed by the corresponding Lookup with the same arguments.
+    void PrefetchUnigram(WordIndex word) const {
+      UTIL_PREFETCH(&unigram_.Lookup(word));
+    }
+
+    void PrefetchMiddle(unsigned char order_minus_2, WordIndex word, const Node &node) const {
+      middle_[order_minus_2].Prefetch(CombineWordHash(node, word));
+    }
+
+    void PrefetchLongest(WordIndex word, const Node &node) const {
+      longest_.Prefetch(CombineWordHash(node, word));
+    }
+
     // Generate a node without necessarily checking that it actually exists.
     // Optionally return false if it's know to not exist.
     bool FastMakeNode(const WordIndex *begin, const WordIndex *end, Node &node) const {
@@ -137,10 +266,12 @@ template <class Value> class HashedSearch {
     }
 
   private:
-    // Interpret config's rest cost build policy and pass the right template argument to ApplyBuild.
-    void DispatchBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn);
+    template <class File> void InitializeFrom(File &f, const std::vector<uint64_t> &counts, const Config &config, ProbingVocabulary &vocab, BinaryFormat &backing);
+
+    // Passed to Value::Callback, which interprets config's rest cost build policy and calls ApplyBuild with the right template argument.
+    template <class File> class BuildCallback;
 
-    template <class Build> void ApplyBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build);
+    template <class Build, class File> void ApplyBuild(File &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build);
 
     class Unigram {
       public:
@@ -178,10 +309,10 @@ template <class Value> class HashedSearch {
 
     Unigram unigram_;
 
-    typedef util::ProbingHashTable<typename Value::ProbingEntry, util::IdentityHash> Middle;
+    typedef typename Layout::template Table<typename Value::ProbingEntry>::T Middle;
     std::vector<Middle> middle_;
 
-    typedef util::ProbingHashTable<ProbEntry, util::IdentityHash> Longest;
+    typedef typename Layout::template Table<ProbEntry>::T Longest;
     Longest longest_;
 };
 
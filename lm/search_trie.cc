@@ -6,6 +6,7 @@
 #include "lm/blank.hh"
 #include "lm/lm_exception.hh"
 #include "lm/max_order.hh"
+#include "lm/ngram_source.hh"
 #include "lm/quantize.hh"
 #include "lm/trie.hh"
 #include "lm/trie_sort.hh"
@@ -17,6 +18,7 @@
 #include "util/proxy_iterator.hh"
 #include "util/scoped.hh"
 #include "util/sized_iterator.hh"
+#include "util/usage.hh"
 
 #include <algorithm>
 #include <cstring>
@@ -459,7 +461,7 @@ void PopulateUnigramWeights(FILE *file, WordIndex unigram_count, RecordReader &c
 
 } // namespace
 
-template <class Quant, class Bhiksha> void BuildTrie(SortedFiles &files, std::vector<uint64_t> &counts, const Config &config, TrieSearch<Quant, Bhiksha> &out, Quant &quant, SortedVocabulary &vocab, BinaryFormat &backing) {
+template <class Quant, class Bhiksha, class Siblings> void BuildTrie(SortedFiles &files, std::vector<uint64_t> &counts, const Config &config, TrieSearch<Quant, Bhiksha, Siblings> &out, Quant &quant, SortedVocabulary &vocab, BinaryFormat &backing) {
   RecordReader inputs[KENLM_MAX_ORDER - 1];
   RecordReader contexts[KENLM_MAX_ORDER - 1];
 
@@ -487,9 +489,10 @@ template <class Quant, class Bhiksha> void BuildTrie(SortedFiles &files, std::ve
   counts = fixed_counts;
 
   sri.ObtainBackoffs(counts.size(), unigram_file.get(), inputs);
+  if (config.phase_timer) config.phase_timer->Finish("identify SRI omissions");
 
   void *vocab_relocate;
-  void *search_base = backing.GrowForSearch(TrieSearch<Quant, Bhiksha>::Size(fixed_counts, config), vocab.UnkCountChangePadding(), vocab_relocate);
+  void *search_base = backing.GrowForSearch(TrieSearch<Quant, Bhiksha, Siblings>::Size(fixed_counts, config), vocab.UnkCountChangePadding(), vocab_relocate);
   vocab.Relocate(vocab_relocate);
   out.SetupMemory(reinterpret_cast<uint8_t*>(search_base), fixed_counts, config);
 
@@ -504,6 +507,7 @@ template <class Quant, class Bhiksha> void BuildTrie(SortedFiles &files, std::ve
     }
     TrainProbQuantizer(counts.size(), counts.back(), inputs[counts.size() - 2], progress, quant);
     quant.FinishedLoading(config);
+    if (config.phase_timer) config.phase_timer->Finish("quantize");
   }
 
   UnigramValue *unigrams = out.unigram_.Raw();
@@ -539,14 +543,46 @@ template <class Quant, class Bhiksha> void BuildTrie(SortedFiles &files, std::ve
   /* Set ending offsets so the last entry will be sized properly */
   // Last entry for unigrams was already set.
   if (out.middle_begin_ != out.middle_end_) {
-    for (typename TrieSearch<Quant, Bhiksha>::Middle *i = out.middle_begin_; i != out.middle_end_ - 1; ++i) {
+    for (typename TrieSearch<Quant, Bhiksha, Siblings>::Middle *i = out.middle_begin_; i != out.middle_end_ - 1; ++i) {
       i->FinishedLoading((i+1)->InsertIndex(), config);
     }
     (out.middle_end_ - 1)->FinishedLoading(out.longest_.InsertIndex(), config);
   }
+
+  out.siblings_.Build(unigrams, counts[0], out.middle_begin_, out.middle_end_, out.longest_);
+  if (config.phase_timer) config.phase_timer->Finish("write trie");
+}
+
+namespace {
+template <class Table> void SampleOrder(const Table &table, EytzingerIndex &index) {
+  for (uint64_t i = 0; i < table.InsertIndex(); i += EytzingerIndex::kEvery) {
+    index.Sample(i, table.ReadWord(i));
+  }
+}
+} // namespace
+
+template <class Middle> void EytzingerSiblings::Build(const UnigramValue *unigrams, uint64_t unigram_count, Middle *middle_begin, Middle *middle_end, const BitPackedLongest &longest) {
+  std::vector<WordIndex> buffer;
+  for (Middle *i = middle_begin; i != middle_end; ++i) {
+    SampleOrder(*i, index_[i - middle_begin]);
+  }
+  SampleOrder(longest, index_.back());
+  // Bigram siblings are delimited by unigrams.
+  for (uint64_t i = 0; i < unigram_count; ++i) {
+    index_[0].Arrange(unigrams[i].next, unigrams[i + 1].next, buffer);
+  }
+  // Children of each middle entry.
+  for (Middle *i = middle_begin; i != middle_end; ++i) {
+    EytzingerIndex &children = index_[i - middle_begin + 1];
+    NodeRange range;
+    for (uint64_t p = 0; p < i->InsertIndex(); ++p) {
+      i->ReadEntry(p, range);
+      children.Arrange(range.begin, range.end, buffer);
+    }
+  }
 }
 
-template <class Quant, class Bhiksha> uint8_t *TrieSearch<Quant, Bhiksha>::SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts, const Config &config) {
+template <class Quant, class Bhiksha, class Siblings> uint8_t *TrieSearch<Quant, Bhiksha, Siblings>::SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts, const Config &config) {
   quant_.SetupMemory(start, counts.size(), config);
   start += Quant::Size(counts.size(), config);
   unigram_.Init(start);
@@ -572,10 +608,19 @@ template <class Quant, class Bhiksha> uint8_t *TrieSearch<Quant, Bhiksha>::Setup
         config);
   }
   longest_.Init(start, quant_.LongestBits(config), counts[0]);
-  return start + Longest::Size(Quant::LongestBits(config), counts.back(), counts[0]);
+  start += Longest::Size(Quant::LongestBits(config), counts.back(), counts[0]);
+  return siblings_.SetupMemory(start, counts);
+}
+
+template <class Quant, class Bhiksha, class Siblings> void TrieSearch<Quant, Bhiksha, Siblings>::InitializeFromARPA(const char *file, util::FilePiece &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing) {
+  InitializeFrom(file, f, counts, config, vocab, backing);
+}
+
+template <class Quant, class Bhiksha, class Siblings> void TrieSearch<Quant, Bhiksha, Siblings>::InitializeFromARPA(const char *file, NGramSource &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing) {
+  InitializeFrom(file, f, counts, config, vocab, backing);
 }
 
-template <class Quant, class Bhiksha> void TrieSearch<Quant, Bhiksha>::InitializeFromARPA(const char *file, util::FilePiece &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing) {
+template <class Quant, class Bhiksha, class Siblings> template <class File> void TrieSearch<Quant, Bhiksha, Siblings>::InitializeFrom(const char *file, File &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing) {
   std::string temporary_prefix;
   if (!config.temporary_directory_prefix.empty()) {
     temporary_prefix = config.temporary_directory_prefix;
@@ -594,6 +639,12 @@ template class TrieSearch<DontQuantize, DontBhiksha>;
 template class TrieSearch<DontQuantize, ArrayBhiksha>;
 template class TrieSearch<SeparatelyQuantize, DontBhiksha>;
 template class TrieSearch<SeparatelyQuantize, ArrayBhiksha>;
+template class TrieSearch<DontQuantize, EliasFanoBhiksha>;
+template class TrieSearch<SeparatelyQuantize, EliasFanoBhiksha>;
+template class TrieSearch<DontQuantize, DontBhiksha, EytzingerSiblings>;
+template class TrieSearch<DontQuantize, ArrayBhiksha, EytzingerSiblings>;
+template class TrieSearch<SeparatelyQuantize, DontBhiksha, EytzingerSiblings>;
+template class TrieSearch<SeparatelyQuantize, ArrayBhiksha, EytzingerSiblings>;
 
 } // namespace trie
 } // namespace ngram
@@ -15,16 +15,78 @@
 #include <cassert>
 
 namespace lm {
+class NGramSource;
 namespace ngram {
 class BinaryFormat;
 class SortedVocabulary;
 namespace trie {
 
-template <class Quant, class Bhiksha> class TrieSearch;
+/* Sibling policies for TrieSearch decide how a word is found among the
+ * children of a node.  SortedSiblings searches the sorted entries directly.
+ */
+class SortedSiblings {
+  public:
+    static const ModelType kModelTypeAdd = static_cast<ModelType>(0);
+
+    static uint64_t Size(const std::vector<uint64_t> &/*counts*/) { return 0; }
+
+    uint8_t *SetupMemory(uint8_t *start, const std::vector<uint64_t> &/*counts*/) { return start; }
+
+    template <class Middle> void Build(const UnigramValue * /*unigrams*/, uint64_t /*unigram_count*/, Middle * /*middle_begin*/, Middle * /*middle_end*/, const BitPackedLongest &/*longest*/) {}
+
+    template <class Middle> util::BitAddress FindMiddle(const Middle &middle, unsigned char /*order_minus_2*/, WordIndex word, NodeRange &range, uint64_t &pointer) const {
+      return middle.Find(word, range, pointer);
+    }
+
+    util::BitAddress FindLongest(const BitPackedLongest &longest, WordIndex word, const NodeRange &range) const {
+      return longest.Find(word, range);
+    }
+};
+
+/* Keep an EytzingerIndex for each order above unigrams, stored after the
+ * longest entries.  This costs about 4 bytes per 8 n-grams.
+ */
+class EytzingerSiblings {
+  public:
+    static const ModelType kModelTypeAdd = kEytzingerAdd;
+
+    static uint64_t Size(const std::vector<uint64_t> &counts) {
+      uint64_t ret = 0;
+      for (std::size_t i = 1; i < counts.size(); ++i) {
+        ret += EytzingerIndex::Size(counts[i]);
+      }
+      return ret;
+    }
+
+    uint8_t *SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts) {
+      index_.resize(counts.size() - 1);
+      for (std::size_t i = 1; i < counts.size(); ++i) {
+        index_[i - 1].Init(start);
+        start += EytzingerIndex::Size(counts[i]);
+      }
+      return start;
+    }
+
+    // Sample and arrange every order once the entries and next pointers are written.
+    template <class Middle> void Build(const UnigramValue *unigrams, uint64_t unigram_count, Middle *middle_begin, Middle *middle_end, const BitPackedLongest &longest);
+
+    template <class Middle> util::BitAddress FindMiddle(const Middle &middle, unsigned char order_minus_2, WordIndex word, NodeRange &range, uint64_t &pointer) const {
+      return middle.Find(word, range, pointer, index_[order_minus_2]);
+    }
+
+    util::BitAddress FindLongest(const BitPackedLongest &longest, WordIndex word, const NodeRange &range) const {
+      return longest.Find(word, range, index_.back());
+    }
+
+  private:
+    std::vector<EytzingerIndex> index_;
+};
+
+template <class Quant, class Bhiksha, class Siblings = SortedSiblings> class TrieSearch;
 class SortedFiles;
-template <class Quant, class Bhiksha> void BuildTrie(SortedFiles &files, std::vector<uint64_t> &counts, const Config &config, TrieSearch<Quant, Bhiksha> &out, Quant &quant, SortedVocabulary &vocab, BinaryFormat &backing);
+template <class Quant, class Bhiksha, class Siblings> void BuildTrie(SortedFiles &files, std::vector<uint64_t> &counts, const Config &config, TrieSearch<Quant, Bhiksha, Siblings> &out, Quant &quant, SortedVocabulary &vocab, BinaryFormat &backing);
 
-template <class Quant, class Bhiksha> class TrieSearch {
+template <class Quant, class Bhiksha, class Siblings> class TrieSearch {
   public:
     typedef NodeRange Node;
 
@@ -34,7 +96,7 @@ template <class Quant, class Bhiksha> class TrieSearch {
 
     static const bool kDifferentRest = false;
 
-    static const ModelType kModelType = static_cast<ModelType>(TRIE_SORTED + Quant::kModelTypeAdd + Bhiksha::kModelTypeAdd);
+    static const ModelType kModelType = static_cast<ModelType>(TRIE_SORTED + Quant::kModelTypeAdd + Bhiksha::kModelTypeAdd + Siblings::kModelTypeAdd);
 
     static const unsigned int kVersion = 1;
 
@@ -50,7 +112,7 @@ template <class Quant, class Bhiksha> class TrieSearch {
       for (unsigned char i = 1; i < counts.size() - 1; ++i) {
         ret += Middle::Size(Quant::MiddleBits(config), counts[i], counts[0], counts[i+1], config);
       }
-      return ret + Longest::Size(Quant::LongestBits(config), counts.back(), counts[0]);
+      return ret + Longest::Size(Quant::LongestBits(config), counts.back(), counts[0]) + Siblings::Size(counts);
     }
 
     TrieSearch() : middle_begin_(NULL), middle_end_(NULL) {}
@@ -60,6 +122,7 @@ template <class Quant, class Bhiksha> class TrieSearch {
     uint8_t *SetupMemory(uint8_t *start, const std::vector<uint64_t> &counts, const Config &config);
 
     void InitializeFromARPA(const char *file, util::FilePiece &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing);
+    void InitializeFromARPA(const char *file, NGramSource &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing);
 
     unsigned char Order() const {
       return middle_end_ - middle_begin_ + 2;
@@ -79,15 +142,26 @@ template <class Quant, class Bhiksha> class TrieSearch {
     }
 
     MiddlePointer LookupMiddle(unsigned char order_minus_2, WordIndex word, Node &node, bool &independent_left, uint64_t &extend_left) const {
-      util::BitAddress address(middle_begin_[order_minus_2].Find(word, node, extend_left));
+      util::BitAddress address(siblings_.FindMiddle(middle_begin_[order_minus_2], order_minus_2, word, node, extend_left));
       independent_left = (address.base == NULL) || (node.begin == node.end);
       return MiddlePointer(quant_, order_minus_2, address);
     }
 
     LongestPointer LookupLongest(WordIndex word, const Node &node) const {
-      return LongestPointer(quant_, longest_.Find(word, node));
+      return LongestPointer(quant_, siblings_.FindLongest(longest_, word, node));
+    }
+
+    // Prefetching for GenericModel::FullScoreBatch.  The location of the
+    // next entry depends on searching the current range, so only unigrams
+    // can be usefully fetched ahead.
+    void PrefetchUnigram(WordIndex word) const {
+      UTIL_PREFETCH(&unigram_.Lookup(word));
     }
 
+    void PrefetchMiddle(unsigned char /*order_minus_2*/, WordIndex /*word*/, const Node &/*node*/) const {}
+
+    void PrefetchLongest(WordIndex /*word*/, const Node &/*node*/) const {}
+
     bool FastMakeNode(const WordIndex *begin, const WordIndex *end, Node &node) const {
       assert(begin != end);
       bool independent_left;
@@ -100,7 +174,9 @@ template <class Quant, class Bhiksha> class TrieSearch {
     }
 
   private:
-    friend void BuildTrie<Quant, Bhiksha>(SortedFiles &files, std::vector<uint64_t> &counts, const Config &config, TrieSearch<Quant, Bhiksha> &out, Quant &quant, SortedVocabulary &vocab, BinaryFormat &backing);
+    friend void BuildTrie<Quant, Bhiksha, Siblings>(SortedFiles &files, std::vector<uint64_t> &counts, const Config &config, TrieSearch<Quant, Bhiksha, Siblings> &out, Quant &quant, SortedVocabulary &vocab, BinaryFormat &backing);
+
+    template <class File> void InitializeFrom(const char *file, File &f, std::vector<uint64_t> &counts, const Config &config, SortedVocabulary &vocab, BinaryFormat &backing);
 
     // Middles are managed manually so we can delay construction and they don't have to be copyable.
     void FreeMiddles() {
@@ -120,6 +196,8 @@ template <class Quant, class Bhiksha> class TrieSearch {
 
     typedef ::lm::ngram::trie::Unigram Unigram;
     Unigram unigram_;
+
+    Siblings siblings_;
 };
 
 } // namespace trie
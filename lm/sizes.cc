@@ -9,13 +9,18 @@ namespace lm {
 namespace ngram {
 
 void ShowSizes(const std::vector<uint64_t> &counts, const lm::ngram::Config &config) {
-  uint64_t sizes[6];
+  uint64_t sizes[11];
   sizes[0] = ProbingModel::Size(counts, config);
   sizes[1] = RestProbingModel::Size(counts, config);
   sizes[2] = TrieModel::Size(counts, config);
   sizes[3] = QuantTrieModel::Size(counts, config);
   sizes[4] = ArrayTrieModel::Size(counts, config);
   sizes[5] = QuantArrayTrieModel::Size(counts, config);
+  sizes[6] = BucketProbingModel::Size(counts, config);
+  sizes[7] = FingerprintProbingModel::Size(counts, config);
+  sizes[8] = PerfectHashModel::Size(counts, config);
+  sizes[9] = EytzingerTrieModel::Size(counts, config);
+  sizes[10] = EliasFanoTrieModel::Size(counts, config);
   uint64_t max_length = *std::max_element(sizes, sizes + sizeof(sizes) / sizeof(uint64_t));
   uint64_t min_length = *std::min_element(sizes, sizes + sizeof(sizes) / sizeof(uint64_t));
   uint64_t divide;
@@ -42,10 +47,15 @@ void ShowSizes(const std::vector<uint64_t> &counts, const lm::ngram::Config &con
   std::cerr << prefix << "B\n"
     "probing " << std::setw(length) << (sizes[0] / divide) << " assuming -p " << config.probing_multiplier << "\n"
     "probing " << std::setw(length) << (sizes[1] / divide) << " assuming -r models -p " << config.probing_multiplier << "\n"
+    "bucket  " << std::setw(length) << (sizes[6] / divide) << " assuming -p " << config.probing_multiplier << "\n"
+    "fingerprint " << std::setw(length) << (sizes[7] / divide) << " assuming -p " << config.probing_multiplier << " -k " << (unsigned)config.fingerprint_bits << "\n"
+    "perfect " << std::setw(length) << (sizes[8] / divide) << " assuming -k " << (unsigned)config.fingerprint_bits << "\n"
     "trie    " << std::setw(length) << (sizes[2] / divide) << " without quantization\n"
     "trie    " << std::setw(length) << (sizes[3] / divide) << " assuming -q " << (unsigned)config.prob_bits << " -b " << (unsigned)config.backoff_bits << " quantization \n"
     "trie    " << std::setw(length) << (sizes[4] / divide) << " assuming -a " << (unsigned)config.pointer_bhiksha_bits << " array pointer compression\n"
-    "trie    " << std::setw(length) << (sizes[5] / divide) << " assuming -a " << (unsigned)config.pointer_bhiksha_bits << " -q " << (unsigned)config.prob_bits << " -b " << (unsigned)config.backoff_bits<< " array pointer compression and quantization\n";
+    "trie    " << std::setw(length) << (sizes[5] / divide) << " assuming -a " << (unsigned)config.pointer_bhiksha_bits << " -q " << (unsigned)config.prob_bits << " -b " << (unsigned)config.backoff_bits<< " array pointer compression and quantization\n"
+    "trie    " << std::setw(length) << (sizes[10] / divide) << " assuming -e Elias-Fano pointer compression\n"
+    "eytzinger " << std::setw(length) << (sizes[9] / divide) << " without quantization\n";
 }
 
 void ShowSizes(const std::vector<uint64_t> &counts) {
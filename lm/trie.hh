@@ -6,6 +6,7 @@
 #include "util/bit_packing.hh"
 
 #include <cstddef>
+#include <vector>
 
 #include <stdint.h>
 
@@ -73,6 +74,53 @@ class Unigram {
     UnigramValue *unigram_;
 };
 
+/* Side index over the entries of one order.  It holds the word of every
+ * kEvery-th entry.  The samples that fall inside a sibling range are
+ * contiguous and belong to that range alone, so Arrange permutes them into
+ * Eytzinger (breadth-first) order.  Searching then descends an implicit
+ * binary tree whose next levels sit at predictable addresses and can be
+ * prefetched, leaving at most kEvery - 1 entries to scan.  The entries
+ * themselves stay sorted so next pointers still delimit children.
+ */
+class EytzingerIndex {
+  public:
+    static const uint64_t kEvery = 8;
+
+    // Ranges with fewer samples are searched without the index.
+    static const uint64_t kMinSamples = 16;
+
+    static uint64_t Size(uint64_t entries) {
+      return (entries / kEvery + 1) * sizeof(WordIndex);
+    }
+
+    EytzingerIndex() : samples_(NULL) {}
+
+    void Init(void *base) {
+      samples_ = static_cast<WordIndex*>(base);
+    }
+
+    // Record the word of entry index, which must be a multiple of kEvery.
+    void Sample(uint64_t index, WordIndex word) {
+      samples_[index / kEvery] = word;
+    }
+
+    // Once sampled, permute the samples of sibling range [begin, end).  buffer is scratch.
+    void Arrange(uint64_t begin, uint64_t end, std::vector<WordIndex> &buffer);
+
+    bool Indexes(uint64_t begin, uint64_t end) const {
+      return (end + kEvery - 1) / kEvery - (begin + kEvery - 1) / kEvery >= kMinSamples;
+    }
+
+    /* Look for key in sibling range [begin, end), which must satisfy Indexes.
+     * Returns true with at_index if key is a sample.  Otherwise narrows
+     * [begin, end) to the entries between the neighboring samples.
+     */
+    bool Narrow(uint64_t key, uint64_t &begin, uint64_t &end, uint64_t &at_index) const;
+
+  private:
+    WordIndex *samples_;
+};
+
 class BitPacked {
   public:
     BitPacked() {}
@@ -81,6 +129,10 @@ class BitPacked {
       return insert_index_;
     }
 
+    WordIndex ReadWord(uint64_t index) const {
+      return util::ReadInt57(base_, index * total_bits_, word_bits_, word_mask_);
+    }
+
   protected:
     static uint64_t BaseSize(uint64_t entries, uint64_t max_vocab, uint8_t remaining_bits);
 
@@ -108,6 +160,9 @@ template <class Bhiksha> class BitPackedMiddle : public BitPacked {
 
     util::BitAddress Find(WordIndex word, NodeRange &range, uint64_t &pointer) const;
 
+    // Find using a side index built over this order.
+    util::BitAddress Find(WordIndex word, NodeRange &range, uint64_t &pointer, const EytzingerIndex &index) const;
+
     util::BitAddress ReadEntry(uint64_t pointer, NodeRange &range) {
       uint64_t addr = pointer * total_bits_;
       addr += word_bits_;
@@ -116,6 +171,9 @@ template <class Bhiksha> class BitPackedMiddle : public BitPacked {
     }
 
   private:
+    // Read the entry at at_pointer once the search found it.
+    util::BitAddress Found(uint64_t at_pointer, NodeRange &range, uint64_t &pointer) const;
+
     uint8_t quant_bits_;
     Bhiksha bhiksha_;
 
@@ -137,6 +195,8 @@ class BitPackedLongest : public BitPacked {
     util::BitAddress Insert(WordIndex word);
 
     util::BitAddress Find(WordIndex word, const NodeRange &node) const;
+
+    util::BitAddress Find(WordIndex word, const NodeRange &node, const EytzingerIndex &index) const;
 };
 
 } // namespace trie
@@ -0,0 +1,103 @@
+#ifndef LM_TRIE_SCAN_H
+#define LM_TRIE_SCAN_H
+
+/* Linear scans over the bit-packed, sorted keys of a trie level, used once
+ * search has narrowed the range to a few cache lines.  Each has
+ *   static bool Find(const KeyAccessor &accessor, uint64_t begin, uint64_t end, uint64_t key, uint64_t &at_index);
+ * which sets at_index to the first entry of [begin, end) that is >= key and
+ * returns whether it equals key.
+ */
+
+#include "lm/word_index.hh"
+#include "util/bit_packing.hh"
+
+#include <stdint.h>
+
+// AVX2Scan needs x86 and a compiler that can target AVX2 one function at a
+// time, so it is always compiled and the tests can run it on capable hardware.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define KENLM_AVX2_SCAN
+#include <immintrin.h>
+#endif
+
+namespace lm {
+namespace ngram {
+namespace trie {
+
+class KeyAccessor {
+  public:
+    KeyAccessor(const void *base, uint64_t key_mask, uint8_t key_bits, uint8_t total_bits)
+      : base_(reinterpret_cast<const uint8_t*>(base)), key_mask_(key_mask), key_bits_(key_bits), total_bits_(total_bits) {}
+
+    typedef uint64_t Key;
+
+    Key operator()(uint64_t index) const {
+      return util::ReadInt57(base_, index * static_cast<uint64_t>(total_bits_), key_bits_, key_mask_);
+    }
+
+    const uint8_t *Base() const { return base_; }
+    WordIndex KeyMask() const { return key_mask_; }
+    uint8_t TotalBits() const { return total_bits_; }
+
+  private:
+    const uint8_t *const base_;
+    const WordIndex key_mask_;
+    const uint8_t key_bits_, total_bits_;
+};
+
+struct ScalarScan {
+  static bool Find(const KeyAccessor &accessor, uint64_t begin, uint64_t end, uint64_t key, uint64_t &at_index) {
+    for (; begin < end; ++begin) {
+      uint64_t got = accessor(begin);
+      // Sorted, so the first entry >= key decides.
+      if (got >= key) {
+        at_index = begin;
+        return got == key;
+      }
+    }
+    return false;
+  }
+};
+
+#ifdef KENLM_AVX2_SCAN
+// Unpack and compare four entries at a time.  Little endian like ReadInt57 on
+// x86.  Only call this if the CPU has AVX2, as it does when compiled with
+// -mavx2.
+struct AVX2Scan {
+  __attribute__((target("avx2"))) static bool Find(const KeyAccessor &accessor, uint64_t begin, uint64_t end, uint64_t key, uint64_t &at_index) {
+    const uint64_t total_bits = accessor.TotalBits();
+    const __m256i target = _mm256_set1_epi64x(key);
+    const __m256i mask = _mm256_set1_epi64x(accessor.KeyMask());
+    const __m256i seven = _mm256_set1_epi64x(7);
+    const __m256i stride = _mm256_set1_epi64x(4 * total_bits);
+    __m256i bit = _mm256_setr_epi64x(begin * total_bits, (begin + 1) * total_bits, (begin + 2) * total_bits, (begin + 3) * total_bits);
+    const uint8_t *base = accessor.Base();
+    for (; begin + 4 <= end; begin += 4) {
+      // BaseSize pads by 8 bytes so these loads stay in bounds, as with ReadInt57.
+      // Separate loads measured faster than _mm256_i64gather_epi64.
+      __m256i raw = _mm256_setr_epi64x(
+          util::ReadOff(base, begin * total_bits),
+          util::ReadOff(base, (begin + 1) * total_bits),
+          util::ReadOff(base, (begin + 2) * total_bits),
+          util::ReadOff(base, (begin + 3) * total_bits));
+      __m256i got = _mm256_and_si256(_mm256_srlv_epi64(raw, _mm256_and_si256(bit, seven)), mask);
+      // Keys are at most 57 bits so signed comparison is safe.
+      int below = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(target, got)));
+      if (below != 0xf) {
+        unsigned int first = __builtin_ctz(~below);
+        at_index = begin + first;
+        int equal = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(target, got)));
+        return (equal >> first) & 1;
+      }
+      bit = _mm256_add_epi64(bit, stride);
+    }
+    return ScalarScan::Find(accessor, begin, end, key, at_index);
+  }
+};
+#endif // KENLM_AVX2_SCAN
+
+} // namespace trie
+} // namespace ngram
+} // namespace lm
+
+#endif // LM_TRIE_SCAN_H
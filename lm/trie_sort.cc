@@ -2,6 +2,8 @@
 
 #include "lm/config.hh"
 #include "lm/lm_exception.hh"
+#include "lm/ngram_source.hh"
+#include "lm/parallel_read_arpa.hh"
 #include "lm/read_arpa.hh"
 #include "lm/vocab.hh"
 #include "lm/weights.hh"
@@ -9,7 +11,9 @@
 #include "util/file_piece.hh"
 #include "util/mmap.hh"
 #include "util/proxy_iterator.hh"
+#include "util/scoped.hh"
 #include "util/sized_iterator.hh"
+#include "util/usage.hh"
 
 #include <algorithm>
 #include <cstring>
@@ -188,6 +192,14 @@ void RecordReader::Rewind() {
 }
 
 SortedFiles::SortedFiles(const Config &config, util::FilePiece &f, std::vector<uint64_t> &counts, size_t buffer, const std::string &file_prefix, SortedVocabulary &vocab) {
+  Initialize(config, f, counts, buffer, file_prefix, vocab);
+}
+
+SortedFiles::SortedFiles(const Config &config, NGramSource &f, std::vector<uint64_t> &counts, size_t buffer, const std::string &file_prefix, SortedVocabulary &vocab) {
+  Initialize(config, f, counts, buffer, file_prefix, vocab);
+}
+
+template <class File> void SortedFiles::Initialize(const Config &config, File &f, std::vector<uint64_t> &counts, size_t buffer, const std::string &file_prefix, SortedVocabulary &vocab) {
   PositiveProbWarn warn(config.positive_log_probability);
   unigram_.reset(util::MakeTemp(file_prefix));
   {
@@ -198,6 +210,7 @@ SortedFiles::SortedFiles(const Config &config, util::FilePiece &f, std::vector<u
     CheckSpecials(config, vocab);
     if (!vocab.SawUnk()) ++counts[0];
   }
+  FinishOrderPhase(config.phase_timer, 1);
 
   // Only use as much buffer as we need.
   size_t buffer_use = 0;
@@ -212,12 +225,21 @@ SortedFiles::SortedFiles(const Config &config, util::FilePiece &f, std::vector<u
   if (!mem.get()) UTIL_THROW(util::ErrnoException, "malloc failed for sort buffer size " << buffer);
 
   for (unsigned char order = 2; order <= counts.size(); ++order) {
-    ConvertToSorted(f, vocab, counts, file_prefix, order, warn, mem.get(), buffer);
+    ConvertToSorted(f, vocab, counts, file_prefix, order, warn, config.load_threads, mem.get(), buffer);
+    FinishOrderPhase(config.phase_timer, order);
   }
   ReadEnd(f);
 }
 
 namespace {
+// Fill the records in [out, out_end) with the next n-grams from reader.
+template <class Weights, class Reader> void ReadBatch(Reader &reader, unsigned char order, uint8_t *out, uint8_t *out_end, std::size_t entry_size) {
+  const std::size_t words_size = sizeof(WordIndex) * order;
+  for (; out != out_end; out += entry_size) {
+    reader.Read(reinterpret_cast<WordIndex*>(out), *reinterpret_cast<Weights*>(out + words_size));
+  }
+}
+
 class Closer {
   public:
     explicit Closer(std::deque<FILE*> &files) : files_(files) {}
@@ -237,7 +259,7 @@ class Closer {
 };
 } // namespace
 
-void SortedFiles::ConvertToSorted(util::FilePiece &f, const SortedVocabulary &vocab, const std::vector<uint64_t> &counts, const std::string &file_prefix, unsigned char order, PositiveProbWarn &warn, void *mem, std::size_t mem_size) {
+template <class File> void SortedFiles::ConvertToSorted(File &f, const SortedVocabulary &vocab, const std::vector<uint64_t> &counts, const std::string &file_prefix, unsigned char order, PositiveProbWarn &warn, std::size_t threads, void *mem, std::size_t mem_size) {
   ReadNGramHeader(f, order);
   const size_t count = counts[order - 1];
   // Size of weights.  Does it include backoff?
@@ -250,19 +272,22 @@ void SortedFiles::ConvertToSorted(util::FilePiece &f, const SortedVocabulary &vo
   std::deque<FILE*> files, contexts;
   Closer files_closer(files), contexts_closer(contexts);
 
+  // One reader for the whole order so its parsing threads start once and keep
+  // parsing ahead while earlier batches are sorted and written.
+  util::scoped_ptr<NGramReader<SortedVocabulary, Prob, File> > prob_reader;
+  util::scoped_ptr<NGramReader<SortedVocabulary, ProbBackoff, File> > backoff_reader;
+  if (order == counts.size()) {
+    prob_reader.reset(new NGramReader<SortedVocabulary, Prob, File>(f, order, count, vocab, warn, threads));
+  } else {
+    backoff_reader.reset(new NGramReader<SortedVocabulary, ProbBackoff, File>(f, order, count, vocab, warn, threads));
+  }
+
   for (std::size_t batch = 0, done = 0; done < count; ++batch) {
-    uint8_t *out = begin;
-    uint8_t *out_end = out + std::min(count - done, batch_size) * entry_size;
-    if (order == counts.size()) {
-      for (; out != out_end; out += entry_size) {
-        std::reverse_iterator<WordIndex*> it(reinterpret_cast<WordIndex*>(out) + order);
-        ReadNGram(f, order, vocab, it, *reinterpret_cast<Prob*>(out + words_size), warn);
-      }
+    uint8_t *out_end = begin + std::min(count - done, batch_size) * entry_size;
+    if (prob_reader.get()) {
+      ReadBatch<Prob>(*prob_reader, order, begin, out_end, entry_size);
     } else {
-      for (; out != out_end; out += entry_size) {
-        std::reverse_iterator<WordIndex*> it(reinterpret_cast<WordIndex*>(out) + order);
-        ReadNGram(f, order, vocab, it, *reinterpret_cast<ProbBackoff*>(out + words_size), warn);
-      }
+      ReadBatch<ProbBackoff>(*backoff_reader, order, begin, out_end, entry_size);
     }
     // Sort full records by full n-gram.
     util::SizedProxy proxy_begin(begin, entry_size), proxy_end(out_end, entry_size);
@@ -21,6 +21,7 @@ class FilePiece;
 } // namespace util
 
 namespace lm {
+class NGramSource;
 class PositiveProbWarn;
 namespace ngram {
 class SortedVocabulary;
@@ -87,6 +88,9 @@ class SortedFiles {
     // Build from ARPA
     SortedFiles(const Config &config, util::FilePiece &f, std::vector<uint64_t> &counts, std::size_t buffer, const std::string &file_prefix, SortedVocabulary &vocab);
 
+    // Build from n-grams that are not ARPA text.
+    SortedFiles(const Config &config, NGramSource &f, std::vector<uint64_t> &counts, std::size_t buffer, const std::string &file_prefix, SortedVocabulary &vocab);
+
     int StealUnigram() {
       return unigram_.release();
     }
@@ -100,7 +104,9 @@ class SortedFiles {
     }
 
   private:
-    void ConvertToSorted(util::FilePiece &f, const SortedVocabulary &vocab, const std::vector<uint64_t> &counts, const std::string &prefix, unsigned char order, PositiveProbWarn &warn, void *mem, std::size_t mem_size);
+    template <class File> void Initialize(const Config &config, File &f, std::vector<uint64_t> &counts, std::size_t buffer, const std::string &file_prefix, SortedVocabulary &vocab);
+
+    template <class File> void ConvertToSorted(File &f, const SortedVocabulary &vocab, const std::vector<uint64_t> &counts, const std::string &prefix, unsigned char order, PositiveProbWarn &warn, std::size_t threads, void *mem, std::size_t mem_size);
 
     util::scoped_fd unigram_;
 
@@ -0,0 +1,141 @@
+#include "lm/trie.hh"
+
+#include "lm/bhiksha.hh"
+#include "lm/config.hh"
+#include "lm/trie_scan.hh"
+#include "util/bit_packing.hh"
+
+#define BOOST_TEST_MODULE TrieTest
+#include <boost/test/unit_test.hpp>
+
+#include <cstdlib>
+#include <vector>
+
+namespace lm {
+namespace ngram {
+namespace trie {
+namespace {
+
+// Even words so odd keys are absent.  Ranges start and end off sample boundaries.
+BOOST_AUTO_TEST_CASE(EytzingerNarrow) {
+  const uint64_t kBounds[] = {0, 3, 200, 215, 1000};
+  const uint64_t kRanges = sizeof(kBounds) / sizeof(uint64_t) - 1;
+  std::vector<WordIndex> words;
+  for (uint64_t r = 0; r < kRanges; ++r) {
+    for (uint64_t i = kBounds[r]; i < kBounds[r + 1]; ++i) {
+      words.push_back(2 * (i - kBounds[r]) + 2 + r);
+    }
+  }
+  std::vector<char> memory(EytzingerIndex::Size(words.size()));
+  EytzingerIndex index;
+  index.Init(&memory[0]);
+  for (uint64_t i = 0; i < words.size(); i += EytzingerIndex::kEvery) {
+    index.Sample(i, words[i]);
+  }
+  std::vector<WordIndex> buffer;
+  for (uint64_t r = 0; r < kRanges; ++r) {
+    index.Arrange(kBounds[r], kBounds[r + 1], buffer);
+  }
+
+  BOOST_CHECK(!index.Indexes(kBounds[1], kBounds[2] - 80));
+  for (uint64_t r = 0; r < kRanges; ++r) {
+    if (!index.Indexes(kBounds[r], kBounds[r + 1])) continue;
+    for (WordIndex key = 0; key < 2 * (kBounds[r + 1] - kBounds[r]) + 4 + r; ++key) {
+      uint64_t begin = kBounds[r], end = kBounds[r + 1], at_index;
+      if (index.Narrow(key, begin, end, at_index)) {
+        BOOST_REQUIRE_EQUAL(key, words[at_index]);
+        BOOST_CHECK_EQUAL(0U, at_index % EytzingerIndex::kEvery);
+        continue;
+      }
+      BOOST_REQUIRE(kBounds[r] <= begin && begin <= end && end <= kBounds[r + 1]);
+      BOOST_CHECK(end - begin < EytzingerIndex::kEvery);
+      // The key, if present, is in what remains.
+      for (uint64_t i = kBounds[r]; i < kBounds[r + 1]; ++i) {
+        if (words[i] == key) BOOST_CHECK(begin <= i && i < end);
+      }
+      if (begin > kBounds[r]) BOOST_CHECK(words[begin - 1] < key);
+      if (end < kBounds[r + 1]) BOOST_CHECK(words[end] > key);
+    }
+  }
+}
+
+// Runs of equal pointers, large gaps, and enough values to use several select samples.
+BOOST_AUTO_TEST_CASE(EliasFanoNext) {
+  Config config;
+  const uint64_t kValues = 5000;
+  std::vector<uint64_t> next;
+  uint64_t value = 0;
+  std::srand(7);
+  for (uint64_t i = 0; i < kValues; ++i) {
+    next.push_back(value);
+    unsigned int roll = std::rand() % 10;
+    value += (roll < 3) ? 0 : ((roll < 9) ? std::rand() % 20 : std::rand() % 5000);
+  }
+  const uint64_t max_next = next.back();
+  std::vector<char> memory(EliasFanoBhiksha::Size(kValues, max_next, config) + 1);
+  // Deliberately misaligned.
+  void *base = &memory[1];
+  EliasFanoBhiksha bhiksha(base, kValues, max_next, config);
+  BOOST_CHECK_EQUAL(0, EliasFanoBhiksha::InlineBits(kValues, max_next, config));
+  for (uint64_t i = 0; i < kValues; ++i) {
+    bhiksha.WriteNext(NULL, 0, i, next[i]);
+  }
+  bhiksha.FinishedLoading(config);
+  for (uint64_t i = 0; i + 1 < kValues; ++i) {
+    NodeRange range;
+    bhiksha.ReadNext(NULL, 0, i, 0, range);
+    BOOST_REQUIRE_EQUAL(next[i], range.begin);
+    BOOST_REQUIRE_EQUAL(next[i + 1], range.end);
+  }
+}
+
+#ifdef KENLM_AVX2_SCAN
+// Sorted keys packed with a payload so entries straddle 64-bit words, scanned
+// from every start in the first few words for present and absent keys.
+void CheckAVX2Scan(uint8_t key_bits, uint8_t total_bits) {
+  const uint64_t kEntries = 300;
+  std::vector<uint64_t> keys;
+  uint64_t key = 0;
+  std::srand(total_bits);
+  for (uint64_t i = 0; i < kEntries; ++i) {
+    // Gaps leave absent keys, including at the bottom.
+    key += 1 + std::rand() % 3;
+    keys.push_back(key);
+  }
+  BOOST_REQUIRE(keys.back() < (1ULL << key_bits));
+  // Pad by 8 bytes as BitPacked::BaseSize does.
+  std::vector<uint8_t> memory((kEntries * total_bits + 7) / 8 + sizeof(uint64_t), 0);
+  for (uint64_t i = 0; i < kEntries; ++i) {
+    util::WriteInt57(&memory[0], i * total_bits, key_bits, keys[i]);
+    // Set the payload bits so the mask matters.
+    if (total_bits > key_bits) util::WriteInt57(&memory[0], i * total_bits + key_bits, total_bits - key_bits, (1ULL << (total_bits - key_bits)) - 1);
+  }
+  KeyAccessor accessor(&memory[0], (1ULL << key_bits) - 1, key_bits, total_bits);
+  for (uint64_t begin = 0; begin < 70; ++begin) {
+    for (uint64_t end = begin; end <= kEntries; end += 1 + end / 8) {
+      for (uint64_t find = 0; find <= keys.back() + 1; find += 1 + find / 50) {
+        uint64_t scalar_at = kEntries + 1, avx2_at = kEntries + 1;
+        bool scalar = ScalarScan::Find(accessor, begin, end, find, scalar_at);
+        BOOST_REQUIRE_EQUAL(scalar, AVX2Scan::Find(accessor, begin, end, find, avx2_at));
+        BOOST_REQUIRE_EQUAL(scalar_at, avx2_at);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(AVX2SameAsScalar) {
+  if (!__builtin_cpu_supports("avx2")) {
+    BOOST_TEST_MESSAGE("Skipping AVX2Scan because this CPU lacks AVX2.");
+    return;
+  }
+  CheckAVX2Scan(10, 10);
+  CheckAVX2Scan(10, 23);
+  CheckAVX2Scan(17, 41);
+  CheckAVX2Scan(20, 57);
+}
+#endif // KENLM_AVX2_SCAN
+
+} // namespace
+} // namespace trie
+} // namespace ngram
+} // namespace lm
@@ -90,7 +90,7 @@ struct BackoffValue {
 
   const static bool kDifferentRest = false;
 
-  template <class Model, class C> void Callback(const Config &, unsigned int, typename Model::Vocabulary &, C &callback) {
+  template <class Model, class C> static void Callback(const Config &, unsigned int, const typename Model::Vocabulary &, C &callback) {
     NoRestBuild build;
     callback(build);
   }
@@ -134,7 +134,7 @@ struct RestValue {
 
   const static bool kDifferentRest = true;
 
-  template <class Model, class C> void Callback(const Config &config, unsigned int order, typename Model::Vocabulary &vocab, C &callback) {
+  template <class Model, class C> static void Callback(const Config &config, unsigned int order, const typename Model::Vocabulary &vocab, C &callback) {
     switch (config.rest_function) {
       case Config::REST_MAX:
         {
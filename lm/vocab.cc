@@ -63,7 +63,12 @@ void ReadWords(int fd, EnumerateVocab *enumerate, WordIndex expected_count, uint
     // Ok now we have null terminated strings.
     for (const char *i = buf.data(); i != buf.data() + buf.size();) {
       std::size_t length = strlen(i);
-      enumerate->Add(index++, StringPiece(i, length));
+      if (index < expected_count) {
+        enumerate->Add(index++, StringPiece(i, length));
+      } else {
+        // Shared copies on hugetlbfs are padded with zeros to a whole page.
+        UTIL_THROW_IF(length, FormatLoadException, "The binary file has too many words at the end.");
+      }
       i += length + 1 /* null byte */;
     }
   }
@@ -301,7 +306,7 @@ void ProbingVocabulary::LoadedBinary(bool have_words, int fd, EnumerateVocab *to
   if (have_words) ReadWords(fd, to, bound_, offset);
 }
 
-void MissingUnknown(const Config &config) throw(SpecialWordMissingException) {
+void MissingUnknown(const Config &config) {
   switch(config.unknown_missing) {
     case SILENT:
       return;
@@ -313,7 +318,7 @@ void MissingUnknown(const Config &config) throw(SpecialWordMissingException) {
   }
 }
 
-void MissingSentenceMarker(const Config &config, const char *str) throw(SpecialWordMissingException) {
+void MissingSentenceMarker(const Config &config, const char *str) {
   switch (config.sentence_marker_missing) {
     case SILENT:
       return;
@@ -207,10 +207,10 @@ class ProbingVocabulary : public base::Vocabulary {
     detail::ProbingVocabularyHeader *header_;
 };
 
-void MissingUnknown(const Config &config) throw(SpecialWordMissingException);
-void MissingSentenceMarker(const Config &config, const char *str) throw(SpecialWordMissingException);
+void MissingUnknown(const Config &config);
+void MissingSentenceMarker(const Config &config, const char *str);
 
-template <class Vocab> void CheckSpecials(const Config &config, const Vocab &vocab) throw(SpecialWordMissingException) {
+template <class Vocab> void CheckSpecials(const Config &config, const Vocab &vocab) {
   if (!vocab.SawUnk()) MissingUnknown(config);
   if (vocab.BeginSentence() == vocab.NotFound()) MissingSentenceMarker(config, "<s>");
   if (vocab.EndSentence() == vocab.NotFound()) MissingSentenceMarker(config, "</s>");
@@ -253,6 +253,15 @@ template <class NewWordAction = NoOpUniqueWords> class GrowableVocab {
       return lookup_.Find(detail::HashForVocab(str), i) ? i->value : 0;
     }
 
+    // Look up by util::MurmurHashNative of the word, the hash FindOrInsert
+    // uses.  Returns false if absent.
+    bool Find(uint64_t hash, WordIndex &out) const {
+      Lookup::ConstIterator i;
+      if (!lookup_.Find(hash, i)) return false;
+      out = i->value;
+      return true;
+    }
+
     WordIndex FindOrInsert(const StringPiece &word) {
       ProbingVocabularyEntry entry = ProbingVocabularyEntry::Make(util::MurmurHashNative(word.data(), word.size()), Size());
       Lookup::MutableIterator it;
@@ -147,6 +147,28 @@ inline void WriteNonPositiveFloat31(void *base, uint64_t bit_off, float value) {
   WriteInt57(base, bit_off, 31, encoded.i);
 }
 
+inline unsigned int PopCount(uint64_t value) {
+#if __GNUC__ >= 4
+  return __builtin_popcountll(value);
+#else
+  unsigned int ret = 0;
+  for (; value; value &= value - 1) ++ret;
+  return ret;
+#endif
+}
+
+// Index of the least significant set bit.  Assumes value != 0.
+inline unsigned int LowestBit(uint64_t value) {
+  assert(value);
+#if __GNUC__ >= 4
+  return __builtin_ctzll(value);
+#else
+  unsigned int ret = 0;
+  for (; !(value & 1); value >>= 1) ++ret;
+  return ret;
+#endif
+}
+
 void BitPackingSanity();
 
 // Return bits required to store integers upto max_value.  Not the most
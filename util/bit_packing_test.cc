@@ -51,6 +51,15 @@ BOOST_AUTO_TEST_CASE(Consecutive25) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(Counting) {
+  BOOST_CHECK_EQUAL(0U, PopCount(0));
+  BOOST_CHECK_EQUAL(64U, PopCount(~0ULL));
+  BOOST_CHECK_EQUAL(3U, PopCount(0x8000000000000101ULL));
+  BOOST_CHECK_EQUAL(0U, LowestBit(1));
+  BOOST_CHECK_EQUAL(8U, LowestBit(0x8000000000000100ULL));
+  BOOST_CHECK_EQUAL(63U, LowestBit(0x8000000000000000ULL));
+}
+
 BOOST_AUTO_TEST_CASE(Sanity) {
   BitPackingSanity();
 }
@@ -0,0 +1,269 @@
+#ifndef UTIL_BUCKETIZED_PROBING_HASH_TABLE_H
+#define UTIL_BUCKETIZED_PROBING_HASH_TABLE_H
+
+#include "util/exception.hh"
+#include "util/probing_hash_table.hh"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <cassert>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace util {
+
+namespace detail {
+
+// Bit i of the return is set if keys[i] == key for i < count.
+template <class Key> inline unsigned int MatchKeys(const Key *keys, std::size_t count, const Key key) {
+  unsigned int ret = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    ret |= static_cast<unsigned int>(keys[i] == key) << i;
+  }
+  return ret;
+}
+
+#if defined(__SSE2__)
+/* SSE2 has no 64-bit compare, so compare 32-bit halves and require both to
+ * match.  Keys need not be 16-byte aligned.
+ */
+inline unsigned int MatchKeys(const uint64_t *keys, std::size_t count, const uint64_t key) {
+  const __m128i target = _mm_set1_epi64x(key);
+  unsigned int ret = 0;
+  std::size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i got = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+    int halves = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(got, target)));
+    // halves has 4 bits: low/high half of keys[i] then low/high of keys[i+1].
+    ret |= static_cast<unsigned int>((halves & 3) == 3) << i;
+    ret |= static_cast<unsigned int>((halves & 12) == 12) << (i + 1);
+  }
+  if (i < count) ret |= static_cast<unsigned int>(keys[i] == key) << i;
+  return ret;
+}
+#endif
+
+inline unsigned int FirstBit(unsigned int mask) {
+  assert(mask);
+#if __GNUC__ >= 4
+  return __builtin_ctz(mask);
+#else
+  unsigned int ret = 0;
+  for (; !(mask & 1); mask >>= 1) ++ret;
+  return ret;
+#endif
+}
+
+} // namespace detail
+
+/* Iterator into a BucketizedProbingHashTable.  Keys and values are stored
+ * separately, so this carries a pointer to each.  Access looks like
+ * ProbingHashTable's iterators: it->value and it->GetKey().
+ */
+template <class KeyT, class ValueT> class BucketIterator {
+  public:
+    class Ref {
+      public:
+        Ref(KeyT *key, ValueT &value_in) : value(value_in), key_(key) {}
+
+        ValueT &value;
+
+        KeyT GetKey() const { return *key_; }
+
+        Ref *operator->() { return this; }
+
+      private:
+        KeyT *key_;
+    };
+
+    BucketIterator() : key_(NULL), value_(NULL) {}
+
+    BucketIterator(KeyT *key, ValueT *value) : key_(key), value_(value) {}
+
+    Ref operator->() const { return Ref(key_, *value_); }
+
+    ValueT &Value() const { return *value_; }
+
+    KeyT GetKey() const { return *key_; }
+
+    bool operator==(const BucketIterator &other) const { return key_ == other.key_; }
+    bool operator!=(const BucketIterator &other) const { return key_ != other.key_; }
+
+  private:
+    KeyT *key_;
+    ValueT *value_;
+};
+
+/* Probing hash table with entries grouped into cache line sized buckets.
+ * Each bucket stores its keys contiguously at the front followed by the
+ * values in the same order, so one (SIMD) compare scans every key in the
+ * bucket.  Buckets fill in order so an empty key ends the probe.  When a
+ * bucket is full, probing continues linearly to the next bucket.
+ *
+ * As with ProbingHashTable, memory management is external, the table never
+ * grows, and only insert and lookup are supported.  Keys are compared
+ * bitwise with ==.  The invalid key is Key(), so memory should be zeroed.
+ */
+template <class EntryT, class HashT, class ModT = DivMod> class BucketizedProbingHashTable {
+  public:
+    typedef EntryT Entry;
+    typedef typename Entry::Key Key;
+    typedef typename Entry::Value Value;
+    typedef HashT Hash;
+    typedef ModT Mod;
+
+    typedef BucketIterator<const Key, const Value> ConstIterator;
+    typedef BucketIterator<Key, Value> MutableIterator;
+
+    static const std::size_t kBucketBytes = 64;
+    static const std::size_t kPerBucket = kBucketBytes / (sizeof(Key) + sizeof(Value));
+
+    static uint64_t Size(uint64_t entries, float multiplier) {
+      uint64_t slots = std::max(entries + 1, static_cast<uint64_t>(multiplier * static_cast<float>(entries)));
+      uint64_t buckets = Mod::RoundBuckets((slots + kPerBucket - 1) / kPerBucket);
+      return buckets * kBucketBytes;
+    }
+
+    // Must be assigned to later.
+    BucketizedProbingHashTable() : mod_(1), entries_(0) {}
+
+    BucketizedProbingHashTable(void *start, std::size_t allocated, const Hash &hash_func = Hash())
+      : begin_(static_cast<uint8_t*>(start)),
+        buckets_(allocated / kBucketBytes),
+        hash_(hash_func),
+        mod_(buckets_),
+        entries_(0) {}
+
+    void Relocate(void *new_base) {
+      begin_ = static_cast<uint8_t*>(new_base);
+    }
+
+    // Hint that key will be looked up soon by fetching its ideal bucket.
+    void Prefetch(const Key key) const {
+      UTIL_PREFETCH(IdealBucket(key));
+    }
+
+    template <class T> MutableIterator Insert(const T &t) {
+      UTIL_THROW_IF(++entries_ >= buckets_ * kPerBucket, ProbingSizeException, "Hash table with " << buckets_ << " buckets of " << kPerBucket << " entries is full.");
+      for (uint8_t *bucket = IdealBucket(t.GetKey());; bucket = NextBucket(bucket)) {
+        unsigned int empty = detail::MatchKeys(Keys(bucket), kPerBucket, Key());
+        if (empty) {
+          unsigned int index = detail::FirstBit(empty);
+          Keys(bucket)[index] = t.GetKey();
+          MutableIterator ret(At(bucket, index));
+          ret.Value() = t.value;
+          return ret;
+        }
+      }
+    }
+
+    // Return true if the value was found (and not inserted).  This is consistent with Find but the opposite of hash_map!
+    template <class T> bool FindOrInsert(const T &t, MutableIterator &out) {
+      if (UnsafeMutableFind(t.GetKey(), out)) return true;
+      out = Insert(t);
+      return false;
+    }
+
+    void FinishedInserting() {}
+
+    // Don't change anything related to GetKey,
+    bool UnsafeMutableFind(const Key key, MutableIterator &out) {
+      const uint8_t *bucket;
+      unsigned int index;
+      if (!FindPosition(key, bucket, index)) return false;
+      out = At(const_cast<uint8_t*>(bucket), index);
+      return true;
+    }
+
+    // Like UnsafeMutableFind, but the key must be there.
+    MutableIterator UnsafeMutableMustFind(const Key key) {
+      MutableIterator ret;
+      bool found = UnsafeMutableFind(key, ret);
+      assert(found);
+      (void)found;
+      return ret;
+    }
+
+    bool Find(const Key key, ConstIterator &out) const {
+      const uint8_t *bucket;
+      unsigned int index;
+      if (!FindPosition(key, bucket, index)) return false;
+      out = At(bucket, index);
+      return true;
+    }
+
+    // Like Find but we're sure it must be there.
+    ConstIterator MustFind(const Key key) const {
+      ConstIterator ret;
+      bool found = Find(key, ret);
+      assert(found);
+      (void)found;
+      return ret;
+    }
+
+    // Return number of entries assuming no serialization went on.
+    std::size_t SizeNoSerialization() const {
+      return entries_;
+    }
+
+  private:
+    // Byte offset of values within each bucket.
+    static const std::size_t kValueOffset = kPerBucket * sizeof(Key);
+
+    template <class Pointer> Pointer IdealBucketFrom(Pointer begin, const Key key) const {
+      return begin + (mod_.Ideal(static_cast<std::size_t>(0), hash_(key)) * kBucketBytes);
+    }
+
+    uint8_t *IdealBucket(const Key key) {
+      return IdealBucketFrom(begin_, key);
+    }
+    const uint8_t *IdealBucket(const Key key) const {
+      return IdealBucketFrom(static_cast<const uint8_t*>(begin_), key);
+    }
+
+    template <class Pointer> Pointer NextBucket(Pointer bucket) const {
+      bucket += kBucketBytes;
+      return (bucket == begin_ + buckets_ * kBucketBytes) ? begin_ : bucket;
+    }
+
+    static Key *Keys(uint8_t *bucket) { return reinterpret_cast<Key*>(bucket); }
+    static const Key *Keys(const uint8_t *bucket) { return reinterpret_cast<const Key*>(bucket); }
+
+    static MutableIterator At(uint8_t *bucket, std::size_t index) {
+      return MutableIterator(Keys(bucket) + index, reinterpret_cast<Value*>(bucket + kValueOffset) + index);
+    }
+    static ConstIterator At(const uint8_t *bucket, std::size_t index) {
+      return ConstIterator(Keys(bucket) + index, reinterpret_cast<const Value*>(bucket + kValueOffset) + index);
+    }
+
+    bool FindPosition(const Key key, const uint8_t *&bucket, unsigned int &index) const {
+      for (bucket = IdealBucket(key);; bucket = NextBucket(bucket)) {
+        const Key *keys = Keys(bucket);
+        unsigned int match = detail::MatchKeys(keys, kPerBucket, key);
+        if (match) {
+          index = detail::FirstBit(match);
+          return true;
+        }
+        if (detail::MatchKeys(keys, kPerBucket, Key())) return false;
+      }
+    }
+
+    uint8_t *begin_;
+    std::size_t buckets_;
+    Hash hash_;
+    Mod mod_;
+
+    std::size_t entries_;
+};
+
+template <class EntryT, class HashT, class ModT> const std::size_t BucketizedProbingHashTable<EntryT, HashT, ModT>::kBucketBytes;
+template <class EntryT, class HashT, class ModT> const std::size_t BucketizedProbingHashTable<EntryT, HashT, ModT>::kPerBucket;
+template <class EntryT, class HashT, class ModT> const std::size_t BucketizedProbingHashTable<EntryT, HashT, ModT>::kValueOffset;
+
+} // namespace util
+
+#endif // UTIL_BUCKETIZED_PROBING_HASH_TABLE_H
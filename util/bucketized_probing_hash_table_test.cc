@@ -0,0 +1,98 @@
+#include "util/bucketized_probing_hash_table.hh"
+
+#include "util/murmur_hash.hh"
+
+#define BOOST_TEST_MODULE BucketizedProbingHashTableTest
+#include <boost/test/unit_test.hpp>
+#include <boost/scoped_array.hpp>
+#include <cstring>
+#include <stdint.h>
+
+namespace util {
+namespace {
+
+struct Value12 {
+  float a, b, c;
+};
+
+struct Entry {
+  typedef uint64_t Key;
+  typedef Value12 Value;
+  uint64_t key;
+  Value12 value;
+  Key GetKey() const { return key; }
+};
+
+typedef BucketizedProbingHashTable<Entry, IdentityHash> Table;
+
+BOOST_AUTO_TEST_CASE(Simple) {
+  BOOST_CHECK_EQUAL(3U, static_cast<std::size_t>(Table::kPerBucket));
+  size_t size = Table::Size(10, 1.2);
+  BOOST_CHECK_EQUAL(0U, size % 64);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+
+  Table table(mem.get(), size);
+  Table::ConstIterator i;
+  BOOST_CHECK(!table.Find(2, i));
+  Entry to_ins;
+  to_ins.key = 3;
+  to_ins.value.a = 1.5;
+  to_ins.value.c = 2.5;
+  table.Insert(to_ins);
+  BOOST_REQUIRE(table.Find(3, i));
+  BOOST_CHECK_EQUAL(3U, i->GetKey());
+  BOOST_CHECK_EQUAL(1.5, i->value.a);
+  BOOST_CHECK_EQUAL(2.5, i->value.c);
+  BOOST_CHECK(!table.Find(2, i));
+
+  Table::MutableIterator m;
+  BOOST_REQUIRE(table.UnsafeMutableFind(3, m));
+  m->value.b = 7.0;
+  BOOST_CHECK_EQUAL(7.0, table.MustFind(3)->value.b);
+}
+
+struct MurmurHashEntry64 {
+  std::size_t operator()(uint64_t value) const {
+    return util::MurmurHash64A(&value, 8);
+  }
+};
+
+// Collisions and overflow into following buckets, including wrap around.
+BOOST_AUTO_TEST_CASE(Overflow) {
+  typedef BucketizedProbingHashTable<Entry, MurmurHashEntry64> Hashed;
+  const uint64_t kEntries = 100;
+  size_t size = Hashed::Size(kEntries, 1.05);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+  Hashed table(mem.get(), size);
+  Entry entry;
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    entry.key = k;
+    entry.value.a = static_cast<float>(k);
+    Hashed::MutableIterator it;
+    BOOST_CHECK(!table.FindOrInsert(entry, it));
+    BOOST_CHECK_EQUAL(k, it->GetKey());
+  }
+  BOOST_CHECK_EQUAL(kEntries, table.SizeNoSerialization());
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    Hashed::ConstIterator it;
+    BOOST_REQUIRE(table.Find(k, it));
+    BOOST_CHECK_EQUAL(static_cast<float>(k), it->value.a);
+    Hashed::MutableIterator mut;
+    BOOST_CHECK(table.FindOrInsert(entry, mut));
+  }
+  Hashed::ConstIterator it;
+  BOOST_CHECK(!table.Find(kEntries + 1, it));
+}
+
+BOOST_AUTO_TEST_CASE(MatchKeysAgrees) {
+  uint64_t keys[5] = {0, 0x100000000ULL, 1, 0x100000001ULL, 1};
+  BOOST_CHECK_EQUAL(20U, detail::MatchKeys(keys, 5, static_cast<uint64_t>(1)));
+  BOOST_CHECK_EQUAL(1U, detail::MatchKeys(keys, 5, static_cast<uint64_t>(0)));
+  BOOST_CHECK_EQUAL(2U, detail::MatchKeys(keys, 5, static_cast<uint64_t>(0x100000000ULL)));
+  BOOST_CHECK_EQUAL(0U, detail::MatchKeys(keys, 5, static_cast<uint64_t>(2)));
+}
+
+} // namespace
+} // namespace util
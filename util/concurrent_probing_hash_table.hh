@@ -0,0 +1,159 @@
+#ifndef UTIL_CONCURRENT_PROBING_HASH_TABLE_H
+#define UTIL_CONCURRENT_PROBING_HASH_TABLE_H
+
+#include "util/exception.hh"
+#include "util/probing_hash_table.hh"
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+
+#include <stdint.h>
+
+#if !defined(__GNUC__)
+#error "ConcurrentProbingHashTable uses the GCC __sync atomic builtins."
+#endif
+
+namespace util {
+
+/* Linear probing hash table that many threads can insert into at once.  The
+ * memory layout and probing are exactly those of ProbingHashTable with the
+ * same Entry, Hash, and Mod, so a table filled concurrently can be read, or
+ * saved and loaded, as a ProbingHashTable.  Only the order of entries within
+ * a run of collisions depends on timing.
+ *
+ * A thread claims a slot by compare-and-swap of its key from invalid, then
+ * writes the rest of the entry.  Slots are never released, so a probe that
+ * reaches an invalid key may stop.  Entries must start with their key, which
+ * must be an integer type that is aligned in every entry.  This rules out
+ * entries packed to less than the key size.
+ *
+ * Concurrent calls may be Insert and FindOrInsert.  A value is only complete
+ * once the thread that inserted it returns, so read values (and call Find)
+ * after the inserting threads are done, e.g. joined.
+ */
+template <class EntryT, class HashT, class ModT = DivMod> class ConcurrentProbingHashTable {
+  public:
+    typedef EntryT Entry;
+    typedef typename Entry::Key Key;
+    typedef const Entry *ConstIterator;
+    typedef Entry *MutableIterator;
+    typedef HashT Hash;
+    typedef ModT Mod;
+
+    // The ProbingHashTable with the same layout.
+    typedef ProbingHashTable<Entry, Hash, std::equal_to<Key>, Mod> Serial;
+
+    static uint64_t Size(uint64_t entries, float multiplier) {
+      return Serial::Size(entries, multiplier);
+    }
+
+    // Must be assigned to later.
+    ConcurrentProbingHashTable() : mod_(1), entries_(0) {}
+
+    ConcurrentProbingHashTable(void *start, std::size_t allocated, const Key &invalid = Key(), const Hash &hash_func = Hash())
+      : begin_(reinterpret_cast<MutableIterator>(start)),
+        end_(begin_ + allocated / sizeof(Entry)),
+        buckets_(end_ - begin_),
+        invalid_(invalid),
+        hash_(hash_func),
+        mod_(end_ - begin_),
+        entries_(0) {
+      UTIL_THROW_IF(sizeof(Entry) % sizeof(Key) || reinterpret_cast<uintptr_t>(start) % sizeof(Key), Exception, "Concurrent insertion needs every key aligned, but entries are " << sizeof(Entry) << " bytes with " << sizeof(Key) << "-byte keys.");
+    }
+
+    // Thread safe.  Like ProbingHashTable::Insert, duplicate keys are not detected.
+    template <class T> MutableIterator Insert(const T &t) {
+      const Entry entry(t);
+      Reserve();
+      for (MutableIterator i = Ideal(entry.GetKey());; mod_.Next(begin_, end_, i)) {
+        if (ReadKey(i) == invalid_ && __sync_bool_compare_and_swap(KeyOf(i), invalid_, entry.GetKey())) {
+          Fill(i, entry);
+          return i;
+        }
+      }
+    }
+
+    /* Thread safe.  Return true if the key was found (and not inserted).  If
+     * another thread inserted the key, its value may not be written yet.
+     */
+    template <class T> bool FindOrInsert(const T &t, MutableIterator &out) {
+      const Entry entry(t);
+      const Key key = entry.GetKey();
+      for (MutableIterator i = Ideal(key);; mod_.Next(begin_, end_, i)) {
+        Key got = ReadKey(i);
+        if (got == invalid_) {
+          Reserve();
+          got = __sync_val_compare_and_swap(KeyOf(i), invalid_, key);
+          if (got == invalid_) {
+            Fill(i, entry);
+            out = i;
+            return false;
+          }
+          // Lost the slot to another thread.
+          __sync_sub_and_fetch(&entries_, 1);
+        }
+        if (got == key) {
+          out = i;
+          return true;
+        }
+      }
+    }
+
+    void FinishedInserting() {}
+
+    // Not thread safe with inserts; see above.
+    bool Find(const Key key, ConstIterator &out) const {
+      for (out = Ideal(key);; mod_.Next(begin_, end_, out)) {
+        Key got(out->GetKey());
+        if (got == key) return true;
+        if (got == invalid_) return false;
+      }
+    }
+
+    std::size_t SizeNoSerialization() const {
+      return entries_;
+    }
+
+  private:
+    MutableIterator Ideal(const Key key) {
+      return mod_.Ideal(begin_, hash_(key));
+    }
+    ConstIterator Ideal(const Key key) const {
+      return mod_.Ideal(begin_, hash_(key));
+    }
+
+    static Key *KeyOf(MutableIterator i) {
+      return reinterpret_cast<Key*>(i);
+    }
+
+    static Key ReadKey(MutableIterator i) {
+      return *reinterpret_cast<const volatile Key*>(i);
+    }
+
+    // Count an entry, keeping at least one slot invalid so probes end.
+    void Reserve() {
+      if (UTIL_UNLIKELY(__sync_add_and_fetch(&entries_, 1) >= buckets_)) {
+        __sync_sub_and_fetch(&entries_, 1);
+        UTIL_THROW(ProbingSizeException, "Hash table with " << buckets_ << " buckets is full.");
+      }
+    }
+
+    // Everything but the key, which the caller already swapped in.
+    static void Fill(MutableIterator i, const Entry &entry) {
+      std::memcpy(reinterpret_cast<uint8_t*>(i) + sizeof(Key), reinterpret_cast<const uint8_t*>(&entry) + sizeof(Key), sizeof(Entry) - sizeof(Key));
+    }
+
+    MutableIterator begin_;
+    MutableIterator end_;
+    std::size_t buckets_;
+    Key invalid_;
+    Hash hash_;
+    Mod mod_;
+
+    std::size_t entries_;
+};
+
+} // namespace util
+
+#endif // UTIL_CONCURRENT_PROBING_HASH_TABLE_H
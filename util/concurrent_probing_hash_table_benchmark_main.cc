@@ -0,0 +1,92 @@
+#include "util/concurrent_probing_hash_table.hh"
+#include "util/mmap.hh"
+#include "util/usage.hh"
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace util {
+namespace {
+
+struct Entry {
+  typedef uint64_t Key;
+  Key key;
+  uint64_t value;
+  Key GetKey() const { return key; }
+};
+
+// Keys are already random.
+typedef ConcurrentProbingHashTable<Entry, IdentityHash> Table;
+
+// xorshift64*, never 0 so never the invalid key.
+void RandomKeys(std::vector<uint64_t> &keys) {
+  uint64_t state = 88172645463325252ULL;
+  for (std::vector<uint64_t>::iterator i = keys.begin(); i != keys.end(); ++i) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    *i = (state * 2685821657736338717ULL) | 1;
+  }
+}
+
+template <class Table> class Inserter {
+  public:
+    Inserter(Table &table, const uint64_t *begin, const uint64_t *end) : table_(table), begin_(begin), end_(end) {}
+
+    void operator()() {
+      Entry entry;
+      typename Table::MutableIterator ignored;
+      for (const uint64_t *i = begin_; i != end_; ++i) {
+        entry.key = *i;
+        entry.value = *i;
+        table_.FindOrInsert(entry, ignored);
+      }
+    }
+
+  private:
+    Table &table_;
+    const uint64_t *begin_, *end_;
+};
+
+// Seconds to insert keys with threads, or the serial table if threads is 0.
+double Run(const std::vector<uint64_t> &keys, std::size_t threads, float multiplier) {
+  std::size_t size = Table::Size(keys.size(), multiplier);
+  scoped_memory backing;
+  HugeMalloc(size, true, backing);
+  double start = WallTime();
+  if (!threads) {
+    Table::Serial table(backing.get(), size);
+    Inserter<Table::Serial>(table, &keys[0], &keys[0] + keys.size())();
+  } else {
+    Table table(backing.get(), size);
+    boost::ptr_vector<boost::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+      const uint64_t *begin = &keys[0] + keys.size() * t / threads;
+      const uint64_t *end = &keys[0] + keys.size() * (t + 1) / threads;
+      workers.push_back(new boost::thread(Inserter<Table>(table, begin, end)));
+    }
+    for (std::size_t t = 0; t < threads; ++t) workers[t].join();
+  }
+  return WallTime() - start;
+}
+
+} // namespace
+} // namespace util
+
+int main(int argc, char *argv[]) {
+  uint64_t entries = (argc > 1) ? std::strtoull(argv[1], NULL, 10) : 10000000;
+  std::size_t max_threads = (argc > 2) ? std::strtoul(argv[2], NULL, 10) : 2 * std::max(1U, boost::thread::hardware_concurrency());
+  const float kMultiplier = 1.5;
+  std::vector<uint64_t> keys(entries);
+  util::RandomKeys(keys);
+  std::cout << "#threads seconds million_inserts_per_second (0 threads is ProbingHashTable)\n";
+  for (std::size_t threads = 0; threads <= max_threads; threads = threads ? threads * 2 : 1) {
+    double seconds = util::Run(keys, threads, kMultiplier);
+    std::cout << threads << ' ' << seconds << ' ' << (static_cast<double>(entries) / seconds / 1000000.0) << std::endl;
+  }
+}
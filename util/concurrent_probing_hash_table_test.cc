@@ -0,0 +1,113 @@
+#include "util/concurrent_probing_hash_table.hh"
+
+#include "util/murmur_hash.hh"
+
+#define BOOST_TEST_MODULE ConcurrentProbingHashTableTest
+#include <boost/test/unit_test.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/thread.hpp>
+#include <cstring>
+#include <stdint.h>
+
+namespace util {
+namespace {
+
+struct Entry {
+  typedef uint64_t Key;
+  uint64_t key;
+  uint64_t value;
+  Key GetKey() const { return key; }
+};
+
+struct MurmurHashEntry64 {
+  std::size_t operator()(uint64_t value) const {
+    return util::MurmurHash64A(&value, 8);
+  }
+};
+
+typedef ConcurrentProbingHashTable<Entry, MurmurHashEntry64> Table;
+
+// Key 0 is invalid so keys start at 1.  Consecutive threads overlap by half.
+class Inserter {
+  public:
+    Inserter(Table &table, uint64_t begin, uint64_t end, std::size_t &inserted)
+      : table_(table), begin_(begin), end_(end), inserted_(inserted) {}
+
+    void operator()() {
+      Entry entry;
+      for (uint64_t k = begin_; k != end_; ++k) {
+        entry.key = k;
+        entry.value = k * 3;
+        Table::MutableIterator it;
+        if (!table_.FindOrInsert(entry, it)) ++inserted_;
+      }
+    }
+
+  private:
+    Table &table_;
+    uint64_t begin_, end_;
+    std::size_t &inserted_;
+};
+
+BOOST_AUTO_TEST_CASE(ConcurrentFindOrInsert) {
+  const std::size_t kThreads = 4;
+  const uint64_t kPerThread = 20000;
+  const uint64_t kDistinct = kPerThread * (kThreads + 1) / 2;
+  std::size_t size = Table::Size(kDistinct, 1.2);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+  Table table(mem.get(), size);
+
+  std::size_t inserted[kThreads];
+  boost::ptr_vector<boost::thread> threads;
+  for (std::size_t t = 0; t < kThreads; ++t) {
+    inserted[t] = 0;
+    uint64_t begin = 1 + t * kPerThread / 2;
+    threads.push_back(new boost::thread(Inserter(table, begin, begin + kPerThread, inserted[t])));
+  }
+  std::size_t total = 0;
+  for (std::size_t t = 0; t < kThreads; ++t) {
+    threads[t].join();
+    total += inserted[t];
+  }
+  BOOST_CHECK_EQUAL(kDistinct, total);
+  BOOST_CHECK_EQUAL(kDistinct, table.SizeNoSerialization());
+
+  // Same memory read as the serial table, which also checks the layout.
+  Table::Serial serial(mem.get(), size);
+  serial.CheckConsistency();
+  for (uint64_t k = 1; k <= kDistinct; ++k) {
+    const Entry *found;
+    BOOST_REQUIRE(serial.Find(k, found));
+    BOOST_CHECK_EQUAL(k * 3, found->value);
+  }
+  const Entry *found;
+  BOOST_CHECK(!serial.Find(kDistinct + 1, found));
+  // Each key appears once.
+  std::size_t occupied = 0;
+  for (const Entry *i = reinterpret_cast<const Entry*>(mem.get()); i != reinterpret_cast<const Entry*>(mem.get() + size); ++i) {
+    occupied += (i->key != 0);
+  }
+  BOOST_CHECK_EQUAL(kDistinct, occupied);
+}
+
+BOOST_AUTO_TEST_CASE(Full) {
+  std::size_t size = Table::Size(3, 1.0);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+  Table table(mem.get(), size);
+  Entry entry;
+  entry.value = 0;
+  for (entry.key = 1; entry.key <= 3; ++entry.key) {
+    table.Insert(entry);
+  }
+  BOOST_CHECK_THROW(table.Insert(entry), ProbingSizeException);
+  Table::MutableIterator it;
+  entry.key = 2;
+  BOOST_CHECK(table.FindOrInsert(entry, it));
+  BOOST_CHECK_EQUAL(2U, it->key);
+}
+
+} // namespace
+} // namespace util
@@ -97,6 +97,12 @@ template <class Except, class Data> typename Except::template ExceptionTag<Excep
 #define UTIL_LIKELY(x) (x)
 #endif
 
+#if __GNUC__ >= 3
+#define UTIL_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define UTIL_PREFETCH(address)
+#endif
+
 #define UTIL_THROW_IF_ARG(Condition, Exception, Arg, Modify) do { \
   if (UTIL_UNLIKELY(Condition)) { \
     UTIL_THROW_BACKEND(#Condition, Exception, Arg, Modify); \
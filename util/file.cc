@@ -288,6 +288,17 @@ void ErsatzPWrite(int fd, const void *from_void, std::size_t size, uint64_t off)
   }
 }
 
+void CopyOrThrow(int from, int to) {
+  const std::size_t kBuffer = 1 << 20;
+  const uint64_t size = SizeOrThrow(from);
+  scoped_malloc buffer(MallocOrThrow(kBuffer));
+  for (uint64_t off = 0; off < size; ) {
+    std::size_t amount = static_cast<std::size_t>(std::min<uint64_t>(kBuffer, size - off));
+    ErsatzPRead(from, buffer.get(), amount, off);
+    ErsatzPWrite(to, buffer.get(), amount, off);
+    off += amount;
+  }
+}
 
 void FSyncOrThrow(int fd) {
 // Apparently windows doesn't have fsync?
@@ -124,6 +124,10 @@ void WriteOrThrow(FILE *to, const void *data, std::size_t size);
 void ErsatzPRead(int fd, void *to, std::size_t size, uint64_t off);
 void ErsatzPWrite(int fd, const void *data_void, std::size_t size, uint64_t off);
 
+// Copy the contents of from to the start of to with ErsatzPRead and
+// ErsatzPWrite.  Does not truncate to.
+void CopyOrThrow(int from, int to);
+
 void FSyncOrThrow(int fd);
 
 // Seeking
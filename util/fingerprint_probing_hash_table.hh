@@ -0,0 +1,233 @@
+#ifndef UTIL_FINGERPRINT_PROBING_HASH_TABLE_H
+#define UTIL_FINGERPRINT_PROBING_HASH_TABLE_H
+
+#include "util/exception.hh"
+#include "util/probing_hash_table.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <cassert>
+#include <stdint.h>
+
+namespace util {
+
+/* Iterator into a FingerprintProbingHashTable.  The key is not stored, so
+ * this only offers it->value.
+ */
+template <class ValueT> class FingerprintIterator {
+  public:
+    struct Ref {
+      explicit Ref(ValueT &value_in) : value(value_in) {}
+      ValueT &value;
+      Ref *operator->() { return this; }
+    };
+
+    FingerprintIterator() : value_(NULL) {}
+
+    explicit FingerprintIterator(ValueT *value) : value_(value) {}
+
+    Ref operator->() const { return Ref(*value_); }
+
+    ValueT &Value() const { return *value_; }
+
+  private:
+    ValueT *value_;
+};
+
+/* Linear probing hash table that stores a fingerprint of each key instead of
+ * the key.  Each slot is the value followed by a fingerprint of
+ * fingerprint_bits / 8 bytes.
+ *
+ * The slot a key hashes to already determines hash % buckets, so the
+ * fingerprint is taken from the quotient hash / buckets and carries bits
+ * that the position does not.  A lookup for an absent key can still match
+ * a stored fingerprint; see FalsePositiveRate.  Worse, when a key is inserted
+ * after another key with the same fingerprint in its probe sequence, lookups
+ * of it stop at the other key and return that key's value.  Insert counts
+ * these in Collisions; FindOrInsert can not tell them from the key itself.
+ * Fingerprint 0 marks an empty slot so memory should be zeroed.
+ *
+ * As with ProbingHashTable, memory management is external, the table never
+ * grows, and only insert and lookup are supported.
+ */
+template <class EntryT, class HashT = IdentityHash> class FingerprintProbingHashTable {
+  public:
+    typedef EntryT Entry;
+    typedef typename Entry::Key Key;
+    typedef typename Entry::Value Value;
+    typedef HashT Hash;
+
+    typedef FingerprintIterator<const Value> ConstIterator;
+    typedef FingerprintIterator<Value> MutableIterator;
+
+    static void CheckBits(uint8_t fingerprint_bits) {
+      UTIL_THROW_IF(fingerprint_bits == 0 || fingerprint_bits > 32 || fingerprint_bits % 8, Exception, "Fingerprints must be 8, 16, 24, or 32 bits, not " << static_cast<unsigned int>(fingerprint_bits) << ".");
+    }
+
+    static std::size_t Buckets(uint64_t entries, float multiplier) {
+      return std::max(entries + 1, static_cast<uint64_t>(multiplier * static_cast<float>(entries)));
+    }
+
+    static uint64_t Size(uint64_t entries, float multiplier, uint8_t fingerprint_bits) {
+      return Buckets(entries, multiplier) * (sizeof(Value) + fingerprint_bits / 8);
+    }
+
+    /* Expected probability that looking up an absent key returns some entry.
+     * An unsuccessful search with linear probing at load a passes
+     * (1 + 1 / (1 - a)^2) / 2 slots on average, all but the last occupied,
+     * and each occupied slot matches with probability 1 / (2^bits - 1).
+     */
+    static double FalsePositiveRate(uint64_t entries, float multiplier, uint8_t fingerprint_bits) {
+      double load = static_cast<double>(entries) / static_cast<double>(Buckets(entries, multiplier));
+      double occupied = 0.5 * (1.0 + 1.0 / ((1.0 - load) * (1.0 - load))) - 1.0;
+      return std::min(1.0, occupied / static_cast<double>((1ULL << fingerprint_bits) - 1));
+    }
+
+    // Must be assigned to later.
+    FingerprintProbingHashTable() : buckets_(1), entries_(0), collisions_(0) {}
+
+    FingerprintProbingHashTable(void *start, std::size_t allocated, uint8_t fingerprint_bits, const Hash &hash_func = Hash())
+      : begin_(static_cast<uint8_t*>(start)),
+        fingerprint_bytes_(fingerprint_bits / 8),
+        stride_(sizeof(Value) + fingerprint_bytes_),
+        buckets_(allocated / stride_),
+        end_(begin_ + buckets_ * stride_),
+        fingerprint_mod_((1ULL << fingerprint_bits) - 1),
+        hash_(hash_func),
+        entries_(0),
+        collisions_(0) {
+      CheckBits(fingerprint_bits);
+    }
+
+    void Relocate(void *new_base) {
+      begin_ = static_cast<uint8_t*>(new_base);
+      end_ = begin_ + buckets_ * stride_;
+    }
+
+    // Hint that key will be looked up soon by fetching its ideal slot.
+    void Prefetch(const Key key) const {
+      UTIL_PREFETCH(begin_ + (hash_(key) % buckets_) * stride_);
+    }
+
+    template <class T> MutableIterator Insert(const T &t) {
+      UTIL_THROW_IF(++entries_ >= buckets_, ProbingSizeException, "Hash table with " << buckets_ << " buckets is full.");
+      uint32_t fingerprint;
+      bool collided = false;
+      for (uint8_t *i = Ideal(t.GetKey(), fingerprint);; Next(i)) {
+        uint32_t got = ReadFingerprint(i);
+        if (!got) {
+          collisions_ += collided;
+          std::memcpy(i, &t.value, sizeof(Value));
+          std::memcpy(i + sizeof(Value), &fingerprint, fingerprint_bytes_);
+          return MutableIterator(reinterpret_cast<Value*>(i));
+        }
+        collided |= (got == fingerprint);
+      }
+    }
+
+    // Return true if the value was found (and not inserted).  This is consistent with Find but the opposite of hash_map!
+    template <class T> bool FindOrInsert(const T &t, MutableIterator &out) {
+      if (UnsafeMutableFind(t.GetKey(), out)) return true;
+      out = Insert(t);
+      return false;
+    }
+
+    void FinishedInserting() {}
+
+    // Don't change anything related to GetKey,
+    bool UnsafeMutableFind(const Key key, MutableIterator &out) {
+      const uint8_t *slot;
+      if (!FindSlot(key, slot)) return false;
+      out = MutableIterator(reinterpret_cast<Value*>(const_cast<uint8_t*>(slot)));
+      return true;
+    }
+
+    // Like UnsafeMutableFind, but the key must be there.
+    MutableIterator UnsafeMutableMustFind(const Key key) {
+      MutableIterator ret;
+      bool found = UnsafeMutableFind(key, ret);
+      assert(found);
+      (void)found;
+      return ret;
+    }
+
+    bool Find(const Key key, ConstIterator &out) const {
+      const uint8_t *slot;
+      if (!FindSlot(key, slot)) return false;
+      out = ConstIterator(reinterpret_cast<const Value*>(slot));
+      return true;
+    }
+
+    // Like Find but we're sure it must be there.
+    ConstIterator MustFind(const Key key) const {
+      ConstIterator ret;
+      bool found = Find(key, ret);
+      assert(found);
+      (void)found;
+      return ret;
+    }
+
+    // Return number of entries assuming no serialization went on.
+    std::size_t SizeNoSerialization() const {
+      return entries_;
+    }
+
+    // Number of inserted keys that lookups will mistake for another key.  Not
+    // serialized.
+    std::size_t Collisions() const {
+      return collisions_;
+    }
+
+  private:
+    template <class Pointer> Pointer IdealFrom(Pointer begin, const Key key, uint32_t &fingerprint) const {
+      uint64_t hash = hash_(key);
+      // Never zero, which marks empty slots.
+      fingerprint = static_cast<uint32_t>((hash / buckets_) % fingerprint_mod_) + 1;
+      return begin + (hash % buckets_) * stride_;
+    }
+
+    uint8_t *Ideal(const Key key, uint32_t &fingerprint) {
+      return IdealFrom(begin_, key, fingerprint);
+    }
+    const uint8_t *Ideal(const Key key, uint32_t &fingerprint) const {
+      return IdealFrom(static_cast<const uint8_t*>(begin_), key, fingerprint);
+    }
+
+    template <class Pointer> void Next(Pointer &slot) const {
+      slot += stride_;
+      if (slot == end_) slot = begin_;
+    }
+
+    uint32_t ReadFingerprint(const uint8_t *slot) const {
+      uint32_t ret = 0;
+      // Little endian assumption, as in the rest of the binary format.
+      std::memcpy(&ret, slot + sizeof(Value), fingerprint_bytes_);
+      return ret;
+    }
+
+    bool FindSlot(const Key key, const uint8_t *&slot) const {
+      uint32_t fingerprint;
+      for (slot = Ideal(key, fingerprint);; Next(slot)) {
+        uint32_t got = ReadFingerprint(slot);
+        if (got == fingerprint) return true;
+        if (!got) return false;
+      }
+    }
+
+    uint8_t *begin_;
+    std::size_t fingerprint_bytes_;
+    std::size_t stride_;
+    std::size_t buckets_;
+    uint8_t *end_;
+    uint64_t fingerprint_mod_;
+    Hash hash_;
+
+    std::size_t entries_;
+    std::size_t collisions_;
+};
+
+} // namespace util
+
+#endif // UTIL_FINGERPRINT_PROBING_HASH_TABLE_H
@@ -0,0 +1,111 @@
+#include "util/fingerprint_probing_hash_table.hh"
+
+#include "util/murmur_hash.hh"
+
+#define BOOST_TEST_MODULE FingerprintProbingHashTableTest
+#include <boost/test/unit_test.hpp>
+#include <boost/scoped_array.hpp>
+#include <cstring>
+#include <stdint.h>
+
+namespace util {
+namespace {
+
+struct Entry {
+  typedef uint64_t Key;
+  typedef float Value;
+  uint64_t key;
+  float value;
+  Key GetKey() const { return key; }
+};
+
+struct MurmurHashEntry64 {
+  std::size_t operator()(uint64_t value) const {
+    return util::MurmurHash64A(&value, 8);
+  }
+};
+
+typedef FingerprintProbingHashTable<Entry, MurmurHashEntry64> Table;
+
+BOOST_AUTO_TEST_CASE(Sizes) {
+  BOOST_CHECK_EQUAL(Table::Buckets(100, 1.5) * 6, Table::Size(100, 1.5, 16));
+  BOOST_CHECK_EQUAL(Table::Buckets(100, 1.5) * 8, Table::Size(100, 1.5, 32));
+  BOOST_CHECK_THROW(Table::CheckBits(12), Exception);
+  BOOST_CHECK_THROW(Table::CheckBits(0), Exception);
+  BOOST_CHECK(Table::FalsePositiveRate(100, 1.5, 8) > Table::FalsePositiveRate(100, 1.5, 16));
+}
+
+BOOST_AUTO_TEST_CASE(InsertFind) {
+  const uint64_t kEntries = 1000;
+  size_t size = Table::Size(kEntries, 1.2, 24);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+  Table table(mem.get(), size, 24);
+  Entry entry;
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    entry.key = k;
+    entry.value = static_cast<float>(k);
+    Table::MutableIterator it;
+    BOOST_CHECK(!table.FindOrInsert(entry, it));
+    BOOST_CHECK_EQUAL(static_cast<float>(k), it->value);
+  }
+  BOOST_CHECK_EQUAL(kEntries, table.SizeNoSerialization());
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    Table::ConstIterator it;
+    BOOST_REQUIRE(table.Find(k, it));
+    BOOST_CHECK_EQUAL(static_cast<float>(k), it->value);
+  }
+  Table::MutableIterator mut;
+  BOOST_REQUIRE(table.UnsafeMutableFind(7, mut));
+  mut->value = -1.0;
+  BOOST_CHECK_EQUAL(-1.0, table.MustFind(7)->value);
+}
+
+// With 8-bit fingerprints absent keys match at roughly the predicted rate.
+BOOST_AUTO_TEST_CASE(FalsePositives) {
+  const uint64_t kEntries = 10000;
+  size_t size = Table::Size(kEntries, 1.5, 8);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+  Table table(mem.get(), size, 8);
+  Entry entry;
+  entry.value = 0.0;
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    entry.key = k;
+    table.Insert(entry);
+  }
+  const uint64_t kQueries = 100000;
+  uint64_t matched = 0;
+  Table::ConstIterator it;
+  for (uint64_t k = kEntries + 1; k <= kEntries + kQueries; ++k) {
+    matched += table.Find(k, it);
+  }
+  double expected = Table::FalsePositiveRate(kEntries, 1.5, 8) * kQueries;
+  BOOST_CHECK_GT(matched, expected / 2.0);
+  BOOST_CHECK_LT(matched, expected * 2.0);
+}
+
+// Keys inserted behind a key with the same fingerprint return its value, and
+// Insert counts exactly those.
+BOOST_AUTO_TEST_CASE(Collisions) {
+  const uint64_t kEntries = 10000;
+  size_t size = Table::Size(kEntries, 1.5, 8);
+  boost::scoped_array<char> mem(new char[size]);
+  memset(mem.get(), 0, size);
+  Table table(mem.get(), size, 8);
+  Entry entry;
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    entry.key = k;
+    entry.value = static_cast<float>(k);
+    table.Insert(entry);
+  }
+  std::size_t wrong = 0;
+  for (uint64_t k = 1; k <= kEntries; ++k) {
+    wrong += (table.MustFind(k)->value != static_cast<float>(k));
+  }
+  BOOST_CHECK_GT(wrong, 0U);
+  BOOST_CHECK_EQUAL(wrong, table.Collisions());
+}
+
+} // namespace
+} // namespace util
@@ -47,6 +47,10 @@ Which is based on: http://0x80.pl/snippets/asm/sse-utoa.c
 #include <cassert>
 #include <stdint.h>
 
+#if defined(__amd64) || defined(_M_X64) || (defined(__SSE2__) && (defined(_M_IX86) || defined(i386)))
+#include <emmintrin.h>
+#endif
+
 namespace util {
 
 namespace {
@@ -69,8 +73,6 @@ const char gDigitsLut[200] = {
 
 #if defined(__amd64) || defined(_M_X64) || (defined(__SSE2__) && (defined(_M_IX86) || defined(i386)))
 
-#include <emmintrin.h>
-
 #ifdef _MSC_VER
 #include "intrin.h"
 #endif
@@ -10,12 +10,17 @@
 #include "util/scoped.hh"
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include <cassert>
+#include <cerrno>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <windows.h>
@@ -25,6 +30,11 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#endif
+
 namespace util {
 
 std::size_t SizePage() {
@@ -211,6 +221,81 @@ bool TryHuge(std::size_t size, uint8_t alignment_bits, bool populate, util::scop
   return true;
 }
 
+// Only explicit huge pages, 1 GB if the size warrants it.  Sizes are rounded
+// up to the huge page size because munmap needs that for hugetlb memory.
+bool HugeTLBMap(std::size_t size, util::scoped_memory &to) {
+#ifdef MAP_HUGE_SHIFT
+  if (size >= (1ULL << 30) && AnonymousMap(RoundUpPow2<std::size_t>(size, 1ULL << 30), MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), false, to))
+    return true;
+  if (AnonymousMap(RoundUpPow2<std::size_t>(size, 1ULL << 21), MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), false, to))
+    return true;
+#endif
+  // Kernel too old to pick a size; the default is almost always 2 MB.
+  return AnonymousMap(RoundUpPow2<std::size_t>(size, 1ULL << 21), MAP_HUGETLB, false, to);
+}
+
+// Memory policies from numaif.h, which comes with libnuma rather than libc.
+const int kPolicyBind = 2;
+const int kPolicyInterleave = 3;
+
+const std::size_t kNodeMaskBits = sizeof(unsigned long) * 8;
+
+void AddNode(unsigned long node, std::vector<unsigned long> &mask) {
+  if (mask.size() <= node / kNodeMaskBits) mask.resize(node / kNodeMaskBits + 1, 0);
+  mask[node / kNodeMaskBits] |= 1UL << (node % kNodeMaskBits);
+}
+
+// Nodes that have memory according to sysfs, which lists them like "0-1,4".
+std::size_t NodesWithMemory(std::vector<unsigned long> &mask) {
+  int fd = open("/sys/devices/system/node/has_memory", O_RDONLY);
+  if (fd == -1) return 0;
+  scoped_fd file(fd);
+  char buf[4096];
+  buf[ReadOrEOF(fd, buf, sizeof(buf) - 1)] = 0;
+  std::size_t count = 0;
+  for (char *i = buf; ; ++i) {
+    char *end;
+    unsigned long from = strtoul(i, &end, 10);
+    if (end == i) break;
+    unsigned long to = from;
+    if (*end == '-') to = strtoul(end + 1, &end, 10);
+    for (unsigned long node = from; node <= to; ++node, ++count) {
+      AddNode(node, mask);
+    }
+    i = end;
+    if (*i != ',') break;
+  }
+  return count;
+}
+
+void BindMemory(void *start, std::size_t size, int policy, const std::vector<unsigned long> &mask) {
+  // Like libnuma, pass one more than the number of bits.
+  if (!syscall(SYS_mbind, start, size, policy, &mask[0], mask.size() * kNodeMaskBits + 1, 0))
+    return;
+  // Kernels built without NUMA have one node anyway.
+  UTIL_THROW_IF(errno != ENOSYS, ErrnoException, "mbind failed to set the NUMA policy of " << size << " bytes");
+}
+
+// Page aligned memory that has not been touched, so the policy decides where it goes.
+void NumaMap(std::size_t size, bool interleave, int node, util::scoped_memory &to) {
+  UTIL_THROW_IF(!AnonymousMap(size, 0, false, to), ErrnoException, "Failed to mmap " << size << " bytes");
+#ifdef MADV_HUGEPAGE
+  madvise(to.get(), size, MADV_HUGEPAGE);
+#endif
+  std::vector<unsigned long> mask;
+  if (interleave) {
+    if (NodesWithMemory(mask) > 1) BindMemory(to.get(), size, kPolicyInterleave, mask);
+    return;
+  }
+  if (node == -1) {
+    unsigned int cpu, current;
+    UTIL_THROW_IF(syscall(SYS_getcpu, &cpu, &current, NULL), ErrnoException, "getcpu failed");
+    node = current;
+  }
+  AddNode(node, mask);
+  BindMemory(to.get(), size, kPolicyBind, mask);
+}
+
 } // namespace
 
 #endif
@@ -293,9 +378,10 @@ void HugeRealloc(std::size_t to, bool zero_new, scoped_memory &mem) {
   }
 }
 
-void MapRead(LoadMethod method, int fd, uint64_t offset, std::size_t size, scoped_memory &out) {
+void MapRead(LoadMethod method, int fd, uint64_t offset, std::size_t size, scoped_memory &out, int node) {
   switch (method) {
     case LAZY:
+    case PREFETCH:
       out.reset(MapOrThrow(size, false, kFileFlags, false, fd, offset), size, scoped_memory::MMAP_ALLOCATED);
       break;
     case POPULATE_OR_LAZY:
@@ -316,9 +402,116 @@ void MapRead(LoadMethod method, int fd, uint64_t offset, std::size_t size, scope
       HugeMalloc(size, false, out);
       ParallelRead(fd, out.get(), size, offset);
       break;
+    case HUGE_READ:
+#ifdef __linux__
+      UTIL_THROW_IF(!HugeTLBMap(size, out), ErrnoException, "No free huge pages for " << size << " bytes.  Reserve them in /proc/sys/vm/nr_hugepages or use another load method");
+#else
+      UTIL_THROW(Exception, "Explicit huge pages are only supported on Linux");
+#endif
+      SeekOrThrow(fd, offset);
+      ReadOrThrow(fd, out.get(), size);
+      break;
+    case INTERLEAVE_READ:
+    case NODE_READ:
+#ifdef __linux__
+      NumaMap(size, method == INTERLEAVE_READ, node, out);
+#else
+      HugeMalloc(size, false, out);
+#endif
+      SeekOrThrow(fd, offset);
+      ReadOrThrow(fd, out.get(), size);
+      break;
+    case SHARED:
+      UTIL_THROW_IF(!OnMemoryFilesystem(fd), Exception, NameFromFD(fd) << " is not on tmpfs or hugetlbfs, so attaching to it would read from disk.  Share the model with kenlm_share first.");
+      out.reset(MapOrThrow(size, false, kFileFlags, false, fd, offset), size, scoped_memory::MMAP_ALLOCATED);
+      break;
+  }
+}
+
+bool ParseLoadMethod(const char *name, LoadMethod &method, int &node) {
+  node = -1;
+  if (!strcmp(name, "lazy")) {
+    method = LAZY;
+  } else if (!strcmp(name, "populate")) {
+    method = POPULATE_OR_READ;
+  } else if (!strcmp(name, "read")) {
+    method = READ;
+  } else if (!strcmp(name, "parallel")) {
+    method = PARALLEL_READ;
+  } else if (!strcmp(name, "huge")) {
+    method = HUGE_READ;
+  } else if (!strcmp(name, "interleave")) {
+    method = INTERLEAVE_READ;
+  } else if (!strcmp(name, "node")) {
+    method = NODE_READ;
+  } else if (!strcmp(name, "shared")) {
+    method = SHARED;
+  } else if (!strcmp(name, "prefetch")) {
+    method = PREFETCH;
+  } else if (!strncmp(name, "node:", 5)) {
+    char *end;
+    long value = strtol(name + 5, &end, 10);
+    if (end == name + 5 || *end || value < 0) return false;
+    method = NODE_READ;
+    node = value;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+#ifdef __linux__
+namespace {
+// From linux/magic.h.
+const uint32_t kTmpFSMagic = 0x01021994;
+const uint32_t kHugeTLBFSMagic = 0x958458f6;
+} // namespace
+#endif
+
+bool OnMemoryFilesystem(int fd) {
+#ifdef __linux__
+  struct statfs fs;
+  UTIL_THROW_IF_ARG(fstatfs(fd, &fs), FDException, (fd), "while checking the filesystem");
+  return static_cast<uint32_t>(fs.f_type) == kTmpFSMagic || static_cast<uint32_t>(fs.f_type) == kHugeTLBFSMagic;
+#else
+  return false;
+#endif
+}
+
+namespace {
+std::string IncompleteName(const char *path) {
+  return std::string(path) + ".incomplete";
+}
+} // namespace
+
+void CreateShared(const char *path, std::size_t size, scoped_fd &file, scoped_memory &to) {
+  file.reset(CreateOrThrow(IncompleteName(path).c_str()));
+  try {
+    std::size_t rounded = size;
+#ifdef __linux__
+    struct statfs fs;
+    UTIL_THROW_IF_ARG(fstatfs(file.get(), &fs), FDException, (file.get()), "while checking the filesystem");
+    // hugetlbfs only takes whole pages, and reports their size as the block size.
+    if (static_cast<uint32_t>(fs.f_type) == kHugeTLBFSMagic) rounded = RoundUpPow2<std::size_t>(size, fs.f_bsize);
+#endif
+    ResizeOrThrow(file.get(), rounded);
+    to.reset(MapOrThrow(rounded, true, kFileFlags, false, file.get(), 0), rounded, scoped_memory::MMAP_ALLOCATED);
+  } catch (...) {
+    file.reset();
+    AbandonShared(path);
+    throw;
   }
 }
 
+void AbandonShared(const char *path) {
+  unlink(IncompleteName(path).c_str());
+}
+
+void PublishShared(const char *path) {
+  std::string incomplete(IncompleteName(path));
+  UTIL_THROW_IF(std::rename(incomplete.c_str(), path), ErrnoException, "while renaming " << incomplete << " to " << path);
+}
+
 void *MapZeroedWrite(int fd, std::size_t size) {
   ResizeOrThrow(fd, 0);
   ResizeOrThrow(fd, size);
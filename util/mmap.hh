@@ -139,9 +139,49 @@ typedef enum {
   READ,
   // malloc and read in parallel (recommended for Lustre)
   PARALLEL_READ,
+  // Read into explicit huge pages (MAP_HUGETLB), 1 GB if possible, else 2 MB.
+  // READ already tries these but settles for transparent huge pages; this
+  // throws if the kernel has none free (see /proc/sys/vm/nr_hugepages).
+  // Linux only.
+  HUGE_READ,
+  // Read into memory interleaved page by page across the NUMA nodes that have
+  // memory, so that no one node serves every query.  Same as READ without NUMA.
+  INTERLEAVE_READ,
+  // Read into memory bound to one NUMA node.  To replicate a model on every
+  // node, load one copy per node and query each from threads on that node.
+  NODE_READ,
+  // Attach to a file on a memory filesystem, such as one CreateShared made
+  // in /dev/shm or on hugetlbfs, by mapping it read-only.  No data is copied
+  // or prefaulted, so attaching takes the same time for any size and every
+  // process shares the same pages.  Throws if the file is on disk.
+  SHARED,
+  // mmap like LAZY and return right away.  The caller then populates the
+  // mapping in the background with util::Prefetch, as BinaryFormat does.
+  PREFETCH,
 } LoadMethod;
 
-void MapRead(LoadMethod method, int fd, uint64_t offset, std::size_t size, scoped_memory &out);
+// node only matters for NODE_READ: the node to bind to or -1 for the caller's.
+void MapRead(LoadMethod method, int fd, uint64_t offset, std::size_t size, scoped_memory &out, int node = -1);
+
+/* Parse a command line name for a load method: lazy, populate, read, parallel,
+ * huge, interleave, node[:N], shared, or prefetch.  Sets node to N or -1 for the caller's node.
+ * Returns false if the name is not recognized.
+ */
+bool ParseLoadMethod(const char *name, LoadMethod &method, int &node);
+
+// Whether fd is on tmpfs or hugetlbfs, where SHARED mappings are free.  Linux only.
+bool OnMemoryFilesystem(int fd);
+
+/* Make a file of at least size bytes at path, which should be on tmpfs (e.g.
+ * /dev/shm) or on hugetlbfs for huge pages, and map it shared for writing.
+ * The file is built under a temporary name; call PublishShared once it is
+ * filled so that processes never attach to a partial copy, or AbandonShared
+ * to remove it if filling fails.  On hugetlbfs the size is rounded up to the
+ * huge page size, so the file ends with zeros.
+ */
+void CreateShared(const char *path, std::size_t size, scoped_fd &file, scoped_memory &to);
+void PublishShared(const char *path);
+void AbandonShared(const char *path);
 
 // Open file name with mmap of size bytes, all of which are initially zero.
 void *MapZeroedWrite(int fd, std::size_t size);
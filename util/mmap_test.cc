@@ -0,0 +1,101 @@
+#include "util/mmap.hh"
+
+#include "util/file.hh"
+#include "util/usage.hh"
+
+#define BOOST_TEST_MODULE MMapTest
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace util {
+namespace {
+
+// A fresh name in /dev/shm or empty if there is no tmpfs there.
+std::string SharedPath(const char *suffix) {
+  int fd = open("/dev/shm", O_RDONLY);
+  if (fd == -1) return std::string();
+  scoped_fd dir(fd);
+  if (!OnMemoryFilesystem(dir.get())) return std::string();
+  std::ostringstream path;
+  path << "/dev/shm/kenlm_mmap_test_" << getpid() << '_' << suffix;
+  return path.str();
+}
+
+void MakeShared(const std::string &path, std::size_t size, scoped_memory &writable) {
+  scoped_fd file;
+  CreateShared(path.c_str(), size, file, writable);
+  for (std::size_t i = 0; i < size; i += 4096) {
+    static_cast<char*>(writable.get())[i] = static_cast<char>(i / 4096);
+  }
+  PublishShared(path.c_str());
+}
+
+double AttachSeconds(const std::string &path, std::size_t size) {
+  double best = 1.0e10;
+  for (unsigned int i = 0; i < 5; ++i) {
+    scoped_fd file(OpenReadOrThrow(path.c_str()));
+    scoped_memory attached;
+    double start = WallTime();
+    MapRead(SHARED, file.get(), 0, size, attached);
+    best = std::min(best, WallTime() - start);
+  }
+  return best;
+}
+
+BOOST_AUTO_TEST_CASE(SharedZeroCopy) {
+  std::string path(SharedPath("zero_copy"));
+  if (path.empty()) return;
+  const std::size_t kSize = 1 << 20;
+  scoped_memory writable;
+  MakeShared(path, kSize, writable);
+  scoped_fd file(OpenReadOrThrow(path.c_str()));
+  BOOST_CHECK(OnMemoryFilesystem(file.get()));
+  scoped_memory attached;
+  MapRead(SHARED, file.get(), 0, kSize, attached);
+  BOOST_CHECK_EQUAL(0, memcmp(writable.get(), attached.get(), kSize));
+  // Same pages, not a copy.
+  static_cast<char*>(writable.get())[12345] = 'x';
+  BOOST_CHECK_EQUAL('x', static_cast<const char*>(attached.get())[12345]);
+  BOOST_CHECK_EQUAL(0, unlink(path.c_str()));
+}
+
+// Nothing is copied or prefaulted, so a segment 1024 times as big attaches just as fast.
+BOOST_AUTO_TEST_CASE(SharedAttachTime) {
+  std::string small_path(SharedPath("small")), big_path(SharedPath("big"));
+  if (small_path.empty()) return;
+  const std::size_t kSmall = 1 << 16, kBig = 1 << 26;
+  scoped_memory small_memory, big_memory;
+  MakeShared(small_path, kSmall, small_memory);
+  MakeShared(big_path, kBig, big_memory);
+  double small_seconds = AttachSeconds(small_path, kSmall);
+  double big_seconds = AttachSeconds(big_path, kBig);
+  BOOST_TEST_MESSAGE("Attach seconds " << small_seconds << " for " << kSmall << " bytes and " << big_seconds << " for " << kBig);
+  // Populating 64 MB takes milliseconds; mapping takes microseconds.
+  BOOST_CHECK(big_seconds < 10.0 * small_seconds + 0.0005);
+  BOOST_CHECK_EQUAL(0, unlink(small_path.c_str()));
+  BOOST_CHECK_EQUAL(0, unlink(big_path.c_str()));
+}
+
+BOOST_AUTO_TEST_CASE(ParseLoadMethodNames) {
+  LoadMethod method;
+  int node;
+  BOOST_REQUIRE(ParseLoadMethod("shared", method, node));
+  BOOST_CHECK_EQUAL(SHARED, method);
+  BOOST_CHECK_EQUAL(-1, node);
+  BOOST_REQUIRE(ParseLoadMethod("node:3", method, node));
+  BOOST_CHECK_EQUAL(NODE_READ, method);
+  BOOST_CHECK_EQUAL(3, node);
+  BOOST_CHECK(!ParseLoadMethod("node:", method, node));
+  BOOST_CHECK(!ParseLoadMethod("nodes", method, node));
+  BOOST_CHECK(!ParseLoadMethod("bogus", method, node));
+}
+
+} // namespace
+} // namespace util
@@ -1,6 +1,42 @@
 #include "util/parallel_read.hh"
 
 #include "util/file.hh"
+#include "util/read_compressed.hh"
+
+#include <algorithm>
+#include <string>
+
+namespace util {
+namespace {
+
+struct Block {
+  uint64_t offset;
+  std::size_t compressed;
+  void *to;
+  std::size_t size;
+
+  bool operator==(const Block &other) const {
+    return (offset == other.offset) && (compressed == other.compressed) && (to == other.to) && (size == other.size);
+  }
+};
+
+Block MakeBlock(const std::vector<uint64_t> &offsets, std::size_t i, std::size_t block_size, void *to, std::size_t amount) {
+  Block block;
+  block.offset = offsets[i];
+  block.compressed = offsets[i + 1] - offsets[i];
+  block.to = static_cast<uint8_t*>(to) + i * block_size;
+  block.size = std::min(block_size, amount - i * block_size);
+  return block;
+}
+
+void DecompressFromFile(int fd, const Block &block, std::string &buffer) {
+  buffer.resize(block.compressed);
+  ErsatzPRead(fd, &buffer[0], block.compressed, block.offset);
+  DecompressBlock(buffer.data(), block.compressed, block.to, block.size);
+}
+
+} // namespace
+} // namespace util
 
 #ifdef WITH_THREADS
 #include "util/thread_pool.hh"
@@ -30,6 +66,38 @@ class Reader {
     int fd_;
 };
 
+// Workers can't throw, so the first error is kept here for the caller.
+struct DecompressShared {
+  int fd;
+  boost::mutex mutex;
+  std::string error;
+};
+
+class Decompressor {
+  public:
+    typedef Block Request;
+
+    explicit Decompressor(DecompressShared *shared) : shared_(*shared) {}
+
+    void operator()(const Block &block) {
+      try {
+        DecompressFromFile(shared_.fd, block, buffer_);
+      } catch (const std::exception &e) {
+        boost::unique_lock<boost::mutex> lock(shared_.mutex);
+        if (shared_.error.empty()) shared_.error = e.what();
+      }
+    }
+
+  private:
+    DecompressShared &shared_;
+    std::string buffer_;
+};
+
+unsigned Threads() {
+  unsigned threads = boost::thread::hardware_concurrency();
+  return threads ? threads : 2;
+}
+
 } // namespace
 
 void ParallelRead(int fd, void *to, std::size_t amount, uint64_t offset) {
@@ -37,9 +105,7 @@ void ParallelRead(int fd, void *to, std::size_t amount, uint64_t offset) {
   poison.to = NULL;
   poison.size = 0;
   poison.offset = 0;
-  unsigned threads = boost::thread::hardware_concurrency();
-  if (!threads) threads = 2;
-  ThreadPool<Reader> pool(2 /* don't need much of a queue */, threads, fd, poison);
+  ThreadPool<Reader> pool(2 /* don't need much of a queue */, Threads(), fd, poison);
   const std::size_t kBatch = 1ULL << 25; // 32 MB
   Reader::Request request;
   request.to = to;
@@ -56,6 +122,23 @@ void ParallelRead(int fd, void *to, std::size_t amount, uint64_t offset) {
   }
 }
 
+void ParallelDecompress(int fd, const std::vector<uint64_t> &offsets, std::size_t block_size, void *to, std::size_t amount) {
+  DecompressShared shared;
+  shared.fd = fd;
+  {
+    Block poison;
+    poison.offset = 0;
+    poison.compressed = 0;
+    poison.to = NULL;
+    poison.size = 0;
+    ThreadPool<Decompressor> pool(2, std::min<std::size_t>(Threads(), offsets.size()), &shared, poison);
+    for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+      pool.Produce(MakeBlock(offsets, i, block_size, to, amount));
+    }
+  }
+  UTIL_THROW_IF(!shared.error.empty(), CompressedException, shared.error);
+}
+
 } // namespace util
 
 #else // WITH_THREADS
@@ -64,6 +147,13 @@ namespace util {
 void ParallelRead(int fd, void *to, std::size_t amount, uint64_t offset) {
  util::ErsatzPRead(fd, to, amount, offset);
 }
+
+void ParallelDecompress(int fd, const std::vector<uint64_t> &offsets, std::size_t block_size, void *to, std::size_t amount) {
+  std::string buffer;
+  for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+    DecompressFromFile(fd, MakeBlock(offsets, i, block_size, to, amount), buffer);
+  }
+}
 } // namespace util
 
 #endif
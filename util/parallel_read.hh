@@ -7,10 +7,16 @@
  */
 
 #include <cstddef>
+#include <vector>
 #include <stdint.h>
 
 namespace util {
 void ParallelRead(int fd, void *to, std::size_t amount, uint64_t offset);
+
+// Block i is bytes [offsets[i], offsets[i+1]) of fd, compressed in any format
+// DecompressBlock understands.  It decompresses to block_size bytes at
+// to + i * block_size, except the last block ends at to + amount.
+void ParallelDecompress(int fd, const std::vector<uint64_t> &offsets, std::size_t block_size, void *to, std::size_t amount);
 } // namespace util
 
 #endif // UTIL_PARALLEL_READ__
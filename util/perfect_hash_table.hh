@@ -0,0 +1,243 @@
+#ifndef UTIL_PERFECT_HASH_TABLE_H
+#define UTIL_PERFECT_HASH_TABLE_H
+
+#include "util/exception.hh"
+#include "util/fingerprint_probing_hash_table.hh"
+#include "util/probing_hash_table.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+#include <stdint.h>
+
+namespace util {
+
+namespace detail {
+
+// Finalizer from MurmurHash3: every input bit affects every output bit.
+inline uint64_t MixHash(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Map a well mixed hash to [0, range) using its high bits.
+inline uint64_t HashRange(uint64_t hash, uint64_t range) {
+#if defined(__SIZEOF_INT128__)
+  return static_cast<uint64_t>((static_cast<unsigned __int128>(hash) * range) >> 64);
+#else
+  return hash % range;
+#endif
+}
+
+} // namespace detail
+
+/* Read-only table of keys built once with a perfect hash function, as in
+ * hash-and-displace schemes (CHD, PTHash).  Keys are split into buckets of
+ * about kKeysPerBucket and each bucket stores a 32-bit pilot chosen at build
+ * time so that its keys land in distinct slots.  A lookup reads one pilot and
+ * one slot.
+ *
+ * Keys are not stored.  Each slot holds the value followed by a fingerprint
+ * of fingerprint_bits / 8 bytes.  An absent key still lands on some slot and
+ * matches its fingerprint with probability about 1 / 2^fingerprint_bits.
+ *
+ * There are Slots(entries) slots, slightly more than entries, to leave room
+ * for entries that the caller adds beyond its estimate and to shorten the
+ * pilot search.  Memory is:
+ *   uint64_t seed
+ *   uint32_t pilot[Buckets(entries)]
+ *   slot[Slots(entries)]
+ * Build fills all of it, so memory need not be zeroed.
+ */
+template <class EntryT> class PerfectHashTable {
+  public:
+    typedef EntryT Entry;
+    typedef typename Entry::Key Key;
+    typedef typename Entry::Value Value;
+
+    typedef FingerprintIterator<const Value> ConstIterator;
+    typedef FingerprintIterator<Value> MutableIterator;
+
+    static const std::size_t kKeysPerBucket = 5;
+
+    static uint64_t Slots(uint64_t entries) {
+      return entries + entries / 64 + 16;
+    }
+
+    static uint64_t Buckets(uint64_t entries) {
+      return Slots(entries) / kKeysPerBucket + 1;
+    }
+
+    static uint64_t Size(uint64_t entries, uint8_t fingerprint_bits) {
+      return sizeof(uint64_t) + Buckets(entries) * sizeof(uint32_t) + Slots(entries) * (sizeof(Value) + fingerprint_bits / 8);
+    }
+
+    // Probability that looking up an absent key returns some entry.
+    static double FalsePositiveRate(uint8_t fingerprint_bits) {
+      return 1.0 / static_cast<double>(1ULL << fingerprint_bits);
+    }
+
+    // Must be assigned to later.
+    PerfectHashTable() : buckets_(1), slots_(1) {}
+
+    PerfectHashTable(void *start, uint64_t entries, uint8_t fingerprint_bits)
+      : seed_(static_cast<uint64_t*>(start)),
+        pilots_(reinterpret_cast<uint32_t*>(seed_ + 1)),
+        slot_begin_(reinterpret_cast<uint8_t*>(pilots_ + Buckets(entries))),
+        buckets_(Buckets(entries)),
+        slots_(Slots(entries)),
+        fingerprint_bytes_(fingerprint_bits / 8),
+        stride_(sizeof(Value) + fingerprint_bytes_),
+        fingerprint_mask_((1ULL << fingerprint_bits) - 1) {
+      FingerprintProbingHashTable<Entry>::CheckBits(fingerprint_bits);
+    }
+
+    /* Build from the entries in [begin, end), skipping those with key
+     * invalid.  This is meant for the raw array of a ProbingHashTable.
+     * Temporarily uses 16 bytes per entry for bucket and hash, 16 bytes per
+     * non-empty bucket, and one bit per slot: about 19 bytes per entry.
+     */
+    void Build(const Entry *begin, const Entry *end, const Key invalid) {
+      std::vector<std::pair<uint64_t, uint64_t> > bucket_hash;
+      for (const Entry *i = begin; i != end; ++i) {
+        if (i->GetKey() != invalid) bucket_hash.push_back(std::pair<uint64_t, uint64_t>(0, 0));
+      }
+      UTIL_THROW_IF(bucket_hash.size() > slots_, ProbingSizeException, "Perfect hash table with " << slots_ << " slots cannot hold " << bucket_hash.size() << " entries.  This happens when many entries were added beyond the estimate, such as n-grams pruned from a model while longer n-grams containing them were kept.");
+      for (uint64_t seed = 0; ; ++seed) {
+        std::vector<std::pair<uint64_t, uint64_t> >::iterator out = bucket_hash.begin();
+        for (const Entry *i = begin; i != end; ++i) {
+          if (i->GetKey() == invalid) continue;
+          out->second = Hash(i->GetKey(), seed);
+          out->first = Bucket(out->second);
+          ++out;
+        }
+        if (FindPilots(bucket_hash)) {
+          *seed_ = seed;
+          break;
+        }
+      }
+      // Slack slots are empty.
+      std::memset(slot_begin_, 0, slots_ * stride_);
+      for (const Entry *i = begin; i != end; ++i) {
+        if (i->GetKey() == invalid) continue;
+        uint64_t hash = Hash(i->GetKey(), *seed_);
+        uint8_t *slot = slot_begin_ + Position(hash, pilots_[Bucket(hash)]) * stride_;
+        uint32_t fingerprint = Fingerprint(hash);
+        std::memcpy(slot, &i->value, sizeof(Value));
+        std::memcpy(slot + sizeof(Value), &fingerprint, fingerprint_bytes_);
+      }
+    }
+
+    // Hint that key will be looked up soon by fetching its pilot.
+    void Prefetch(const Key key) const {
+      UTIL_PREFETCH(pilots_ + Bucket(Hash(key, *seed_)));
+    }
+
+    bool Find(const Key key, ConstIterator &out) const {
+      uint64_t hash = Hash(key, *seed_);
+      const uint8_t *slot = slot_begin_ + Position(hash, pilots_[Bucket(hash)]) * stride_;
+      uint32_t got = 0;
+      // Little endian assumption, as in the rest of the binary format.
+      std::memcpy(&got, slot + sizeof(Value), fingerprint_bytes_);
+      if (got != Fingerprint(hash)) return false;
+      out = ConstIterator(reinterpret_cast<const Value*>(slot));
+      return true;
+    }
+
+    // Like Find but we're sure it must be there.
+    ConstIterator MustFind(const Key key) const {
+      ConstIterator ret;
+      bool found = Find(key, ret);
+      assert(found);
+      (void)found;
+      return ret;
+    }
+
+  private:
+    // Give up on a seed after this many pilots for one bucket.
+    static const uint32_t kMaxPilot = 1 << 24;
+
+    static uint64_t Hash(const Key key, uint64_t seed) {
+      return detail::MixHash(static_cast<uint64_t>(key) ^ (seed * 0x9e3779b97f4a7c15ULL));
+    }
+
+    uint64_t Bucket(uint64_t hash) const {
+      return detail::HashRange(hash, buckets_);
+    }
+
+    uint64_t Position(uint64_t hash, uint32_t pilot) const {
+      return detail::HashRange(detail::MixHash(hash ^ (static_cast<uint64_t>(pilot) * 0xc2b2ae3d27d4eb4fULL)), slots_);
+    }
+
+    // Never zero, which marks empty slots.
+    uint32_t Fingerprint(uint64_t hash) const {
+      uint32_t ret = static_cast<uint32_t>(hash & fingerprint_mask_);
+      return ret ? ret : 1;
+    }
+
+    // Largest buckets first, as they are the hardest to place.
+    struct GreaterSize {
+      bool operator()(const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) const {
+        return a.first > b.first;
+      }
+    };
+
+    // Returns false if this seed does not work.
+    bool FindPilots(std::vector<std::pair<uint64_t, uint64_t> > &bucket_hash) {
+      std::sort(bucket_hash.begin(), bucket_hash.end());
+      // (size, offset into bucket_hash) for each non-empty bucket.
+      std::vector<std::pair<uint64_t, uint64_t> > order;
+      for (uint64_t i = 0; i < bucket_hash.size();) {
+        uint64_t end = i + 1;
+        while (end < bucket_hash.size() && bucket_hash[end].first == bucket_hash[i].first) ++end;
+        order.push_back(std::pair<uint64_t, uint64_t>(end - i, i));
+        i = end;
+      }
+      std::stable_sort(order.begin(), order.end(), GreaterSize());
+
+      std::fill(pilots_, pilots_ + buckets_, 0);
+      std::vector<bool> taken(slots_);
+      std::vector<uint64_t> positions;
+      for (std::vector<std::pair<uint64_t, uint64_t> >::const_iterator b = order.begin(); b != order.end(); ++b) {
+        const std::pair<uint64_t, uint64_t> *keys = &bucket_hash[b->second];
+        uint32_t pilot = 0;
+        for (; ; ++pilot) {
+          if (pilot == kMaxPilot) return false;
+          positions.clear();
+          uint64_t k = 0;
+          for (; k < b->first; ++k) {
+            uint64_t position = Position(keys[k].second, pilot);
+            if (taken[position] || std::find(positions.begin(), positions.end(), position) != positions.end()) break;
+            positions.push_back(position);
+          }
+          if (k == b->first) break;
+        }
+        pilots_[keys[0].first] = pilot;
+        for (std::vector<uint64_t>::const_iterator p = positions.begin(); p != positions.end(); ++p) {
+          taken[*p] = true;
+        }
+      }
+      return true;
+    }
+
+    uint64_t *seed_;
+    uint32_t *pilots_;
+    uint8_t *slot_begin_;
+    uint64_t buckets_;
+    uint64_t slots_;
+    std::size_t fingerprint_bytes_;
+    std::size_t stride_;
+    uint64_t fingerprint_mask_;
+};
+
+} // namespace util
+
+#endif // UTIL_PERFECT_HASH_TABLE_H
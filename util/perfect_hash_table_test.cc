@@ -0,0 +1,68 @@
+#include "util/perfect_hash_table.hh"
+
+#define BOOST_TEST_MODULE PerfectHashTableTest
+#include <boost/test/unit_test.hpp>
+#include <boost/scoped_array.hpp>
+#include <vector>
+#include <stdint.h>
+
+namespace util {
+namespace {
+
+struct Entry {
+  typedef uint64_t Key;
+  typedef float Value;
+  uint64_t key;
+  float value;
+  Key GetKey() const { return key; }
+};
+
+typedef PerfectHashTable<Entry> Table;
+
+BOOST_AUTO_TEST_CASE(BuildFind) {
+  const uint64_t kEntries = 10000;
+  // Interleave invalid entries as a probing hash table would have.
+  std::vector<Entry> entries(kEntries * 2);
+  for (uint64_t i = 0; i < kEntries; ++i) {
+    entries[2 * i].key = (i + 1) * 0x9e3779b97f4a7c15ULL;
+    entries[2 * i].value = static_cast<float>(i);
+    entries[2 * i + 1].key = 0;
+  }
+  size_t size = Table::Size(kEntries, 16);
+  boost::scoped_array<char> mem(new char[size]);
+  Table table(mem.get(), kEntries, 16);
+  table.Build(&entries.front(), &entries.front() + entries.size(), 0);
+
+  for (uint64_t i = 0; i < kEntries; ++i) {
+    Table::ConstIterator it;
+    BOOST_REQUIRE(table.Find(entries[2 * i].key, it));
+    BOOST_CHECK_EQUAL(static_cast<float>(i), it->value);
+  }
+
+  // Loading the same memory again finds the same values.
+  Table loaded(mem.get(), kEntries, 16);
+  BOOST_CHECK_EQUAL(5.0, loaded.MustFind(entries[10].key)->value);
+
+  uint64_t matched = 0;
+  Table::ConstIterator it;
+  for (uint64_t i = 0; i < 100000; ++i) {
+    matched += table.Find(i * 2 + 1, it);
+  }
+  // Expect about 100000 / 65536.
+  BOOST_CHECK_LT(matched, 10U);
+}
+
+BOOST_AUTO_TEST_CASE(TooMany) {
+  std::vector<Entry> entries(40);
+  for (uint64_t i = 0; i < entries.size(); ++i) {
+    entries[i].key = i + 1;
+    entries[i].value = 0.0;
+  }
+  size_t size = Table::Size(10, 8);
+  boost::scoped_array<char> mem(new char[size]);
+  Table table(mem.get(), 10, 8);
+  BOOST_CHECK_THROW(table.Build(&entries.front(), &entries.front() + entries.size(), 0), ProbingSizeException);
+}
+
+} // namespace
+} // namespace util
@@ -0,0 +1,131 @@
+#include "util/prefetch.hh"
+
+#include "util/mmap.hh"
+
+#ifdef WITH_THREADS
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#endif
+
+#include <algorithm>
+
+#include <stdint.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>
+#endif
+
+namespace util {
+namespace {
+
+// Small enough that low orders are done early, large enough that claiming blocks costs nothing.
+const std::size_t kBlock = 1 << 22;
+
+void Populate(const uint8_t *begin, std::size_t size) {
+#ifdef MADV_POPULATE_READ
+  // Linux >= 5.14 faults the whole range in with one call.
+  if (!madvise(const_cast<uint8_t*>(begin), size, MADV_POPULATE_READ)) return;
+#endif
+#ifdef MADV_WILLNEED
+  madvise(const_cast<uint8_t*>(begin), size, MADV_WILLNEED);
+#endif
+  const std::size_t page = SizePage();
+  for (const volatile uint8_t *i = begin; i < begin + size; i += page) {
+    *i;
+  }
+}
+
+} // namespace
+
+#ifdef WITH_THREADS
+
+class Prefetch::Backend {
+  public:
+    Backend(const uint8_t *begin, std::size_t size, std::size_t threads)
+      : begin_(begin), size_(size), next_(0), populated_(0), stop_(false) {
+      for (std::size_t i = 0; i < threads; ++i) {
+        workers_.push_back(new boost::thread(&Backend::Run, this));
+      }
+    }
+
+    ~Backend() {
+      {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      for (boost::ptr_vector<boost::thread>::iterator i = workers_.begin(); i != workers_.end(); ++i) {
+        i->join();
+      }
+    }
+
+    std::size_t Populated() const {
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      return populated_;
+    }
+
+    void Wait() const {
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      while (populated_ != size_) done_.wait(lock);
+    }
+
+  private:
+    void Run() {
+      while (true) {
+        std::size_t offset;
+        {
+          boost::unique_lock<boost::mutex> lock(mutex_);
+          if (stop_ || next_ >= size_) return;
+          offset = next_;
+          next_ += kBlock;
+        }
+        std::size_t amount = std::min(kBlock, size_ - offset);
+        Populate(begin_ + offset, amount);
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        populated_ += amount;
+        if (populated_ == size_) done_.notify_all();
+      }
+    }
+
+    const uint8_t *const begin_;
+    const std::size_t size_;
+
+    mutable boost::mutex mutex_;
+    mutable boost::condition_variable done_;
+    std::size_t next_, populated_;
+    bool stop_;
+
+    boost::ptr_vector<boost::thread> workers_;
+};
+
+Prefetch::Prefetch(const void *begin, std::size_t size, std::size_t threads)
+  : size_(size), backend_(new Backend(static_cast<const uint8_t*>(begin), size, std::max<std::size_t>(1, threads))) {}
+
+std::size_t Prefetch::Populated() const {
+  return backend_->Populated();
+}
+
+void Prefetch::Wait() const {
+  backend_->Wait();
+}
+
+#else // WITH_THREADS
+
+class Prefetch::Backend {};
+
+Prefetch::Prefetch(const void *begin, std::size_t size, std::size_t /*threads*/) : size_(size) {
+  Populate(static_cast<const uint8_t*>(begin), size);
+}
+
+std::size_t Prefetch::Populated() const {
+  return size_;
+}
+
+void Prefetch::Wait() const {}
+
+#endif // WITH_THREADS
+
+Prefetch::~Prefetch() {}
+
+} // namespace util
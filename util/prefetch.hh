@@ -0,0 +1,52 @@
+#ifndef UTIL_PREFETCH_H
+#define UTIL_PREFETCH_H
+
+/* Populate a lazy memory mapping in the background so that it can be used
+ * right away and gets faster as pages arrive.  Pages come in address order
+ * (threads take consecutive blocks), which in KenLM binaries means the
+ * vocabulary, then unigrams, then each higher order.
+ *
+ * Without threads (WITH_THREADS undefined), the constructor populates
+ * everything before returning.
+ */
+
+#include <cstddef>
+
+#include <boost/scoped_ptr.hpp>
+
+namespace util {
+
+class Prefetch {
+  public:
+    // Start populating size bytes at begin, which must be page aligned.
+    Prefetch(const void *begin, std::size_t size, std::size_t threads = 1);
+
+    // Stops early if still running.  Call before unmapping.
+    ~Prefetch();
+
+    std::size_t Size() const { return size_; }
+
+    // Bytes populated so far.
+    std::size_t Populated() const;
+
+    // Fraction populated, from 0 to 1.
+    double Progress() const {
+      return size_ ? static_cast<double>(Populated()) / static_cast<double>(size_) : 1.0;
+    }
+
+    bool Done() const { return Populated() == size_; }
+
+    // Block until everything is populated.
+    void Wait() const;
+
+  private:
+    class Backend;
+
+    std::size_t size_;
+
+    boost::scoped_ptr<Backend> backend_;
+};
+
+} // namespace util
+
+#endif // UTIL_PREFETCH_H
@@ -143,6 +143,11 @@ template <class EntryT, class HashT, class EqualT = std::equal_to<typename Entry
       return mod_.Ideal(begin_, hash_(key));
     }
 
+    // Hint that key will be looked up soon by fetching its ideal bucket.
+    template <class Key> void Prefetch(const Key key) const {
+      UTIL_PREFETCH(Ideal(key));
+    }
+
     template <class T> MutableIterator Insert(const T &t) {
 #ifdef DEBUG
       assert(initialized_);
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 #include <cassert>
 #include <climits>
@@ -401,8 +402,83 @@ ReadBase *ReadFactory(int fd, uint64_t &raw_amount, const void *already_data, co
   }
 }
 
+template <class Compression> void DecompressAll(const void *in, std::size_t in_size, void *out, std::size_t out_size) {
+  Compression back(in, in_size);
+  back.SetOutput(out, out_size);
+  const void *last_in = in, *last_out = out;
+  while (back.Process()) {
+    // The stream needs more input or more output space than it has.
+    UTIL_THROW_IF(last_in == back.Stream().next_in && last_out == back.Stream().next_out, CompressedException, "Compressed block of " << in_size << " bytes is truncated or decompresses to more than " << out_size << " bytes.");
+    last_in = back.Stream().next_in;
+    last_out = back.Stream().next_out;
+  }
+  std::size_t got = static_cast<const uint8_t*>(static_cast<const void*>(back.Stream().next_out)) - static_cast<const uint8_t*>(out);
+  UTIL_THROW_IF(got != out_size, CompressedException, "Compressed block decompressed to " << got << " bytes instead of " << out_size);
+}
+
 } // namespace
 
+void DecompressBlock(const void *in, std::size_t in_size, void *out, std::size_t out_size) {
+  switch (DetectMagic(in, in_size)) {
+    case UTIL_GZIP:
+#ifdef HAVE_ZLIB
+      DecompressAll<GZip>(in, in_size, out, out_size);
+      return;
+#else
+      UTIL_THROW(CompressedException, "This block is gzipped but gzip support was not compiled in.");
+#endif
+    case UTIL_BZIP:
+#ifdef HAVE_BZLIB
+      DecompressAll<BZip>(in, in_size, out, out_size);
+      return;
+#else
+      UTIL_THROW(CompressedException, "This block is bzipped but bzip support was not compiled in.");
+#endif
+    case UTIL_XZIP:
+#ifdef HAVE_XZLIB
+      DecompressAll<XZip>(in, in_size, out, out_size);
+      return;
+#else
+      UTIL_THROW(CompressedException, "This block is xz compressed but xz support was not compiled in.");
+#endif
+    default:
+      UTIL_THROW(CompressedException, "Block of " << in_size << " bytes is not compressed with a known format.");
+  }
+}
+
+bool GZipAvailable() {
+#ifdef HAVE_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+void GZipBlock(const void *in, std::size_t in_size, int level, std::string &out) {
+#ifdef HAVE_ZLIB
+  UTIL_THROW_IF(in_size >= static_cast<std::size_t>(std::numeric_limits<uInt>::max()), GZException, "Block of " << in_size << " bytes is too large for zlib.");
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  stream.msg = NULL;
+  // 16 for a gzip header, which DetectMagic recognizes.
+  UTIL_THROW_IF(Z_OK != deflateInit2(&stream, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY), GZException, "Failed to initialize zlib compression at level " << level);
+  std::size_t original = out.size();
+  out.resize(original + deflateBound(&stream, in_size));
+  stream.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(in));
+  stream.avail_in = in_size;
+  stream.next_out = reinterpret_cast<Bytef*>(&out[original]);
+  stream.avail_out = out.size() - original;
+  int result = deflate(&stream, Z_FINISH);
+  out.resize(original + stream.total_out);
+  deflateEnd(&stream);
+  UTIL_THROW_IF(result != Z_STREAM_END, GZException, "zlib compression failed with code " << result);
+#else
+  UTIL_THROW(CompressedException, "Compressing requires zlib, which was not compiled in.");
+#endif
+}
+
 bool ReadCompressed::DetectCompressedMagic(const void *from_void) {
   return DetectMagic(from_void, kMagicSize) != UTIL_UNKNOWN;
 }
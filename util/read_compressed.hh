@@ -5,6 +5,7 @@
 #include "util/scoped.hh"
 
 #include <cstddef>
+#include <string>
 #include <stdint.h>
 
 namespace util {
@@ -79,6 +80,17 @@ class ReadCompressed {
     void operator=(const ReadCompressed &);
 };
 
+// Decompress all of a complete gzip, bzip2, or xz stream (detected by magic)
+// into exactly out_size bytes.  Used for blocks of compressed binary files.
+void DecompressBlock(const void *in, std::size_t in_size, void *out, std::size_t out_size);
+
+// Whether zlib was compiled in, so GZipBlock can compress.
+bool GZipAvailable();
+
+// Append the gzip compression of in at level 1-9 to out.  Throws
+// CompressedException if zlib was not compiled in.
+void GZipBlock(const void *in, std::size_t in_size, int level, std::string &out);
+
 } // namespace util
 
 #endif // UTIL_READ_COMPRESSED_H
@@ -83,6 +83,33 @@ template <class Iterator, class Accessor, class Pivot> bool BoundedSortedUniform
   return false;
 }
 
+/* Like BoundedSortedUniformFind, but stop narrowing once at most remaining
+ * entries lie strictly between before_it and after_it.  Returns true if key
+ * was hit along the way, setting out.  Otherwise the caller should finish by
+ * searching [before_it + 1, after_it - 1], for example with a linear scan.
+ */
+template <class Iterator, class Accessor, class Pivot> bool BoundedSortedUniformNarrow(
+    const Accessor &accessor,
+    Iterator &before_it, typename Accessor::Key before_v,
+    Iterator &after_it, typename Accessor::Key after_v,
+    const typename Accessor::Key key, const std::size_t remaining, Iterator &out) {
+  while (static_cast<std::size_t>(after_it - before_it - 1) > remaining) {
+    Iterator pivot(before_it + (1 + Pivot::Calc(key - before_v, after_v - before_v, after_it - before_it - 1)));
+    typename Accessor::Key mid(accessor(pivot));
+    if (mid < key) {
+      before_it = pivot;
+      before_v = mid;
+    } else if (mid > key) {
+      after_it = pivot;
+      after_v = mid;
+    } else {
+      out = pivot;
+      return true;
+    }
+  }
+  return false;
+}
+
 template <class Iterator, class Accessor, class Pivot> bool SortedUniformFind(const Accessor &accessor, Iterator begin, Iterator end, const typename Accessor::Key key, Iterator &out) {
   if (begin == end) return false;
   typename Accessor::Key below(accessor(begin));
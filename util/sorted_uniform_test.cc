@@ -123,5 +123,21 @@ BOOST_AUTO_TEST_CASE(sparse_random) {
   RandomTest<uint64_t>(std::numeric_limits<uint64_t>::max(), 100000, 2000);
 }
 
+BOOST_AUTO_TEST_CASE(narrow) {
+  std::vector<uint64_t> keys;
+  for (uint64_t i = 1; i < 1000; ++i) keys.push_back(i * i);
+  for (uint64_t key = 0; key < 1000000; key += 997) {
+    const uint64_t *before = &keys.front() - 1, *after = &keys.front() + keys.size();
+    const uint64_t *out = NULL;
+    if (BoundedSortedUniformNarrow<const uint64_t*, IdentityAccessor<uint64_t>, Pivot64>(IdentityAccessor<uint64_t>(), before, 0, after, 1000000, key, 8, out)) {
+      BOOST_CHECK_EQUAL(key, *out);
+      continue;
+    }
+    BOOST_CHECK_LE(after - before - 1, 8);
+    BOOST_CHECK(before < &keys.front() || *before < key);
+    BOOST_CHECK(after == &keys.front() + keys.size() || *after > key);
+  }
+}
+
 } // namespace
 } // namespace util
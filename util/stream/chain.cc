@@ -62,6 +62,11 @@ Chain &Chain::operator>>(const PWriteAndRecycle &writer) {
   return *this;
 }
 
+Chain &Chain::operator>>(const WriteRun &writer) {
+  threads_.push_back(new Thread(Complete(), writer));
+  return *this;
+}
+
 void Chain::Wait(bool release_memory) {
   if (queues_.empty()) {
     assert(threads_.empty());
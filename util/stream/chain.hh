@@ -104,6 +104,7 @@ class Recycler {
 extern const Recycler kRecycle;
 class WriteAndRecycle;
 class PWriteAndRecycle;
+class WriteRun;
 
 /**
  * Represents a sequence of workers, through which @ref Block "blocks" can pass.
@@ -218,6 +219,7 @@ class Chain {
      */
     Chain &operator>>(const WriteAndRecycle &writer);
     Chain &operator>>(const PWriteAndRecycle &writer);
+    Chain &operator>>(const WriteRun &writer);
 
     // Chains are reusable.  Call Wait to wait for everything to finish and free memory.
     void Wait(bool release_memory = true);
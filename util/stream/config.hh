@@ -49,6 +49,9 @@ struct ChainConfig {
  */
 struct SortConfig {
 
+  /** Constructs a configuration that sorts on one thread without compression. */
+  SortConfig() : threads(1), compress(false), min_merge_buffer(0) {}
+
   /** Filename prefix where temporary files should be placed. */
   std::string temp_prefix;
 
@@ -57,6 +60,19 @@ struct SortConfig {
 
   /** Total memory to use when running alone. */
   std::size_t total_memory;
+
+  /** Threads for sorting each block and for each merge. */
+  std::size_t threads;
+
+  /** Compress the runs spilled to temporary files.  Trades CPU for disk. */
+  bool compress;
+
+  /**
+   * Merges may read each stripe in pieces down to this size, instead of
+   * buffer_size, when the higher arity saves a pass.  0 to always read
+   * buffer_size.
+   */
+  std::size_t min_merge_buffer;
 };
 
 }} // namespaces
@@ -1,9 +1,13 @@
 #include "util/stream/io.hh"
 
 #include "util/file.hh"
+#include "util/read_compressed.hh"
 #include "util/stream/chain.hh"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <limits>
 
 namespace util {
 namespace stream {
@@ -74,5 +78,136 @@ void PWriteAndRecycle::Run(const ChainPosition &position) {
   util::ResizeOrThrow(file_, offset);
 }
 
+namespace {
+// Fast beats small: the point is to spend a little CPU to save disk.
+const int kSpillLevel = 1;
+
+// Each entry becomes itself XOR the entry before it.
+void XOREncode(const uint8_t *from, uint8_t *to, std::size_t size, std::size_t entry_size) {
+  std::copy(from, from + std::min(size, entry_size), to);
+  for (std::size_t i = entry_size; i < size; ++i) {
+    to[i] = from[i] ^ from[i - entry_size];
+  }
+}
+
+void XORDecode(uint8_t *data, std::size_t size, std::size_t entry_size) {
+  for (std::size_t i = entry_size; i < size; ++i) {
+    data[i] ^= data[i - entry_size];
+  }
+}
+} // namespace
+
+RunFile::RunFile(int fd, std::size_t entry_size, std::size_t frame_size, bool compress)
+  : file_(fd), entry_size_(entry_size),
+    frame_size_(std::max(entry_size, frame_size - frame_size % entry_size)),
+    compress_(compress), size_(0), decoded_frame_(std::numeric_limits<uint64_t>::max()) {
+  frames_.push_back(0);
+}
+
+void RunFile::Append(const void *data, std::size_t size) {
+  size_ += size;
+  if (!compress_) {
+    WriteOrThrow(file_.get(), data, size);
+    return;
+  }
+  const uint8_t *from = static_cast<const uint8_t*>(data);
+  if (!pending_.empty()) {
+    std::size_t amount = std::min(size, frame_size_ - pending_.size());
+    pending_.append(reinterpret_cast<const char*>(from), amount);
+    from += amount;
+    size -= amount;
+    if (pending_.size() < frame_size_) return;
+    WriteFrame(pending_.data(), pending_.size());
+    pending_.clear();
+  }
+  for (; size >= frame_size_; from += frame_size_, size -= frame_size_) {
+    WriteFrame(from, frame_size_);
+  }
+  pending_.assign(reinterpret_cast<const char*>(from), size);
+}
+
+void RunFile::FinishedAppending() {
+  if (compress_ && !pending_.empty()) {
+    WriteFrame(pending_.data(), pending_.size());
+    pending_.clear();
+  }
+}
+
+void RunFile::WriteFrame(const void *data, std::size_t size) {
+  encoded_.resize(size);
+  XOREncode(static_cast<const uint8_t*>(data), reinterpret_cast<uint8_t*>(&encoded_[0]), size, entry_size_);
+  compressed_.clear();
+  GZipBlock(encoded_.data(), size, kSpillLevel, compressed_);
+  WriteOrThrow(file_.get(), compressed_.data(), compressed_.size());
+  frames_.push_back(frames_.back() + compressed_.size());
+}
+
+const uint8_t *RunFile::DecodeFrame(uint64_t frame) {
+  if (frame != decoded_frame_) {
+    // Invalidate in case of exception.
+    decoded_frame_ = std::numeric_limits<uint64_t>::max();
+    std::size_t raw = static_cast<std::size_t>(std::min<uint64_t>(frame_size_, size_ - frame * frame_size_));
+    std::size_t compressed = static_cast<std::size_t>(frames_[frame + 1] - frames_[frame]);
+    compressed_.resize(compressed);
+    ErsatzPRead(file_.get(), &compressed_[0], compressed, frames_[frame]);
+    decoded_.resize(raw);
+    DecompressBlock(compressed_.data(), compressed, &decoded_[0], raw);
+    XORDecode(reinterpret_cast<uint8_t*>(&decoded_[0]), raw, entry_size_);
+    decoded_frame_ = frame;
+  }
+  return reinterpret_cast<const uint8_t*>(decoded_.data());
+}
+
+void RunFile::Read(void *to, std::size_t size, uint64_t offset) {
+  if (!compress_) {
+    ErsatzPRead(file_.get(), to, size, offset);
+    return;
+  }
+  UTIL_THROW_IF(offset + size > size_, EndOfFileException, " reading " << size << " bytes at " << offset << " from a spill file of " << size_ << " bytes");
+  uint8_t *out = static_cast<uint8_t*>(to);
+  while (size) {
+    uint64_t frame = offset / frame_size_;
+    std::size_t within = static_cast<std::size_t>(offset % frame_size_);
+    std::size_t amount = std::min(size, static_cast<std::size_t>(std::min<uint64_t>(frame_size_, size_ - frame * frame_size_)) - within);
+    memcpy(out, DecodeFrame(frame) + within, amount);
+    out += amount;
+    offset += amount;
+    size -= amount;
+  }
+}
+
+void RunFile::Reset() {
+  ResizeOrThrow(file_.get(), 0);
+  SeekOrThrow(file_.get(), 0);
+  size_ = 0;
+  frames_.resize(1);
+  pending_.clear();
+  decoded_frame_ = std::numeric_limits<uint64_t>::max();
+}
+
+int RunFile::StealPlain(const std::string &temp_prefix) {
+  if (!compress_) {
+    SeekOrThrow(file_.get(), 0);
+    return file_.release();
+  }
+  scoped_fd plain(MakeTemp(temp_prefix));
+  for (uint64_t frame = 0; frame + 1 < frames_.size(); ++frame) {
+    std::size_t raw = static_cast<std::size_t>(std::min<uint64_t>(frame_size_, size_ - frame * frame_size_));
+    WriteOrThrow(plain.get(), DecodeFrame(frame), raw);
+  }
+  SeekOrThrow(plain.get(), 0);
+  file_.reset();
+  return plain.release();
+}
+
+void WriteRun::Run(const ChainPosition &position) {
+  const std::size_t block_size = position.GetChain().BlockSize();
+  for (Link link(position); link; ++link) {
+    file_->Append(link->Get(), link->ValidSize());
+    link->SetValidSize(block_size);
+  }
+  file_->FinishedAppending();
+}
+
 } // namespace stream
 } // namespace util
@@ -4,6 +4,9 @@
 #include "util/exception.hh"
 #include "util/file.hh"
 
+#include <string>
+#include <vector>
+
 namespace util {
 namespace stream {
 
@@ -59,6 +62,63 @@ class PWriteAndRecycle {
     int file_;
 };
 
+/* A file of sorted runs that Sort spills, read back by byte offset as if it
+ * were plain.  With compression, the bytes are cut into frames of frame_size,
+ * each entry XORed with the one before it so sorted entries become mostly
+ * zeros, and each frame gzipped on its own.  An index in memory finds frames.
+ * Reading compressed frames is not thread safe.
+ */
+class RunFile {
+  public:
+    // Takes ownership of fd.  frame_size is rounded down to a multiple of
+    // entry_size.
+    RunFile(int fd, std::size_t entry_size, std::size_t frame_size, bool compress);
+
+    bool Compressed() const { return compress_; }
+
+    int File() const { return file_.get(); }
+
+    // Uncompressed size.
+    uint64_t Size() const { return size_; }
+
+    // Append whole entries.  Call FinishedAppending before reading.
+    void Append(const void *data, std::size_t size);
+    void FinishedAppending();
+
+    void Read(void *to, std::size_t size, uint64_t offset);
+
+    // Empty the file for writing again.
+    void Reset();
+
+    // Decompress if necessary and give up ownership of a plain file
+    // positioned at the beginning.
+    int StealPlain(const std::string &temp_prefix);
+
+  private:
+    void WriteFrame(const void *data, std::size_t size);
+
+    const uint8_t *DecodeFrame(uint64_t frame);
+
+    scoped_fd file_;
+    const std::size_t entry_size_, frame_size_;
+    const bool compress_;
+
+    uint64_t size_;
+
+    // Compressed only.  Offset in the file of each frame, plus the end.
+    std::vector<uint64_t> frames_;
+    std::string pending_, encoded_, compressed_, decoded_;
+    uint64_t decoded_frame_;
+};
+
+// Append blocks to a RunFile, then recycle them.
+class WriteRun {
+  public:
+    explicit WriteRun(RunFile &file) : file_(&file) {}
+    void Run(const ChainPosition &position);
+  private:
+    RunFile *file_;
+};
 
 // Reuse the same file over and over again to buffer output.
 class FileBuffer {
@@ -78,6 +138,8 @@ class FileBuffer {
       return SizeOrThrow(file_.get());
     }
 
+    int File() const { return file_.get(); }
+
   private:
     scoped_fd file_;
 };
@@ -0,0 +1,161 @@
+#ifndef UTIL_STREAM_RADIX_SORT_H
+#define UTIL_STREAM_RADIX_SORT_H
+
+/* In-place most significant digit radix sort (American flag sort) of
+ * fixed-size records keyed by 32-bit unsigned words.  BlockSorter uses it
+ * instead of comparison sort when the comparator describes its order with
+ * WordOrder.  It needs no memory beyond the block.
+ */
+
+#include "util/sized_iterator.hh"
+
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+namespace util { namespace stream {
+
+/* Specialize for a comparator that orders records lexicographically by
+ * uint32_t words, comparing each as an unsigned integer.  Get fills words
+ * with the position of each word in the record, in units of uint32_t, from
+ * most to least significant and returns true.  Records that agree on all
+ * these words must compare equal.
+ */
+template <class Compare> struct WordOrder {
+  static bool Get(const Compare &/*compare*/, std::vector<std::size_t> &/*words*/) { return false; }
+};
+
+namespace detail {
+
+template <class Compare> class RadixSorter {
+  public:
+    // Buckets with fewer records than this are comparison sorted.
+    static const std::size_t kSmall = 64;
+
+    RadixSorter(std::size_t entry_size, const std::vector<std::size_t> &words, const Compare &compare)
+      : entry_size_(entry_size), words_(words), compare_(compare) {}
+
+    // Sort records in [begin, end) that agree on digits before digit.
+    void Sort(uint8_t *begin, uint8_t *end, std::size_t digit, std::size_t threads) const {
+      const std::size_t digits = words_.size() * 4;
+      for (; digit < digits; ++digit) {
+        const std::size_t count = (end - begin) / entry_size_;
+        if (count < kSmall) {
+          std::sort(SizedIt(begin, entry_size_), SizedIt(end, entry_size_), SizedCompare<Compare>(compare_));
+          return;
+        }
+        std::size_t counts[256];
+        std::fill(counts, counts + 256, 0);
+        for (const uint8_t *i = begin; i != end; i += entry_size_) {
+          ++counts[Digit(i, digit)];
+        }
+        // Common for the high bytes of vocabulary ids.
+        if (counts[Digit(begin, digit)] == count) continue;
+
+        uint8_t *heads[256], *tails[256];
+        uint8_t *at = begin;
+        for (std::size_t b = 0; b < 256; ++b) {
+          heads[b] = at;
+          at += counts[b] * entry_size_;
+          tails[b] = at;
+        }
+        Permute(heads, tails, digit);
+
+        std::vector<std::pair<uint8_t*, uint8_t*> > buckets;
+        for (std::size_t b = 0; b < 256; ++b) {
+          if (counts[b] > 1) buckets.push_back(std::make_pair(tails[b] - counts[b] * entry_size_, tails[b]));
+        }
+        if (threads > 1) {
+          SortParallel(buckets, count, digit + 1, threads);
+        } else {
+          SortBuckets(buckets.begin(), buckets.end(), digit + 1, 1);
+        }
+        return;
+      }
+      // All digits agree so the records are equal.
+    }
+
+  private:
+    typedef std::vector<std::pair<uint8_t*, uint8_t*> >::const_iterator BucketIterator;
+
+    class Task {
+      public:
+        Task(const RadixSorter &sorter, BucketIterator begin, BucketIterator end, std::size_t digit, std::size_t threads)
+          : sorter_(&sorter), begin_(begin), end_(end), digit_(digit), threads_(threads) {}
+
+        void operator()() { sorter_->SortBuckets(begin_, end_, digit_, threads_); }
+
+      private:
+        const RadixSorter *sorter_;
+        BucketIterator begin_, end_;
+        std::size_t digit_, threads_;
+    };
+
+    uint8_t Digit(const uint8_t *record, std::size_t digit) const {
+      uint32_t word;
+      memcpy(&word, record + words_[digit / 4] * sizeof(uint32_t), sizeof(uint32_t));
+      return static_cast<uint8_t>(word >> (24 - 8 * (digit % 4)));
+    }
+
+    void Permute(uint8_t **heads, uint8_t *const *tails, std::size_t digit) const {
+      for (std::size_t b = 0; b < 256; ++b) {
+        while (heads[b] != tails[b]) {
+          uint8_t belongs = Digit(heads[b], digit);
+          if (belongs == b) {
+            heads[b] += entry_size_;
+          } else {
+            std::swap_ranges(heads[b], heads[b] + entry_size_, heads[belongs]);
+            heads[belongs] += entry_size_;
+          }
+        }
+      }
+    }
+
+    void SortBuckets(BucketIterator begin, BucketIterator end, std::size_t digit, std::size_t threads) const {
+      for (BucketIterator i = begin; i != end; ++i) {
+        Sort(i->first, i->second, digit, threads);
+      }
+    }
+
+    // Group buckets into about threads pieces of similar size.  A bucket
+    // bigger than a piece takes threads in proportion to its size.
+    void SortParallel(const std::vector<std::pair<uint8_t*, uint8_t*> > &buckets, std::size_t count, std::size_t digit, std::size_t threads) const {
+      const std::size_t target = count / threads + 1;
+      boost::thread_group group;
+      BucketIterator group_begin = buckets.begin();
+      std::size_t group_size = 0;
+      for (BucketIterator i = buckets.begin(); i != buckets.end(); ++i) {
+        group_size += (i->second - i->first) / entry_size_;
+        if (group_size < target && i + 1 != buckets.end()) continue;
+        std::size_t group_threads = std::max<std::size_t>(1, threads * group_size / count);
+        if (i + 1 == buckets.end()) {
+          SortBuckets(group_begin, i + 1, digit, group_threads);
+        } else {
+          group.create_thread(Task(*this, group_begin, i + 1, digit, group_threads));
+        }
+        group_begin = i + 1;
+        group_size = 0;
+      }
+      group.join_all();
+    }
+
+    const std::size_t entry_size_;
+    const std::vector<std::size_t> &words_;
+    const Compare compare_;
+};
+
+} // namespace detail
+
+// Sort records [begin, end) of entry_size bytes by words as described for WordOrder.
+template <class Compare> void RadixSort(void *begin, void *end, std::size_t entry_size, const std::vector<std::size_t> &words, const Compare &compare, std::size_t threads = 1) {
+  detail::RadixSorter<Compare>(entry_size, words, compare).Sort(static_cast<uint8_t*>(begin), static_cast<uint8_t*>(end), 0, threads);
+}
+
+}} // namespaces
+
+#endif // UTIL_STREAM_RADIX_SORT_H
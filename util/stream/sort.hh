@@ -21,18 +21,25 @@
 #include "util/stream/chain.hh"
 #include "util/stream/config.hh"
 #include "util/stream/io.hh"
+#include "util/stream/radix_sort.hh"
 #include "util/stream/stream.hh"
 #include "util/stream/timer.hh"
 
 #include "util/file.hh"
 #include "util/fixed_array.hh"
+#include "util/pcqueue.hh"
 #include "util/scoped.hh"
 #include "util/sized_iterator.hh"
 
+#include <boost/thread/thread.hpp>
+
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace util {
 namespace stream {
@@ -124,11 +131,11 @@ class Offsets {
 // A priority queue of entries backed by file buffers
 template <class Compare> class MergeQueue {
   public:
-    MergeQueue(int fd, std::size_t buffer_size, std::size_t entry_size, const Compare &compare)
-      : queue_(Greater(compare)), in_(fd), buffer_size_(buffer_size), entry_size_(entry_size) {}
+    MergeQueue(RunFile &in, std::size_t buffer_size, std::size_t entry_size, const Compare &compare)
+      : queue_(Greater(compare)), in_(&in), buffer_size_(buffer_size), entry_size_(entry_size) {}
 
     void Push(void *base, uint64_t offset, uint64_t amount) {
-      queue_.push(Entry(base, in_, offset, amount, buffer_size_));
+      queue_.push(Entry(base, *in_, offset, amount, buffer_size_));
     }
 
     const void *Top() const {
@@ -138,7 +145,7 @@ template <class Compare> class MergeQueue {
     void Pop() {
       Entry top(queue_.top());
       queue_.pop();
-      if (top.Increment(in_, buffer_size_, entry_size_))
+      if (top.Increment(*in_, buffer_size_, entry_size_))
         queue_.push(top);
     }
 
@@ -156,23 +163,23 @@ template <class Compare> class MergeQueue {
       public:
         Entry() {}
 
-        Entry(void *base, int fd, uint64_t offset, uint64_t amount, std::size_t buf_size) {
+        Entry(void *base, RunFile &in, uint64_t offset, uint64_t amount, std::size_t buf_size) {
           offset_ = offset;
           remaining_ = amount;
           buffer_end_ = static_cast<uint8_t*>(base) + buf_size;
-          Read(fd, buf_size);
+          Read(in, buf_size);
         }
 
-        bool Increment(int fd, std::size_t buf_size, std::size_t entry_size) {
+        bool Increment(RunFile &in, std::size_t buf_size, std::size_t entry_size) {
           current_ += entry_size;
           if (current_ != buffer_end_) return true;
-          return Read(fd, buf_size);
+          return Read(in, buf_size);
         }
 
         const void *Current() const { return current_; }
 
       private:
-        bool Read(int fd, std::size_t buf_size) {
+        bool Read(RunFile &in, std::size_t buf_size) {
           current_ = buffer_end_ - buf_size;
           std::size_t amount;
           if (static_cast<uint64_t>(buf_size) < remaining_) {
@@ -183,7 +190,7 @@ template <class Compare> class MergeQueue {
             amount = remaining_;
             buffer_end_ = current_ + remaining_;
           }
-          ErsatzPRead(fd, current_, amount, offset_);
+          in.Read(current_, amount, offset_);
           offset_ += amount;
           assert(current_ <= buffer_end_);
           remaining_ -= amount;
@@ -212,11 +219,227 @@ template <class Compare> class MergeQueue {
     typedef std::priority_queue<Entry, std::vector<Entry>, Greater> Queue;
     Queue queue_;
 
-    const int in_;
+    RunFile *const in_;
     const std::size_t buffer_size_;
     const std::size_t entry_size_;
 };
 
+/* Merges a group of sorted stripes in a file on several threads.  Splitter
+ * keys cut the group into ranges with no key in common, each a slice of every
+ * stripe.  Threads merge whole ranges in memory and Run writes them out in
+ * order, so the output is the same as merging on one thread.
+ */
+template <class Compare, class Combine> class ParallelMerge {
+  public:
+    // Offsets [first, second) in the file.
+    typedef std::pair<uint64_t, uint64_t> Piece;
+
+    // Ranges and their merged output share memory evenly over threads.
+    ParallelMerge(int fd, std::size_t entry_size, std::size_t threads, std::size_t memory, const Compare &compare, const Combine &combine)
+      : in_(fd), entry_size_(entry_size),
+        range_entries_(std::max<std::size_t>(1, memory / (2 * threads) / entry_size)),
+        compare_(compare), combine_(combine), slots_(threads) {
+      for (std::size_t i = 0; i < threads; ++i) {
+        slots_.push_back();
+        workers_.create_thread(Worker(*this, slots_.back()));
+      }
+    }
+
+    ~ParallelMerge() {
+      for (Slot *i = slots_.begin(); i != slots_.end(); ++i) {
+        i->start.Produce(false);
+      }
+      workers_.join_all();
+    }
+
+    // Merge the stripes into str, combining as the single threaded merge
+    // would.  Returns the number of entries written.
+    uint64_t Run(const std::vector<Piece> &stripes, Stream &str) {
+      remaining_ = stripes;
+      const std::size_t threads = slots_.size();
+      std::size_t submitted = 0;
+      for (; submitted < threads && NextRange(slots_[submitted]); ++submitted) {
+        slots_[submitted].start.Produce(true);
+      }
+      uint64_t written = 0;
+      bool started = false;
+      for (std::size_t received = 0; received < submitted; ++received) {
+        Slot &slot = slots_[received % threads];
+        slot.done.Consume();
+        UTIL_THROW_IF(slot.failed, Exception, "Merging thread failed: " << slot.error);
+        const uint8_t *i = slot.out.empty() ? NULL : &slot.out[0];
+        const uint8_t *const end = i + slot.out_size;
+        // Ranges were combined internally but may combine at the boundary.
+        if (!started) {
+          memcpy(str.Get(), i, entry_size_);
+          started = true;
+          i += entry_size_;
+        } else if (combine_(str.Get(), i, compare_)) {
+          i += entry_size_;
+        }
+        for (; i != end; i += entry_size_) {
+          ++written; ++str;
+          memcpy(str.Get(), i, entry_size_);
+        }
+        if (NextRange(slot)) {
+          slot.start.Produce(true);
+          ++submitted;
+        }
+      }
+      if (started) {
+        ++written; ++str;
+      }
+      return written;
+    }
+
+  private:
+    struct Slot {
+      Slot() : start(1), done(1), out_size(0), failed(false) {}
+
+      // Producing false stops the thread.
+      PCQueue<bool> start, done;
+
+      std::vector<Piece> pieces;
+      std::vector<uint8_t> in, out;
+      std::size_t out_size;
+
+      bool failed;
+      std::string error;
+    };
+
+    class Worker {
+      public:
+        Worker(ParallelMerge &merge, Slot &slot) : merge_(&merge), slot_(&slot) {}
+
+        void operator()() {
+          while (slot_->start.Consume()) {
+            try {
+              merge_->MergeRange(*slot_);
+            } catch (const std::exception &e) {
+              slot_->error = e.what();
+              slot_->failed = true;
+            }
+            slot_->done.Produce(true);
+          }
+        }
+
+      private:
+        ParallelMerge *merge_;
+        Slot *slot_;
+    };
+
+    // Position within one stripe of the range being merged.
+    struct Cursor {
+      const uint8_t *current, *end;
+    };
+
+    class CursorGreater : public std::binary_function<const Cursor &, const Cursor &, bool> {
+      public:
+        explicit CursorGreater(const Compare &compare) : compare_(compare) {}
+
+        bool operator()(const Cursor &first, const Cursor &second) const {
+          return compare_(second.current, first.current);
+        }
+
+      private:
+        const Compare compare_;
+    };
+
+    void ReadEntry(uint64_t offset, std::string &to) const {
+      to.resize(entry_size_);
+      ErsatzPRead(in_, &to[0], entry_size_, offset);
+    }
+
+    // First offset in the piece with an entry greater than key_.
+    uint64_t UpperBound(const Piece &piece) {
+      uint64_t low = 0, high = (piece.second - piece.first) / entry_size_;
+      while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        ReadEntry(piece.first + middle * entry_size_, probe_);
+        if (compare_(key_.data(), probe_.data())) {
+          high = middle;
+        } else {
+          low = middle + 1;
+        }
+      }
+      return piece.first + low * entry_size_;
+    }
+
+    // Cut the next range from what remains.  The splitter is the least of the
+    // keys range_entries_ / stripes into each stripe, so every stripe gives at
+    // most that much unless it repeats the splitter.
+    bool NextRange(Slot &slot) {
+      slot.pieces.clear();
+      const uint64_t step = std::max<uint64_t>(1, range_entries_ / remaining_.size()) * entry_size_;
+      bool bounded = false;
+      for (std::vector<Piece>::const_iterator i = remaining_.begin(); i != remaining_.end(); ++i) {
+        if (i->second - i->first <= step) continue;
+        ReadEntry(i->first + step - entry_size_, probe_);
+        if (!bounded || compare_(probe_.data(), key_.data())) key_.swap(probe_);
+        bounded = true;
+      }
+      for (std::vector<Piece>::iterator i = remaining_.begin(); i != remaining_.end(); ++i) {
+        uint64_t cut = bounded ? UpperBound(*i) : i->second;
+        if (cut != i->first) slot.pieces.push_back(Piece(i->first, cut));
+        i->first = cut;
+      }
+      return !slot.pieces.empty();
+    }
+
+    // Called by the worker threads.
+    void MergeRange(Slot &slot) const {
+      std::size_t total = 0;
+      for (std::vector<Piece>::const_iterator i = slot.pieces.begin(); i != slot.pieces.end(); ++i) {
+        total += static_cast<std::size_t>(i->second - i->first);
+      }
+      if (slot.in.size() < total) {
+        slot.in.resize(total);
+        slot.out.resize(total);
+      }
+      std::priority_queue<Cursor, std::vector<Cursor>, CursorGreater> queue((CursorGreater(compare_)));
+      uint8_t *base = &slot.in[0];
+      for (std::vector<Piece>::const_iterator i = slot.pieces.begin(); i != slot.pieces.end(); ++i) {
+        std::size_t size = static_cast<std::size_t>(i->second - i->first);
+        ErsatzPRead(in_, base, size, i->first);
+        Cursor cursor;
+        cursor.current = base;
+        cursor.end = base + size;
+        queue.push(cursor);
+        base += size;
+      }
+      uint8_t *out = &slot.out[0];
+      memcpy(out, queue.top().current, entry_size_);
+      for (Pop(queue); !queue.empty(); Pop(queue)) {
+        if (!combine_(out, queue.top().current, compare_)) {
+          out += entry_size_;
+          memcpy(out, queue.top().current, entry_size_);
+        }
+      }
+      slot.out_size = out + entry_size_ - &slot.out[0];
+    }
+
+    void Pop(std::priority_queue<Cursor, std::vector<Cursor>, CursorGreater> &queue) const {
+      Cursor top(queue.top());
+      queue.pop();
+      top.current += entry_size_;
+      if (top.current != top.end) queue.push(top);
+    }
+
+    const int in_;
+    const std::size_t entry_size_;
+    const std::size_t range_entries_;
+
+    const Compare compare_;
+    const Combine combine_;
+
+    // Only used by the thread calling Run.
+    std::vector<Piece> remaining_;
+    std::string key_, probe_;
+
+    FixedArray<Slot> slots_;
+    boost::thread_group workers_;
+};
+
 /* A worker object that merges.  If the number of pieces to merge exceeds the
  * arity, it outputs multiple sorted blocks, recording to out_offsets.
  * However, users will only every see a single sorted block out output because
@@ -225,11 +448,11 @@ template <class Compare> class MergeQueue {
  */
 template <class Compare, class Combine> class MergingReader {
   public:
-    MergingReader(int in, Offsets *in_offsets, Offsets *out_offsets, std::size_t buffer_size, std::size_t total_memory, const Compare &compare, const Combine &combine) :
+    MergingReader(RunFile *in, Offsets *in_offsets, Offsets *out_offsets, std::size_t buffer_size, std::size_t total_memory, const Compare &compare, const Combine &combine, std::size_t threads = 1) :
         compare_(compare), combine_(combine),
         in_(in),
         in_offsets_(in_offsets), out_offsets_(out_offsets),
-        buffer_size_(buffer_size), total_memory_(total_memory) {}
+        buffer_size_(buffer_size), total_memory_(total_memory), threads_(threads) {}
 
     void Run(const ChainPosition &position) {
       Run(position, false);
@@ -253,10 +476,15 @@ template <class Compare, class Combine> class MergingReader {
       }
 
       Stream str(position);
-      scoped_malloc buffer(MallocOrThrow(total_memory_));
-      uint8_t *const buffer_end = static_cast<uint8_t*>(buffer.get()) + total_memory_;
-
       const std::size_t entry_size = position.GetChain().EntrySize();
+      scoped_malloc buffer;
+      scoped_ptr<ParallelMerge<Compare, Combine> > parallel;
+      // Compressed runs decode through one cache so they merge on one thread.
+      if (threads_ > 1 && !in_->Compressed()) {
+        parallel.reset(new ParallelMerge<Compare, Combine>(in_->File(), entry_size, threads_, total_memory_, compare_, combine_));
+      } else {
+        buffer.reset(MallocOrThrow(total_memory_));
+      }
 
       while (in_offsets_->RemainingBlocks()) {
         // Use bigger buffers if there's less remaining.
@@ -266,17 +494,17 @@ template <class Compare, class Combine> class MergingReader {
         per_buffer -= per_buffer % entry_size;
         assert(per_buffer);
 
-        // Populate queue.
-        MergeQueue<Compare> queue(in_, per_buffer, entry_size, compare_);
-        for (uint8_t *buf = static_cast<uint8_t*>(buffer.get());
-            in_offsets_->RemainingBlocks() && (buf + std::min(per_buffer, in_offsets_->PeekSize()) <= buffer_end);) {
+        // Choose as many stripes as have buffers in memory.
+        stripes_.clear();
+        for (uint64_t used = 0;
+            in_offsets_->RemainingBlocks() && (used + std::min(per_buffer, in_offsets_->PeekSize()) <= total_memory_);) {
           uint64_t offset = in_offsets_->TotalOffset();
           uint64_t size = in_offsets_->NextSize();
-          queue.Push(buf, offset, size);
-          buf += static_cast<std::size_t>(std::min<uint64_t>(size, per_buffer));
+          stripes_.push_back(std::make_pair(offset, offset + size));
+          used += std::min<uint64_t>(size, per_buffer);
         }
         // This shouldn't happen but it's probably better to die than loop indefinitely.
-        if (queue.Size() < 2 && in_offsets_->RemainingBlocks()) {
+        if (stripes_.size() < 2 && in_offsets_->RemainingBlocks()) {
           std::cerr << "Bug in sort implementation: not merging at least two stripes." << std::endl;
           abort();
         }
@@ -285,6 +513,21 @@ template <class Compare, class Combine> class MergingReader {
           abort();
         }
 
+        if (parallel.get()) {
+          uint64_t written = parallel->Run(stripes_, str);
+          if (out_offsets_)
+            out_offsets_->Append(written * entry_size);
+          continue;
+        }
+
+        // Populate queue.
+        MergeQueue<Compare> queue(*in_, per_buffer, entry_size, compare_);
+        uint8_t *buf = static_cast<uint8_t*>(buffer.get());
+        for (std::vector<std::pair<uint64_t, uint64_t> >::const_iterator i = stripes_.begin(); i != stripes_.end(); ++i) {
+          queue.Push(buf, i->first, i->second - i->first);
+          buf += static_cast<std::size_t>(std::min<uint64_t>(i->second - i->first, per_buffer));
+        }
+
         uint64_t written = 0;
         // Merge including combiner support.
         memcpy(str.Get(), queue.Top(), entry_size);
@@ -308,10 +551,10 @@ template <class Compare, class Combine> class MergingReader {
       const uint64_t block_size = position.GetChain().BlockSize();
       Link l(position);
       for (; offset + block_size < end; ++l, offset += block_size) {
-        ErsatzPRead(in_, l->Get(), block_size, offset);
+        in_->Read(l->Get(), block_size, offset);
         l->SetValidSize(block_size);
       }
-      ErsatzPRead(in_, l->Get(), end - offset, offset);
+      in_->Read(l->Get(), end - offset, offset);
       l->SetValidSize(end - offset);
       (++l).Poison();
       return;
@@ -320,9 +563,9 @@ template <class Compare, class Combine> class MergingReader {
     Compare compare_;
     Combine combine_;
 
-    int in_;
-
   protected:
+    RunFile *in_;
+
     Offsets *in_offsets_;
 
   private:
@@ -330,6 +573,11 @@ template <class Compare, class Combine> class MergingReader {
 
     std::size_t buffer_size_;
     std::size_t total_memory_;
+
+    std::size_t threads_;
+
+    // Stripes of the current merge group as offsets [first, second).
+    std::vector<std::pair<uint64_t, uint64_t> > stripes_;
 };
 
 // The lazy step owns the remaining files.  This keeps track of them.
@@ -337,43 +585,119 @@ template <class Compare, class Combine> class OwningMergingReader : public Mergi
   private:
     typedef MergingReader<Compare, Combine> P;
   public:
-    OwningMergingReader(int data, const Offsets &offsets, std::size_t buffer, std::size_t lazy, const Compare &compare, const Combine &combine)
-      : P(data, NULL, NULL, buffer, lazy, compare, combine),
-        data_(data),
+    // Takes ownership of data.
+    OwningMergingReader(RunFile *data, const Offsets &offsets, std::size_t buffer, std::size_t lazy, const Compare &compare, const Combine &combine, std::size_t threads = 1)
+      : P(data, NULL, NULL, buffer, lazy, compare, combine, threads),
         offsets_(offsets) {}
 
     void Run(const ChainPosition &position) {
       P::in_offsets_ = &offsets_;
-      scoped_fd data(data_);
+      scoped_ptr<RunFile> data(P::in_);
       scoped_fd offsets_file(offsets_.File());
       P::Run(position, true);
     }
 
   private:
-    int data_;
     Offsets offsets_;
 };
 
+template <class Iterator, class Compare> void ParallelSort(Iterator begin, Iterator end, const Compare &compare, std::size_t threads);
+
+namespace detail {
+
+template <class Compare, class Value> class BelowPivot {
+  public:
+    BelowPivot(const Compare &compare, const Value &pivot) : compare_(compare), pivot_(pivot) {}
+    template <class T> bool operator()(const T &value) const { return compare_(value, pivot_); }
+  private:
+    const Compare &compare_;
+    const Value &pivot_;
+};
+
+template <class Compare, class Value> class NotAbovePivot {
+  public:
+    NotAbovePivot(const Compare &compare, const Value &pivot) : compare_(compare), pivot_(pivot) {}
+    template <class T> bool operator()(const T &value) const { return !compare_(pivot_, value); }
+  private:
+    const Compare &compare_;
+    const Value &pivot_;
+};
+
+template <class Iterator, class Compare> class ParallelSortTask {
+  public:
+    ParallelSortTask(Iterator begin, Iterator end, const Compare &compare, std::size_t threads)
+      : begin_(begin), end_(end), compare_(compare), threads_(threads) {}
+
+    void operator()() { ParallelSort(begin_, end_, compare_, threads_); }
+
+  private:
+    Iterator begin_, end_;
+    Compare compare_;
+    std::size_t threads_;
+};
+
+} // namespace detail
+
+/* Quicksort in place on up to threads threads.  Each partition is three-way
+ * around a median of three, then the sides are sorted concurrently with
+ * threads divided in proportion to their sizes.  Small ranges and single
+ * threads use std::sort.
+ */
+template <class Iterator, class Compare> void ParallelSort(Iterator begin, Iterator end, const Compare &compare, std::size_t threads) {
+  typedef typename std::iterator_traits<Iterator>::value_type Value;
+  const std::ptrdiff_t kMinimum = 1 << 14;
+  while (threads > 1 && end - begin >= kMinimum) {
+    Value first(*begin), middle(*(begin + (end - begin) / 2)), last(*(end - 1));
+    const Value *pivot;
+    if (compare(first, middle)) {
+      pivot = compare(middle, last) ? &middle : (compare(first, last) ? &last : &first);
+    } else {
+      pivot = compare(first, last) ? &first : (compare(middle, last) ? &last : &middle);
+    }
+    Iterator lower = std::partition(begin, end, detail::BelowPivot<Compare, Value>(compare, *pivot));
+    Iterator upper = std::partition(lower, end, detail::NotAbovePivot<Compare, Value>(compare, *pivot));
+    // [lower, upper) equals the pivot and is done.
+    const std::ptrdiff_t left = lower - begin, right = end - upper;
+    if (!left) {
+      begin = upper;
+    } else if (!right) {
+      end = lower;
+    } else {
+      std::size_t left_threads = static_cast<std::size_t>(static_cast<double>(threads) * static_cast<double>(left) / static_cast<double>(left + right) + 0.5);
+      left_threads = std::min(threads - 1, std::max<std::size_t>(1, left_threads));
+      boost::thread left_thread(detail::ParallelSortTask<Iterator, Compare>(begin, lower, compare, left_threads));
+      ParallelSort(upper, end, compare, threads - left_threads);
+      left_thread.join();
+      return;
+    }
+  }
+#if defined(_WIN32) || defined(_WIN64)
+  std::stable_sort
+#else
+  std::sort
+#endif
+    (begin, end, compare);
+}
+
 // Don't use this directly.  Worker that sorts blocks.
 template <class Compare> class BlockSorter {
   public:
-    BlockSorter(Offsets &offsets, const Compare &compare) :
-      offsets_(&offsets), compare_(compare) {}
+    BlockSorter(Offsets &offsets, const Compare &compare, std::size_t threads = 1) :
+      offsets_(&offsets), compare_(compare), threads_(threads) {}
 
     void Run(const ChainPosition &position) {
       const std::size_t entry_size = position.GetChain().EntrySize();
+      std::vector<std::size_t> words;
+      const bool radix = WordOrder<Compare>::Get(compare_.GetDelegate(), words);
       for (Link link(position); link; ++link) {
         // Record the size of each block in a separate file.
         offsets_->Append(link->ValidSize());
         void *end = static_cast<uint8_t*>(link->Get()) + link->ValidSize();
-#if defined(_WIN32) || defined(_WIN64)
-        std::stable_sort
-#else
-        std::sort
-#endif
-          (SizedIt(link->Get(), entry_size),
-           SizedIt(end, entry_size),
-           compare_);
+        if (radix) {
+          RadixSort(link->Get(), end, entry_size, words, compare_.GetDelegate(), threads_);
+        } else {
+          ParallelSort(SizedIt(link->Get(), entry_size), SizedIt(end, entry_size), compare_, threads_);
+        }
       }
       offsets_->FinishedAppending();
     }
@@ -381,6 +705,7 @@ template <class Compare> class BlockSorter {
   private:
     Offsets *offsets_;
     SizedCompare<Compare> compare_;
+    std::size_t threads_;
 };
 
 class BadSortConfig : public Exception {
@@ -395,20 +720,21 @@ template <class Compare, class Combine = NeverCombine> class Sort {
     /** Constructs an object capable of sorting */
     Sort(Chain &in, const SortConfig &config, const Compare &compare = Compare(), const Combine &combine = Combine())
       : config_(config),
-        data_(MakeTemp(config.temp_prefix)),
         offsets_file_(MakeTemp(config.temp_prefix)), offsets_(offsets_file_.get()),
         compare_(compare), combine_(combine),
-        entry_size_(in.EntrySize()) {
+        entry_size_(in.EntrySize()),
+        passes_(0) {
       UTIL_THROW_IF(!entry_size_, BadSortConfig, "Sorting entries of size 0");
       // Make buffer_size a multiple of the entry_size.
       config_.buffer_size -= config_.buffer_size % entry_size_;
       UTIL_THROW_IF(!config_.buffer_size, BadSortConfig, "Sort buffer too small");
       UTIL_THROW_IF(config_.total_memory < config_.buffer_size * 4, BadSortConfig, "Sorting memory " << config_.total_memory << " is too small for four buffers (two read and two write).");
-      in >> BlockSorter<Compare>(offsets_, compare_) >> WriteAndRecycle(data_.get());
+      data_.reset(MakeRunFile());
+      in >> BlockSorter<Compare>(offsets_, compare_, config_.threads) >> WriteRun(*data_);
     }
 
     uint64_t Size() const {
-      return SizeOrThrow(data_.get());
+      return data_->Size();
     }
 
     // Do merge sort, terminating when lazy merge could be done with the
@@ -424,12 +750,14 @@ template <class Compare, class Combine = NeverCombine> class Sort {
       if (offsets_.RemainingBlocks() <= lazy_arity || size <= static_cast<uint64_t>(lazy_memory))
         return std::min<std::size_t>(size, offsets_.RemainingBlocks() * config_.buffer_size);
 
-      scoped_fd data2(MakeTemp(config_.temp_prefix));
-      int fd_in = data_.get(), fd_out = data2.get();
+      scoped_ptr<RunFile> data2(MakeRunFile());
+      RunFile *file_in = data_.get(), *file_out = data2.get();
       scoped_fd offsets2_file(MakeTemp(config_.temp_prefix));
       Offsets offsets2(offsets2_file.get());
       Offsets *offsets_in = &offsets_, *offsets_out = &offsets2;
 
+      const std::size_t read_buffer = ReadBuffer(std::min<uint64_t>(config_.total_memory - 2 * config_.buffer_size, size), lazy_arity);
+
       // Double buffered writing.
       ChainConfig chain_config;
       chain_config.entry_size = entry_size_;
@@ -443,26 +771,25 @@ template <class Compare, class Combine = NeverCombine> class Sort {
         if (size < static_cast<uint64_t>(reading_memory)) {
           reading_memory = static_cast<std::size_t>(size);
         }
-        SeekOrThrow(fd_in, 0);
         chain >>
           MergingReader<Compare, Combine>(
-              fd_in,
+              file_in,
               offsets_in, offsets_out,
-              config_.buffer_size,
+              read_buffer,
               reading_memory,
-              compare_, combine_) >>
-          WriteAndRecycle(fd_out);
+              compare_, combine_, config_.threads) >>
+          WriteRun(*file_out);
         chain.Wait();
         offsets_out->FinishedAppending();
-        ResizeOrThrow(fd_in, 0);
+        file_in->Reset();
         offsets_in->Reset();
-        std::swap(fd_in, fd_out);
+        ++passes_;
+        std::swap(file_in, file_out);
         std::swap(offsets_in, offsets_out);
-        size = SizeOrThrow(fd_in);
+        size = file_in->Size();
       }
 
-      SeekOrThrow(fd_in, 0);
-      if (fd_in == data2.get()) {
+      if (file_in == data2.get()) {
         data_.reset(data2.release());
         offsets_file_.reset(offsets2_file.release());
         offsets_ = offsets2;
@@ -477,7 +804,7 @@ template <class Compare, class Combine = NeverCombine> class Sort {
     void Output(Chain &out, std::size_t lazy_memory) {
       Merge(lazy_memory);
       out.SetProgressTarget(Size());
-      out >> OwningMergingReader<Compare, Combine>(data_.get(), offsets_, config_.buffer_size, lazy_memory, compare_, combine_);
+      out >> OwningMergingReader<Compare, Combine>(data_.get(), offsets_, config_.buffer_size, lazy_memory, compare_, combine_, config_.threads);
       data_.release();
       offsets_file_.release();
     }
@@ -504,29 +831,77 @@ template <class Compare, class Combine = NeverCombine> class Sort {
      * Solve for lazy
      *   lazy = memory * (arity - 1) / arity
      */
-    std::size_t DefaultLazy() {
+    std::size_t DefaultLazy() const {
       float arity = static_cast<float>(config_.total_memory / config_.buffer_size);
       return static_cast<std::size_t>(static_cast<float>(config_.total_memory) * (arity - 1.0) / arity);
     }
 
+    // Lazy memory for which Merge would make no more passes.
+    std::size_t LazyWithoutMerge() const {
+      if (offsets_.RemainingBlocks() <= 1) return 0;
+      return static_cast<std::size_t>(std::min(Size(), offsets_.RemainingBlocks() * static_cast<uint64_t>(config_.buffer_size)));
+    }
+
+    // Merge passes over the whole data so far.
+    unsigned int MergePasses() const { return passes_; }
+
     // Same as Output with default lazy memory setting.
     void Output(Chain &out) {
       Output(out, DefaultLazy());
     }
 
-    // Completely merge sort and transfer ownership to the caller.
+    // Completely merge sort and transfer ownership to the caller.  The file
+    // is plain even if runs were compressed.
     int StealCompleted() {
       // Merge all the way.
       Merge(0);
-      SeekOrThrow(data_.get(), 0);
       offsets_file_.reset();
-      return data_.release();
+      int ret = data_->StealPlain(config_.temp_prefix);
+      data_.reset();
+      return ret;
     }
 
   private:
+    // Passes to merge stripes down to lazy_arity of them.
+    static unsigned int PassesFor(uint64_t stripes, uint64_t arity, uint64_t lazy_arity) {
+      unsigned int passes = 0;
+      for (; stripes > lazy_arity; ++passes) {
+        stripes = (stripes + arity - 1) / arity;
+      }
+      return passes;
+    }
+
+    /* Size of merge reads.  Smaller reads mean higher arity.  Use the biggest
+     * size, down to min_merge_buffer, that needs the fewest passes.
+     */
+    std::size_t ReadBuffer(uint64_t reading_memory, uint64_t lazy_arity) const {
+      const std::size_t entries = config_.buffer_size / entry_size_;
+      const std::size_t min_entries = std::max<std::size_t>(1, config_.min_merge_buffer / entry_size_);
+      if (!config_.min_merge_buffer || min_entries >= entries) return config_.buffer_size;
+      const uint64_t stripes = offsets_.RemainingBlocks();
+      const unsigned int best = PassesFor(stripes, std::max<uint64_t>(2, reading_memory / (min_entries * entry_size_)), lazy_arity);
+      // Passes only go down as reads get smaller.  Find the biggest read with best.
+      std::size_t low = min_entries, high = entries;
+      while (low < high) {
+        std::size_t mid = low + (high - low + 1) / 2;
+        if (PassesFor(stripes, std::max<uint64_t>(2, reading_memory / (mid * entry_size_)), lazy_arity) == best) {
+          low = mid;
+        } else {
+          high = mid - 1;
+        }
+      }
+      return low * entry_size_;
+    }
+
+    // Compressed frames are small enough to waste little decoding the ends
+    // of merge buffers.
+    RunFile *MakeRunFile() const {
+      return new RunFile(MakeTemp(config_.temp_prefix), entry_size_, std::min<std::size_t>(config_.buffer_size, 1 << 16), config_.compress);
+    }
+
     SortConfig config_;
 
-    scoped_fd data_;
+    scoped_ptr<RunFile> data_;
 
     scoped_fd offsets_file_;
     Offsets offsets_;
@@ -534,6 +909,8 @@ template <class Compare, class Combine = NeverCombine> class Sort {
     const Compare compare_;
     const Combine combine_;
     const std::size_t entry_size_;
+
+    unsigned int passes_;
 };
 
 // returns bytes to be read on demand.
@@ -4,6 +4,9 @@
 #include <boost/test/unit_test.hpp>
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
 
 #include <unistd.h>
 
@@ -18,7 +21,7 @@ struct CompareUInt64 : public std::binary_function<const void *, const void *, b
 const uint64_t kSize = 100000;
 
 struct Putter {
-  Putter(std::vector<uint64_t> &shuffled) : shuffled_(shuffled) {}
+  Putter(const std::vector<uint64_t> &shuffled) : shuffled_(shuffled) {}
 
   void Run(const ChainPosition &position) {
     Stream put_shuffled(position);
@@ -27,30 +30,63 @@ struct Putter {
     }
     put_shuffled.Poison();
   }
-  std::vector<uint64_t> &shuffled_;
+  const std::vector<uint64_t> &shuffled_;
 };
 
-BOOST_AUTO_TEST_CASE(FromShuffled) {
+// 0 to kSize - 1 in random order.
+std::vector<uint64_t> Shuffled() {
   std::vector<uint64_t> shuffled;
   shuffled.reserve(kSize);
   for (uint64_t i = 0; i < kSize; ++i) {
     shuffled.push_back(i);
   }
   std::random_shuffle(shuffled.begin(), shuffled.end());
+  return shuffled;
+}
 
-  ChainConfig config;
-  config.entry_size = 8;
-  config.total_memory = 800;
-  config.block_count = 3;
-
+// Small enough that sorting the shuffled values takes several merge passes.
+SortConfig SmallSortConfig() {
   SortConfig merge_config;
   merge_config.temp_prefix = "sort_test_temp";
   merge_config.buffer_size = 800;
   merge_config.total_memory = 3300;
+  return merge_config;
+}
+
+// Sort the shuffled values, merge them all the way, and check the file.
+// Returns the merge passes it took.
+unsigned int SortShuffledCompletely(const std::vector<uint64_t> &shuffled, const SortConfig &merge_config) {
+  ChainConfig config;
+  config.entry_size = 8;
+  config.total_memory = 8000;
+  config.block_count = 2;
+
+  Chain chain(config);
+  chain >> Putter(shuffled);
+  Sort<CompareUInt64> sorter(chain, merge_config);
+  chain.Wait();
+  BOOST_CHECK_EQUAL(0, sorter.Merge(0));
+  const unsigned int passes = sorter.MergePasses();
+  scoped_fd file(sorter.StealCompleted());
+  BOOST_REQUIRE_EQUAL(kSize * 8, SizeOrThrow(file.get()));
+  std::vector<uint64_t> sorted(kSize);
+  ReadOrThrow(file.get(), &sorted[0], kSize * 8);
+  for (uint64_t i = 0; i < kSize; ++i) {
+    BOOST_REQUIRE_EQUAL(i, sorted[i]);
+  }
+  return passes;
+}
+
+BOOST_AUTO_TEST_CASE(FromShuffled) {
+  ChainConfig config;
+  config.entry_size = 8;
+  config.total_memory = 800;
+  config.block_count = 3;
 
+  const std::vector<uint64_t> shuffled(Shuffled());
   Chain chain(config);
   chain >> Putter(shuffled);
-  BlockingSort(chain, merge_config, CompareUInt64(), NeverCombine());
+  BlockingSort(chain, SmallSortConfig(), CompareUInt64(), NeverCombine());
   Stream sorted;
   chain >> sorted >> kRecycle;
   for (uint64_t i = 0; i < kSize; ++i, ++sorted) {
@@ -59,4 +95,219 @@ BOOST_AUTO_TEST_CASE(FromShuffled) {
   BOOST_CHECK(!sorted);
 }
 
+BOOST_AUTO_TEST_CASE(ParallelSortMatches) {
+  std::vector<uint64_t> values;
+  uint64_t state = 1;
+  for (uint64_t i = 0; i < 300000; ++i) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    // Plenty of duplicates.
+    values.push_back((state >> 33) % 20000);
+  }
+  std::vector<uint64_t> expected(values);
+  std::sort(expected.begin(), expected.end());
+
+  std::vector<uint64_t> direct(values);
+  ParallelSort(direct.begin(), direct.end(), std::less<uint64_t>(), 4);
+  BOOST_CHECK(expected == direct);
+
+  std::vector<uint64_t> sized(values);
+  ParallelSort(SizedIt(&sized[0], sizeof(uint64_t)), SizedIt(&sized[0] + sized.size(), sizeof(uint64_t)), SizedCompare<CompareUInt64>(), 3);
+  BOOST_CHECK(expected == sized);
+}
+
+// Entries are a key and a count.
+struct CombineSum {
+  bool operator()(void *first, const void *second, const CompareUInt64 &compare) const {
+    if (compare(first, second)) return false;
+    static_cast<uint64_t*>(first)[1] += static_cast<const uint64_t*>(second)[1];
+    return true;
+  }
+};
+
+struct CountPutter {
+  CountPutter(const std::vector<uint64_t> &keys) : keys_(keys) {}
+
+  void Run(const ChainPosition &position) {
+    Stream put(position);
+    for (std::size_t i = 0; i < keys_.size(); ++i, ++put) {
+      static_cast<uint64_t*>(put.Get())[0] = keys_[i];
+      static_cast<uint64_t*>(put.Get())[1] = 1;
+    }
+    put.Poison();
+  }
+  const std::vector<uint64_t> &keys_;
+};
+
+struct RecordPutter {
+  RecordPutter(const std::vector<uint32_t> &records) : records_(records) {}
+
+  void Run(const ChainPosition &position) {
+    Stream put(position);
+    for (std::size_t i = 0; i < records_.size(); i += 4, ++put) {
+      memcpy(put.Get(), &records_[i], 16);
+    }
+    put.Poison();
+  }
+  const std::vector<uint32_t> &records_;
+};
+
+std::vector<uint64_t> SortCounts(const std::vector<uint64_t> &keys, std::size_t threads, bool compress = false) {
+  // Blocks big enough for ParallelSort to split and enough of them for
+  // several merge passes.
+  ChainConfig config;
+  config.entry_size = 16;
+  config.total_memory = 16 * 20000 * 3;
+  config.block_count = 3;
+
+  SortConfig merge_config;
+  merge_config.temp_prefix = "sort_test_temp";
+  merge_config.buffer_size = 16 * 1000;
+  merge_config.total_memory = 16 * 4500;
+  merge_config.threads = threads;
+  merge_config.compress = compress;
+
+  Chain chain(config);
+  chain >> CountPutter(keys);
+  BlockingSort(chain, merge_config, CompareUInt64(), CombineSum());
+  std::vector<uint64_t> ret;
+  Stream sorted;
+  chain >> sorted >> kRecycle;
+  for (; sorted; ++sorted) {
+    ret.push_back(static_cast<const uint64_t*>(sorted.Get())[0]);
+    ret.push_back(static_cast<const uint64_t*>(sorted.Get())[1]);
+  }
+  return ret;
+}
+
+BOOST_AUTO_TEST_CASE(ThreadedCombine) {
+  std::vector<uint64_t> keys;
+  std::vector<uint64_t> histogram(30000);
+  uint64_t state = 7;
+  for (uint64_t i = 0; i < 200000; ++i) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    keys.push_back((state >> 33) % histogram.size());
+    ++histogram[keys.back()];
+  }
+  std::vector<uint64_t> expected;
+  for (uint64_t i = 0; i < histogram.size(); ++i) {
+    if (!histogram[i]) continue;
+    expected.push_back(i);
+    expected.push_back(histogram[i]);
+  }
+  BOOST_CHECK(expected == SortCounts(keys, 1));
+  BOOST_CHECK(expected == SortCounts(keys, 3));
+  BOOST_CHECK(expected == SortCounts(keys, 1, true));
+  BOOST_CHECK(expected == SortCounts(keys, 3, true));
+}
+
+BOOST_AUTO_TEST_CASE(SmallerMergeReads) {
+  const std::vector<uint64_t> shuffled(Shuffled());
+  SortConfig merge_config(SmallSortConfig());
+  unsigned int passes[2];
+  for (unsigned int smaller = 0; smaller < 2; ++smaller) {
+    merge_config.min_merge_buffer = smaller ? 80 : 0;
+    passes[smaller] = SortShuffledCompletely(shuffled, merge_config);
+  }
+  BOOST_CHECK_LT(passes[1], passes[0]);
+}
+
+BOOST_AUTO_TEST_CASE(CompressedStealCompleted) {
+  SortConfig merge_config(SmallSortConfig());
+  merge_config.compress = true;
+  SortShuffledCompletely(Shuffled(), merge_config);
+}
+
+// Three words then a payload, compared by words 2, 0, 1.
+struct CompareThree : public std::binary_function<const void *, const void *, bool> {
+  bool operator()(const void *first_void, const void *second_void) const {
+    const uint32_t *first = static_cast<const uint32_t*>(first_void), *second = static_cast<const uint32_t*>(second_void);
+    if (first[2] != second[2]) return first[2] < second[2];
+    if (first[0] != second[0]) return first[0] < second[0];
+    return first[1] < second[1];
+  }
+};
+
+}
+
+template <> struct WordOrder<CompareThree> {
+  static bool Get(const CompareThree &, std::vector<std::size_t> &words) {
+    words.clear();
+    words.push_back(2);
+    words.push_back(0);
+    words.push_back(1);
+    return true;
+  }
+};
+
+namespace {
+
+void CheckRadix(uint32_t range, std::size_t threads) {
+  const std::size_t kEntries = 100000;
+  std::vector<uint32_t> records;
+  uint64_t state = range;
+  for (std::size_t i = 0; i < kEntries; ++i) {
+    for (unsigned int j = 0; j < 3; ++j) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      records.push_back(static_cast<uint32_t>(state >> 32) % range);
+    }
+    records.push_back(static_cast<uint32_t>(i));
+  }
+  std::vector<uint32_t> expected(records);
+  std::sort(SizedIt(&expected[0], 16), SizedIt(&expected[0] + expected.size(), 16), SizedCompare<CompareThree>());
+
+  std::vector<std::size_t> words;
+  BOOST_REQUIRE(WordOrder<CompareThree>::Get(CompareThree(), words));
+  RadixSort(&records[0], &records[0] + records.size(), 16, words, CompareThree(), threads);
+  // Payloads of equal keys may be in any order, so compare keys and the set of payloads.
+  std::vector<uint32_t> expected_payloads, payloads;
+  for (std::size_t i = 0; i < records.size(); i += 4) {
+    BOOST_REQUIRE(std::equal(&records[i], &records[i] + 3, &expected[i]));
+    payloads.push_back(records[i + 3]);
+  }
+  std::sort(payloads.begin(), payloads.end());
+  for (std::size_t i = 0; i < kEntries; ++i) {
+    BOOST_REQUIRE_EQUAL(i, payloads[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Radix) {
+  // Few distinct values leave most digits equal; the full range uses them all.
+  CheckRadix(5, 1);
+  CheckRadix(1000, 1);
+  CheckRadix(0xffffffff, 1);
+  CheckRadix(1000, 3);
+  CheckRadix(0xffffffff, 4);
+}
+
+BOOST_AUTO_TEST_CASE(BlockSorterRadix) {
+  std::vector<uint32_t> records;
+  uint64_t state = 3;
+  for (std::size_t i = 0; i < 40000; ++i) {
+    for (unsigned int j = 0; j < 4; ++j) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      records.push_back(static_cast<uint32_t>(state >> 40));
+    }
+  }
+  ChainConfig config;
+  config.entry_size = 16;
+  config.total_memory = 16 * 5000 * 2;
+  config.block_count = 2;
+  SortConfig merge_config;
+  merge_config.temp_prefix = "sort_test_temp";
+  merge_config.buffer_size = 16 * 1000;
+  merge_config.total_memory = 16 * 4500;
+
+  Chain chain(config);
+  chain >> RecordPutter(records);
+  BlockingSort(chain, merge_config, CompareThree(), NeverCombine());
+  std::sort(SizedIt(&records[0], 16), SizedIt(&records[0] + records.size(), 16), SizedCompare<CompareThree>());
+  Stream sorted;
+  chain >> sorted >> kRecycle;
+  for (std::size_t i = 0; i < records.size(); i += 4, ++sorted) {
+    BOOST_REQUIRE(sorted);
+    BOOST_CHECK(std::equal(&records[i], &records[i] + 3, static_cast<const uint32_t*>(sorted.Get())));
+  }
+  BOOST_CHECK(!sorted);
+}
+
 }}} // namespaces
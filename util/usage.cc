@@ -175,6 +175,20 @@ void PrintUsage(std::ostream &out) {
   out << "real:" << WallTime() << '\n';
 }
 
+PhaseTimer::PhaseTimer() : last_(WallTime()) {}
+
+void PhaseTimer::Finish(const std::string &name) {
+  double now = WallTime();
+  phases_.push_back(std::make_pair(name, now - last_));
+  last_ = now;
+}
+
+void PhaseTimer::Print(std::ostream &to) const {
+  for (std::vector<std::pair<std::string, double> >::const_iterator i = phases_.begin(); i != phases_.end(); ++i) {
+    to << i->first << '\t' << i->second << "s\n";
+  }
+}
+
 /* Adapted from physmem.c in gnulib 831b84c59ef413c57a36b67344467d66a8a2ba70 */
 /* Calculate the size of physical memory.
 
@@ -3,6 +3,8 @@
 #include <cstddef>
 #include <iosfwd>
 #include <string>
+#include <utility>
+#include <vector>
 #include <stdint.h>
 
 namespace util {
@@ -14,6 +16,25 @@ double CPUTime();
 
 void PrintUsage(std::ostream &to);
 
+// Wall time of consecutive phases of a job.  Each phase starts where the
+// previous one finished, or at construction for the first.
+class PhaseTimer {
+  public:
+    PhaseTimer();
+
+    void Finish(const std::string &name);
+
+    // One line per phase with its name and seconds.
+    void Print(std::ostream &to) const;
+
+    const std::vector<std::pair<std::string, double> > &Phases() const { return phases_; }
+
+  private:
+    double last_;
+
+    std::vector<std::pair<std::string, double> > phases_;
+};
+
 // Determine how much physical memory there is.  Return 0 on failure.
 uint64_t GuessPhysicalMemory();
 